@@ -40,6 +40,13 @@
 #include <vlc_plugin.h>
 #include <vlc_access.h>
 #include <vlc_network.h>
+#include <vlc_input.h>
+
+#include <errno.h>
+#if defined (__linux__) && defined (MSG_WAITFORONE)
+/* recvmmsg() and MSG_WAITFORONE appeared together (Linux 2.6.33) */
+# define UDP_BATCH 1
+#endif
 
 #define MTU 65535
 
@@ -50,6 +57,10 @@
 #define CACHING_LONGTEXT N_( \
     "Caching value for UDP streams. This " \
     "value should be set in milliseconds." )
+#define BATCH_TEXT N_("Datagrams per system call")
+#define BATCH_LONGTEXT N_( \
+    "Maximum number of datagrams received at once. " \
+    "Use 1 to receive one datagram at a time." )
 
 static int  Open ( vlc_object_t * );
 static void Close( vlc_object_t * );
@@ -63,6 +74,10 @@ vlc_module_begin ()
     add_integer( "udp-caching", DEFAULT_PTS_DELAY / 1000, NULL, CACHING_TEXT,
                  CACHING_LONGTEXT, true )
         change_safe()
+#ifdef UDP_BATCH
+    add_integer_with_range( "udp-batch", 32, 1, 1024, NULL, BATCH_TEXT,
+                            BATCH_LONGTEXT, true )
+#endif
     add_obsolete_integer( "rtp-late" )
     add_obsolete_bool( "udp-auto-mtu" )
 
@@ -79,8 +94,38 @@ vlc_module_end ()
  * Local prototypes
  *****************************************************************************/
 #define RTP_HEADER_LEN 12
+/* Size of the batch receive slots: an Ethernet frame fits */
+#define UDP_SLOT 2048
+
+struct access_sys_t
+{
+    int             fd;
+#ifdef UDP_BATCH
+    unsigned        i_batch; /* 0 if not receiving in batches */
+    block_t       **pp_slots; /* kept across calls if not filled */
+    uint8_t        *p_spill;  /* MTU bytes per slot */
+    struct mmsghdr *p_msgs;
+    struct iovec   *p_iov;    /* 2 per slot: the block, then the spill */
+    uint8_t        *p_cmsg;
+    size_t          i_cmsg;  /* control buffer size per datagram */
+
+    /* Statistics */
+    uint64_t        i_calls;
+    uint64_t        i_datagrams;
+    uint64_t        i_copied; /* did not fit in their slot */
+    uint32_t        i_drops; /* kernel receive queue overflows */
+    uint32_t        i_drops_logged;
+    mtime_t         i_drops_report;
+    input_thread_t *p_input; /* publishes udp-drops */
+#endif
+};
 
 static block_t *BlockUDP( access_t * );
+#ifdef UDP_BATCH
+static block_t *BlockUDPBatch( access_t * );
+static int  OpenBatch( access_t * );
+static void CloseBatch( access_t * );
+#endif
 static int Control( access_t *, int, va_list );
 
 /*****************************************************************************
@@ -167,7 +212,20 @@ static int Open( vlc_object_t *p_this )
         msg_Err( p_access, "cannot open socket" );
         return VLC_EGENERIC;
     }
-    p_access->p_sys = (void *)(intptr_t)fd;
+
+    access_sys_t *p_sys = calloc( 1, sizeof( *p_sys ) );
+    if( p_sys == NULL )
+    {
+        net_Close( fd );
+        return VLC_ENOMEM;
+    }
+    p_sys->fd = fd;
+    p_access->p_sys = p_sys;
+
+#ifdef UDP_BATCH
+    if( OpenBatch( p_access ) == VLC_SUCCESS )
+        p_access->pf_block = BlockUDPBatch;
+#endif
 
     /* Update default_pts to a suitable value for udp access */
     var_Create( p_access, "udp-caching", VLC_VAR_INTEGER | VLC_VAR_DOINHERIT );
@@ -180,8 +238,13 @@ static int Open( vlc_object_t *p_this )
 static void Close( vlc_object_t *p_this )
 {
     access_t     *p_access = (access_t*)p_this;
+    access_sys_t *p_sys = p_access->p_sys;
 
-    net_Close( (intptr_t)p_access->p_sys );
+#ifdef UDP_BATCH
+    CloseBatch( p_access );
+#endif
+    net_Close( p_sys->fd );
+    free( p_sys );
 }
 
 /*****************************************************************************
@@ -239,7 +302,9 @@ static block_t *BlockUDP( access_t *p_access )
 
     /* Read data */
     p_block = block_New( p_access, MTU );
-    len = net_Read( p_access, (intptr_t)p_sys, NULL,
+    if( p_block == NULL )
+        return NULL;
+    len = net_Read( p_access, p_sys->fd, NULL,
                     p_block->p_buffer, MTU, false );
     if( len < 0 )
     {
@@ -249,3 +314,253 @@ static block_t *BlockUDP( access_t *p_access )
 
     return block_Realloc( p_block, 0, len );
 }
+
+#ifdef UDP_BATCH
+/*****************************************************************************
+ * Batched receive: the first datagram is waited for with net_Read(), then
+ * recvmmsg() fills up to i_batch - 1 more slots without blocking. Slots are
+ * plain blocks (recycled by the block pool), handed over as a chain, and
+ * replaced on the next call.
+ *
+ * Each slot is followed by its row of the spill buffer, so that no datagram
+ * is ever truncated: those that do not fit in their slot are copied into a
+ * block of their size. The spill buffer is only touched by such datagrams,
+ * and by the first datagram, which is read in the first row and copied into
+ * a block of its size.
+ *
+ * The kernel drops are published as the "udp-drops" variable of the input.
+ *****************************************************************************/
+static int OpenBatch( access_t *p_access )
+{
+    access_sys_t *p_sys = p_access->p_sys;
+    unsigned i_batch = var_CreateGetInteger( p_access, "udp-batch" );
+
+    if( i_batch <= 1 )
+        return VLC_EGENERIC;
+
+#ifdef SO_RXQ_OVFL
+    /* Ask for the count of datagrams dropped by the kernel */
+    if( setsockopt( p_sys->fd, SOL_SOCKET, SO_RXQ_OVFL,
+                    &(int){ 1 }, sizeof (int) ) == 0 )
+        p_sys->i_cmsg = CMSG_SPACE( sizeof (uint32_t) );
+#endif
+
+    p_sys->pp_slots = calloc( i_batch, sizeof( *p_sys->pp_slots ) );
+    p_sys->p_spill = malloc( i_batch * MTU );
+    p_sys->p_msgs = calloc( i_batch, sizeof( *p_sys->p_msgs ) );
+    p_sys->p_iov = calloc( 2 * i_batch, sizeof( *p_sys->p_iov ) );
+    if( p_sys->i_cmsg > 0 )
+        p_sys->p_cmsg = malloc( i_batch * p_sys->i_cmsg );
+    if( p_sys->pp_slots == NULL || p_sys->p_spill == NULL
+     || p_sys->p_msgs == NULL || p_sys->p_iov == NULL
+     || (p_sys->i_cmsg > 0 && p_sys->p_cmsg == NULL) )
+    {
+        CloseBatch( p_access );
+        return VLC_ENOMEM;
+    }
+
+    p_sys->i_batch = i_batch;
+
+    p_sys->p_input = access_GetParentInput( p_access );
+    if( p_sys->p_input != NULL )
+    {
+        var_Create( p_sys->p_input, "udp-drops", VLC_VAR_INTEGER );
+    }
+    msg_Dbg( p_access, "receiving up to %u datagrams at once", i_batch );
+    return VLC_SUCCESS;
+}
+
+static void CloseBatch( access_t *p_access )
+{
+    access_sys_t *p_sys = p_access->p_sys;
+
+    if( p_sys->i_calls > 0 )
+        msg_Dbg( p_access, "received %"PRIu64" datagrams in %"PRIu64
+                 " calls, %"PRIu64" copied, %"PRIu32" dropped",
+                 p_sys->i_datagrams, p_sys->i_calls, p_sys->i_copied,
+                 p_sys->i_drops );
+
+    if( p_sys->p_input != NULL )
+    {
+        var_Destroy( p_sys->p_input, "udp-drops" );
+        vlc_object_release( p_sys->p_input );
+        p_sys->p_input = NULL;
+    }
+    if( p_sys->pp_slots != NULL )
+        for( unsigned i = 0; i < p_sys->i_batch; i++ )
+            if( p_sys->pp_slots[i] != NULL )
+                block_Release( p_sys->pp_slots[i] );
+    free( p_sys->pp_slots );
+    free( p_sys->p_spill );
+    free( p_sys->p_msgs );
+    free( p_sys->p_iov );
+    free( p_sys->p_cmsg );
+    p_sys->pp_slots = NULL;
+    p_sys->p_spill = NULL;
+    p_sys->p_msgs = NULL;
+    p_sys->p_iov = NULL;
+    p_sys->p_cmsg = NULL;
+    p_sys->i_batch = 0;
+}
+
+static void BatchDrops( access_t *p_access, const struct msghdr *p_hdr )
+{
+#ifdef SO_RXQ_OVFL
+    access_sys_t *p_sys = p_access->p_sys;
+
+    for( struct cmsghdr *cmsg = CMSG_FIRSTHDR( p_hdr ); cmsg != NULL;
+         cmsg = CMSG_NXTHDR( (struct msghdr *)p_hdr, cmsg ) )
+    {
+        uint32_t i_drops;
+
+        if( cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SO_RXQ_OVFL )
+            continue;
+        memcpy( &i_drops, CMSG_DATA( cmsg ), sizeof( i_drops ) );
+        if( i_drops != p_sys->i_drops && p_sys->p_input != NULL )
+            var_SetInteger( p_sys->p_input, "udp-drops", i_drops );
+        p_sys->i_drops = i_drops;
+        if( i_drops == p_sys->i_drops_logged )
+            return;
+
+        /* Do not flood the log when the receive buffer keeps overflowing */
+        mtime_t now = mdate();
+        if( now >= p_sys->i_drops_report )
+        {
+            msg_Warn( p_access, "%"PRIu32" datagram(s) dropped by the kernel "
+                      "(receive buffer overrun)",
+                      i_drops - p_sys->i_drops_logged );
+            p_sys->i_drops_report = now + CLOCK_FREQ;
+            p_sys->i_drops_logged = i_drops;
+        }
+        return;
+    }
+#else
+    VLC_UNUSED( p_access ); VLC_UNUSED( p_hdr );
+#endif
+}
+
+/* Returns a block of i_len bytes, from the slot and its spill row */
+static block_t *BatchCopy( access_t *p_access, unsigned i, size_t i_len )
+{
+    access_sys_t *p_sys = p_access->p_sys;
+    size_t i_slot = (i == 0) ? 0 : UDP_SLOT;
+    block_t *p_block = block_Alloc( i_len );
+
+    if( p_block == NULL )
+        return NULL;
+    if( i_slot > 0 )
+        memcpy( p_block->p_buffer, p_sys->pp_slots[i]->p_buffer, i_slot );
+    memcpy( p_block->p_buffer + i_slot, p_sys->p_spill + i * MTU,
+            i_len - i_slot );
+    return p_block;
+}
+
+static block_t *BlockUDPBatch( access_t *p_access )
+{
+    access_sys_t *p_sys = p_access->p_sys;
+    unsigned i_batch = p_sys->i_batch;
+
+    if( p_access->info.b_eof )
+        return NULL;
+
+    /* Replace the slots handed over by the previous call */
+    for( unsigned i = 1; i < i_batch; i++ )
+    {
+        struct msghdr *p_hdr = &p_sys->p_msgs[i].msg_hdr;
+        struct iovec *p_iov = &p_sys->p_iov[2 * i];
+
+        if( p_sys->pp_slots[i] == NULL )
+        {
+            p_sys->pp_slots[i] = block_Alloc( UDP_SLOT );
+            if( p_sys->pp_slots[i] == NULL )
+            {
+                i_batch = i;
+                break;
+            }
+        }
+        p_iov[0].iov_base = p_sys->pp_slots[i]->p_buffer;
+        p_iov[0].iov_len = UDP_SLOT;
+        p_iov[1].iov_base = p_sys->p_spill + i * MTU;
+        p_iov[1].iov_len = MTU - UDP_SLOT;
+
+        memset( p_hdr, 0, sizeof( *p_hdr ) );
+        p_hdr->msg_iov = p_iov;
+        p_hdr->msg_iovlen = 2;
+        if( p_sys->i_cmsg > 0 )
+        {
+            p_hdr->msg_control = p_sys->p_cmsg + i * p_sys->i_cmsg;
+            p_hdr->msg_controllen = p_sys->i_cmsg;
+        }
+    }
+
+    /* Wait for the first datagram (this is a cancellation point) */
+    ssize_t i_first = net_Read( p_access, p_sys->fd, NULL,
+                                p_sys->p_spill, MTU, false );
+    if( i_first < 0 )
+        return NULL;
+    p_sys->i_calls++;
+
+    block_t *p_chain = NULL, **pp_last = &p_chain;
+
+    if( i_first > 0 )
+    {
+        p_chain = BatchCopy( p_access, 0, i_first );
+        if( p_chain != NULL )
+        {
+            pp_last = &p_chain->p_next;
+            p_sys->i_datagrams++;
+        }
+    }
+
+    /* Then take whatever else is queued */
+    int val = 0;
+
+    if( i_batch > 1 )
+    {
+        val = recvmmsg( p_sys->fd, p_sys->p_msgs + 1, i_batch - 1,
+                        MSG_DONTWAIT, NULL );
+        if( val < 0 )
+        {
+            if( errno == ENOSYS )
+            {
+                msg_Warn( p_access, "batch receive not supported" );
+                CloseBatch( p_access );
+                p_access->pf_block = BlockUDP;
+                return p_chain;
+            }
+            if( errno != EAGAIN && errno != EINTR )
+                msg_Err( p_access, "receive error: %m" );
+            val = 0;
+        }
+    }
+
+    for( int i = 1; i <= val; i++ )
+    {
+        size_t i_len = p_sys->p_msgs[i].msg_len;
+        block_t *p_block;
+
+        if( i_len == 0 )
+            continue;
+        if( i_len > UDP_SLOT )
+        {   /* The slot is kept for the next call */
+            p_block = BatchCopy( p_access, i, i_len );
+            if( p_block == NULL )
+                continue;
+            p_sys->i_copied++;
+        }
+        else
+        {
+            p_block = p_sys->pp_slots[i];
+            p_sys->pp_slots[i] = NULL;
+            p_block->i_buffer = i_len;
+        }
+        *pp_last = p_block;
+        pp_last = &p_block->p_next;
+        p_sys->i_datagrams++;
+    }
+    if( val > 0 )
+        BatchDrops( p_access, &p_sys->p_msgs[val].msg_hdr );
+
+    return p_chain;
+}
+#endif
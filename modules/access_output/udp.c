@@ -48,10 +48,21 @@
 #else
 #   include <sys/socket.h>
 #endif
+#include <errno.h>
 
 #include <vlc_network.h>
 
+#if defined (__linux__) && defined (__GLIBC__)
+#   if __GLIBC_PREREQ(2, 14)
+/* sendmmsg() appeared in Linux 3.0 and glibc 2.14 */
+#       define UDP_SENDMMSG 1
+#       include <netinet/udp.h>
+#   endif
+#endif
+
 #define MAX_EMPTY_BLOCKS 200
+/* Maximum number of datagrams sent at once */
+#define MAX_BATCH 64
 
 /*****************************************************************************
  * Module descriptor
@@ -73,6 +84,16 @@ static void Close( vlc_object_t * );
                           "helps reducing the scheduling load on " \
                           "heavily-loaded systems." )
 
+#define WINDOW_TEXT N_("Pacing window (ms)")
+#define WINDOW_LONGTEXT N_("Packets due within this delay are sent together " \
+                           "with a single system call. This is the maximum " \
+                           "advance of a packet on its schedule. " \
+                           "0 sends packets one by one." )
+
+#define GSO_TEXT N_("UDP segmentation offload")
+#define GSO_LONGTEXT N_("Let the kernel split packets sent together, if " \
+                        "supported.")
+
 vlc_module_begin ()
     set_description( N_("UDP stream output") )
     set_shortname( "UDP" )
@@ -81,6 +102,10 @@ vlc_module_begin ()
     add_integer( SOUT_CFG_PREFIX "caching", DEFAULT_PTS_DELAY / 1000, NULL, CACHING_TEXT, CACHING_LONGTEXT, true )
     add_integer( SOUT_CFG_PREFIX "group", 1, NULL, GROUP_TEXT, GROUP_LONGTEXT,
                                  true )
+    add_integer( SOUT_CFG_PREFIX "window", 0, NULL, WINDOW_TEXT,
+                 WINDOW_LONGTEXT, true )
+    add_bool( SOUT_CFG_PREFIX "gso", false, NULL, GSO_TEXT, GSO_LONGTEXT,
+              true )
     add_obsolete_integer( SOUT_CFG_PREFIX "late" )
     add_obsolete_bool( SOUT_CFG_PREFIX "raw" )
 
@@ -96,6 +121,8 @@ vlc_module_end ()
 static const char *const ppsz_sout_options[] = {
     "caching",
     "group",
+    "window",
+    "gso",
     NULL
 };
 
@@ -115,6 +142,12 @@ static int Control( sout_access_out_t *, int, va_list );
 static void* ThreadWrite( void * );
 static block_t *NewUDPPacket( sout_access_out_t *, mtime_t );
 
+/* Send lateness histogram upper bounds (exclusive), in microseconds */
+static const mtime_t pi_late_bounds[] = {
+    1000, 2000, 5000, 10000, 20000, 50000, 100000, INT64_MAX
+};
+#define LATE_BUCKETS (sizeof (pi_late_bounds) / sizeof (pi_late_bounds[0]))
+
 struct sout_access_out_sys_t
 {
     mtime_t       i_caching;
@@ -127,6 +160,14 @@ struct sout_access_out_sys_t
     block_t      *p_buffer;
 
     vlc_thread_t  thread;
+
+    /* Batched sending (written by the thread only) */
+    mtime_t       i_window;
+    bool          b_gso;
+    bool          b_mmsg; /**< sendmmsg() is available */
+    uint64_t      i_sent;
+    uint64_t      i_calls;
+    uint64_t      pi_late[LATE_BUCKETS];
 };
 
 #define DEFAULT_PORT 1234
@@ -219,6 +260,21 @@ static int Open( vlc_object_t *p_this )
     p_sys->p_empty_blocks = block_FifoNew();
     p_sys->p_buffer = NULL;
 
+    p_sys->i_window = UINT64_C(1000)
+                    * var_GetInteger( p_access, SOUT_CFG_PREFIX "window" );
+    p_sys->b_gso = var_GetBool( p_access, SOUT_CFG_PREFIX "gso" );
+#if defined (UDP_SENDMMSG) && defined (UDP_SEGMENT)
+    if( p_sys->b_gso && p_sys->i_window == 0 )
+        msg_Warn( p_access, "segmentation offload requires a pacing window" );
+#else
+    if( p_sys->b_gso )
+        msg_Warn( p_access, "segmentation offload not supported" );
+    p_sys->b_gso = false;
+#endif
+    p_sys->b_mmsg = true;
+    p_sys->i_sent = p_sys->i_calls = 0;
+    memset( p_sys->pi_late, 0, sizeof( p_sys->pi_late ) );
+
     if( vlc_clone( &p_sys->thread, ThreadWrite, p_access,
                            VLC_THREAD_PRIORITY_HIGHEST ) )
     {
@@ -247,6 +303,23 @@ static void Close( vlc_object_t * p_this )
 
     vlc_cancel( p_sys->thread );
     vlc_join( p_sys->thread, NULL );
+
+    if( p_sys->i_sent > 0 )
+    {
+        char psz_hist[LATE_BUCKETS * 32], *p = psz_hist;
+
+        for( unsigned i = 0; i < LATE_BUCKETS; i++ )
+        {
+            if( pi_late_bounds[i] != INT64_MAX )
+                p += sprintf( p, " <%"PRId64"ms:%"PRIu64,
+                              pi_late_bounds[i] / 1000, p_sys->pi_late[i] );
+            else
+                p += sprintf( p, " more:%"PRIu64, p_sys->pi_late[i] );
+        }
+        msg_Dbg( p_access, "sent %"PRIu64" packets in %"PRIu64" calls, "
+                 "lateness:%s", p_sys->i_sent, p_sys->i_calls, psz_hist );
+    }
+
     block_FifoRelease( p_sys->p_fifo );
     block_FifoRelease( p_sys->p_empty_blocks );
 
@@ -397,6 +470,148 @@ static block_t *NewUDPPacket( sout_access_out_t *p_access, mtime_t i_dts)
     return p_buffer;
 }
 
+/*****************************************************************************
+ * SendBatch: send packets at once, and account for their lateness
+ *****************************************************************************/
+static void SendBatch( sout_access_out_t *p_access, block_t **pp_pk,
+                       unsigned i_count )
+{
+    sout_access_out_sys_t *p_sys = p_access->p_sys;
+    unsigned i_done = 0;
+
+#ifdef UDP_SENDMMSG
+    struct iovec iov[MAX_BATCH];
+
+    for( unsigned i = 0; i < i_count; i++ )
+    {
+        iov[i].iov_base = pp_pk[i]->p_buffer;
+        iov[i].iov_len = pp_pk[i]->i_buffer;
+    }
+
+# ifdef UDP_SEGMENT
+    /* The kernel splits one big datagram in parts of the first packet size:
+     * all packets of a segmented send but the last one must have that size,
+     * and the whole must fit in one datagram. */
+    while( p_sys->b_gso && i_count - i_done > 1 )
+    {
+        const size_t i_segment = iov[i_done].iov_len;
+        size_t i_total = i_segment;
+        unsigned n = 1;
+
+        while( i_done + n < i_count
+            && iov[i_done + n].iov_len <= i_segment
+            && i_total + iov[i_done + n].iov_len <= 65507 )
+        {
+            i_total += iov[i_done + n].iov_len;
+            if( iov[i_done + n++].iov_len < i_segment )
+                break; /* short packet: must be the last one */
+        }
+        if( n < 2 )
+            break;
+
+        union {
+            char buf[CMSG_SPACE(sizeof (uint16_t))];
+            struct cmsghdr align;
+        } control;
+        struct msghdr hdr = {
+            .msg_iov = &iov[i_done],
+            .msg_iovlen = n,
+            .msg_control = control.buf,
+            .msg_controllen = sizeof (control.buf),
+        };
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR( &hdr );
+        uint16_t i_size = i_segment;
+
+        cmsg->cmsg_level = SOL_UDP;
+        cmsg->cmsg_type = UDP_SEGMENT;
+        cmsg->cmsg_len = CMSG_LEN(sizeof (i_size));
+        memcpy( CMSG_DATA(cmsg), &i_size, sizeof (i_size) );
+
+        p_sys->i_calls++;
+        if( sendmsg( p_sys->i_handle, &hdr, 0 ) < 0 )
+        {
+            if( errno == EINVAL || errno == EIO || errno == ENOPROTOOPT )
+            {
+                msg_Warn( p_access, "segmentation offload failed (%m), "
+                          "disabling" );
+                p_sys->b_gso = false;
+                break;
+            }
+            msg_Warn( p_access, "send error: %m" );
+        }
+        i_done += n;
+    }
+# endif
+
+    while( p_sys->b_mmsg && i_done < i_count )
+    {
+        struct mmsghdr msgs[MAX_BATCH];
+        unsigned n = i_count - i_done;
+
+        memset( msgs, 0, n * sizeof (*msgs) );
+        for( unsigned i = 0; i < n; i++ )
+        {
+            msgs[i].msg_hdr.msg_iov = &iov[i_done + i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        p_sys->i_calls++;
+        int val = sendmmsg( p_sys->i_handle, msgs, n, 0 );
+        if( val < 0 )
+        {
+            if( errno == ENOSYS )
+            {   /* fall back to send() from now on */
+                msg_Dbg( p_access, "sendmmsg() not supported" );
+                p_sys->b_mmsg = false;
+                break;
+            }
+            msg_Warn( p_access, "send error: %m" );
+            val = 1; /* skip the failing packet */
+        }
+        i_done += val;
+    }
+#endif
+
+    for( ; i_done < i_count; i_done++ )
+    {
+        p_sys->i_calls++;
+        if( send( p_sys->i_handle, pp_pk[i_done]->p_buffer,
+                  pp_pk[i_done]->i_buffer, 0 ) == -1 )
+            msg_Warn( p_access, "send error: %m" );
+    }
+
+    /* Lateness histogram */
+    mtime_t now = mdate();
+    for( unsigned i = 0; i < i_count; i++ )
+    {
+        mtime_t i_late = now - (pp_pk[i]->i_dts + p_sys->i_caching);
+        unsigned b = 0;
+
+        while( i_late >= pi_late_bounds[b] )
+            b++;
+        p_sys->pi_late[b]++;
+    }
+    p_sys->i_sent += i_count;
+}
+
+static void BatchCleanup( void *data )
+{
+    block_ChainRelease( data );
+}
+
+/*****************************************************************************
+ * SendWindow: wait for the first packet date, then send the batch. The
+ * packets are chained from pp_batch[0] for the cancellation cleanup.
+ *****************************************************************************/
+static void SendWindow( sout_access_out_t *p_access, block_t **pp_batch,
+                        unsigned i_count, mtime_t i_date )
+{
+    vlc_cleanup_push( BatchCleanup, pp_batch[0] );
+    mwait( i_date );
+    SendBatch( p_access, pp_batch, i_count );
+    vlc_cleanup_pop();
+}
+
 /*****************************************************************************
  * ThreadWrite: Write a packet on the network at the good time.
  *****************************************************************************/
@@ -438,6 +653,47 @@ static void* ThreadWrite( void *data )
             }
         }
 
+        if( p_sys->i_window > 0 )
+        {
+            /* Take the packets due within the pacing window */
+            block_t *pp_batch[MAX_BATCH], **pp_last = &p_pk->p_next;
+            unsigned i_count = 1;
+
+            pp_batch[0] = p_pk;
+            while( i_count < MAX_BATCH
+                && block_FifoCount( p_sys->p_fifo ) > 0 )
+            {
+                /* This thread is the only reader: Show() does not block */
+                block_t *p_next = block_FifoShow( p_sys->p_fifo );
+                mtime_t i_next = p_sys->i_caching + p_next->i_dts;
+
+                if( i_next > i_date + p_sys->i_window || i_next < i_date )
+                    break; /* too early, or a hole: leave it to the next batch */
+                p_next = block_FifoGet( p_sys->p_fifo );
+                pp_batch[i_count++] = p_next;
+                *pp_last = p_next;
+                pp_last = &p_next->p_next;
+                i_date_last = i_next;
+            }
+
+            SendWindow( p_access, pp_batch, i_count, i_date );
+
+            for( unsigned i = 0; i < i_count; i++ )
+            {
+                pp_batch[i]->p_next = NULL;
+                block_FifoPut( p_sys->p_empty_blocks, pp_batch[i] );
+            }
+
+            if( i_dropped_packets )
+            {
+                msg_Dbg( p_access, "dropped %i packets", i_dropped_packets );
+                i_dropped_packets = 0;
+            }
+            if( i_date_last < i_date )
+                i_date_last = i_date;
+            continue;
+        }
+
         block_cleanup_push( p_pk );
         i_to_send--;
         if( !i_to_send || (p_pk->i_flags & BLOCK_FLAG_CLOCK) )
@@ -445,8 +701,7 @@ static void* ThreadWrite( void *data )
             mwait( i_date );
             i_to_send = i_group;
         }
-        if ( send( p_sys->i_handle, p_pk->p_buffer, p_pk->i_buffer, 0 ) == -1 )
-            msg_Warn( p_access, "send error: %m" );
+        SendBatch( p_access, &p_pk, 1 );
         vlc_cleanup_pop();
 
         if( i_dropped_packets )
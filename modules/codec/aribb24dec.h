@@ -103,13 +103,6 @@ typedef struct drcs_data_s
 } drcs_data_t;
 #endif //ARIBSUB_GEN_DRCS_DATA
 
-typedef struct drcs_conversion_s {
-    char                     hash[32+1];
-    unsigned int             code;
-
-    struct drcs_conversion_s *p_next;
-} drcs_conversion_t ;
-
 typedef struct arib_buf_region_s
 {
     char *p_start;
@@ -197,13 +190,15 @@ typedef struct arib_decoder_s
     int i_charleft;
     int i_charbottom;
 
+    /* code points of the DRCS characters, 0 when there is no conversion */
     int i_drcs_num;
-    char drcs_hash_table[10][32 + 1];
-
-    drcs_conversion_t *p_drcs_conv;
+    const unsigned int *p_drcs_code;
 
     arib_buf_region_t *p_region;
     bool b_need_next_region;
+
+    /* false for plain text (EIT), where no region/position is tracked */
+    bool b_caption;
 } arib_decoder_t;
 
 static void decoder_adjust_position( arib_decoder_t *decoder )
@@ -281,10 +276,24 @@ static inline int u8_uctomb( unsigned char *s, unsigned int uc, int n )
     }
 }
 
-static int decoder_push( arib_decoder_t *decoder, unsigned int uc )
+static int decoder_push_utf8( arib_decoder_t *decoder, unsigned int uc,
+                              const unsigned char *p_utf8, size_t i_utf8 )
 {
     char *p_start = decoder->ubuf;
 
+    if( decoder->ucount < i_utf8 )
+    {
+        return 0;
+    }
+
+    if( !decoder->b_caption )
+    {
+        memcpy( decoder->ubuf, p_utf8, i_utf8 );
+        decoder->ubuf += i_utf8;
+        decoder->ucount -= i_utf8;
+        return 1;
+    }
+
     if( decoder->i_foreground_color_prev != decoder->i_foreground_color )
     {
         decoder->i_foreground_color_prev = decoder->i_foreground_color; 
@@ -405,14 +414,9 @@ static int decoder_push( arib_decoder_t *decoder, unsigned int uc )
             break;
     }
 
-    int i_cnt = u8_uctomb( (unsigned char*)decoder->ubuf, uc, decoder->ucount );
-    if( i_cnt <= 0 )
-    {
-        return 0;
-    }
-
-    decoder->ubuf += i_cnt;
-    decoder->ucount -= i_cnt;
+    memcpy( decoder->ubuf, p_utf8, i_utf8 );
+    decoder->ubuf += i_utf8;
+    decoder->ucount -= i_utf8;
 
     char *p_end = decoder->ubuf;
 
@@ -513,6 +517,17 @@ static int decoder_push( arib_decoder_t *decoder, unsigned int uc )
     return 1;
 }
 
+static int decoder_push( arib_decoder_t *decoder, unsigned int uc )
+{
+    unsigned char p_utf8[4];
+    int i_cnt = u8_uctomb( p_utf8, uc, sizeof(p_utf8) );
+    if( i_cnt <= 0 )
+    {
+        return 0;
+    }
+    return decoder_push_utf8( decoder, uc, p_utf8, i_cnt );
+}
+
 static int decoder_pull( arib_decoder_t *decoder, int *c )
 {
     if( decoder->count == 0 )
@@ -534,21 +549,7 @@ static int decoder_handle_drcs( arib_decoder_t *decoder, int c )
     uc = 0;
     if( c < decoder->i_drcs_num )
     {
-        drcs_conversion_t *p_drcs_conv =  decoder->p_drcs_conv;
-        while( p_drcs_conv != NULL )
-        {
-            if( strcmp( p_drcs_conv->hash, decoder->drcs_hash_table[c] ) == 0 )
-            {
-#ifdef DEBUG_ARIBB24DEC
-                fprintf( stderr, "drcs hash[%s] converted to U+%x\n",
-                         p_drcs_conv->hash,
-                         p_drcs_conv->code);
-#endif //DEBUG_ARIBB24DEC
-                uc = p_drcs_conv->code;
-                break;
-            }
-            p_drcs_conv = p_drcs_conv->p_next;
-        }
+        uc = decoder->p_drcs_code[c];
     }
     if( uc == 0 )
     {
@@ -2798,13 +2799,176 @@ static void dump( const unsigned char *start, const unsigned char *end )
 #endif //DEBUG_ARIBB24DEC
 }
 
+/*****************************************************************************
+ * UTF-8 conversion tables, built once from the code point tables above
+ *****************************************************************************/
+typedef struct
+{
+    unsigned char i_len; /* 0 if the character is not defined */
+    unsigned char p[4];
+} arib_utf8_char_t;
+
+#define DECODER_KANJI_ROWS \
+    (sizeof(decoder_kanji_table) / sizeof(decoder_kanji_table[0]))
+
+static arib_utf8_char_t decoder_kanji_utf8[DECODER_KANJI_ROWS][94];
+static arib_utf8_char_t decoder_alnum_utf8[94];
+static arib_utf8_char_t decoder_hiragana_utf8[94];
+static arib_utf8_char_t decoder_katakana_utf8[94];
+static bool decoder_utf8_ready = false;
+
+static void decoder_utf8_fill( arib_utf8_char_t *p_dst,
+                               const unsigned int *p_src, size_t i_count,
+                               unsigned int i_offset )
+{
+    for( size_t i = 0; i < i_count; i++ )
+    {
+        int i_len = 0;
+        if( p_src[i] != 0 )
+        {
+            i_len = u8_uctomb( p_dst[i].p, p_src[i] + i_offset, 4 );
+        }
+        p_dst[i].i_len = i_len > 0 ? i_len : 0;
+    }
+}
+
+static void decoder_utf8_init( void )
+{
+    static vlc_mutex_t lock = VLC_STATIC_MUTEX;
+
+    vlc_mutex_lock( &lock );
+    if( !decoder_utf8_ready )
+    {
+        for( size_t ku = 0; ku < DECODER_KANJI_ROWS; ku++ )
+        {
+            decoder_utf8_fill( decoder_kanji_utf8[ku],
+                               decoder_kanji_table[ku], 94, 0 );
+        }
+        decoder_utf8_fill( decoder_alnum_utf8, decoder_alnum_table,
+                           94, 0xfee0 /* FULLWIDTH */ );
+        decoder_utf8_fill( decoder_hiragana_utf8, decoder_hiragana_table,
+                           94, 0 );
+        decoder_utf8_fill( decoder_katakana_utf8, decoder_katakana_table,
+                           94, 0 );
+        decoder_utf8_ready = true;
+    }
+    vlc_mutex_unlock( &lock );
+}
+
+/* Converts the run of graphic characters at the current position straight
+ * from the UTF-8 tables, as long as the invoked sets are plain kanji, kana
+ * or alphanumeric ones and no single shift nor half kanji is pending.
+ * It stops on the first byte that needs the state machine. */
+static int decoder_decode_run( arib_decoder_t *decoder )
+{
+    static const arib_utf8_char_t space = { 3, { 0xe3, 0x80, 0x80 } };
+
+    if( decoder->handle_gl_single != NULL || decoder->kanji_ku >= 0 )
+    {
+        return 1;
+    }
+
+    while( decoder->count > 0 )
+    {
+        const unsigned char *buf = decoder->buf;
+        int (*handle)(arib_decoder_t *, int);
+        int c = buf[0];
+        int i_base;
+
+        if( c == 0x20 || c == 0x7f )
+        {
+            handle = NULL;
+            i_base = 0;
+        }
+        else if( c >= 0x21 && c <= 0x7e )
+        {
+            handle = *decoder->handle_gl;
+            i_base = 0x21;
+        }
+        else if( c >= 0xa1 && c <= 0xfe )
+        {
+            handle = *decoder->handle_gr;
+            i_base = 0xa1;
+        }
+        else
+        {
+            break;
+        }
+
+        const arib_utf8_char_t *p_char;
+        unsigned int uc;
+        size_t i_used = 1;
+
+        if( handle == NULL )
+        {
+            p_char = &space;
+            uc = 0x3000;
+        }
+        else if( handle == decoder_handle_kanji )
+        {
+            /* Both bytes must come from the same half of the table */
+            if( decoder->count < 2 ||
+                buf[1] < i_base || buf[1] > i_base + 0x5d )
+            {
+                break;
+            }
+            const int ku = c - i_base;
+            const int ten = buf[1] - i_base;
+            p_char = &decoder_kanji_utf8[ku][ten];
+            uc = decoder_kanji_table[ku][ten];
+            i_used = 2;
+        }
+        else if( handle == decoder_handle_hiragana )
+        {
+            p_char = &decoder_hiragana_utf8[c - i_base];
+            uc = decoder_hiragana_table[c - i_base];
+        }
+        else if( handle == decoder_handle_katakana )
+        {
+            p_char = &decoder_katakana_utf8[c - i_base];
+            uc = decoder_katakana_table[c - i_base];
+        }
+        else if( handle == decoder_handle_alnum )
+        {
+            p_char = &decoder_alnum_utf8[c - i_base];
+            uc = decoder_alnum_table[c - i_base] + 0xfee0;
+        }
+        else
+        {
+            break;
+        }
+
+        if( p_char->i_len == 0 )
+        {
+            break;
+        }
+
+        decoder->buf += i_used;
+        decoder->count -= i_used;
+        if( decoder_push_utf8( decoder, uc, p_char->p, p_char->i_len ) == 0 )
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
 static int arib_decode( arib_decoder_t *decoder )
 {
     int (*handle)(arib_decoder_t *, int);
     int c;
     /* ARIB STD-B24 VOLUME 1 Part 2 Chapter 7 Figure 7-1 Code Table */
-    while( decoder_pull( decoder, &c ) != 0 )
+    for( ;; )
     {
+        /* Plain text runs do not need the per byte dispatch below */
+        if( decoder_decode_run( decoder ) == 0 )
+        {
+            return 0;
+        }
+        if( decoder_pull( decoder, &c ) == 0 )
+        {
+            break;
+        }
         if( c < 0x20 )
         {
             handle = decoder_handle_c0;
@@ -2884,17 +3048,14 @@ static void arib_initialize_decoder( arib_decoder_t* decoder, bool b_caption )
     decoder->i_charbottom = decoder->i_top + decoder->i_charheight - 1;
 
     decoder->i_drcs_num = 0;
-#if 0
-    for( int i = 0; i < 10; i++ )
-    {
-        memset(decoder->drcs_hash_table[i], 0, 32+1);
-    }
-#endif
-
-    decoder->p_drcs_conv = NULL;
+    decoder->p_drcs_code = NULL;
 
     decoder->p_region = NULL;
     decoder->b_need_next_region = true;
+
+    decoder->b_caption = b_caption;
+
+    decoder_utf8_init();
 }
 
 static void arib_finalize_decoder( arib_decoder_t* decoder )
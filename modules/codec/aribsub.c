@@ -61,6 +61,10 @@ static subpicture_t *Decode( decoder_t *, block_t ** );
 #define IGNORE_RUBY_LONGTEXT N_("Ignore ruby(furigana) in the subtitle.")
 #define IGNORE_POSITION_ADJUSTMENT_TEXT N_("Ignore position adjustment")
 #define IGNORE_POSITION_ADJUSTMENT_LONGTEXT N_("Ignore position adjustment for quartztext.")
+#define INCREMENTAL_TEXT N_("Reuse rendered regions")
+#define INCREMENTAL_LONGTEXT N_("Only render the caption regions that changed " \
+    "since the previous caption statement, the other ones reuse the bitmap " \
+    "already rendered.")
 
 vlc_module_begin ()
 #   define ARIBSUB_CFG_PREFIX "aribsub-"
@@ -73,6 +77,7 @@ vlc_module_begin ()
 
     add_bool( ARIBSUB_CFG_PREFIX "ignore_ruby", NULL, false, IGNORE_RUBY_TEXT, IGNORE_RUBY_LONGTEXT, true )
 //    add_bool( ARIBSUB_CFG_PREFIX "ignore_position_adjustment", NULL, false, IGNORE_POSITION_ADJUSTMENT_TEXT, IGNORE_POSITION_ADJUSTMENT_LONGTEXT, true )
+    add_bool( ARIBSUB_CFG_PREFIX "incremental", NULL, true, INCREMENTAL_TEXT, INCREMENTAL_LONGTEXT, true )
 vlc_module_end ()
 
 
@@ -97,21 +102,32 @@ struct decoder_sys_t
     bool              b_ignore_position_adjustment;
 
     arib_decoder_t    arib_decoder;
+    arib_bitmap_cache_t *p_bitmap_cache;
 #ifdef ARIBSUB_GEN_DRCS_DATA
     drcs_data_t       *p_drcs_data;
 #endif //ARIBSUB_GEN_DRCS_DATA
 
+    /* code points of the DRCS of the current PES, in order of definition */
     int               i_drcs_num;
-    char              drcs_hash_table[10][32 + 1];
-
-    drcs_conversion_t *p_drcs_conv;
+    unsigned int      *p_drcs_code;
+
+    /* PNG dump of the unknown DRCS patterns */
+    vlc_thread_t      png_thread;
+    vlc_mutex_t       png_lock;
+    vlc_cond_t        png_wait;
+    bool              b_png_writer;
+    bool              b_png_quit;
+    struct drcs_png_job_s *p_png_jobs;
+    struct drcs_png_job_s **pp_png_jobs_last;
 };
 
 
 /*****************************************************************************
  * Local prototypes
  *****************************************************************************/
-static void load_drcs_conversion_table( decoder_t * );
+static void drcs_cache_hold( void );
+static void drcs_cache_release( void );
+static void *drcs_writer_thread( void * );
 static void parse_data_unit( decoder_t * );
 static void parse_caption_management_data( decoder_t * );
 static void parse_caption_statement_data( decoder_t * );
@@ -152,13 +168,30 @@ static int Open( vlc_object_t *p_this )
         var_InheritBool( p_this, ARIBSUB_CFG_PREFIX "ignore_ruby" );
     p_sys->b_ignore_position_adjustment = true; /* XXX */
         //var_InheritBool( p_this, ARIBSUB_CFG_PREFIX "ignore_position_adjustment" );
+    p_sys->p_bitmap_cache = NULL;
+    if( var_InheritBool( p_this, ARIBSUB_CFG_PREFIX "incremental" ) )
+    {
+        p_sys->p_bitmap_cache = aribcache_New();
+    }
 #ifdef ARIBSUB_GEN_DRCS_DATA
     p_sys->p_drcs_data = NULL;
 #endif //ARIBSUB_GEN_DRCS_DATA
     p_sys->i_drcs_num = 0;
-
-    p_sys->p_drcs_conv = NULL;
-    load_drcs_conversion_table( p_dec );
+    p_sys->p_drcs_code = NULL;
+
+    drcs_cache_hold();
+
+    vlc_mutex_init( &p_sys->png_lock );
+    vlc_cond_init( &p_sys->png_wait );
+    p_sys->b_png_quit = false;
+    p_sys->p_png_jobs = NULL;
+    p_sys->pp_png_jobs_last = &p_sys->p_png_jobs;
+    p_sys->b_png_writer = !vlc_clone( &p_sys->png_thread, drcs_writer_thread,
+                                      p_sys, VLC_THREAD_PRIORITY_LOW );
+    if( !p_sys->b_png_writer )
+    {
+        msg_Warn( p_dec, "cannot start the DRCS image writer" );
+    }
 
     return VLC_SUCCESS;
 }
@@ -172,14 +205,14 @@ static void free_all( decoder_t *p_dec )
     free( p_sys->psz_fontfamily );
     p_sys->psz_fontfamily = NULL;
 
-    drcs_conversion_t *p_drcs_conv = p_sys->p_drcs_conv;
-    while( p_drcs_conv != NULL )
+    free( p_sys->p_drcs_code );
+    p_sys->p_drcs_code = NULL;
+
+    if( p_sys->p_bitmap_cache != NULL )
     {
-        drcs_conversion_t *p_next = p_drcs_conv->p_next;
-        free( p_drcs_conv );
-        p_drcs_conv = p_next;
+        aribcache_Release( p_sys->p_bitmap_cache );
+        p_sys->p_bitmap_cache = NULL;
     }
-    p_sys->p_drcs_conv = NULL;
 }
 
 /*****************************************************************************
@@ -193,6 +226,19 @@ static void Close( vlc_object_t *p_this )
     var_Destroy( p_this, ARIBSUB_CFG_PREFIX "ignore_ruby" );
  //   var_Destroy( p_this, ARIBSUB_CFG_PREFIX "ignore_position_adjustment" );
 
+    if( p_sys->b_png_writer )
+    {
+        vlc_mutex_lock( &p_sys->png_lock );
+        p_sys->b_png_quit = true;
+        vlc_cond_signal( &p_sys->png_wait );
+        vlc_mutex_unlock( &p_sys->png_lock );
+        vlc_join( p_sys->png_thread, NULL );
+    }
+    vlc_cond_destroy( &p_sys->png_wait );
+    vlc_mutex_destroy( &p_sys->png_lock );
+
+    drcs_cache_release();
+
     free_all( p_dec );
     free( p_sys );
 }
@@ -226,9 +272,8 @@ static subpicture_t *Decode( decoder_t *p_dec, block_t **pp_block )
 
 /* following functions are local */
 
-static char* get_arib_base_dir( decoder_t *p_dec )
+static char* get_arib_base_dir( void )
 {
-    VLC_UNUSED(p_dec);
     char *psz_data_dir = config_GetUserDir( VLC_DATA_DIR );
     if( psz_data_dir == NULL )
     {
@@ -245,9 +290,9 @@ static char* get_arib_base_dir( decoder_t *p_dec )
     return psz_arib_base_dir;
 }
 
-static char* get_arib_data_dir( decoder_t *p_dec )
+static char* get_arib_data_dir( void )
 {
-    char *psz_arib_base_dir = get_arib_base_dir( p_dec );
+    char *psz_arib_base_dir = get_arib_base_dir();
     if( psz_arib_base_dir == NULL )
     {
         return NULL;
@@ -263,9 +308,9 @@ static char* get_arib_data_dir( decoder_t *p_dec )
     return psz_arib_data_dir;
 }
 
-static void create_arib_basedir( decoder_t *p_dec )
+static void create_arib_basedir( void )
 {
-    char *psz_arib_base_dir = get_arib_base_dir( p_dec );
+    char *psz_arib_base_dir = get_arib_base_dir();
     if( psz_arib_base_dir == NULL )
     {
         return;
@@ -284,10 +329,10 @@ static void create_arib_basedir( decoder_t *p_dec )
     free( psz_arib_base_dir );
 }
 
-static void create_arib_datadir( decoder_t *p_dec )
+static void create_arib_datadir( void )
 {
-    create_arib_basedir( p_dec );
-    char *psz_arib_data_dir = get_arib_data_dir( p_dec );
+    create_arib_basedir();
+    char *psz_arib_data_dir = get_arib_data_dir();
     if( psz_arib_data_dir == NULL )
     {
         return;
@@ -306,13 +351,163 @@ static void create_arib_datadir( decoder_t *p_dec )
     free( psz_arib_data_dir );
 }
 
-static void load_drcs_conversion_table( decoder_t *p_dec )
+/*****************************************************************************
+ * DRCS glyph cache
+ *****************************************************************************
+ * Every DRCS pattern seen by any ARIB decoder of the process is kept here,
+ * keyed by the binary MD5 digest of its pattern data, together with the
+ * code point it converts to (from drcs_conv.ini) and its decoded bitmap.
+ * Entries loaded from the conversion table are pinned, the others are
+ * evicted oldest first once there are more than DRCS_CACHE_MAX of them.
+ *****************************************************************************/
+#define DRCS_CACHE_BUCKETS 256
+#define DRCS_CACHE_MAX     1024
+
+typedef struct drcs_glyph_s
 {
-    decoder_sys_t *p_sys = p_dec->p_sys;
-    p_sys->p_drcs_conv = NULL;
+    uint8_t      digest[16];
+    unsigned int code;          /* 0 if there is no conversion */
+    bool         b_pinned;
+
+    int          i_width;
+    int          i_height;
+    uint8_t      *p_bitmap;     /* one byte per pixel, 0 or 1 */
+
+    struct drcs_glyph_s *p_hash_next;
+    struct drcs_glyph_s *p_age_next;
+} drcs_glyph_t;
+
+typedef struct
+{
+    unsigned     i_users;
+    drcs_glyph_t *pp_bucket[DRCS_CACHE_BUCKETS];
+
+    /* evictable glyphs, oldest first */
+    drcs_glyph_t *p_oldest;
+    drcs_glyph_t *p_newest;
+    unsigned     i_glyphs;
+} drcs_cache_t;
+
+static vlc_mutex_t  drcs_cache_lock = VLC_STATIC_MUTEX;
+static drcs_cache_t drcs_cache;
+
+static void drcs_digest_to_hex( char psz_hash[32 + 1], const uint8_t digest[16] )
+{
+    for( int i = 0; i < 16; i++ )
+    {
+        sprintf( &psz_hash[2 * i], "%02x", digest[i] );
+    }
+    psz_hash[32] = '\0';
+}
+
+static bool drcs_digest_from_hex( uint8_t digest[16], const char *psz_hash )
+{
+    for( int i = 0; i < 32; i++ )
+    {
+        int c = tolower( (unsigned char)psz_hash[i] );
+        int v;
+        if( c >= '0' && c <= '9' )
+            v = c - '0';
+        else if( c >= 'a' && c <= 'f' )
+            v = c - 'a' + 10;
+        else
+            return false;
+        if( i & 1 )
+            digest[i / 2] |= v;
+        else
+            digest[i / 2] = v << 4;
+    }
+    return true;
+}
+
+/* Must be called with drcs_cache_lock held */
+static drcs_glyph_t *drcs_cache_find( const uint8_t digest[16] )
+{
+    drcs_glyph_t *p_glyph = drcs_cache.pp_bucket[digest[0]];
+    while( p_glyph != NULL &&
+           memcmp( p_glyph->digest, digest, 16 ) != 0 )
+    {
+        p_glyph = p_glyph->p_hash_next;
+    }
+    return p_glyph;
+}
+
+static void drcs_cache_unlink( drcs_glyph_t *p_glyph )
+{
+    drcs_glyph_t **pp = &drcs_cache.pp_bucket[p_glyph->digest[0]];
+    while( *pp != p_glyph )
+    {
+        pp = &(*pp)->p_hash_next;
+    }
+    *pp = p_glyph->p_hash_next;
+}
+
+static drcs_glyph_t *drcs_cache_insert( const uint8_t digest[16], bool b_pinned )
+{
+    drcs_glyph_t *p_glyph = (drcs_glyph_t*) calloc( 1, sizeof(drcs_glyph_t) );
+    if( p_glyph == NULL )
+    {
+        return NULL;
+    }
+    memcpy( p_glyph->digest, digest, 16 );
+    p_glyph->b_pinned = b_pinned;
+    p_glyph->p_hash_next = drcs_cache.pp_bucket[digest[0]];
+    drcs_cache.pp_bucket[digest[0]] = p_glyph;
+
+    if( b_pinned )
+    {
+        return p_glyph;
+    }
+
+    if( drcs_cache.p_newest != NULL )
+    {
+        drcs_cache.p_newest->p_age_next = p_glyph;
+    }
+    else
+    {
+        drcs_cache.p_oldest = p_glyph;
+    }
+    drcs_cache.p_newest = p_glyph;
+    drcs_cache.i_glyphs++;
+
+    while( drcs_cache.i_glyphs > DRCS_CACHE_MAX )
+    {
+        drcs_glyph_t *p_old = drcs_cache.p_oldest;
+        drcs_cache.p_oldest = p_old->p_age_next;
+        drcs_cache.i_glyphs--;
+        drcs_cache_unlink( p_old );
+        free( p_old->p_bitmap );
+        free( p_old );
+    }
+    if( drcs_cache.p_oldest == NULL )
+    {
+        drcs_cache.p_newest = NULL;
+    }
+    return p_glyph;
+}
+
+static void drcs_cache_clean( void )
+{
+    for( int i = 0; i < DRCS_CACHE_BUCKETS; i++ )
+    {
+        drcs_glyph_t *p_glyph = drcs_cache.pp_bucket[i];
+        while( p_glyph != NULL )
+        {
+            drcs_glyph_t *p_next = p_glyph->p_hash_next;
+            free( p_glyph->p_bitmap );
+            free( p_glyph );
+            p_glyph = p_next;
+        }
+    }
+    memset( &drcs_cache, 0, sizeof(drcs_cache) );
+}
 
-    create_arib_basedir( p_dec );
-    char *psz_arib_base_dir = get_arib_base_dir( p_dec );
+/* Loads drcs_conv.ini as pinned entries of the cache.
+ * Must be called with drcs_cache_lock held */
+static void load_drcs_conversion_table( void )
+{
+    create_arib_basedir();
+    char *psz_arib_base_dir = get_arib_base_dir();
     if( psz_arib_base_dir == NULL )
     {
         return;
@@ -336,7 +531,6 @@ static void load_drcs_conversion_table( decoder_t *p_dec )
         return;
     }
 
-    drcs_conversion_t *p_drcs_conv = NULL;
     char buf[256] = { 0 };
     while( fgets( buf, 256, fp ) != 0 )
     {
@@ -362,45 +556,76 @@ static void load_drcs_conversion_table( decoder_t *p_dec )
             continue;
         }
 
-        char hash[32 + 1];
-        strncpy( hash, buf, 32 );
-        hash[32] = '\0';
-        unsigned long code = strtoul( p_code + 2, NULL, 16 );
-        if( code > 0x10ffff )
+        uint8_t digest[16];
+        if( !drcs_digest_from_hex( digest, buf ) )
         {
             continue;
         }
-        
-        drcs_conversion_t *p_next = (drcs_conversion_t*) calloc(
-                1, sizeof(drcs_conversion_t) );
-        if( p_next == NULL )
+        unsigned long code = strtoul( p_code + 2, NULL, 16 );
+        if( code > 0x10ffff )
         {
             continue;
         }
-        strncpy( p_next->hash, hash, 32 );
-        p_next->hash[32] = '\0';
-        p_next->code = code;
-        if( p_drcs_conv == NULL )
+
+        /* The first conversion of a pattern wins */
+        if( drcs_cache_find( digest ) != NULL )
         {
-            p_sys->p_drcs_conv = p_next;
+            continue;
         }
-        else
+        drcs_glyph_t *p_glyph = drcs_cache_insert( digest, true );
+        if( p_glyph == NULL )
         {
-            p_drcs_conv->p_next = p_next;
+            continue;
         }
-        p_drcs_conv = p_next;
-        p_drcs_conv->p_next = NULL;
+        p_glyph->code = code;
     }
 
     fclose( fp );
 }
 
-static FILE* open_image_file( decoder_t* p_dec, const char *psz_hash )
+static void drcs_cache_hold( void )
+{
+    vlc_mutex_lock( &drcs_cache_lock );
+    if( drcs_cache.i_users++ == 0 )
+    {
+        load_drcs_conversion_table();
+    }
+    vlc_mutex_unlock( &drcs_cache_lock );
+}
+
+static void drcs_cache_release( void )
+{
+    vlc_mutex_lock( &drcs_cache_lock );
+    if( --drcs_cache.i_users == 0 )
+    {
+        drcs_cache_clean();
+    }
+    vlc_mutex_unlock( &drcs_cache_lock );
+}
+
+/*****************************************************************************
+ * DRCS PNG writer
+ *****************************************************************************
+ * Patterns without a conversion are dumped as PNG files in the arib data
+ * directory, so that users can build drcs_conv.ini. This is done by a low
+ * priority thread of the decoder, away from the caption decoding path.
+ *****************************************************************************/
+typedef struct drcs_png_job_s
+{
+    char        psz_hash[32 + 1];
+    int         i_width;
+    int         i_height;
+
+    struct drcs_png_job_s *p_next;
+    uint8_t     p_bitmap[];
+} drcs_png_job_t;
+
+static FILE* open_image_file( const char *psz_hash )
 {
     FILE* fp = NULL;
-    create_arib_datadir( p_dec );
+    create_arib_datadir();
 
-    char *psz_arib_data_dir = get_arib_data_dir( p_dec );
+    char *psz_arib_data_dir = get_arib_data_dir();
     if( psz_arib_data_dir == NULL )
     {
         return NULL;
@@ -432,27 +657,9 @@ static FILE* open_image_file( decoder_t* p_dec, const char *psz_hash )
     return fp;
 }
 
-static char* get_drcs_pattern_data_hash(
-        decoder_t *p_dec,
-        int i_width, int i_height,
-        int i_depth, const int8_t* p_patternData )
-{
-    VLC_UNUSED(p_dec);
-    int i_bits_per_pixel = ceil( sqrt( ( i_depth ) ) );
-    struct md5_s md5;
-    InitMD5( &md5 );
-    AddMD5( &md5, p_patternData, i_width * i_height * i_bits_per_pixel / 8 );
-    EndMD5( &md5 );
-    return psz_md5_hash( &md5 );
-}
-
-static void save_drcs_pattern_data_image(
-        decoder_t *p_dec,
-        const char* psz_hash,
-        int i_width, int i_height,
-        int i_depth, const int8_t* p_patternData )
+static void save_drcs_pattern_data_image( const drcs_png_job_t *p_job )
 {
-    FILE *fp = open_image_file( p_dec, psz_hash );
+    FILE *fp = open_image_file( p_job->psz_hash );
     if( fp == NULL )
     {
         return;
@@ -470,6 +677,17 @@ static void save_drcs_pattern_data_image(
         goto png_create_info_struct_failed;
     }
 
+    /* The rows point into the already decoded bitmap */
+    png_bytepp pp_image = malloc( p_job->i_height * sizeof(png_bytep) );
+    if( pp_image == NULL )
+    {
+        goto png_create_info_struct_failed;
+    }
+    for( int j = 0; j < p_job->i_height; j++ )
+    {
+        pp_image[j] = (png_bytep) &p_job->p_bitmap[j * p_job->i_width];
+    }
+
     if( setjmp( png_jmpbuf( png_ptr ) ) )
     {
         goto png_failure;
@@ -477,36 +695,14 @@ static void save_drcs_pattern_data_image(
 
     png_set_IHDR( png_ptr,
                   info_ptr,
-                  i_width,
-                  i_height,
+                  p_job->i_width,
+                  p_job->i_height,
                   1,
                   PNG_COLOR_TYPE_PALETTE,
                   PNG_INTERLACE_NONE,
                   PNG_COMPRESSION_TYPE_DEFAULT,
                   PNG_FILTER_TYPE_DEFAULT );
 
-    png_bytepp pp_image;
-    pp_image = png_malloc( png_ptr, i_height * sizeof(png_bytep) );
-    for( int j = 0; j < i_height; j++ )
-    {
-        pp_image[j] = png_malloc( png_ptr, i_width * sizeof(png_byte) );
-    }
-
-
-    int i_bits_per_pixel = ceil( sqrt( ( i_depth ) ) );
-
-    bs_t bs;
-    bs_init( &bs, p_patternData, i_width * i_height * i_bits_per_pixel / 8 );
-
-    for( int j = 0; j < i_height; j++ )
-    {
-        for( int i = 0; i < i_width; i++ )
-        {
-            uint8_t i_pxl = bs_read( &bs, i_bits_per_pixel );
-            pp_image[j][i] = i_pxl ? 1 : 0;
-        }
-    }
-
     png_byte trans_values[1];
     trans_values[0] = (png_byte)0;
     png_set_tRNS( png_ptr, info_ptr, trans_values, 1, NULL );
@@ -531,66 +727,146 @@ static void save_drcs_pattern_data_image(
     png_write_image( png_ptr, pp_image );
     png_write_end( png_ptr, info_ptr );
 
-    for( int j = 0; j < i_height; j++ )
-    {
-        png_free( png_ptr, pp_image[j] );
-    }
-    png_free( png_ptr, pp_image );
-
 png_failure:
+    free( pp_image );
 png_create_info_struct_failed:
     png_destroy_write_struct( &png_ptr, &info_ptr );
 png_create_write_struct_failed:
     fclose( fp );
 }
 
+static void *drcs_writer_thread( void *data )
+{
+    decoder_sys_t *p_sys = data;
+
+    vlc_mutex_lock( &p_sys->png_lock );
+    for( ;; )
+    {
+        while( p_sys->p_png_jobs == NULL && !p_sys->b_png_quit )
+        {
+            vlc_cond_wait( &p_sys->png_wait, &p_sys->png_lock );
+        }
+
+        /* Pending jobs are still written on exit */
+        drcs_png_job_t *p_job = p_sys->p_png_jobs;
+        if( p_job == NULL )
+        {
+            break;
+        }
+        p_sys->p_png_jobs = p_job->p_next;
+        if( p_sys->p_png_jobs == NULL )
+        {
+            p_sys->pp_png_jobs_last = &p_sys->p_png_jobs;
+        }
+        vlc_mutex_unlock( &p_sys->png_lock );
+
+        int canc = vlc_savecancel();
+        save_drcs_pattern_data_image( p_job );
+        vlc_restorecancel( canc );
+        free( p_job );
+
+        vlc_mutex_lock( &p_sys->png_lock );
+    }
+    vlc_mutex_unlock( &p_sys->png_lock );
+
+    return NULL;
+}
+
+static void queue_drcs_pattern_data_image( decoder_t *p_dec,
+                                           const drcs_glyph_t *p_glyph )
+{
+    decoder_sys_t *p_sys = p_dec->p_sys;
+
+    if( !p_sys->b_png_writer )
+    {
+        return;
+    }
+
+    const size_t i_size = p_glyph->i_width * p_glyph->i_height;
+    drcs_png_job_t *p_job = (drcs_png_job_t*) malloc(
+            sizeof(drcs_png_job_t) + i_size );
+    if( p_job == NULL )
+    {
+        return;
+    }
+    drcs_digest_to_hex( p_job->psz_hash, p_glyph->digest );
+    p_job->i_width = p_glyph->i_width;
+    p_job->i_height = p_glyph->i_height;
+    p_job->p_next = NULL;
+    memcpy( p_job->p_bitmap, p_glyph->p_bitmap, i_size );
+
+    vlc_mutex_lock( &p_sys->png_lock );
+    *p_sys->pp_png_jobs_last = p_job;
+    p_sys->pp_png_jobs_last = &p_job->p_next;
+    vlc_cond_signal( &p_sys->png_wait );
+    vlc_mutex_unlock( &p_sys->png_lock );
+}
+
 static void save_drcs_pattern(
         decoder_t *p_dec,
         int i_width, int i_height,
         int i_depth, const int8_t* p_patternData )
 {
     decoder_sys_t *p_sys = p_dec->p_sys;
-    drcs_conversion_t *p_drcs_conv;
-    bool found;
 
-    char* psz_hash = get_drcs_pattern_data_hash( p_dec,
-            i_width, i_height, i_depth, p_patternData );
+    int i_bits_per_pixel = ceil( sqrt( ( i_depth ) ) );
+    int i_pattern_size = i_width * i_height * i_bits_per_pixel / 8;
+
+    struct md5_s md5;
+    InitMD5( &md5 );
+    AddMD5( &md5, p_patternData, i_pattern_size );
+    EndMD5( &md5 );
 
-    found = false;
-    // has convert table?
-    p_drcs_conv = p_sys->p_drcs_conv;
-    while( p_drcs_conv != NULL && p_drcs_conv->hash)
+    uint8_t digest[16];
+    for( int i = 0; i < 16; i++ )
     {
-        if (strcmp( p_drcs_conv->hash,psz_hash) == 0 )
+        digest[i] = md5.p_digest[i / 4] >> ( 8 * ( i % 4 ) );
+    }
+
+    unsigned int code = 0;
+
+    vlc_mutex_lock( &drcs_cache_lock );
+    drcs_glyph_t *p_glyph = drcs_cache_find( digest );
+    if( p_glyph == NULL )
+    {
+        p_glyph = drcs_cache_insert( digest, false );
+    }
+    if( p_glyph != NULL )
+    {
+        code = p_glyph->code;
+        if( p_glyph->p_bitmap == NULL && i_width > 0 && i_height > 0 )
         {
-            found = true;
-            break;
+            p_glyph->p_bitmap = (uint8_t*) malloc( i_width * i_height );
         }
-        p_drcs_conv = p_drcs_conv->p_next;
-    }
-    // already saved?
-    if (!found) {
-        for(int i=0;i<10;i++) {
-           if (strcmp(p_sys->drcs_hash_table[i],psz_hash) == 0)
-           {
-               found = true;
-               break;
-           }
+        if( p_glyph->p_bitmap != NULL && p_glyph->i_width == 0 )
+        {
+            bs_t bs;
+            bs_init( &bs, p_patternData, i_pattern_size );
+            for( int k = 0; k < i_width * i_height; k++ )
+            {
+                p_glyph->p_bitmap[k] =
+                    bs_read( &bs, i_bits_per_pixel ) ? 1 : 0;
+            }
+            p_glyph->i_width = i_width;
+            p_glyph->i_height = i_height;
+
+            /* Seen for the first time by this process */
+            if( code == 0 )
+            {
+                queue_drcs_pattern_data_image( p_dec, p_glyph );
+            }
         }
     }
+    vlc_mutex_unlock( &drcs_cache_lock );
 
-    strncpy( p_sys->drcs_hash_table[p_sys->i_drcs_num], psz_hash, 32 );
-    p_sys->drcs_hash_table[p_sys->i_drcs_num][32] = '\0';
-
-    p_sys->i_drcs_num++;
-
-    if (!found)
+    unsigned int *p_drcs_code = (unsigned int*) realloc( p_sys->p_drcs_code,
+            ( p_sys->i_drcs_num + 1 ) * sizeof(unsigned int) );
+    if( p_drcs_code == NULL )
     {
-        save_drcs_pattern_data_image( p_dec, psz_hash,
-            i_width, i_height, i_depth, p_patternData );
+        return;
     }
-
-    free( psz_hash );
+    p_sys->p_drcs_code = p_drcs_code;
+    p_sys->p_drcs_code[p_sys->i_drcs_num++] = code;
 }
 
 static void parse_data_unit_staement_body( decoder_t *p_dec,
@@ -1036,13 +1312,7 @@ static subpicture_t *render( decoder_t *p_dec, block_t *p_block )
     arib_initialize_decoder( &p_sys->arib_decoder, true );
 
     p_sys->arib_decoder.i_drcs_num = p_sys->i_drcs_num;
-    for( int i = 0; i < p_sys->i_drcs_num; i++ )
-    {
-        strncpy( p_sys->arib_decoder.drcs_hash_table[i], 
-                p_sys->drcs_hash_table[i], 32 );
-        p_sys->arib_decoder.drcs_hash_table[i][32] = '\0';
-    }
-    p_sys->arib_decoder.p_drcs_conv = p_sys->p_drcs_conv;
+    p_sys->arib_decoder.p_drcs_code = p_sys->p_drcs_code;
 
     i_subtitle_size = arib_decode_buffer( &p_sys->arib_decoder,
                                           p_sys->psz_subtitle_data,
@@ -1078,7 +1348,19 @@ static subpicture_t *render( decoder_t *p_dec, block_t *p_block )
         goto decoder_NewSubpictureText_failed;
     }
     p_spu->p_sys = malloc( sizeof(subpicture_sys_t));
-    //p_spu->pf_update_regions = SubpictureTextUpdate;
+    if( p_spu->p_sys == NULL )
+    {
+        decoder_DeleteSubpicture( p_dec, p_spu );
+        p_spu = NULL;
+        goto malloc_failed;
+    }
+    p_spu->p_sys->p_region = NULL;
+    p_spu->p_sys->p_cache = NULL;
+    if( p_sys->p_bitmap_cache != NULL )
+    {
+        p_spu->p_sys->p_cache = aribcache_Hold( p_sys->p_bitmap_cache );
+        p_spu->pf_update_regions = SubpictureTextUpdateRegions;
+    }
     p_spu->pf_destroy = SubpictureTextDestroy;
 
     p_spu->i_start = p_block->i_pts;
@@ -1108,6 +1390,7 @@ static subpicture_t *render( decoder_t *p_dec, block_t *p_block )
     p_region->i_horint = 0;
     p_region->i_charleft = 0;
     p_region->i_charbottom = 0;
+    p_region->b_cached = false;
     p_region->p_next = NULL;
     for( arib_buf_region_t *p_buf_region = p_sys->arib_decoder.p_region;
          p_buf_region; p_buf_region = p_buf_region->p_next )
@@ -36,16 +36,288 @@ typedef struct arib_text_region_s
     int                       i_charleft;
     int                       i_charbottom;
 
+    /* the subpicture region has been stored in or taken from the cache */
+    bool                      b_cached;
+
     struct arib_text_region_s *p_next;
 } arib_text_region_t;
 
+/*****************************************************************************
+ * Rendered region cache
+ *****************************************************************************
+ * Every caption statement produces a new subpicture, but with roll-up and
+ * time controlled captions most of its regions are identical to the ones
+ * of the previous statement. The regions rasterized by the text renderer
+ * are kept here, keyed by their arib_text_region_t, so that the following
+ * subpictures pick up the existing YUVA/RGBA picture instead of rendering
+ * the same text again. The position is not part of the key: a roll-up
+ * caption is the same text, one line higher. The cache is shared by the decoder and all the
+ * subpictures it created, the latter being used by the vout thread.
+ *****************************************************************************/
+#define ARIB_BITMAP_CACHE_MAX 32
+
+typedef struct arib_bitmap_s
+{
+    arib_text_region_t        key;
+
+    video_format_t            fmt;
+    picture_t                 *p_picture;
+    int                       i_alpha;
+
+    struct arib_bitmap_s      *p_next;
+} arib_bitmap_t;
+
+typedef struct
+{
+    vlc_mutex_t               lock;
+    int                       i_refcount;
+
+    /* most recently used first */
+    arib_bitmap_t             *p_first;
+    int                       i_count;
+} arib_bitmap_cache_t;
+
+static bool aribtext_region_equal( const arib_text_region_t *a,
+                                   const arib_text_region_t *b )
+{
+    if( a->i_font_color != b->i_font_color ||
+        a->i_planewidth != b->i_planewidth ||
+        a->i_planeheight != b->i_planeheight ||
+        a->i_fontwidth != b->i_fontwidth ||
+        a->i_fontheight != b->i_fontheight ||
+        a->i_verint != b->i_verint ||
+        a->i_horint != b->i_horint )
+    {
+        return false;
+    }
+    return !strcmp( a->psz_text ? a->psz_text : "",
+                    b->psz_text ? b->psz_text : "" ) &&
+           !strcmp( a->psz_fontname ? a->psz_fontname : "",
+                    b->psz_fontname ? b->psz_fontname : "" );
+}
+
+static void aribbitmap_Delete( arib_bitmap_t *p_bitmap )
+{
+    free( p_bitmap->key.psz_text );
+    free( p_bitmap->key.psz_fontname );
+    free( p_bitmap->fmt.p_palette );
+    picture_Release( p_bitmap->p_picture );
+    free( p_bitmap );
+}
+
+static arib_bitmap_cache_t *aribcache_New( void )
+{
+    arib_bitmap_cache_t *p_cache = (arib_bitmap_cache_t*)
+        calloc( 1, sizeof(arib_bitmap_cache_t) );
+    if( p_cache == NULL )
+    {
+        return NULL;
+    }
+    vlc_mutex_init( &p_cache->lock );
+    p_cache->i_refcount = 1;
+    return p_cache;
+}
+
+static arib_bitmap_cache_t *aribcache_Hold( arib_bitmap_cache_t *p_cache )
+{
+    vlc_mutex_lock( &p_cache->lock );
+    p_cache->i_refcount++;
+    vlc_mutex_unlock( &p_cache->lock );
+    return p_cache;
+}
+
+static void aribcache_Release( arib_bitmap_cache_t *p_cache )
+{
+    vlc_mutex_lock( &p_cache->lock );
+    bool b_last = --p_cache->i_refcount == 0;
+    vlc_mutex_unlock( &p_cache->lock );
+    if( !b_last )
+    {
+        return;
+    }
+
+    arib_bitmap_t *p_bitmap = p_cache->p_first;
+    while( p_bitmap != NULL )
+    {
+        arib_bitmap_t *p_next = p_bitmap->p_next;
+        aribbitmap_Delete( p_bitmap );
+        p_bitmap = p_next;
+    }
+    vlc_mutex_destroy( &p_cache->lock );
+    free( p_cache );
+}
+
+/* Must be called with the cache lock held */
+static arib_bitmap_t *aribcache_Find( arib_bitmap_cache_t *p_cache,
+                                      const arib_text_region_t *p_key )
+{
+    arib_bitmap_t **pp = &p_cache->p_first;
+    for( arib_bitmap_t *p_bitmap = *pp; p_bitmap != NULL;
+         pp = &p_bitmap->p_next, p_bitmap = *pp )
+    {
+        if( aribtext_region_equal( &p_bitmap->key, p_key ) )
+        {
+            /* move to front */
+            *pp = p_bitmap->p_next;
+            p_bitmap->p_next = p_cache->p_first;
+            p_cache->p_first = p_bitmap;
+            return p_bitmap;
+        }
+    }
+    return NULL;
+}
+
+/* Must be called with the cache lock held */
+static void aribcache_Put( arib_bitmap_cache_t *p_cache,
+                           const arib_text_region_t *p_key,
+                           const subpicture_region_t *r )
+{
+    if( aribcache_Find( p_cache, p_key ) != NULL )
+    {
+        return;
+    }
+
+    arib_bitmap_t *p_bitmap = (arib_bitmap_t*) calloc( 1, sizeof(arib_bitmap_t) );
+    if( p_bitmap == NULL )
+    {
+        return;
+    }
+    p_bitmap->key = *p_key;
+    p_bitmap->key.psz_text = p_key->psz_text ? strdup( p_key->psz_text ) : NULL;
+    p_bitmap->key.psz_html = NULL;
+    p_bitmap->key.psz_fontname = p_key->psz_fontname ? strdup( p_key->psz_fontname ) : NULL;
+    p_bitmap->key.p_next = NULL;
+    p_bitmap->fmt = r->fmt;
+    if( r->fmt.p_palette != NULL )
+    {
+        p_bitmap->fmt.p_palette = malloc( sizeof(*r->fmt.p_palette) );
+        if( p_bitmap->fmt.p_palette != NULL )
+        {
+            *p_bitmap->fmt.p_palette = *r->fmt.p_palette;
+        }
+    }
+    p_bitmap->p_picture = picture_Hold( r->p_picture );
+    p_bitmap->i_alpha = r->i_alpha;
+
+    p_bitmap->p_next = p_cache->p_first;
+    p_cache->p_first = p_bitmap;
+    if( ++p_cache->i_count <= ARIB_BITMAP_CACHE_MAX )
+    {
+        return;
+    }
+
+    /* drop the least recently used one */
+    arib_bitmap_t **pp = &p_cache->p_first;
+    while( (*pp)->p_next != NULL )
+    {
+        pp = &(*pp)->p_next;
+    }
+    aribbitmap_Delete( *pp );
+    *pp = NULL;
+    p_cache->i_count--;
+}
+
+/* Creates a region showing a cached bitmap at the place of the text
+ * region p_text, NULL on failure */
+static subpicture_region_t *aribcache_NewRegion( const arib_bitmap_t *p_bitmap,
+                                                 const subpicture_region_t *p_text )
+{
+    video_format_t fmt = p_bitmap->fmt;
+    fmt.i_chroma = VLC_CODEC_TEXT;
+    fmt.p_palette = NULL;
+
+    /* A text region does not allocate any picture */
+    subpicture_region_t *r = subpicture_region_New( &fmt );
+    if( r == NULL )
+    {
+        return NULL;
+    }
+    if( p_bitmap->fmt.p_palette != NULL )
+    {
+        r->fmt.p_palette = malloc( sizeof(*p_bitmap->fmt.p_palette) );
+        if( r->fmt.p_palette == NULL )
+        {
+            subpicture_region_Delete( r );
+            return NULL;
+        }
+        *r->fmt.p_palette = *p_bitmap->fmt.p_palette;
+    }
+    r->fmt.i_chroma = p_bitmap->fmt.i_chroma;
+    r->p_picture = picture_Hold( p_bitmap->p_picture );
+    r->i_x = p_text->i_x;
+    r->i_y = p_text->i_y;
+    r->i_align = p_text->i_align;
+    r->i_alpha = p_bitmap->i_alpha;
+    return r;
+}
+
 #define subpicture_updater_sys_t subpicture_sys_t
 
 struct subpicture_updater_sys_t
 {
     arib_text_region_t *p_region;
+    arib_bitmap_cache_t *p_cache;   /* NULL when disabled */
 };
 
+/* Called by the vout before each rendering: stores the regions rasterized
+ * by the text renderer and swaps the text regions already rendered for
+ * a previous subpicture with their bitmap */
+static void SubpictureTextUpdateRegions( spu_t *p_spu, subpicture_t *subpic,
+                                         const video_format_t *fmt,
+                                         mtime_t ts )
+{
+    subpicture_updater_sys_t *sys = subpic->p_sys;
+    VLC_UNUSED(p_spu); VLC_UNUSED(fmt); VLC_UNUSED(ts);
+
+    if( sys->p_cache == NULL )
+    {
+        return;
+    }
+
+    vlc_mutex_lock( &sys->p_cache->lock );
+
+    subpicture_region_t **pp_region = &subpic->p_region;
+    arib_text_region_t *p_text = sys->p_region;
+    for( ; *pp_region != NULL && p_text != NULL;
+         pp_region = &(*pp_region)->p_next, p_text = p_text->p_next )
+    {
+        subpicture_region_t *r = *pp_region;
+
+        if( p_text->b_cached || p_text->psz_text == NULL )
+        {
+            continue;
+        }
+
+        if( r->fmt.i_chroma != VLC_CODEC_TEXT )
+        {
+            /* rendered since the last call */
+            if( r->p_picture != NULL )
+            {
+                aribcache_Put( sys->p_cache, p_text, r );
+            }
+            p_text->b_cached = true;
+            continue;
+        }
+
+        arib_bitmap_t *p_bitmap = aribcache_Find( sys->p_cache, p_text );
+        if( p_bitmap == NULL )
+        {
+            continue;
+        }
+        subpicture_region_t *p_new = aribcache_NewRegion( p_bitmap, r );
+        if( p_new == NULL )
+        {
+            continue;
+        }
+        p_new->p_next = r->p_next;
+        *pp_region = p_new;
+        subpicture_region_Delete( r );
+        p_text->b_cached = true;
+    }
+
+    vlc_mutex_unlock( &sys->p_cache->lock );
+}
+
 #if 0
 
 static int SubpictureTextValidate(subpicture_t *subpic,
@@ -136,6 +408,10 @@ static void SubpictureTextDestroy(subpicture_t *subpic)
         free( p_region );
     }
     sys->p_region = NULL;
+    if( sys->p_cache != NULL )
+    {
+        aribcache_Release( sys->p_cache );
+    }
     free( sys );
 }
 
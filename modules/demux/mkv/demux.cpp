@@ -26,10 +26,22 @@
 #include "demux.hpp"
 
 #include "Ebml_parser.hpp"
+#include "matroska_segment.hpp"
+
+#include <vlc_block.h>
+#include <vlc_fs.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#ifdef HAVE_UNISTD_H
+#   include <unistd.h>
+#endif
 
 demux_sys_t::~demux_sys_t()
 {
     StopUiThread();
+    IndexCacheClose();
     size_t i;
     for ( i=0; i<streams.size(); i++ )
         delete streams[i];
@@ -784,3 +796,251 @@ void demux_sys_t::SwapButtons()
     }
 #endif
 }
+
+/*****************************************************************************
+ * Index cache
+ *****************************************************************************
+ * The sidecar file keeps the index of each segment of a local file, from
+ * the Cues or from the background indexer, so that later opens neither
+ * parse the Cues (usually at the end of the file) nor the clusters. It is
+ * only used if the size, the modification time and a hash of the
+ * beginning of the file did not change.
+ *
+ * Layout (all values big endian):
+ *  0  "VLCMKIDX"
+ *  8  version (16), segments count (16), reserved (32)
+ *  16 file size, modification time, head hash (64 each)
+ *  40 per segment: segment position (64), entries count (32), reserved (32)
+ *     .. entries: position | MKV_INDEX_KEY (64), time (64), track (32),
+ *        block number (32)
+ *****************************************************************************/
+#define MKV_INDEX_MAGIC        "VLCMKIDX"
+#define MKV_INDEX_VERSION      1
+#define MKV_INDEX_HEADER_SIZE  40
+#define MKV_INDEX_SEGMENT_SIZE 16
+#define MKV_INDEX_ENTRY_SIZE   24
+#define MKV_INDEX_KEY          (UINT64_C(1) << 63)
+/* Size of the beginning of the file that is hashed */
+#define MKV_INDEX_HASH_SIZE    (64 * 1024)
+
+void demux_sys_t::IndexCacheOpen()
+{
+    const uint8_t *p_peek;
+    struct stat st;
+    int i_peek;
+
+    if( !var_InheritBool( &demuxer, "mkv-index-cache" ) )
+        return;
+
+    /* Only local files can have a sidecar */
+    if( ( *demuxer.psz_access && strcmp( demuxer.psz_access, "file" ) ) ||
+        !*demuxer.psz_path || vlc_stat( demuxer.psz_path, &st ) )
+        return;
+
+    i_peek = stream_Peek( demuxer.s, &p_peek, MKV_INDEX_HASH_SIZE );
+    if( i_peek <= 0 )
+        return;
+
+    /* FNV-1a */
+    i_index_hash = UINT64_C(14695981039346656037);
+    for( int i = 0; i < i_peek; i++ )
+    {
+        i_index_hash ^= p_peek[i];
+        i_index_hash *= UINT64_C(1099511628211);
+    }
+    i_index_mtime = st.st_mtime;
+
+    if( asprintf( &psz_index_cache, "%s.mkvidx", demuxer.psz_path ) < 0 )
+        psz_index_cache = NULL;
+}
+
+static void IndexCacheRead( matroska_segment_c *p_segment,
+                            const uint8_t *p, int i_entries )
+{
+    if( i_entries >= p_segment->i_index_max )
+    {
+        p_segment->i_index_max = i_entries + 1024;
+        p_segment->p_indexes = (mkv_index_t*)xrealloc( p_segment->p_indexes,
+                                sizeof( mkv_index_t ) * p_segment->i_index_max );
+    }
+
+    for( int i = 0; i < i_entries; i++, p += MKV_INDEX_ENTRY_SIZE )
+    {
+        mkv_index_t *p_idx = &p_segment->p_indexes[i];
+        const uint64_t i_position = GetQWBE( &p[0] );
+
+        p_idx->i_position     = i_position & ~MKV_INDEX_KEY;
+        p_idx->b_key          = ( i_position & MKV_INDEX_KEY ) != 0;
+        p_idx->i_time         = GetQWBE( &p[8] );
+        p_idx->i_track        = (int32_t)GetDWBE( &p[16] );
+        p_idx->i_block_number = (int32_t)GetDWBE( &p[20] );
+    }
+    p_segment->i_index = i_entries;
+    p_segment->b_cues = true;
+    p_segment->b_index_cached = true;
+}
+
+void demux_sys_t::IndexCacheLoad( matroska_stream_c *p_stream )
+{
+    if( psz_index_cache == NULL )
+        return;
+
+    int fd = vlc_open( psz_index_cache, O_RDONLY );
+    if( fd == -1 )
+        return;
+    block_t *p_file = block_File( fd );
+    close( fd );
+    if( !p_file )
+        return;
+
+    const uint8_t *p = p_file->p_buffer;
+    const size_t i_size = p_file->i_buffer;
+    if( i_size < MKV_INDEX_HEADER_SIZE ||
+        memcmp( p, MKV_INDEX_MAGIC, 8 ) ||
+        GetWBE( &p[8] ) != MKV_INDEX_VERSION )
+    {
+        msg_Warn( &demuxer, "invalid index file %s", psz_index_cache );
+        block_Release( p_file );
+        return;
+    }
+
+    if( GetQWBE( &p[16] ) != (uint64_t)stream_Size( demuxer.s ) ||
+        (int64_t)GetQWBE( &p[24] ) != i_index_mtime ||
+        GetQWBE( &p[32] ) != i_index_hash )
+    {
+        msg_Dbg( &demuxer, "index file %s is outdated", psz_index_cache );
+        block_Release( p_file );
+        return;
+    }
+
+    const int i_segments = GetWBE( &p[10] );
+    size_t i_offset = MKV_INDEX_HEADER_SIZE;
+    for( int i = 0; i < i_segments; i++ )
+    {
+        if( i_size - i_offset < MKV_INDEX_SEGMENT_SIZE )
+            break;
+        const int64_t i_segment_pos = GetQWBE( &p[i_offset] );
+        const uint32_t i_entries = GetDWBE( &p[i_offset + 8] );
+        i_offset += MKV_INDEX_SEGMENT_SIZE;
+        if( ( i_size - i_offset ) / MKV_INDEX_ENTRY_SIZE < i_entries )
+        {
+            msg_Warn( &demuxer, "truncated index file %s", psz_index_cache );
+            break;
+        }
+
+        for( size_t j = 0; j < p_stream->segments.size(); j++ )
+        {
+            matroska_segment_c *p_segment = p_stream->segments[j];
+
+            if( (int64_t)p_segment->segment->GetElementPosition() == i_segment_pos &&
+                !p_segment->b_cues && i_entries > 0 )
+            {
+                IndexCacheRead( p_segment, &p[i_offset], i_entries );
+                msg_Dbg( &demuxer, "loaded %d index entries from %s",
+                         p_segment->i_index, psz_index_cache );
+            }
+        }
+        i_offset += (size_t)i_entries * MKV_INDEX_ENTRY_SIZE;
+    }
+    block_Release( p_file );
+}
+
+static void IndexCacheWrite( demux_sys_t & sys, matroska_stream_c *p_stream,
+                             int i_segments )
+{
+    uint8_t header[MKV_INDEX_HEADER_SIZE];
+    char *psz_tmp;
+
+    if( asprintf( &psz_tmp, "%s.tmp", sys.psz_index_cache ) < 0 )
+        return;
+
+    FILE *file = vlc_fopen( psz_tmp, "wb" );
+    if( !file )
+    {
+        msg_Warn( &sys.demuxer, "cannot create index file %s: %m", psz_tmp );
+        free( psz_tmp );
+        return;
+    }
+
+    memcpy( &header[0], MKV_INDEX_MAGIC, 8 );
+    SetWBE( &header[8], MKV_INDEX_VERSION );
+    SetWBE( &header[10], i_segments );
+    SetDWBE( &header[12], 0 );
+    SetQWBE( &header[16], stream_Size( sys.demuxer.s ) );
+    SetQWBE( &header[24], sys.i_index_mtime );
+    SetQWBE( &header[32], sys.i_index_hash );
+
+    bool b_error = fwrite( header, sizeof(header), 1, file ) != 1;
+    for( size_t i = 0; i < p_stream->segments.size() && !b_error; i++ )
+    {
+        matroska_segment_c *p_segment = p_stream->segments[i];
+        uint8_t segment[MKV_INDEX_SEGMENT_SIZE];
+
+        if( !p_segment->b_cues || p_segment->i_index <= 0 )
+            continue;
+
+        SetQWBE( &segment[0], p_segment->segment->GetElementPosition() );
+        SetDWBE( &segment[8], p_segment->i_index );
+        SetDWBE( &segment[12], 0 );
+        b_error = fwrite( segment, sizeof(segment), 1, file ) != 1;
+
+        for( int j = 0; j < p_segment->i_index && !b_error; j++ )
+        {
+            const mkv_index_t *p_idx = &p_segment->p_indexes[j];
+            uint8_t entry[MKV_INDEX_ENTRY_SIZE];
+
+            SetQWBE( &entry[0], (uint64_t)p_idx->i_position |
+                                ( p_idx->b_key ? MKV_INDEX_KEY : 0 ) );
+            SetQWBE( &entry[8], p_idx->i_time );
+            SetDWBE( &entry[16], p_idx->i_track );
+            SetDWBE( &entry[20], p_idx->i_block_number );
+            b_error = fwrite( entry, sizeof(entry), 1, file ) != 1;
+        }
+    }
+    if( fclose( file ) )
+        b_error = true;
+
+    /* Replace the old file atomically */
+    if( b_error || vlc_rename( psz_tmp, sys.psz_index_cache ) )
+    {
+        msg_Warn( &sys.demuxer, "cannot write index file %s", sys.psz_index_cache );
+        vlc_unlink( psz_tmp );
+    }
+    else
+    {
+        msg_Dbg( &sys.demuxer, "wrote the index of %d segment(s) to %s",
+                 i_segments, sys.psz_index_cache );
+    }
+    free( psz_tmp );
+}
+
+void demux_sys_t::IndexCacheClose()
+{
+    if( psz_index_cache == NULL )
+        return;
+
+    if( streams.size() > 0 )
+    {
+        matroska_stream_c *p_stream = streams[0];
+        bool b_dirty = false;
+        int i_segments = 0;
+
+        for( size_t i = 0; i < p_stream->segments.size(); i++ )
+        {
+            matroska_segment_c *p_segment = p_stream->segments[i];
+
+            /* Only complete indexes are kept */
+            p_segment->IndexerStop();
+            if( p_segment->b_cues && p_segment->i_index > 0 )
+            {
+                i_segments++;
+                b_dirty |= p_segment->b_index_dirty;
+            }
+        }
+        if( b_dirty )
+            IndexCacheWrite( *this, p_stream, i_segments );
+    }
+
+    free( psz_index_cache );
+    psz_index_cache = NULL;
+}
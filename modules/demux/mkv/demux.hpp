@@ -326,6 +326,9 @@ public:
         ,p_input(NULL)
         ,b_pci_packet_set(false)
         ,p_ev(NULL)
+        ,psz_index_cache(NULL)
+        ,i_index_mtime(0)
+        ,i_index_hash(0)
     {
         vlc_mutex_init( &lock_demuxer );
     }
@@ -389,7 +392,13 @@ public:
     static int EventKey( vlc_object_t *p_this, char const *psz_var,
                      vlc_value_t oldval, vlc_value_t newval, void *p_data );
 
-
+    /* index cache file */
+    char           *psz_index_cache;
+    int64_t        i_index_mtime;
+    uint64_t       i_index_hash;
+    void IndexCacheOpen();
+    void IndexCacheLoad( matroska_stream_c *p_stream );
+    void IndexCacheClose();
 
 protected:
     virtual_segment_c *VirtualFromSegments( matroska_segment_c *p_segment ) const;
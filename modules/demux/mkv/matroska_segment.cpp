@@ -28,6 +28,8 @@
 
 #include "demux.hpp"
 
+#include "stream_io_callback.hpp"
+
 extern "C" {
 #include "../vobsub.h"
 }
@@ -42,6 +44,8 @@ static vlc_fourcc_t __GetFOURCC( uint8_t *p )
 /* Destructor */
 matroska_segment_c::~matroska_segment_c()
 {
+    IndexerStop();
+
     for( size_t i_track = 0; i_track < tracks.size(); i_track++ )
     {
         delete tracks[i_track]->p_compression_data;
@@ -101,7 +105,9 @@ void matroska_segment_c::LoadCues( KaxCues *cues )
 
     if( b_cues )
     {
-        msg_Err( &sys.demuxer, "There can be only 1 Cues per section." );
+        /* The cache file already gave us the cues */
+        if( !b_index_cached )
+            msg_Err( &sys.demuxer, "There can be only 1 Cues per section." );
         return;
     }
 
@@ -191,6 +197,7 @@ void matroska_segment_c::LoadCues( KaxCues *cues )
     }
     delete ep;
     b_cues = true;
+    b_index_dirty = true;
     msg_Dbg( &sys.demuxer, "|   - loading cues done." );
 }
 
@@ -381,6 +388,179 @@ void matroska_segment_c::IndexAppendCluster( KaxCluster *cluster )
 #undef idx
 }
 
+/*****************************************************************************
+ * Background indexer
+ *****************************************************************************
+ * Segments without Cues are only indexed as the playback goes, and seeking
+ * further has to parse every cluster in between. The indexer walks the
+ * clusters with its own stream, reading only their timecode, while the
+ * playback continues. Both indexes are prefixes of the cluster list, so
+ * the demuxer simply takes the longest one when it needs to seek.
+ *****************************************************************************/
+static void *IndexerThread( void *data )
+{
+    matroska_segment_c *p_segment = (matroska_segment_c *)data;
+    mkv_indexer_t      *p_indexer = p_segment->p_indexer;
+    demux_t            *p_demux = &p_segment->sys.demuxer;
+    vlc_stream_io_callback io( p_indexer->s, false );
+    EbmlStream         es( io );
+    EbmlElement        *p_l0, *el = NULL, *l;
+
+    /* The parser needs its own segment element */
+    io.setFilePointer( p_segment->segment->GetElementPosition(), seek_beginning );
+    p_l0 = es.FindNextID( EBML_INFO(KaxSegment), 0xFFFFFFFFFLL );
+    if( p_l0 == NULL )
+    {
+        msg_Warn( p_demux, "indexer cannot find the segment" );
+        return NULL;
+    }
+
+    io.setFilePointer( p_segment->i_start_pos, seek_beginning );
+    {
+        EbmlParser ep( &es, p_l0, p_demux );
+        bool b_stop = false;
+
+        while( !b_stop && ( el = ep.Get() ) != NULL )
+        {
+            if( !MKV_IS_ID( el, KaxCluster ) )
+                continue;
+
+            mkv_index_t idx;
+            idx.i_track       = -1;
+            idx.i_block_number= -1;
+            idx.i_position    = el->GetElementPosition();
+            idx.i_time        = -1;
+            idx.b_key         = true;
+
+            /* Only the timecode is read, the blocks are skipped */
+            ep.Down();
+            while( ( l = ep.Get() ) != NULL )
+            {
+                if( idx.i_time < 0 && MKV_IS_ID( l, KaxClusterTimecode ) )
+                {
+                    KaxClusterTimecode &ctc = *(KaxClusterTimecode*)l;
+
+                    ctc.ReadData( es.I_O(), SCOPE_ALL_DATA );
+                    idx.i_time = uint64( ctc ) * p_segment->i_timescale / (mtime_t)1000;
+                }
+            }
+            ep.Up();
+
+            vlc_mutex_lock( &p_indexer->lock );
+            if( p_indexer->i_index >= p_indexer->i_index_max )
+            {
+                mkv_index_t *p_new = (mkv_index_t*)realloc( p_indexer->p_indexes,
+                        sizeof( mkv_index_t ) * ( p_indexer->i_index_max + 1024 ) );
+                if( p_new )
+                {
+                    p_indexer->p_indexes = p_new;
+                    p_indexer->i_index_max += 1024;
+                }
+            }
+            if( p_indexer->i_index < p_indexer->i_index_max )
+                p_indexer->p_indexes[p_indexer->i_index++] = idx;
+            else
+                p_indexer->b_stop = true;
+            b_stop = p_indexer->b_stop;
+            vlc_mutex_unlock( &p_indexer->lock );
+        }
+    }
+    delete p_l0;
+
+    if( el == NULL )
+    {
+        vlc_mutex_lock( &p_indexer->lock );
+        p_indexer->b_done = true;
+        vlc_mutex_unlock( &p_indexer->lock );
+        msg_Dbg( p_demux, "indexer reached the end of the segment" );
+    }
+    return NULL;
+}
+
+void matroska_segment_c::IndexerStart( const char *psz_path )
+{
+    if( p_indexer != NULL || b_cues || cluster == NULL )
+        return;
+
+    mkv_indexer_t *p_idx = (mkv_indexer_t*)malloc( sizeof( mkv_indexer_t ) );
+    if( p_idx == NULL )
+        return;
+
+    p_idx->s = stream_UrlNew( &sys.demuxer, psz_path );
+    if( p_idx->s == NULL )
+    {
+        free( p_idx );
+        return;
+    }
+    vlc_mutex_init( &p_idx->lock );
+    p_idx->b_stop      = false;
+    p_idx->b_done      = false;
+    p_idx->i_index     = 0;
+    p_idx->i_index_max = 0;
+    p_idx->p_indexes   = NULL;
+
+    p_indexer = p_idx;
+    if( vlc_clone( &p_idx->thread, IndexerThread, this, VLC_THREAD_PRIORITY_LOW ) )
+    {
+        msg_Warn( &sys.demuxer, "cannot start the cluster indexer" );
+        stream_Delete( p_idx->s );
+        vlc_mutex_destroy( &p_idx->lock );
+        free( p_idx );
+        p_indexer = NULL;
+        return;
+    }
+    msg_Dbg( &sys.demuxer, "no cues, indexing the clusters in the background" );
+}
+
+void matroska_segment_c::IndexerStop( )
+{
+    if( p_indexer == NULL )
+        return;
+
+    vlc_mutex_lock( &p_indexer->lock );
+    p_indexer->b_stop = true;
+    vlc_mutex_unlock( &p_indexer->lock );
+    vlc_join( p_indexer->thread, NULL );
+
+    IndexerMerge();
+
+    stream_Delete( p_indexer->s );
+    vlc_mutex_destroy( &p_indexer->lock );
+    free( p_indexer->p_indexes );
+    free( p_indexer );
+    p_indexer = NULL;
+}
+
+void matroska_segment_c::IndexerMerge( )
+{
+    if( p_indexer == NULL || b_cues )
+        return;
+
+    vlc_mutex_lock( &p_indexer->lock );
+    if( p_indexer->i_index > i_index ||
+        ( p_indexer->b_done && p_indexer->i_index > 0 ) )
+    {
+        if( p_indexer->i_index >= i_index_max )
+        {
+            i_index_max = p_indexer->i_index + 1024;
+            p_indexes = (mkv_index_t*)xrealloc( p_indexes,
+                                        sizeof( mkv_index_t ) * i_index_max );
+        }
+        memcpy( p_indexes, p_indexer->p_indexes,
+                sizeof( mkv_index_t ) * p_indexer->i_index );
+        i_index = p_indexer->i_index;
+
+        /* The index is now as good as cues */
+        if( p_indexer->b_done )
+        {
+            b_cues = true;
+            b_index_dirty = true;
+            msg_Dbg( &sys.demuxer, "%d clusters indexed", i_index );
+        }
+    }
+    vlc_mutex_unlock( &p_indexer->lock );
+}
+
 
 bool matroska_segment_c::PreloadFamily( const matroska_segment_c & of_segment )
 {
@@ -616,11 +796,18 @@ void matroska_segment_c::Seek( mtime_t i_date, mtime_t i_time_offset, int64_t i_
     int64_t     i_seek_position = i_start_pos;
     int64_t     i_seek_time = i_start_time;
 
+    IndexerMerge();
+
     if( i_global_position >= 0 )
     {
         /* Special case for seeking in files with no cues */
         EbmlElement *el = NULL;
-        es.I_O().setFilePointer( i_start_pos, seek_beginning );
+
+        /* Resume the parsing from the last indexed cluster before the target */
+        for( int i_idx = 0; i_idx < i_index && p_indexes[i_idx].i_position <= i_global_position; i_idx++ )
+            i_seek_position = p_indexes[i_idx].i_position;
+
+        es.I_O().setFilePointer( i_seek_position, seek_beginning );
         delete ep;
         ep = new EbmlParser( &es, segment, &sys.demuxer );
         cluster = NULL;
@@ -34,6 +34,19 @@ class chapter_edition_c;
 class chapter_translation_c;
 class chapter_item_c;
 
+/* Background cluster indexer of a segment without Cues */
+typedef struct
+{
+    vlc_thread_t    thread;
+    vlc_mutex_t     lock;
+    stream_t        *s;         /* private stream, not the demuxer's one */
+    bool            b_stop;
+    bool            b_done;     /* the whole segment has been indexed */
+    int             i_index;
+    int             i_index_max;
+    mkv_index_t     *p_indexes;
+} mkv_indexer_t;
+
 class matroska_segment_c
 {
 public:
@@ -59,6 +72,9 @@ public:
         ,p_prev_segment_uid(NULL)
         ,p_next_segment_uid(NULL)
         ,b_cues(false)
+        ,b_index_cached(false)
+        ,b_index_dirty(false)
+        ,p_indexer(NULL)
         ,i_index(0)
         ,i_index_max(1024)
         ,psz_muxing_application(NULL)
@@ -108,6 +124,9 @@ public:
     KaxNextUID              *p_next_segment_uid;
 
     bool                    b_cues;
+    bool                    b_index_cached; /* index read from the cache file */
+    bool                    b_index_dirty;  /* complete index to cache */
+    mkv_indexer_t           *p_indexer;
     int                     i_index;
     int                     i_index_max;
     mkv_index_t             *p_indexes;
@@ -144,6 +163,9 @@ public:
     void ParseTrackEntry( KaxTrackEntry *m );
     void ParseCluster( );
     void IndexAppendCluster( KaxCluster *cluster );
+    void IndexerStart( const char *psz_path );
+    void IndexerStop( );
+    void IndexerMerge( );
     void LoadCues( KaxCues *cues );
     void LoadTags( KaxTags *tags );
     void InformationCreate( );
@@ -89,7 +89,9 @@ void matroska_segment_c::ParseSeekHead( KaxSeekHead *seekhead )
                 if( id == EBML_ID(KaxCues) )
                 {
                     msg_Dbg( &sys.demuxer, "|   - cues at %"PRId64, i_pos );
-                    LoadSeekHeadItem( EBML_INFO(KaxCues), i_pos );
+                    /* Avoid seeking to the end of the file for nothing */
+                    if( !b_index_cached )
+                        LoadSeekHeadItem( EBML_INFO(KaxCues), i_pos );
                 }
                 else if( id == EBML_ID(KaxInfo) )
                 {
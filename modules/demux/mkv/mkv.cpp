@@ -65,6 +65,12 @@ vlc_module_begin ()
             N_("Seek based on percent not time"),
             N_("Seek based on percent not time."), true );
 
+    add_bool( "mkv-index-cache", false, NULL,
+            N_("Index cache file"),
+            N_("Keep the cues or the cluster positions of local files in a "
+               "sidecar \".mkvidx\" file, built in the background for files "
+               "without cues. Later opens use it instead of parsing the file."), true );
+
     add_bool( "mkv-use-dummy", false, NULL,
             N_("Dummy Elements"),
             N_("Read and discard unknown EBML elements (not good for broken files)."), true );
@@ -105,6 +111,9 @@ static int Open( vlc_object_t * p_this )
     p_demux->pf_control = Control;
     p_demux->p_sys      = p_sys = new demux_sys_t( *p_demux );
 
+    /* must be done while the stream is still at the begining */
+    p_sys->IndexCacheOpen();
+
     p_io_callback = new vlc_stream_io_callback( p_demux->s, false );
     p_io_stream = new EbmlStream( *p_io_callback );
 
@@ -127,9 +136,13 @@ static int Open( vlc_object_t * p_this )
     p_stream->p_in = p_io_callback;
     p_stream->p_es = p_io_stream;
 
+    p_sys->IndexCacheLoad( p_stream );
+
     for (size_t i=0; i<p_stream->segments.size(); i++)
     {
         p_stream->segments[i]->Preload();
+        if( p_sys->psz_index_cache != NULL )
+            p_stream->segments[i]->IndexerStart( p_demux->psz_path );
     }
 
     p_segment = p_stream->segments[0];
@@ -420,6 +433,9 @@ static void Seek( demux_t *p_demux, mtime_t i_date, double f_percent, chapter_it
         return;
     }
 
+    /* take what the background indexer found so far */
+    p_segment->IndexerMerge();
+
     /* seek without index or without date */
     if( f_percent >= 0 && (var_InheritBool( p_demux, "mkv-seek-percent" ) || !p_segment->b_cues || i_date < 0 ))
     {
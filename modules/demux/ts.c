@@ -34,9 +34,14 @@
 #include <vlc_plugin.h>
 
 #include <assert.h>
+#include <fcntl.h>
+#ifdef HAVE_UNISTD_H
+#   include <unistd.h>
+#endif
 
 #include <vlc_access.h> /* DVB-specific things */
 #include <vlc_demux.h>
+#include <vlc_input.h>
 #include <vlc_meta.h>
 #include <vlc_epg.h>
 
@@ -44,6 +49,11 @@
 #include <vlc_network.h>
 #include <vlc_charset.h>
 #include <vlc_fs.h>
+#include <vlc_cpu.h>
+
+#if defined(__ARM_NEON__)
+#   include <arm_neon.h>
+#endif
 
 #include "../mux/mpeg/csa.h"
 
@@ -126,6 +136,15 @@ static void Close ( vlc_object_t * );
 #define MTUOUT_TEXT N_("MTU for out mode")
 #define MTUOUT_LONGTEXT N_("MTU for out mode.")
 
+#define SPLIT_TEXT N_("Split programs")
+#define SPLIT_LONGTEXT N_( \
+    "Write each program of the multiplex to its own output, with a PAT and " \
+    "a PMT of its own, instead of decoding it. This is a comma separated " \
+    "list of program=destination, \"*\" being any other program; \"%d\" is " \
+    "replaced by the program number and is required for \"*\". A " \
+    "destination is a file or udp://host[:port]. The programs are " \
+    "descrambled when a CSA key is given." )
+
 #define CSA_TEXT N_("CSA ck")
 #define CSA_LONGTEXT N_("Control word for the CSA encryption algorithm")
 
@@ -154,6 +173,12 @@ static void Close ( vlc_object_t * );
     "Seek and position based on a percent byte position, not a PCR generated " \
     "time position. If seeking doesn't work propery, turn on this option." )
 
+#define SEEK_INDEX_TEXT N_("Seek index file")
+#define SEEK_INDEX_LONGTEXT N_( \
+    "Keep the PCR and random access point positions of local files in a " \
+    "sidecar \".tsidx\" file next to the recording. Later opens use it to " \
+    "get the duration and to seek without scanning the file." )
+
 #define SUPPORT_ARIB_TEXT N_("Support ARIB STD-B24.")
 #define SUPPORT_ARIB_LONGTEXT N_( \
     "Support ARIB STD-B24 for decoding characters." \
@@ -172,6 +197,7 @@ vlc_module_begin ()
     add_string( "ts-out", NULL, NULL, TSOUT_TEXT, TSOUT_LONGTEXT, true )
     add_integer( "ts-out-mtu", 1400, NULL, MTUOUT_TEXT,
                  MTUOUT_LONGTEXT, true )
+    add_string( "ts-split", NULL, NULL, SPLIT_TEXT, SPLIT_LONGTEXT, true )
     add_string( "ts-csa-ck", NULL, NULL, CSA_TEXT, CSA_LONGTEXT, true )
     add_string( "ts-csa2-ck", NULL, NULL, CSA_TEXT, CSA_LONGTEXT, true )
     add_integer( "ts-csa-pkt", 188, NULL, CPKT_TEXT, CPKT_LONGTEXT, true )
@@ -179,6 +205,7 @@ vlc_module_begin ()
 
     add_bool( "ts-split-es", true, NULL, SPLIT_ES_TEXT, SPLIT_ES_LONGTEXT, false )
     add_bool( "ts-seek-percent", false, NULL, SEEK_PERCENT_TEXT, SEEK_PERCENT_LONGTEXT, true )
+    add_bool( "ts-seek-index", false, NULL, SEEK_INDEX_TEXT, SEEK_INDEX_LONGTEXT, true )
     add_bool( "ts-support-arib", false, NULL, SUPPORT_ARIB_TEXT, SUPPORT_ARIB_LONGTEXT, true )
 
     set_capability( "demux", 10 )
@@ -310,9 +337,10 @@ typedef struct
     es_format_t  fmt;
     es_out_id_t *id;
     int         i_pes_size;
-    int         i_pes_gathered;
-    block_t     *p_pes;
-    block_t     **pp_last;
+    block_t     *p_pes;         /* PES being gathered, i_buffer is the
+                                   amount of payload gathered so far */
+    size_t      i_pes_alloc;    /* room available in p_pes */
+    size_t      i_pes_hint;     /* decaying max of the recent PES sizes */
 
     es_mpeg4_descriptor_t *p_mpeg4desc;
     int         b_gather;
@@ -342,6 +370,76 @@ typedef struct
 
 } ts_pid_t;
 
+typedef struct
+{
+    char        *psz_path;      /* sidecar file */
+
+    /* Entries loaded from the sidecar file (mapped, read only) */
+    block_t     *p_file;
+    const uint8_t *p_file_entries;
+    int         i_file_entries;
+
+    /* Entries added while demuxing, in the same layout as in the file */
+    uint8_t     *p_entries;
+    int         i_entries;
+    int         i_entries_max;
+
+    int64_t     i_end;          /* byte position up to which we are indexed */
+    mtime_t     i_last_pcr;     /* PCR of the last entry */
+    bool        b_dirty;
+} ts_index_t;
+
+/* Output of the split mode, carrying a single program */
+typedef struct
+{
+    int         i_number;       /* program number */
+    int         i_pmt_pid;      /* -1 while the program is not in the PAT */
+    char        *psz_dst;
+    int         fd;             /* udp socket, -1 when writing to a file */
+    FILE        *file;
+
+    /* Packets waiting to be written */
+    uint8_t     *p_buffer;
+    int         i_buffer;
+    int         i_buffer_max;
+
+    /* Regenerated PAT and PMT packets */
+    uint8_t     *p_pat;
+    int         i_pat_packets;
+    int         i_pat_cc;
+    uint8_t     *p_pmt;
+    int         i_pmt_packets;
+    int         i_pmt_cc;
+
+    int64_t     i_packets;      /* written */
+    int64_t     i_errors;
+} ts_split_t;
+
+typedef struct
+{
+    int         i_number;       /* -1 for any program */
+    char        *psz_dst;
+} ts_split_dst_t;
+
+typedef struct
+{
+    int         i_out;
+    ts_split_t  **pp_out;
+} ts_split_route_t;
+
+typedef struct
+{
+    int             i_dst;
+    ts_split_dst_t  **pp_dst;
+    int             i_udp_packets;  /* packets per datagram */
+
+    int             i_out;
+    ts_split_t      **pp_out;
+
+    /* Outputs each pid is written to */
+    ts_split_route_t route[8192];
+} ts_split_sys_t;
+
 struct demux_sys_t
 {
     vlc_mutex_t     csa_lock;
@@ -352,6 +450,19 @@ struct demux_sys_t
     /* how many TS packet we read at once */
     int         i_ts_read;
 
+    /* Chunk of packets read from the stream, copied out one by one */
+    block_t     *p_chunk;
+    int         i_chunk_packets;    /* size of the chunks (in packets) */
+    size_t      i_chunk_offset;     /* offset of the next packet */
+    int64_t     i_chunk_pos;        /* stream position of the chunk */
+    size_t      i_chunk_clear;      /* offset up to which it is descrambled */
+
+    /* Synchronisation */
+    size_t      (*pf_sync_locate)( const uint8_t *, size_t, size_t, int );
+    int64_t     i_sync_lost;
+    int64_t     i_sync_garbage;     /* bytes skipped */
+    input_thread_t *p_input;        /* publishes ts-sync-lost/-skipped */
+
     /* to determine length and time */
     int         i_pid_ref_pcr;
     mtime_t     i_first_pcr;
@@ -361,6 +472,7 @@ struct demux_sys_t
     int         i_pcrs_num;
     mtime_t     *p_pcrs;
     int64_t     *p_pos;
+    ts_index_t  *p_index;
 
     bool        b_support_arib;
 
@@ -384,6 +496,9 @@ struct demux_sys_t
     int         fd; /* udp socket */
     uint8_t     *buffer;
 
+    /* Split mode, NULL when disabled */
+    ts_split_sys_t *p_split;
+
     /* */
     bool        b_access_control;
 
@@ -425,6 +540,16 @@ static inline int PIDGet( block_t *p )
 static bool GatherPES( demux_t *p_demux, ts_pid_t *pid, block_t *p_bk );
 
 static block_t* ReadTSPacket( demux_t *p_demux );
+static size_t  SyncLocate( const uint8_t *, size_t, size_t, int );
+#if defined(CAN_COMPILE_SSE2)
+static size_t  SyncLocateSSE2( const uint8_t *, size_t, size_t, int );
+#endif
+#if defined(__ARM_NEON__)
+static size_t  SyncLocateNEON( const uint8_t *, size_t, size_t, int );
+#endif
+static void    ChunkDrop( demux_t *p_demux );
+static int64_t TSTell( demux_t *p_demux );
+static int     TSSeek( demux_t *p_demux, int64_t i_pos );
 static mtime_t GetPCR( block_t *p_pkt );
 static int SeekToPCR( demux_t *p_demux, int64_t i_pos );
 static int Seek( demux_t *p_demux, double f_percent );
@@ -433,6 +558,11 @@ static void GetLastPCR( demux_t *p_demux );
 static void CheckPCR( demux_t *p_demux );
 static void PCRHandle( demux_t *p_demux, ts_pid_t *, block_t * );
 
+static void IndexOpen( demux_t *p_demux );
+static void IndexClose( demux_t *p_demux );
+static void IndexAdd( demux_t *p_demux, mtime_t i_pcr, bool b_rap );
+static int  IndexSeek( demux_t *p_demux, mtime_t i_target_pcr );
+
 static iod_descriptor_t *IODNew( int , uint8_t * );
 static void              IODFree( iod_descriptor_t * );
 
@@ -442,12 +572,24 @@ static int UserPmt( demux_t *p_demux, const char * );
 static int  SetPIDFilter( demux_t *, int i_pid, bool b_selected );
 static void SetPrgFilter( demux_t *, int i_prg, bool b_selected );
 
+static int  SplitOpen( demux_t *p_demux, const char *psz_split );
+static void SplitClose( demux_t *p_demux );
+static void SplitPacket( demux_t *p_demux, ts_pid_t *p_pid, block_t *p_pkt );
+static void SplitSetPAT( demux_t *p_demux, dvbpsi_pat_t *p_pat );
+static void SplitSetPMT( demux_t *p_demux, dvbpsi_pmt_t *p_pmt );
+static ts_split_t *SplitFind( ts_split_sys_t *p_split, int i_number );
+
 #define TS_PACKET_SIZE_188 188
 #define TS_PACKET_SIZE_192 192
 #define TS_PACKET_SIZE_204 204
 #define TS_PACKET_SIZE_MAX 204
 #define TS_TOPFIELD_HEADER 1320
 
+/* Number of TS packets read at once from seekable streams */
+#define TS_CHUNK_PACKETS 512
+/* Number of consecutive sync bytes needed to resynchronise */
+#define TS_SYNC_COUNT 4
+
 /*****************************************************************************
  * Open
  *****************************************************************************/
@@ -632,7 +774,31 @@ static int Open( vlc_object_t *p_this )
     p_sys->i_packet_size = i_packet_size;
     p_sys->b_udp_out = false;
     p_sys->fd = -1;
+    p_sys->p_split = NULL;
     p_sys->i_ts_read = 50;
+    p_sys->p_chunk = NULL;
+    p_sys->i_chunk_offset = 0;
+    p_sys->i_chunk_pos = 0;
+    p_sys->i_chunk_clear = 0;
+    p_sys->i_sync_lost = 0;
+    p_sys->i_sync_garbage = 0;
+    p_sys->p_input = demux_GetParentInput( p_demux );
+    if( p_sys->p_input != NULL )
+    {
+        var_Create( p_sys->p_input, "ts-sync-lost", VLC_VAR_INTEGER );
+        var_Create( p_sys->p_input, "ts-sync-skipped", VLC_VAR_INTEGER );
+    }
+#if defined(CAN_COMPILE_SSE2)
+    if( vlc_CPU() & CPU_CAPABILITY_SSE2 )
+        p_sys->pf_sync_locate = SyncLocateSSE2;
+    else
+#endif
+#if defined(__ARM_NEON__)
+    if( vlc_CPU() & CPU_CAPABILITY_NEON )
+        p_sys->pf_sync_locate = SyncLocateNEON;
+    else
+#endif
+        p_sys->pf_sync_locate = SyncLocate;
     p_sys->csa = NULL;
     p_sys->b_start_record = false;
 
@@ -681,8 +847,17 @@ static int Open( vlc_object_t *p_this )
     /* Read config */
     p_sys->b_es_id_pid = var_CreateGetBool( p_demux, "ts-es-id-pid" );
 
-    char* psz_string = var_CreateGetString( p_demux, "ts-out" );
+    char* psz_string = var_CreateGetString( p_demux, "ts-split" );
     if( psz_string && *psz_string )
+        SplitOpen( p_demux, psz_string );
+    free( psz_string );
+
+    psz_string = var_CreateGetString( p_demux, "ts-out" );
+    if( psz_string && *psz_string && p_sys->p_split )
+    {
+        msg_Warn( p_demux, "ts-out is ignored in split mode" );
+    }
+    else if( psz_string && *psz_string )
     {
         char *psz = strchr( psz_string, ':' );
         int   i_port = 0;
@@ -782,21 +957,41 @@ static int Open( vlc_object_t *p_this )
     p_sys->i_pcrs_num = 10;
     p_sys->p_pcrs = (mtime_t *)calloc( p_sys->i_pcrs_num, sizeof( mtime_t ) );
     p_sys->p_pos = (int64_t *)calloc( p_sys->i_pcrs_num, sizeof( int64_t ) );
+    p_sys->p_index = NULL;
 
     bool can_seek = false;
     stream_Control( p_demux->s, STREAM_CAN_SEEK, &can_seek );
+
+    /* Live streams are read in small bursts so as not to add latency */
+    p_sys->i_chunk_packets = can_seek ? TS_CHUNK_PACKETS : p_sys->i_ts_read;
+
     if( can_seek  )
     {
         GetFirstPCR( p_demux );
-        CheckPCR( p_demux );
-        GetLastPCR( p_demux );
+        if( p_sys->i_first_pcr >= 0 &&
+            var_CreateGetBool( p_demux, "ts-seek-index" ) )
+            IndexOpen( p_demux );
+        /* The index may already know the length of the file */
+        if( p_sys->i_last_pcr < 0 )
+        {
+            CheckPCR( p_demux );
+            GetLastPCR( p_demux );
+        }
     }
     if( p_sys->i_first_pcr < 0 || p_sys->i_last_pcr < 0 )
     {
         p_sys->b_force_seek_per_percent = true;
     }
+    if( p_sys->b_force_seek_per_percent && p_sys->p_index )
+    {
+        /* Useless without PCR based seeking */
+        p_sys->p_index->b_dirty = false;
+        IndexClose( p_demux );
+    }
 
-    while( p_sys->i_pmt_es <= 0  && vlc_object_alive( p_demux ) )
+    /* Nothing is decoded in split mode */
+    while( p_sys->i_pmt_es <= 0 && !p_sys->p_split &&
+           vlc_object_alive( p_demux ) )
     {
         if( p_demux->pf_demux( p_demux ) != 1 )
             break;
@@ -879,6 +1074,20 @@ static void Close( vlc_object_t *p_this )
 
     free( p_sys->buffer );
 
+    if( p_sys->p_split )
+        SplitClose( p_demux );
+
+    ChunkDrop( p_demux );
+
+    if( p_sys->p_input != NULL )
+    {
+        var_Destroy( p_sys->p_input, "ts-sync-skipped" );
+        var_Destroy( p_sys->p_input, "ts-sync-lost" );
+        vlc_object_release( p_sys->p_input );
+    }
+
+    if( p_sys->p_index )
+        IndexClose( p_demux );
     free( p_sys->p_pcrs );
     free( p_sys->p_pos );
 
@@ -942,6 +1151,9 @@ static int Demux( demux_t *p_demux )
         /* Parse the TS packet */
         ts_pid_t *p_pid = &p_sys->pid[PIDGet( p_pkt )];
 
+        if( p_sys->p_split )
+            SplitPacket( p_demux, p_pid, p_pkt );
+
         if( p_pid->b_valid )
         {
             if( p_pid->psi )
@@ -960,7 +1172,7 @@ static int Demux( demux_t *p_demux )
                 }
                 block_Release( p_pkt );
             }
-            else if( !p_sys->b_udp_out )
+            else if( !p_sys->b_udp_out && !p_sys->p_split )
             {
                 b_frame = GatherPES( p_demux, p_pid, p_pkt );
             }
@@ -1051,7 +1263,7 @@ static int Control( demux_t *p_demux, int i_query, va_list args )
             if( !DVBEventInformation( p_demux, &i_time, &i_length ) && i_length > 0 )
                 *pf = (double)i_time/(double)i_length;
             else if( (i64 = stream_Size( p_demux->s) ) > 0 )
-                *pf = (double)stream_Tell( p_demux->s ) / (double)i64;
+                *pf = (double)TSTell( p_demux ) / (double)i64;
             else
                 *pf = 0.0;
         }
@@ -1070,7 +1282,7 @@ static int Control( demux_t *p_demux, int i_query, va_list args )
             p_sys->i_last_pcr - p_sys->i_first_pcr <= 0 )
         {
             i64 = stream_Size( p_demux->s );
-            if( stream_Seek( p_demux->s, (int64_t)(i64 * f) ) )
+            if( TSSeek( p_demux, (int64_t)(i64 * f) ) )
                 return VLC_EGENERIC;
         }
         else
@@ -1434,8 +1646,8 @@ static void PIDInit( ts_pid_t *pid, bool b_psi, ts_psi_t *p_owner )
             pid->es->id      = NULL;
             pid->es->p_pes   = NULL;
             pid->es->i_pes_size= 0;
-            pid->es->i_pes_gathered= 0;
-            pid->es->pp_last = &pid->es->p_pes;
+            pid->es->i_pes_alloc = 0;
+            pid->es->i_pes_hint = 0;
             pid->es->p_mpeg4desc = NULL;
             pid->es->b_gather = false;
         }
@@ -1471,7 +1683,7 @@ static void PIDClean( demux_t *p_demux, ts_pid_t *pid )
         }
 
         if( pid->es->p_pes )
-            block_ChainRelease( pid->es->p_pes );
+            block_Release( pid->es->p_pes );
 
         es_format_Clean( &pid->es->fmt );
 
@@ -1486,7 +1698,7 @@ static void PIDClean( demux_t *p_demux, ts_pid_t *pid )
             }
 
             if( pid->extra_es[i]->p_pes )
-                block_ChainRelease( pid->extra_es[i]->p_pes );
+                block_Release( pid->extra_es[i]->p_pes );
 
             es_format_Clean( &pid->extra_es[i]->fmt );
 
@@ -1516,18 +1728,24 @@ static void ParsePES( demux_t *p_demux, ts_pid_t *pid )
     /* remove the pes from pid */
     pid->es->p_pes = NULL;
     pid->es->i_pes_size= 0;
-    pid->es->i_pes_gathered= 0;
-    pid->es->pp_last = &pid->es->p_pes;
+    pid->es->i_pes_alloc = 0;
+
+    /* Size the next arena after the largest recent PES, slowly decaying
+     * so that a single large access unit does not pin memory forever */
+    pid->es->i_pes_hint -= pid->es->i_pes_hint / 16;
+    if( pid->es->i_pes_hint < p_pes->i_buffer )
+        pid->es->i_pes_hint = p_pes->i_buffer;
 
     /* FIXME find real max size */
-    /* const int i_max = */ block_ChainExtract( p_pes, header, 34 );
-    
+    memset( header, 0, sizeof(header) );
+    memcpy( header, p_pes->p_buffer, __MIN( p_pes->i_buffer, sizeof(header) ) );
+
     if( header[0] != 0 || header[1] != 0 || header[2] != 1 )
     {
         if( !p_demux->p_sys->b_silent )
             msg_Warn( p_demux, "invalid header [0x%x:%x:%x:%x] (pid: %d)",
                       header[0], header[1],header[2],header[3], pid->i_pid );
-        block_ChainRelease( p_pes );
+        block_Release( p_pes );
         return;
     }
 
@@ -1578,7 +1796,7 @@ static void ParsePES( demux_t *p_demux, ts_pid_t *pid )
             if( i_skip == 23 )
             {
                 msg_Err( p_demux, "too much MPEG-1 stuffing" );
-                block_ChainRelease( p_pes );
+                block_Release( p_pes );
                 return;
             }
             if( ( header[i_skip] & 0xC0 ) == 0x40 )
@@ -1649,22 +1867,15 @@ static void ParsePES( demux_t *p_demux, ts_pid_t *pid )
     }
 
     /* skip header */
-    while( p_pes && i_skip > 0 )
+    if( p_pes->i_buffer <= i_skip )
     {
-        if( p_pes->i_buffer <= i_skip )
-        {
-            block_t *p_next = p_pes->p_next;
-
-            i_skip -= p_pes->i_buffer;
-            block_Release( p_pes );
-            p_pes = p_next;
-        }
-        else
-        {
-            p_pes->i_buffer -= i_skip;
-            p_pes->p_buffer += i_skip;
-            break;
-        }
+        block_Release( p_pes );
+        p_pes = NULL;
+    }
+    else
+    {
+        p_pes->i_buffer -= i_skip;
+        p_pes->p_buffer += i_skip;
     }
 
     /* ISO/IEC 13818-1 2.7.5: if no pts and no dts, then dts == pts */
@@ -1684,7 +1895,7 @@ static void ParsePES( demux_t *p_demux, ts_pid_t *pid )
 
         p_pes->i_length = i_length * 100 / 9;
 
-        p_block = block_ChainGather( p_pes );
+        p_block = p_pes;
         if( pid->es->fmt.i_codec == VLC_CODEC_SUBT )
         {
             if( i_pes_size > 0 && p_block->i_buffer > i_pes_size )
@@ -1744,61 +1955,348 @@ static void ParsePES( demux_t *p_demux, ts_pid_t *pid )
     }
 }
 
-static block_t* ReadTSPacket( demux_t *p_demux )
+static void ChunkDrop( demux_t *p_demux )
 {
     demux_sys_t *p_sys = p_demux->p_sys;
 
-    block_t     *p_pkt;
+    if( p_sys->p_chunk )
+        block_Release( p_sys->p_chunk );
+    p_sys->p_chunk = NULL;
+    p_sys->i_chunk_offset = 0;
+    p_sys->i_chunk_clear = 0;
+}
+
+/* Descrambles the ES packets of the chunk from i_offset on, by batches,
+ * until the synchro is lost. GatherPES descrambles the ones that are missed
+ * (ES declared in the middle of the chunk, packets after a resync). */
+static void ChunkDescramble( demux_t *p_demux, size_t i_offset )
+{
+    demux_sys_t *p_sys = p_demux->p_sys;
+    uint8_t *p_data = p_sys->p_chunk->p_buffer;
+    const size_t i_data = p_sys->p_chunk->i_buffer;
+    const size_t i_packet_size = p_sys->i_packet_size;
+    uint8_t *pp_pkts[CSA_BATCH_SIZE];
+    int i_pkts = 0;
 
-    /* Get a new TS packet */
-    if( !( p_pkt = stream_Block( p_demux->s, p_sys->i_packet_size ) ) )
+    vlc_mutex_lock( &p_sys->csa_lock );
+    for( ; i_offset + i_packet_size <= i_data && p_data[i_offset] == 0x47;
+         i_offset += i_packet_size )
     {
-        msg_Dbg( p_demux, "eof ?" );
-        return NULL;
+        uint8_t *p = &p_data[i_offset];
+        const ts_pid_t *p_pid = &p_sys->pid[((p[1]&0x1f)<<8)|p[2]];
+
+        if( !(p[3]&0x80) || !p_pid->b_valid || p_pid->psi )
+            continue;
+
+        pp_pkts[i_pkts++] = p;
+        if( i_pkts == CSA_BATCH_SIZE )
+        {
+            csa_DecryptBatch( p_sys->csa, pp_pkts, i_pkts,
+                              p_sys->i_csa_pkt_size );
+            i_pkts = 0;
+        }
     }
+    if( i_pkts > 0 )
+        csa_DecryptBatch( p_sys->csa, pp_pkts, i_pkts, p_sys->i_csa_pkt_size );
+    vlc_mutex_unlock( &p_sys->csa_lock );
+
+    p_sys->i_chunk_clear = i_offset;
+}
+
+/* Reads the next chunk. Bytes of the current chunk that were not consumed
+ * (a partial packet) are kept at the beginning of the new one. */
+static int ChunkRead( demux_t *p_demux )
+{
+    demux_sys_t *p_sys = p_demux->p_sys;
+    const size_t i_read = p_sys->i_chunk_packets * p_sys->i_packet_size;
+    size_t i_carry = 0;
+    block_t *p_data;
+
+    if( p_sys->p_chunk )
+        i_carry = p_sys->p_chunk->i_buffer - p_sys->i_chunk_offset;
 
-    /* Check sync byte and re-sync if needed */
-    if( p_pkt->p_buffer[0] != 0x47 )
+    if( i_carry == 0 )
     {
-        msg_Warn( p_demux, "lost synchro" );
-        block_Release( p_pkt );
-        while( vlc_object_alive (p_demux) )
+        p_data = stream_Block( p_demux->s, i_read );
+    }
+    else
+    {
+        p_data = block_Alloc( i_carry + i_read );
+        if( p_data )
+        {
+            memcpy( p_data->p_buffer,
+                    &p_sys->p_chunk->p_buffer[p_sys->i_chunk_offset],
+                    i_carry );
+            const int i_ret = stream_Read( p_demux->s,
+                                           &p_data->p_buffer[i_carry], i_read );
+            if( i_ret > 0 )
+            {
+                p_data->i_buffer = i_carry + i_ret;
+            }
+            else
+            {
+                block_Release( p_data );
+                p_data = NULL;
+            }
+        }
+    }
+    ChunkDrop( p_demux );
+
+    if( !p_data )
+        return VLC_EGENERIC;
+    if( p_data->i_buffer < (size_t)p_sys->i_packet_size )
+    {
+        block_Release( p_data );
+        return VLC_EGENERIC;
+    }
+
+    p_sys->p_chunk = p_data;
+    p_sys->i_chunk_pos = stream_Tell( p_demux->s ) - p_data->i_buffer;
+    return VLC_SUCCESS;
+}
+
+/* Position of the next packet */
+static int64_t TSTell( demux_t *p_demux )
+{
+    demux_sys_t *p_sys = p_demux->p_sys;
+
+    if( !p_sys->p_chunk )
+        return stream_Tell( p_demux->s );
+    return p_sys->i_chunk_pos + p_sys->i_chunk_offset;
+}
+
+static int TSSeek( demux_t *p_demux, int64_t i_pos )
+{
+    ChunkDrop( p_demux );
+    return stream_Seek( p_demux->s, i_pos );
+}
+
+/* Returns the offset of the first of i_count sync bytes spaced by i_stride,
+ * or i_data if there is none */
+static size_t SyncLocate( const uint8_t *p_data, size_t i_data,
+                          size_t i_stride, int i_count )
+{
+    const size_t i_span = ( i_count - 1 ) * i_stride;
+    if( i_data <= i_span )
+        return i_data;
+
+    const size_t i_last = i_data - i_span;
+    for( size_t i = 0; i < i_last; i++ )
+    {
+        const uint8_t *p = memchr( &p_data[i], 0x47, i_last - i );
+        if( !p )
+            break;
+        i = p - p_data;
+
+        int k = 1;
+        while( k < i_count && p[k * i_stride] == 0x47 )
+            k++;
+        if( k == i_count )
+            return i;
+    }
+    return i_data;
+}
+
+/* Count trailing zeroes, x must not be 0 */
+static inline unsigned SyncCtz( unsigned x )
+{
+#ifdef __GNUC__
+    return __builtin_ctz( x );
+#else
+    unsigned i = 0;
+
+    while( !(x & 1) )
+    {
+        x >>= 1;
+        i++;
+    }
+    return i;
+#endif
+}
+
+#if defined(CAN_COMPILE_SSE2)
+/* The compiler only knows (and may only use) SSE registers if enabled */
+#   if defined(__SSE__)
+#       define SYNC_SSE2_CLOBBERS "xmm0", "xmm1"
+#   else
+#       define SYNC_SSE2_CLOBBERS
+#   endif
+
+/* Returns a bit mask of the sync bytes among the 16 bytes at p */
+static inline unsigned SyncMaskSSE2( const uint8_t *p )
+{
+    static const uint8_t sync[16] = {
+        0x47, 0x47, 0x47, 0x47, 0x47, 0x47, 0x47, 0x47,
+        0x47, 0x47, 0x47, 0x47, 0x47, 0x47, 0x47, 0x47,
+    };
+    unsigned i_mask;
+
+    asm( "movdqu   %1, %%xmm0\n"
+         "movdqu   %2, %%xmm1\n"
+         "pcmpeqb  %%xmm1, %%xmm0\n"
+         "pmovmskb %%xmm0, %0\n"
+         : "=r"(i_mask)
+         : "m"(*(const uint8_t (*)[16])sync), "m"(*(const uint8_t (*)[16])p)
+         : SYNC_SSE2_CLOBBERS );
+    return i_mask;
+}
+
+/* Checks 16 candidate offsets at once */
+static size_t SyncLocateSSE2( const uint8_t *p_data, size_t i_data,
+                              size_t i_stride, int i_count )
+{
+    const size_t i_span = ( i_count - 1 ) * i_stride;
+    if( i_data <= i_span )
+        return i_data;
+
+    const size_t i_last = i_data - i_span;
+    size_t i = 0;
+
+    for( ; i + 16 <= i_last; i += 16 )
+    {
+        unsigned i_mask = SyncMaskSSE2( &p_data[i] );
+
+        for( int k = 1; k < i_count && i_mask; k++ )
+            i_mask &= SyncMaskSSE2( &p_data[i + k * i_stride] );
+        if( i_mask )
+            return i + SyncCtz( i_mask );
+    }
+
+    const size_t i_tail = SyncLocate( &p_data[i], i_data - i, i_stride, i_count );
+    return i + i_tail;
+}
+#endif
+
+#if defined(__ARM_NEON__)
+/* Checks 16 candidate offsets at once */
+static size_t SyncLocateNEON( const uint8_t *p_data, size_t i_data,
+                              size_t i_stride, int i_count )
+{
+    const size_t i_span = ( i_count - 1 ) * i_stride;
+    if( i_data <= i_span )
+        return i_data;
+
+    const size_t i_last = i_data - i_span;
+    const uint8x16_t sync = vdupq_n_u8( 0x47 );
+    size_t i = 0;
+
+    for( ; i + 16 <= i_last; i += 16 )
+    {
+        uint8x16_t match = vceqq_u8( sync, vld1q_u8( &p_data[i] ) );
+        for( int k = 1; k < i_count; k++ )
+            match = vandq_u8( match,
+                              vceqq_u8( sync, vld1q_u8( &p_data[i + k * i_stride] ) ) );
+
+        const uint64x2_t match64 = vreinterpretq_u64_u8( match );
+        if( vgetq_lane_u64( match64, 0 ) | vgetq_lane_u64( match64, 1 ) )
         {
-            const uint8_t *p_peek;
-            int i_peek, i_skip = 0;
+            uint8_t mask[16];
+            vst1q_u8( mask, match );
+            for( int j = 0; j < 16; j++ )
+                if( mask[j] )
+                    return i + j;
+        }
+    }
+
+    const size_t i_tail = SyncLocate( &p_data[i], i_data - i, i_stride, i_count );
+    return i + i_tail;
+}
+#endif
 
-            i_peek = stream_Peek( p_demux->s, &p_peek,
-                    p_sys->i_packet_size * 10 );
-            if( i_peek < p_sys->i_packet_size + 1 )
+/* Data was lost: account for it on the input */
+static void SyncLost( demux_t *p_demux, size_t i_skipped )
+{
+    demux_sys_t *p_sys = p_demux->p_sys;
+
+    p_sys->i_sync_lost++;
+    p_sys->i_sync_garbage += i_skipped;
+
+    if( p_sys->p_input != NULL )
+    {
+        var_SetInteger( p_sys->p_input, "ts-sync-lost", p_sys->i_sync_lost );
+        var_SetInteger( p_sys->p_input, "ts-sync-skipped",
+                        p_sys->i_sync_garbage );
+    }
+}
+
+static block_t* ReadTSPacket( demux_t *p_demux )
+{
+    demux_sys_t *p_sys = p_demux->p_sys;
+    const size_t i_packet_size = p_sys->i_packet_size;
+    bool b_synced = true;
+    size_t i_skipped = 0;
+
+    while( vlc_object_alive (p_demux) )
+    {
+        block_t *p_chunk = p_sys->p_chunk;
+
+        /* Get new TS packets */
+        if( !p_chunk ||
+            p_sys->i_chunk_offset + i_packet_size > p_chunk->i_buffer )
+        {
+            if( ChunkRead( p_demux ) )
             {
                 msg_Dbg( p_demux, "eof ?" );
-                return NULL;
+                break;
             }
+            continue;
+        }
+
+        const uint8_t *p_data = p_chunk->p_buffer;
+        const size_t i_data = p_chunk->i_buffer;
+        size_t i_offset = p_sys->i_chunk_offset;
 
-            while( i_skip < i_peek - p_sys->i_packet_size )
+        /* Check sync byte and re-sync if needed */
+        if( p_data[i_offset] != 0x47 )
+        {
+            if( b_synced )
+                msg_Warn( p_demux, "lost synchro" );
+            b_synced = false;
+
+            const size_t i_skip = i_offset +
+                p_sys->pf_sync_locate( &p_data[i_offset], i_data - i_offset,
+                                       i_packet_size, TS_SYNC_COUNT );
+            if( i_skip >= i_data )
             {
-                if( p_peek[i_skip] == 0x47 &&
-                        p_peek[i_skip + p_sys->i_packet_size] == 0x47 )
+                /* Not found: the end of the chunk may still be the start
+                 * of valid packets, check it again with the next chunk */
+                const size_t i_keep = ( TS_SYNC_COUNT - 1 ) * i_packet_size;
+                if( i_data - i_offset > i_keep )
+                {
+                    i_skipped += i_data - i_keep - i_offset;
+                    p_sys->i_chunk_offset = i_data - i_keep;
+                }
+                if( ChunkRead( p_demux ) )
                 {
+                    msg_Dbg( p_demux, "eof ?" );
                     break;
                 }
-                i_skip++;
-            }
-            msg_Dbg( p_demux, "skipping %d bytes of garbage", i_skip );
-            stream_Read( p_demux->s, NULL, i_skip );
-
-            if( i_skip < i_peek - p_sys->i_packet_size )
-            {
-                break;
+                continue;
             }
+            i_skipped += i_skip - i_offset;
+            i_offset = p_sys->i_chunk_offset = i_skip;
         }
-        if( !( p_pkt = stream_Block( p_demux->s, p_sys->i_packet_size ) ) )
+        if( !b_synced )
         {
-            msg_Dbg( p_demux, "eof ?" );
-            return NULL;
+            msg_Dbg( p_demux, "skipping %zu bytes of garbage", i_skipped );
+            SyncLost( p_demux, i_skipped );
+            b_synced = true;
         }
+
+        if( p_sys->csa && !p_sys->b_udp_out &&
+            i_offset >= p_sys->i_chunk_clear )
+            ChunkDescramble( p_demux, i_offset );
+
+        block_t *p_pkt = block_Alloc( i_packet_size );
+        if( !p_pkt )
+            break;
+        memcpy( p_pkt->p_buffer, &p_data[i_offset], i_packet_size );
+        p_sys->i_chunk_offset += i_packet_size;
+        return p_pkt;
     }
-    return p_pkt;
+    if( !b_synced )
+        SyncLost( p_demux, i_skipped );
+    return NULL;
 }
 
 static mtime_t AdjustPCRWrapAround( demux_t *p_demux, mtime_t i_pcr )
@@ -1809,7 +2307,7 @@ static mtime_t AdjustPCRWrapAround( demux_t *p_demux, mtime_t i_pcr )
      * So, need to add 0x1FFFFFFFF, for calculating duration or current position.
      */
     mtime_t i_adjust = 0;
-    int64_t i_pos = stream_Tell( p_demux->s );
+    int64_t i_pos = TSTell( p_demux );
     int i;
     for( i = 1; i < p_sys->i_pcrs_num && p_sys->p_pos[i] <= i_pos; ++i )
     {
@@ -1847,7 +2345,7 @@ static int SeekToPCR( demux_t *p_demux, int64_t i_pos )
     demux_sys_t *p_sys = p_demux->p_sys;
 
     mtime_t i_pcr = -1;
-    int64_t i_initial_pos = stream_Tell( p_demux->s );
+    int64_t i_initial_pos = TSTell( p_demux );
 
     if( i_pos < 0 )
         return VLC_EGENERIC;
@@ -1858,7 +2356,7 @@ static int SeekToPCR( demux_t *p_demux, int64_t i_pos )
         i_last_pos = stream_Size( p_demux->s ) - p_sys->i_packet_size;
     }
 
-    if( stream_Seek( p_demux->s, i_pos ) )
+    if( TSSeek( p_demux, i_pos ) )
         return VLC_EGENERIC;
 
     while( vlc_object_alive( p_demux ) )
@@ -1875,12 +2373,12 @@ static int SeekToPCR( demux_t *p_demux, int64_t i_pos )
         block_Release( p_pkt );
         if( i_pcr >= 0 )
             break;
-        if( stream_Tell( p_demux->s ) >= i_last_pos )
+        if( TSTell( p_demux ) >= i_last_pos )
             break;
     }
     if( i_pcr < 0 )
     {
-        stream_Seek( p_demux->s, i_initial_pos );
+        TSSeek( p_demux, i_initial_pos );
         return VLC_EGENERIC;
     }
     else
@@ -1894,7 +2392,7 @@ static int Seek( demux_t *p_demux, double f_percent )
 {
     demux_sys_t *p_sys = p_demux->p_sys;
 
-    int64_t i_initial_pos = stream_Tell( p_demux->s );
+    int64_t i_initial_pos = TSTell( p_demux );
     mtime_t i_initial_pcr = p_sys->i_current_pcr;
 
     /*
@@ -1902,6 +2400,9 @@ static int Seek( demux_t *p_demux, double f_percent )
      */
     mtime_t i_target_pcr = (p_sys->i_last_pcr - p_sys->i_first_pcr) * f_percent + p_sys->i_first_pcr;
 
+    if( p_sys->p_index && !IndexSeek( p_demux, i_target_pcr ) )
+        return VLC_SUCCESS;
+
     int64_t i_head_pos = 0;
     int64_t i_tail_pos = stream_Size( p_demux->s );
     {
@@ -1947,7 +2448,7 @@ static int Seek( demux_t *p_demux, double f_percent )
     if( !b_found )
     {
         msg_Dbg( p_demux, "Seek():cannot find a time position. i_cnt:%d", i_cnt );
-        stream_Seek( p_demux->s, i_initial_pos );
+        TSSeek( p_demux, i_initial_pos );
         p_sys->i_current_pcr = i_initial_pcr;
         return VLC_EGENERIC;
     }
@@ -1962,9 +2463,9 @@ static void GetFirstPCR( demux_t *p_demux )
 {
     demux_sys_t *p_sys = p_demux->p_sys;
 
-    int64_t i_initial_pos = stream_Tell( p_demux->s );
+    int64_t i_initial_pos = TSTell( p_demux );
 
-    if( stream_Seek( p_demux->s, 0 ) )
+    if( TSSeek( p_demux, 0 ) )
         return;
 
     while( vlc_object_alive (p_demux) )
@@ -1985,14 +2486,14 @@ static void GetFirstPCR( demux_t *p_demux )
         if( p_sys->i_first_pcr >= 0 )
             break;
     }
-    stream_Seek( p_demux->s, i_initial_pos );
+    TSSeek( p_demux, i_initial_pos );
 }
 
 static void GetLastPCR( demux_t *p_demux )
 {
     demux_sys_t *p_sys = p_demux->p_sys;
 
-    int64_t i_initial_pos = stream_Tell( p_demux->s );
+    int64_t i_initial_pos = TSTell( p_demux );
     mtime_t i_initial_pcr = p_sys->i_current_pcr;
 
     int64_t i_last_pos = stream_Size( p_demux->s ) - p_sys->i_packet_size;
@@ -2005,7 +2506,7 @@ static void GetLastPCR( demux_t *p_demux )
         if( SeekToPCR( p_demux, i_pos ) )
             break;
         p_sys->i_last_pcr = AdjustPCRWrapAround( p_demux, p_sys->i_current_pcr );
-        if( ( i_pos = stream_Tell( p_demux->s ) ) >= i_last_pos )
+        if( ( i_pos = TSTell( p_demux ) ) >= i_last_pos )
             break;
     }
     if( p_sys->i_last_pcr >= 0 )
@@ -2022,7 +2523,7 @@ static void GetLastPCR( demux_t *p_demux )
             p_sys->i_last_pcr = -1;
         }
     }
-    stream_Seek( p_demux->s, i_initial_pos );
+    TSSeek( p_demux, i_initial_pos );
     p_sys->i_current_pcr = i_initial_pcr;
 }
 
@@ -2030,7 +2531,7 @@ static void CheckPCR( demux_t *p_demux )
 {
     demux_sys_t   *p_sys = p_demux->p_sys;
 
-    int64_t i_initial_pos = stream_Tell( p_demux->s );
+    int64_t i_initial_pos = TSTell( p_demux );
     mtime_t i_initial_pcr = p_sys->i_current_pcr;
 
     int64_t i_size = stream_Size( p_demux->s );
@@ -2045,7 +2546,7 @@ static void CheckPCR( demux_t *p_demux )
         if( SeekToPCR( p_demux, i_pos ) )
             break;
         p_sys->p_pcrs[i] = p_sys->i_current_pcr;
-        p_sys->p_pos[i] = stream_Tell( p_demux->s );
+        p_sys->p_pos[i] = TSTell( p_demux );
         if( p_sys->p_pcrs[i-1] > p_sys->p_pcrs[i] )
         {
             msg_Dbg( p_demux, "PCR Wrap Around found between %d%% and %d%% (pcr:%lld(0x%09llx) pcr:%lld(0x%09llx))",
@@ -2058,7 +2559,7 @@ static void CheckPCR( demux_t *p_demux )
         p_sys->b_force_seek_per_percent = true;
     }
 
-    stream_Seek( p_demux->s, i_initial_pos );
+    TSSeek( p_demux, i_initial_pos );
     p_sys->i_current_pcr = i_initial_pcr;
 }
 
@@ -2066,32 +2567,429 @@ static void PCRHandle( demux_t *p_demux, ts_pid_t *pid, block_t *p_bk )
 {
     demux_sys_t   *p_sys = p_demux->p_sys;
 
-    if( p_sys->i_pmt_es <= 0 )
-        return;
+    if( p_sys->i_pmt_es <= 0 )
+        return;
+
+    mtime_t i_pcr = GetPCR( p_bk );
+    if( i_pcr >= 0 )
+    {
+        if( p_sys->i_pid_ref_pcr == pid->i_pid )
+        {
+            p_sys->i_current_pcr = AdjustPCRWrapAround( p_demux, i_pcr );
+            if( p_sys->p_index )
+                IndexAdd( p_demux, p_sys->i_current_pcr, false );
+        }
+
+        /* Search program and set the PCR */
+        for( int i = 0; i < p_sys->i_pmt; i++ )
+        {
+            for( int i_prg = 0; i_prg < p_sys->pmt[i]->psi->i_prg; i_prg++ )
+            {
+                if( pid->i_pid == p_sys->pmt[i]->psi->prg[i_prg]->i_pid_pcr )
+                {
+                    p_sys->pmt[i]->psi->prg[i_prg]->i_pcr_value = i_pcr;
+                    es_out_Control( p_demux->out, ES_OUT_SET_GROUP_PCR,
+                                    (int)p_sys->pmt[i]->psi->prg[i_prg]->i_number,
+                                    (int64_t)(VLC_TS_0 + i_pcr * 100 / 9) );
+                }
+            }
+        }
+    }
+}
+
+/*****************************************************************************
+ * Seek index
+ *****************************************************************************
+ * The sidecar file maps PCR values (wrap-around adjusted) of the reference
+ * PCR PID to byte positions, with random access points flagged. It also
+ * keeps the results of GetFirstPCR/CheckPCR/GetLastPCR so that later opens
+ * of the same file do not have to scan it again.
+ *
+ * Layout (all values big endian):
+ *  0  "VLCTSIDX"
+ *  8  version (16), packet size (16), PCR PID (16), checkpoints count (16)
+ *  16 file size, indexed size, first PCR, last PCR (64 each)
+ *  48 entries count (32), reserved (32)
+ *  56 checkpoints: PCR (64), position (64)
+ *  .. entries: PCR | TS_INDEX_RAP (64), position (64)
+ *****************************************************************************/
+#define TS_INDEX_MAGIC       "VLCTSIDX"
+#define TS_INDEX_VERSION     1
+#define TS_INDEX_HEADER_SIZE 56
+#define TS_INDEX_ENTRY_SIZE  16
+#define TS_INDEX_RAP         (UINT64_C(1) << 63)
+/* Maximum PCR distance between two entries (500ms) */
+#define TS_INDEX_INTERVAL    (45000)
+/* How far back we look for a random access point when seeking (2s) */
+#define TS_INDEX_RAP_WINDOW  (180000)
+/* A larger jump between two indexed packets means we have seeked */
+#define TS_INDEX_MAX_GAP     (4 * 1024 * 1024)
+
+static int IndexCount( const ts_index_t *p_index )
+{
+    return p_index->i_file_entries + p_index->i_entries;
+}
+
+static const uint8_t *IndexGet( const ts_index_t *p_index, int i )
+{
+    if( i < p_index->i_file_entries )
+        return &p_index->p_file_entries[i * TS_INDEX_ENTRY_SIZE];
+    i -= p_index->i_file_entries;
+    return &p_index->p_entries[i * TS_INDEX_ENTRY_SIZE];
+}
+
+static mtime_t IndexGetPCR( const uint8_t *p_entry )
+{
+    return GetQWBE( p_entry ) & ~TS_INDEX_RAP;
+}
+
+static void IndexLoad( demux_t *p_demux, ts_index_t *p_index )
+{
+    demux_sys_t *p_sys = p_demux->p_sys;
+
+    int fd = vlc_open( p_index->psz_path, O_RDONLY );
+    if( fd == -1 )
+        return;
+    block_t *p_file = block_File( fd );
+    close( fd );
+    if( !p_file )
+        return;
+
+    const uint8_t *p = p_file->p_buffer;
+    if( p_file->i_buffer < TS_INDEX_HEADER_SIZE ||
+        memcmp( p, TS_INDEX_MAGIC, 8 ) ||
+        GetWBE( &p[8] ) != TS_INDEX_VERSION )
+    {
+        msg_Warn( p_demux, "invalid index file %s", p_index->psz_path );
+        block_Release( p_file );
+        return;
+    }
+
+    const int i_checkpoints = GetWBE( &p[14] );
+    const int64_t i_size = GetQWBE( &p[16] );
+    const int i_entries = GetDWBE( &p[48] );
+    const size_t i_need = TS_INDEX_HEADER_SIZE +
+                          (size_t)(i_checkpoints + i_entries) * TS_INDEX_ENTRY_SIZE;
+
+    /* The file may have grown since (recording) but must not have changed */
+    if( p_file->i_buffer < i_need ||
+        GetWBE( &p[10] ) != p_sys->i_packet_size ||
+        GetWBE( &p[12] ) != p_sys->i_pid_ref_pcr ||
+        (mtime_t)GetQWBE( &p[32] ) != p_sys->i_first_pcr ||
+        i_size > stream_Size( p_demux->s ) )
+    {
+        msg_Dbg( p_demux, "index file %s is outdated", p_index->psz_path );
+        block_Release( p_file );
+        return;
+    }
+
+    if( i_size == stream_Size( p_demux->s ) &&
+        i_checkpoints == p_sys->i_pcrs_num )
+    {
+        for( int i = 0; i < i_checkpoints; i++ )
+        {
+            const uint8_t *p_cp = &p[TS_INDEX_HEADER_SIZE + i * TS_INDEX_ENTRY_SIZE];
+            p_sys->p_pcrs[i] = GetQWBE( &p_cp[0] );
+            p_sys->p_pos[i] = GetQWBE( &p_cp[8] );
+        }
+        p_sys->i_last_pcr = GetQWBE( &p[40] );
+    }
+    else
+    {
+        /* The probes have to be done again */
+        p_index->b_dirty = true;
+    }
+
+    p_index->p_file = p_file;
+    p_index->p_file_entries = &p[TS_INDEX_HEADER_SIZE +
+                                 i_checkpoints * TS_INDEX_ENTRY_SIZE];
+    p_index->i_file_entries = i_entries;
+    p_index->i_end = GetQWBE( &p[24] );
+    if( i_entries > 0 )
+        p_index->i_last_pcr = IndexGetPCR( IndexGet( p_index, i_entries - 1 ) );
+
+    msg_Dbg( p_demux, "loaded %d index entries from %s (%"PRId64" bytes indexed)",
+             i_entries, p_index->psz_path, p_index->i_end );
+}
+
+static void IndexOpen( demux_t *p_demux )
+{
+    demux_sys_t *p_sys = p_demux->p_sys;
+
+    /* Only local files can have a sidecar */
+    if( ( *p_demux->psz_access && strcmp( p_demux->psz_access, "file" ) ) ||
+        !*p_demux->psz_path )
+        return;
+
+    ts_index_t *p_index = malloc( sizeof( *p_index ) );
+    if( !p_index )
+        return;
+    if( asprintf( &p_index->psz_path, "%s.tsidx", p_demux->psz_path ) < 0 )
+    {
+        free( p_index );
+        return;
+    }
+    p_index->p_file = NULL;
+    p_index->p_file_entries = NULL;
+    p_index->i_file_entries = 0;
+    p_index->p_entries = NULL;
+    p_index->i_entries = 0;
+    p_index->i_entries_max = 0;
+    p_index->i_end = -1;
+    p_index->i_last_pcr = -1;
+    p_index->b_dirty = false;
+
+    IndexLoad( p_demux, p_index );
+    if( !p_index->p_file )
+        p_index->b_dirty = true;
+
+    p_sys->p_index = p_index;
+}
+
+static void IndexWrite( demux_t *p_demux )
+{
+    demux_sys_t *p_sys = p_demux->p_sys;
+    ts_index_t *p_index = p_sys->p_index;
+    uint8_t header[TS_INDEX_HEADER_SIZE];
+    char *psz_tmp;
+
+    if( asprintf( &psz_tmp, "%s.tmp", p_index->psz_path ) < 0 )
+        return;
+
+    FILE *file = vlc_fopen( psz_tmp, "wb" );
+    if( !file )
+    {
+        msg_Warn( p_demux, "cannot create index file %s: %m", psz_tmp );
+        free( psz_tmp );
+        return;
+    }
+
+    memcpy( &header[0], TS_INDEX_MAGIC, 8 );
+    SetWBE( &header[8], TS_INDEX_VERSION );
+    SetWBE( &header[10], p_sys->i_packet_size );
+    SetWBE( &header[12], p_sys->i_pid_ref_pcr );
+    SetWBE( &header[14], p_sys->i_pcrs_num );
+    SetQWBE( &header[16], stream_Size( p_demux->s ) );
+    SetQWBE( &header[24], p_index->i_end );
+    SetQWBE( &header[32], p_sys->i_first_pcr );
+    SetQWBE( &header[40], p_sys->i_last_pcr );
+    SetDWBE( &header[48], IndexCount( p_index ) );
+    SetDWBE( &header[52], 0 );
+
+    bool b_error = fwrite( header, sizeof(header), 1, file ) != 1;
+    for( int i = 0; i < p_sys->i_pcrs_num && !b_error; i++ )
+    {
+        uint8_t checkpoint[TS_INDEX_ENTRY_SIZE];
+        SetQWBE( &checkpoint[0], p_sys->p_pcrs[i] );
+        SetQWBE( &checkpoint[8], p_sys->p_pos[i] );
+        b_error = fwrite( checkpoint, sizeof(checkpoint), 1, file ) != 1;
+    }
+    if( !b_error && p_index->i_file_entries > 0 )
+        b_error = fwrite( p_index->p_file_entries, TS_INDEX_ENTRY_SIZE,
+                          p_index->i_file_entries, file ) != (size_t)p_index->i_file_entries;
+    if( !b_error && p_index->i_entries > 0 )
+        b_error = fwrite( p_index->p_entries, TS_INDEX_ENTRY_SIZE,
+                          p_index->i_entries, file ) != (size_t)p_index->i_entries;
+    if( fclose( file ) )
+        b_error = true;
+
+    /* Replace the old file atomically, it may still be mapped */
+    if( b_error || vlc_rename( psz_tmp, p_index->psz_path ) )
+    {
+        msg_Warn( p_demux, "cannot write index file %s", p_index->psz_path );
+        vlc_unlink( psz_tmp );
+    }
+    else
+    {
+        msg_Dbg( p_demux, "wrote %d index entries to %s",
+                 IndexCount( p_index ), p_index->psz_path );
+    }
+    free( psz_tmp );
+}
+
+static void IndexClose( demux_t *p_demux )
+{
+    demux_sys_t *p_sys = p_demux->p_sys;
+    ts_index_t *p_index = p_sys->p_index;
+
+    if( p_index->b_dirty )
+        IndexWrite( p_demux );
+
+    if( p_index->p_file )
+        block_Release( p_index->p_file );
+    free( p_index->p_entries );
+    free( p_index->psz_path );
+    free( p_index );
+    p_sys->p_index = NULL;
+}
+
+static void IndexAdd( demux_t *p_demux, mtime_t i_pcr, bool b_rap )
+{
+    demux_sys_t *p_sys = p_demux->p_sys;
+    ts_index_t *p_index = p_sys->p_index;
+    const int64_t i_pos = TSTell( p_demux ) - p_sys->i_packet_size;
+
+    if( i_pcr < 0 )
+        return;
+
+    if( i_pos == p_index->i_end && b_rap )
+    {
+        /* The PCR of this packet has just been seen: flag its entry, or
+         * index it now if it was skipped as too close to the previous one.
+         * The last entry may come from the file, which is mapped read only:
+         * it is then left as is. */
+        const int i_count = IndexCount( p_index );
+        if( i_count > 0 &&
+            (int64_t)GetQWBE( &IndexGet( p_index, i_count - 1 )[8] ) == i_pos )
+        {
+            if( p_index->i_entries > 0 )
+            {
+                uint8_t *p_last = &p_index->p_entries[(p_index->i_entries - 1) *
+                                                      TS_INDEX_ENTRY_SIZE];
+                SetQWBE( &p_last[0], GetQWBE( &p_last[0] ) | TS_INDEX_RAP );
+                p_index->b_dirty = true;
+            }
+            return;
+        }
+    }
+    /* Only extend the index with data that directly follows it */
+    else if( i_pos <= p_index->i_end ||
+             i_pos - p_index->i_end > TS_INDEX_MAX_GAP )
+        return;
+    p_index->i_end = i_pos;
+
+    if( i_pcr < p_index->i_last_pcr ||
+        ( !b_rap && p_index->i_last_pcr >= 0 &&
+          i_pcr - p_index->i_last_pcr < TS_INDEX_INTERVAL ) )
+        return;
+
+    if( p_index->i_entries >= p_index->i_entries_max )
+    {
+        const int i_max = __MAX( 1024, 2 * p_index->i_entries_max );
+        uint8_t *p_entries = realloc( p_index->p_entries,
+                                      i_max * TS_INDEX_ENTRY_SIZE );
+        if( !p_entries )
+            return;
+        p_index->p_entries = p_entries;
+        p_index->i_entries_max = i_max;
+    }
+
+    uint8_t *p_entry = &p_index->p_entries[p_index->i_entries * TS_INDEX_ENTRY_SIZE];
+    SetQWBE( &p_entry[0], (uint64_t)i_pcr | ( b_rap ? TS_INDEX_RAP : 0 ) );
+    SetQWBE( &p_entry[8], i_pos );
+    p_index->i_entries++;
+    p_index->i_last_pcr = i_pcr;
+    p_index->b_dirty = true;
+}
+
+static int IndexSeek( demux_t *p_demux, mtime_t i_target_pcr )
+{
+    demux_sys_t *p_sys = p_demux->p_sys;
+    ts_index_t *p_index = p_sys->p_index;
+    const int i_count = IndexCount( p_index );
+
+    if( i_count <= 0 ||
+        i_target_pcr > p_index->i_last_pcr + TS_INDEX_INTERVAL )
+        return VLC_EGENERIC;
+
+    /* Find the last entry before the target */
+    int i_found = -1;
+    for( int i_low = 0, i_high = i_count - 1; i_low <= i_high; )
+    {
+        const int i_mid = ( i_low + i_high ) / 2;
+        if( IndexGetPCR( IndexGet( p_index, i_mid ) ) <= i_target_pcr )
+        {
+            i_found = i_mid;
+            i_low = i_mid + 1;
+        }
+        else
+        {
+            i_high = i_mid - 1;
+        }
+    }
+
+    int64_t i_pos = 0;
+    mtime_t i_pcr = p_sys->i_first_pcr;
+    if( i_found >= 0 )
+    {
+        /* Prefer a close random access point */
+        int i_entry = i_found;
+        for( int i = i_found; i >= 0; i-- )
+        {
+            const uint8_t *p_entry = IndexGet( p_index, i );
+            if( i_target_pcr - IndexGetPCR( p_entry ) > TS_INDEX_RAP_WINDOW )
+                break;
+            if( GetQWBE( p_entry ) & TS_INDEX_RAP )
+            {
+                i_entry = i;
+                break;
+            }
+        }
+        const uint8_t *p_entry = IndexGet( p_index, i_entry );
+        i_pcr = IndexGetPCR( p_entry );
+        i_pos = GetQWBE( &p_entry[8] );
+    }
+
+    if( TSSeek( p_demux, i_pos ) )
+        return VLC_EGENERIC;
+    p_sys->i_current_pcr = i_pcr;
+    msg_Dbg( p_demux, "Seek():found position %"PRId64" in the index", i_pos );
+    return VLC_SUCCESS;
+}
+
+/* PES are reassembled into a single per-ES arena instead of a chain of
+ * TS packets: the payload is copied once, at gathering time, and the
+ * resulting block is sent as is without a block_ChainGather() pass.
+ * The arena is sized from the PES_packet_length when the stream sets it,
+ * or from the recent PES sizes of the ES otherwise (video). */
+#define TS_PES_MIN_ALLOC (4 * TS_PACKET_SIZE_188)
+
+static void PESNew( ts_es_t *es )
+{
+    size_t i_alloc = es->i_pes_size > 0 ? (size_t)es->i_pes_size
+                                        : es->i_pes_hint;
+    if( i_alloc < TS_PES_MIN_ALLOC )
+        i_alloc = TS_PES_MIN_ALLOC;
+
+    es->p_pes = block_Alloc( i_alloc );
+    if( !es->p_pes )
+    {
+        es->i_pes_alloc = 0;
+        return;
+    }
+    es->p_pes->i_buffer = 0;
+    es->i_pes_alloc = i_alloc;
+}
+
+static bool PESAppend( ts_es_t *es, const uint8_t *p_data, size_t i_data )
+{
+    block_t *p_pes = es->p_pes;
+    const size_t i_used = p_pes->i_buffer;
 
-    mtime_t i_pcr = GetPCR( p_bk );
-    if( i_pcr >= 0 )
+    if( i_used + i_data > es->i_pes_alloc )
     {
-        if( p_sys->i_pid_ref_pcr == pid->i_pid )
-        {
-            p_sys->i_current_pcr = AdjustPCRWrapAround( p_demux, i_pcr );
-        }
+        size_t i_alloc = 2 * es->i_pes_alloc;
+        if( i_alloc < i_used + i_data )
+            i_alloc = i_used + i_data;
 
-        /* Search program and set the PCR */
-        for( int i = 0; i < p_sys->i_pmt; i++ )
+        /* block_Realloc() only copies the i_buffer bytes in use */
+        p_pes = block_Realloc( p_pes, 0, i_alloc );
+        if( !p_pes )
         {
-            for( int i_prg = 0; i_prg < p_sys->pmt[i]->psi->i_prg; i_prg++ )
-            {
-                if( pid->i_pid == p_sys->pmt[i]->psi->prg[i_prg]->i_pid_pcr )
-                {
-                    p_sys->pmt[i]->psi->prg[i_prg]->i_pcr_value = i_pcr;
-                    es_out_Control( p_demux->out, ES_OUT_SET_GROUP_PCR,
-                                    (int)p_sys->pmt[i]->psi->prg[i_prg]->i_number,
-                                    (int64_t)(VLC_TS_0 + i_pcr * 100 / 9) );
-                }
-            }
+            /* The PES is lost, resynchronize on the next unit start */
+            es->p_pes = NULL;
+            es->i_pes_size = 0;
+            es->i_pes_alloc = 0;
+            return false;
         }
+        p_pes->i_buffer = i_used;
+        es->p_pes = p_pes;
+        es->i_pes_alloc = i_alloc;
     }
+
+    memcpy( &p_pes->p_buffer[i_used], p_data, i_data );
+    p_pes->i_buffer = i_used + i_data;
+    return true;
 }
 
 static bool GatherPES( demux_t *p_demux, ts_pid_t *pid, block_t *p_bk )
@@ -2103,6 +3001,7 @@ static bool GatherPES( demux_t *p_demux, ts_pid_t *pid, block_t *p_bk )
     const bool b_payload    = p[3]&0x10;
     const int  i_cc         = p[3]&0x0f; /* continuity counter */
     bool       b_discontinuity = false;  /* discontinuity */
+    bool       b_random_access = false;
 
     /* transport_scrambling_control is ignored */
     int         i_skip = 0;
@@ -2153,10 +3052,7 @@ static bool GatherPES( demux_t *p_demux, ts_pid_t *pid, block_t *p_bk )
                             pid->i_pid );
                 /* pid->es->p_pes->i_flags |= BLOCK_FLAG_DISCONTINUITY; */
             }
-#if 0
-            if( p[5]&0x40 )
-                msg_Dbg( p_demux, "random access indicator (pid=%d) ", pid->i_pid );
-#endif
+            b_random_access = (p[5]&0x40) ? true : false;
         }
     }
 
@@ -2197,6 +3093,10 @@ static bool GatherPES( demux_t *p_demux, ts_pid_t *pid, block_t *p_bk )
 
     PCRHandle( p_demux, pid, p_bk );
 
+    if( b_random_access && p_demux->p_sys->p_index &&
+        pid->es->fmt.i_cat == VIDEO_ES )
+        IndexAdd( p_demux, p_demux->p_sys->i_current_pcr, true );
+
     if( i_skip >= 188 || pid->es->id == NULL || p_demux->p_sys->b_udp_out )
     {
         block_Release( p_bk );
@@ -2221,8 +3121,8 @@ static bool GatherPES( demux_t *p_demux, ts_pid_t *pid, block_t *p_bk )
     }
 
     /* We have to gather it */
-    p_bk->p_buffer += i_skip;
-    p_bk->i_buffer -= i_skip;
+    const uint8_t *p_payload = &p_bk->p_buffer[i_skip];
+    const size_t   i_payload = p_bk->i_buffer - i_skip;
 
     if( b_unit_start )
     {
@@ -2232,42 +3132,31 @@ static bool GatherPES( demux_t *p_demux, ts_pid_t *pid, block_t *p_bk )
             i_ret = true;
         }
 
-        block_ChainLastAppend( &pid->es->pp_last, p_bk );
-        if( p_bk->i_buffer > 6 )
+        if( i_payload > 6 )
         {
-            pid->es->i_pes_size = GetWBE( &p_bk->p_buffer[4] );
+            pid->es->i_pes_size = GetWBE( &p_payload[4] );
             if( pid->es->i_pes_size > 0 )
             {
                 pid->es->i_pes_size += 6;
             }
         }
-        pid->es->i_pes_gathered += p_bk->i_buffer;
+        PESNew( pid->es );
+    }
+
+    if( pid->es->p_pes == NULL )
+    {
+        /* msg_Dbg( p_demux, "broken packet" ); */
+    }
+    else if( PESAppend( pid->es, p_payload, i_payload ) )
+    {
         if( pid->es->i_pes_size > 0 &&
-            pid->es->i_pes_gathered >= pid->es->i_pes_size )
+            pid->es->p_pes->i_buffer >= (size_t)pid->es->i_pes_size )
         {
             ParsePES( p_demux, pid );
             i_ret = true;
         }
     }
-    else
-    {
-        if( pid->es->p_pes == NULL )
-        {
-            /* msg_Dbg( p_demux, "broken packet" ); */
-            block_Release( p_bk );
-        }
-        else
-        {
-            block_ChainLastAppend( &pid->es->pp_last, p_bk );
-            pid->es->i_pes_gathered += p_bk->i_buffer;
-            if( pid->es->i_pes_size > 0 &&
-                pid->es->i_pes_gathered >= pid->es->i_pes_size )
-            {
-                ParsePES( p_demux, pid );
-                i_ret = true;
-            }
-        }
-    }
+    block_Release( p_bk );
 
     return i_ret;
 }
@@ -2764,6 +3653,8 @@ static bool ProgramIsSelected( demux_t *p_demux, uint16_t i_pgrm )
         return true;
     if( p_sys->i_current_program == i_pgrm )
         return true;
+    if( p_sys->p_split && SplitFind( p_sys->p_split, i_pgrm ) )
+        return true;
 
     if( p_sys->programs_list.i_count != 0 )
     {
@@ -3681,8 +4572,8 @@ static void PMTSetupEsTeletext( demux_t *p_demux, ts_pid_t *pid,
                 p_es->id      = NULL;
                 p_es->p_pes   = NULL;
                 p_es->i_pes_size = 0;
-                p_es->i_pes_gathered = 0;
-                p_es->pp_last = &p_es->p_pes;
+                p_es->i_pes_alloc = 0;
+                p_es->i_pes_hint = 0;
                 p_es->p_mpeg4desc = NULL;
                 p_es->b_gather = false;
 
@@ -3768,8 +4659,8 @@ static void PMTSetupEsDvbSubtitle( demux_t *p_demux, ts_pid_t *pid,
                 p_es->id      = NULL;
                 p_es->p_pes   = NULL;
                 p_es->i_pes_size = 0;
-                p_es->i_pes_gathered = 0;
-                p_es->pp_last = &p_es->p_pes;
+                p_es->i_pes_alloc = 0;
+                p_es->i_pes_hint = 0;
                 p_es->p_mpeg4desc = NULL;
                 p_es->b_gather = false;
 
@@ -4372,7 +5263,7 @@ static void PMTCallBack( demux_t *p_demux, dvbpsi_pmt_t *p_pmt )
             msg_Dbg( p_demux, "  * es pid=%d type=%d *unknown*",
                      p_es->i_pid, p_es->i_type );
         }
-        else if( !p_sys->b_udp_out )
+        else if( !p_sys->b_udp_out && !p_sys->p_split )
         {
             msg_Dbg( p_demux, "  * es pid=%d type=%d fcc=%4.4s",
                      p_es->i_pid, p_es->i_type, (char*)&pid->es->fmt.i_codec );
@@ -4436,13 +5327,16 @@ static void PMTCallBack( demux_t *p_demux, dvbpsi_pmt_t *p_pmt )
         }
 
         if( ProgramIsSelected( p_demux, prg->i_number ) &&
-            ( pid->es->id != NULL || p_sys->b_udp_out ) )
+            ( pid->es->id != NULL || p_sys->b_udp_out || p_sys->p_split ) )
         {
             /* Set demux filter */
             SetPIDFilter( p_demux, p_es->i_pid, true );
         }
     }
 
+    if( p_sys->p_split )
+        SplitSetPMT( p_demux, p_pmt );
+
     /* Set CAM descrambling */
     if( !ProgramIsSelected( p_demux, prg->i_number )
      || stream_Control( p_demux->s, STREAM_CONTROL_ACCESS,
@@ -4562,6 +5456,10 @@ static void PATCallBack( demux_t *p_demux, dvbpsi_pat_t *p_pat )
         free( pmt_rm );
     }
 
+    /* Outputs must exist before the programs are selected */
+    if( p_sys->p_split )
+        SplitSetPAT( p_demux, p_pat );
+
     /* now create programs */
     for( p_program = p_pat->p_first_program; p_program != NULL;
          p_program = p_program->p_next )
@@ -4620,3 +5518,539 @@ static void PATCallBack( demux_t *p_demux, dvbpsi_pat_t *p_pat )
 
     dvbpsi_DeletePAT( p_pat );
 }
+
+/*****************************************************************************
+ * Split mode: every program is written with its own PAT and PMT to a file or
+ * a udp socket, without decoding anything
+ *****************************************************************************/
+#define TS_SPLIT_FILE_PACKETS 348   /* 64 KiB writes */
+
+static int SplitOpen( demux_t *p_demux, const char *psz_split )
+{
+    demux_sys_t    *p_sys = p_demux->p_sys;
+    ts_split_sys_t *p_split;
+    char           *psz_dup, *psz_item, *psz_save;
+
+    p_split = calloc( 1, sizeof(*p_split) );
+    psz_dup = strdup( psz_split );
+    if( !p_split || !psz_dup )
+    {
+        free( p_split );
+        free( psz_dup );
+        return VLC_ENOMEM;
+    }
+
+    for( psz_item = strtok_r( psz_dup, ",", &psz_save ); psz_item != NULL;
+         psz_item = strtok_r( NULL, ",", &psz_save ) )
+    {
+        const size_t i_digits = strspn( psz_item, "0123456789" );
+        int i_number = -1;
+        char *psz_dst = psz_item;
+
+        if( i_digits > 0 && psz_item[i_digits] == '=' )
+        {
+            i_number = atoi( psz_item );
+            psz_dst = &psz_item[i_digits + 1];
+        }
+        else if( !strncmp( psz_item, "*=", 2 ) )
+        {
+            psz_dst = &psz_item[2];
+        }
+
+        if( *psz_dst == '\0' || i_number == 0 )
+        {
+            msg_Err( p_demux, "invalid split destination '%s'", psz_item );
+            continue;
+        }
+        if( i_number < 0 && !strstr( psz_dst, "%d" ) )
+        {
+            msg_Err( p_demux, "split destination '%s' does not contain %%d",
+                     psz_dst );
+            continue;
+        }
+
+        ts_split_dst_t *p_dst = malloc( sizeof(*p_dst) );
+        if( !p_dst )
+            break;
+        p_dst->i_number = i_number;
+        p_dst->psz_dst = strdup( psz_dst );
+        if( !p_dst->psz_dst )
+        {
+            free( p_dst );
+            break;
+        }
+        TAB_APPEND( p_split->i_dst, p_split->pp_dst, p_dst );
+    }
+    free( psz_dup );
+
+    if( p_split->i_dst <= 0 )
+    {
+        free( p_split );
+        return VLC_EGENERIC;
+    }
+
+    p_split->i_udp_packets = var_InheritInteger( p_demux, "ts-out-mtu" ) /
+                             TS_PACKET_SIZE_188;
+    if( p_split->i_udp_packets <= 0 )
+        p_split->i_udp_packets = 1500 / TS_PACKET_SIZE_188;
+    TAB_INIT( p_split->i_out, p_split->pp_out );
+
+    msg_Dbg( p_demux, "splitting programs to %d destination(s)",
+             p_split->i_dst );
+    p_sys->p_split = p_split;
+    return VLC_SUCCESS;
+}
+
+static void SplitFlush( demux_t *p_demux, ts_split_t *p_out )
+{
+    const size_t i_size = p_out->i_buffer * TS_PACKET_SIZE_188;
+    bool b_error;
+
+    if( p_out->i_buffer <= 0 )
+        return;
+
+    if( p_out->fd >= 0 )
+        b_error = net_Write( p_demux, p_out->fd, NULL, p_out->p_buffer,
+                             i_size ) != (ssize_t)i_size;
+    else
+        b_error = fwrite( p_out->p_buffer, 1, i_size, p_out->file ) != i_size;
+
+    if( b_error && p_out->i_errors++ == 0 )
+        msg_Err( p_demux, "cannot write program %d to %s: %m",
+                 p_out->i_number, p_out->psz_dst );
+    p_out->i_buffer = 0;
+}
+
+static void SplitClose( demux_t *p_demux )
+{
+    demux_sys_t    *p_sys = p_demux->p_sys;
+    ts_split_sys_t *p_split = p_sys->p_split;
+
+    for( int i = 0; i < p_split->i_out; i++ )
+    {
+        ts_split_t *p_out = p_split->pp_out[i];
+
+        SplitFlush( p_demux, p_out );
+        msg_Dbg( p_demux, "program %d: %"PRId64" packets written to %s",
+                 p_out->i_number, p_out->i_packets, p_out->psz_dst );
+        if( p_out->i_errors > 0 )
+            msg_Warn( p_demux, "program %d: %"PRId64" writes failed",
+                      p_out->i_number, p_out->i_errors );
+
+        if( p_out->fd >= 0 )
+            net_Close( p_out->fd );
+        else
+            fclose( p_out->file );
+        free( p_out->psz_dst );
+        free( p_out->p_buffer );
+        free( p_out->p_pat );
+        free( p_out->p_pmt );
+        free( p_out );
+    }
+    TAB_CLEAN( p_split->i_out, p_split->pp_out );
+
+    for( int i = 0; i < 8192; i++ )
+        TAB_CLEAN( p_split->route[i].i_out, p_split->route[i].pp_out );
+
+    for( int i = 0; i < p_split->i_dst; i++ )
+    {
+        free( p_split->pp_dst[i]->psz_dst );
+        free( p_split->pp_dst[i] );
+    }
+    TAB_CLEAN( p_split->i_dst, p_split->pp_dst );
+
+    free( p_split );
+    p_sys->p_split = NULL;
+}
+
+static ts_split_t *SplitFind( ts_split_sys_t *p_split, int i_number )
+{
+    for( int i = 0; i < p_split->i_out; i++ )
+    {
+        if( p_split->pp_out[i]->i_number == i_number )
+            return p_split->pp_out[i];
+    }
+    return NULL;
+}
+
+/* Opens the output of a program, returns NULL when it is not split */
+static ts_split_t *SplitNew( demux_t *p_demux, int i_number )
+{
+    ts_split_sys_t *p_split = p_demux->p_sys->p_split;
+    ts_split_dst_t *p_dst = NULL;
+    ts_split_t     *p_out;
+    char           *psz_dst;
+
+    for( int i = 0; i < p_split->i_dst; i++ )
+    {
+        if( p_split->pp_dst[i]->i_number == i_number )
+        {
+            p_dst = p_split->pp_dst[i];
+            break;
+        }
+        if( p_split->pp_dst[i]->i_number < 0 && !p_dst )
+            p_dst = p_split->pp_dst[i];
+    }
+    if( !p_dst )
+        return NULL;
+
+    /* The destination is not used as a format string */
+    const char *psz_number = strstr( p_dst->psz_dst, "%d" );
+    if( psz_number )
+    {
+        if( asprintf( &psz_dst, "%.*s%d%s",
+                      (int)(psz_number - p_dst->psz_dst), p_dst->psz_dst,
+                      i_number, &psz_number[2] ) < 0 )
+            return NULL;
+    }
+    else
+    {
+        psz_dst = strdup( p_dst->psz_dst );
+        if( !psz_dst )
+            return NULL;
+    }
+
+    p_out = calloc( 1, sizeof(*p_out) );
+    if( !p_out )
+    {
+        free( psz_dst );
+        return NULL;
+    }
+    p_out->i_number = i_number;
+    p_out->i_pmt_pid = -1;
+    p_out->psz_dst = psz_dst;
+    p_out->fd = -1;
+
+    if( !strncmp( psz_dst, "udp://", 6 ) )
+    {
+        char *psz_host = strdup( &psz_dst[6] );
+        char *psz_port = NULL;
+        int   i_port = 0;
+
+        if( psz_host && psz_host[0] == '[' )
+        {
+            /* IPv6 address */
+            char *psz_end = strchr( psz_host, ']' );
+            if( psz_end )
+            {
+                *psz_end = '\0';
+                if( psz_end[1] == ':' )
+                    psz_port = &psz_end[2];
+            }
+            memmove( psz_host, &psz_host[1], strlen( psz_host ) );
+        }
+        else if( psz_host )
+        {
+            psz_port = strchr( psz_host, ':' );
+            if( psz_port )
+                *psz_port++ = '\0';
+        }
+        if( psz_port )
+            i_port = atoi( psz_port );
+        if( i_port <= 0 )
+            i_port = 1234;
+
+        if( psz_host )
+            p_out->fd = net_ConnectUDP( VLC_OBJECT(p_demux), psz_host,
+                                        i_port, -1 );
+        free( psz_host );
+        p_out->i_buffer_max = p_split->i_udp_packets;
+    }
+    else
+    {
+        p_out->file = vlc_fopen( psz_dst, "wb" );
+        p_out->i_buffer_max = TS_SPLIT_FILE_PACKETS;
+    }
+
+    if( p_out->fd < 0 && !p_out->file )
+    {
+        msg_Err( p_demux, "cannot open %s for program %d", psz_dst,
+                 i_number );
+        free( psz_dst );
+        free( p_out );
+        return NULL;
+    }
+    p_out->p_buffer = xmalloc( p_out->i_buffer_max * TS_PACKET_SIZE_188 );
+
+    msg_Dbg( p_demux, "program %d is written to %s", i_number, psz_dst );
+    return p_out;
+}
+
+static void SplitRoute( ts_split_sys_t *p_split, ts_split_t *p_out,
+                        int i_pid )
+{
+    ts_split_route_t *p_route = &p_split->route[i_pid];
+    int i_index;
+
+    TAB_FIND( p_route->i_out, p_route->pp_out, p_out, i_index );
+    if( i_index < 0 )
+        TAB_APPEND( p_route->i_out, p_route->pp_out, p_out );
+}
+
+static void SplitUnroute( ts_split_sys_t *p_split, ts_split_t *p_out )
+{
+    for( int i = 0; i < 8192; i++ )
+    {
+        ts_split_route_t *p_route = &p_split->route[i];
+
+        if( p_route->i_out > 0 )
+            TAB_REMOVE( p_route->i_out, p_route->pp_out, p_out );
+    }
+}
+
+/* Cuts PSI sections into TS packets, each section starting a packet. The
+ * continuity counter is set when the packets are written. */
+static int SplitPacketizePSI( uint8_t **pp_packets, int i_pid,
+                              dvbpsi_psi_section_t *p_section )
+{
+    uint8_t *p_packets = NULL;
+    int     i_packets = 0;
+
+    for( ; p_section != NULL; p_section = p_section->p_next )
+    {
+        const uint8_t *p_data = p_section->p_data;
+        size_t i_size = p_section->p_payload_end - p_section->p_data +
+                        ( p_section->b_syntax_indicator ? 4 : 0 );
+        bool b_start = true;
+
+        while( i_size > 0 )
+        {
+            uint8_t *p;
+            int     i_header = 4;
+
+            p_packets = xrealloc( p_packets,
+                                  ( i_packets + 1 ) * TS_PACKET_SIZE_188 );
+            p = &p_packets[i_packets++ * TS_PACKET_SIZE_188];
+
+            p[0] = 0x47;
+            p[1] = ( b_start ? 0x40 : 0x00 ) | ( ( i_pid >> 8 )&0x1f );
+            p[2] = i_pid & 0xff;
+            p[3] = 0x10;                /* payload only */
+            if( b_start )
+                p[i_header++] = 0x00;   /* pointer_field */
+
+            const size_t i_copy = __MIN( i_size,
+                                         (size_t)(TS_PACKET_SIZE_188 - i_header) );
+            memcpy( &p[i_header], p_data, i_copy );
+            memset( &p[i_header + i_copy], 0xff,
+                    TS_PACKET_SIZE_188 - i_header - i_copy );
+
+            p_data += i_copy;
+            i_size -= i_copy;
+            b_start = false;
+        }
+    }
+    *pp_packets = p_packets;
+    return i_packets;
+}
+
+static void SplitWrite( demux_t *p_demux, ts_split_t *p_out,
+                        const uint8_t *p_packet )
+{
+    memcpy( &p_out->p_buffer[p_out->i_buffer++ * TS_PACKET_SIZE_188],
+            p_packet, TS_PACKET_SIZE_188 );
+    p_out->i_packets++;
+
+    if( p_out->i_buffer >= p_out->i_buffer_max )
+        SplitFlush( p_demux, p_out );
+}
+
+static void SplitWritePSI( demux_t *p_demux, ts_split_t *p_out,
+                           const uint8_t *p_packets, int i_packets,
+                           int *pi_cc )
+{
+    for( int i = 0; i < i_packets; i++ )
+    {
+        uint8_t packet[TS_PACKET_SIZE_188];
+
+        memcpy( packet, &p_packets[i * TS_PACKET_SIZE_188],
+                TS_PACKET_SIZE_188 );
+        packet[3] = 0x10 | ( *pi_cc & 0x0f );
+        *pi_cc = ( *pi_cc + 1 ) & 0x0f;
+        SplitWrite( p_demux, p_out, packet );
+    }
+}
+
+/* Writes a TS packet of the multiplex to the outputs it belongs to. The PAT
+ * and PMT are replaced by the regenerated ones, at the same rate. */
+static void SplitPacket( demux_t *p_demux, ts_pid_t *p_pid, block_t *p_pkt )
+{
+    demux_sys_t    *p_sys = p_demux->p_sys;
+    ts_split_sys_t *p_split = p_sys->p_split;
+    const uint8_t  *p = p_pkt->p_buffer;
+    const bool      b_start = p[1]&0x40;
+
+    if( p_pid->i_pid == 0 )
+    {
+        if( !b_start )
+            return;
+        for( int i = 0; i < p_split->i_out; i++ )
+        {
+            ts_split_t *p_out = p_split->pp_out[i];
+
+            if( p_out->i_pmt_packets > 0 )
+                SplitWritePSI( p_demux, p_out, p_out->p_pat,
+                               p_out->i_pat_packets, &p_out->i_pat_cc );
+        }
+        return;
+    }
+
+    const ts_split_route_t *p_route = &p_split->route[p_pid->i_pid];
+    if( p_route->i_out <= 0 )
+        return;
+
+    /* Packets of a pid declared in the middle of a chunk were not
+     * descrambled with the rest of the chunk */
+    if( (p[3]&0x80) && p_sys->csa && p_pid->b_valid && !p_pid->psi )
+    {
+        vlc_mutex_lock( &p_sys->csa_lock );
+        csa_Decrypt( p_sys->csa, p_pkt->p_buffer, p_sys->i_csa_pkt_size );
+        vlc_mutex_unlock( &p_sys->csa_lock );
+    }
+
+    for( int i = 0; i < p_route->i_out; i++ )
+    {
+        ts_split_t *p_out = p_route->pp_out[i];
+
+        if( p_pid->i_pid != p_out->i_pmt_pid )
+            SplitWrite( p_demux, p_out, p );
+        else if( b_start && p_out->i_pmt_packets > 0 )
+            SplitWritePSI( p_demux, p_out, p_out->p_pmt,
+                           p_out->i_pmt_packets, &p_out->i_pmt_cc );
+    }
+}
+
+/* Opens the outputs of the new programs and regenerates their PAT */
+static void SplitSetPAT( demux_t *p_demux, dvbpsi_pat_t *p_pat )
+{
+    ts_split_sys_t       *p_split = p_demux->p_sys->p_split;
+    dvbpsi_pat_program_t *p_program;
+
+    /* Programs that are gone stay silent until they come back */
+    for( int i = 0; i < p_split->i_out; i++ )
+    {
+        ts_split_t *p_out = p_split->pp_out[i];
+
+        for( p_program = p_pat->p_first_program; p_program != NULL;
+             p_program = p_program->p_next )
+        {
+            if( p_program->i_number == p_out->i_number )
+                break;
+        }
+        if( p_program || p_out->i_pmt_pid < 0 )
+            continue;
+
+        msg_Dbg( p_demux, "program %d removed from the PAT", p_out->i_number );
+        SplitUnroute( p_split, p_out );
+        p_out->i_pmt_pid = -1;
+        FREENULL( p_out->p_pmt );
+        p_out->i_pmt_packets = 0;
+    }
+
+    for( p_program = p_pat->p_first_program; p_program != NULL;
+         p_program = p_program->p_next )
+    {
+        ts_split_t *p_out;
+
+        if( p_program->i_number == 0 )
+            continue;
+
+        p_out = SplitFind( p_split, p_program->i_number );
+        if( !p_out )
+        {
+            p_out = SplitNew( p_demux, p_program->i_number );
+            if( !p_out )
+                continue;
+            TAB_APPEND( p_split->i_out, p_split->pp_out, p_out );
+        }
+
+        if( p_out->i_pmt_pid != p_program->i_pid )
+        {
+            /* The pids are routed again with the next PMT */
+            SplitUnroute( p_split, p_out );
+            FREENULL( p_out->p_pmt );
+            p_out->i_pmt_packets = 0;
+            p_out->i_pmt_pid = p_program->i_pid;
+            SplitRoute( p_split, p_out, p_out->i_pmt_pid );
+        }
+
+        dvbpsi_pat_t         pat;
+        dvbpsi_psi_section_t *p_section;
+
+        dvbpsi_InitPAT( &pat, p_pat->i_ts_id, p_pat->i_version, 1 );
+        dvbpsi_PATAddProgram( &pat, p_program->i_number, p_program->i_pid );
+        p_section = dvbpsi_GenPATSections( &pat, 0 );
+
+        free( p_out->p_pat );
+        p_out->i_pat_packets = SplitPacketizePSI( &p_out->p_pat, 0,
+                                                  p_section );
+
+        dvbpsi_DeletePSISections( p_section );
+        dvbpsi_EmptyPAT( &pat );
+    }
+}
+
+/* Routes the pids of a program to its output and regenerates its PMT */
+static void SplitSetPMT( demux_t *p_demux, dvbpsi_pmt_t *p_pmt )
+{
+    demux_sys_t          *p_sys = p_demux->p_sys;
+    ts_split_sys_t       *p_split = p_sys->p_split;
+    ts_split_t           *p_out;
+    dvbpsi_descriptor_t  *p_dr;
+    dvbpsi_pmt_es_t      *p_es;
+    dvbpsi_pmt_t         pmt;
+    dvbpsi_psi_section_t *p_section;
+    int                  i_pids = 0;
+
+    p_out = SplitFind( p_split, p_pmt->i_program_number );
+    if( !p_out || p_out->i_pmt_pid < 0 )
+        return;
+
+    /* The CA descriptors are dropped when we descramble ourselves */
+    const bool b_clear = p_sys->csa != NULL;
+
+    SplitUnroute( p_split, p_out );
+    SplitRoute( p_split, p_out, p_out->i_pmt_pid );
+    if( p_pmt->i_pcr_pid != 0x1fff )
+        SplitRoute( p_split, p_out, p_pmt->i_pcr_pid );
+
+    dvbpsi_InitPMT( &pmt, p_pmt->i_program_number, p_pmt->i_version, 1,
+                    p_pmt->i_pcr_pid );
+    for( p_dr = p_pmt->p_first_descriptor; p_dr != NULL; p_dr = p_dr->p_next )
+    {
+        if( !b_clear || p_dr->i_tag != 0x09 )
+            dvbpsi_PMTAddDescriptor( &pmt, p_dr->i_tag, p_dr->i_length,
+                                     p_dr->p_data );
+    }
+    for( p_es = p_pmt->p_first_es; p_es != NULL; p_es = p_es->p_next )
+    {
+        dvbpsi_pmt_es_t *p_new = dvbpsi_PMTAddES( &pmt, p_es->i_type,
+                                                  p_es->i_pid );
+        for( p_dr = p_es->p_first_descriptor; p_dr != NULL;
+             p_dr = p_dr->p_next )
+        {
+            if( !b_clear || p_dr->i_tag != 0x09 )
+                dvbpsi_PMTESAddDescriptor( p_new, p_dr->i_tag,
+                                           p_dr->i_length, p_dr->p_data );
+        }
+        SplitRoute( p_split, p_out, p_es->i_pid );
+        i_pids++;
+    }
+    p_section = dvbpsi_GenPMTSections( &pmt );
+
+    free( p_out->p_pmt );
+    p_out->i_pmt_packets = SplitPacketizePSI( &p_out->p_pmt,
+                                              p_out->i_pmt_pid, p_section );
+
+    dvbpsi_DeletePSISections( p_section );
+    dvbpsi_EmptyPMT( &pmt );
+
+    msg_Dbg( p_demux, "program %d: %d es written to %s",
+             p_out->i_number, i_pids, p_out->psz_dst );
+
+    /* Start with the PSI so that the output can be read from here */
+    SplitWritePSI( p_demux, p_out, p_out->p_pat, p_out->i_pat_packets,
+                   &p_out->i_pat_cc );
+    SplitWritePSI( p_demux, p_out, p_out->p_pmt, p_out->i_pmt_packets,
+                   &p_out->i_pmt_cc );
+}
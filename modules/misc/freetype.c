@@ -136,6 +136,10 @@ static const char *const ppsz_sizes_text[] = {
 #define YUVP_TEXT N_("Use YUVP renderer")
 #define YUVP_LONGTEXT N_("This renders the font using \"paletized YUV\". " \
   "This option is only needed if you want to encode into DVB subtitles" )
+#define CACHE_TEXT N_("Glyph cache size")
+#define CACHE_LONGTEXT N_("Memory used to keep rendered glyphs, in kilobytes, " \
+    "so that they are not rasterized again for every subtitle. " \
+    "0 disables the cache." )
 #define EFFECT_TEXT N_("Font Effect")
 #define EFFECT_LONGTEXT N_("It is possible to apply effects to the rendered " \
 "text to improve its readability." )
@@ -199,6 +203,8 @@ vlc_module_begin ()
 
     add_bool( "freetype-yuvp", false, NULL, YUVP_TEXT,
               YUVP_LONGTEXT, true )
+    add_integer( "freetype-cache-size", 4096, NULL, CACHE_TEXT,
+                 CACHE_LONGTEXT, true )
     set_capability( "text renderer", 100 )
     add_shortcut( "text" )
     set_callbacks( Create, Destroy )
@@ -279,6 +285,45 @@ static int Render( filter_t *, subpicture_region_t *, line_desc_t *, int, int);
 static void FreeLines( line_desc_t * );
 static void FreeLine( line_desc_t * );
 
+/* Glyph cache: rasterized glyphs of the default face, keyed by size,
+ * synthetic style and glyph index, evicted least recently used first */
+#define GLYPH_HALFWIDTH 0x01
+#define GLYPH_BOLD      0x02
+#define GLYPH_ITALIC    0x04
+
+#define GLYPH_CACHE_BUCKETS 1024
+
+typedef struct glyph_cache_entry_t glyph_cache_entry_t;
+struct glyph_cache_entry_t
+{
+    FT_UInt         i_index;
+    uint32_t        i_size;     /* x_ppem << 16 | y_ppem */
+    int             i_flags;
+
+    FT_BitmapGlyph  p_glyph;
+    FT_BBox         bbox;       /* outline control box, in pixels */
+    FT_Pos          i_advance;  /* 26.6 */
+    size_t          i_bytes;
+
+    glyph_cache_entry_t *p_hash_next;
+    glyph_cache_entry_t *p_lru_prev;    /* more recently used */
+    glyph_cache_entry_t *p_lru_next;    /* less recently used */
+};
+
+typedef struct
+{
+    glyph_cache_entry_t *pp_bucket[GLYPH_CACHE_BUCKETS];
+    glyph_cache_entry_t *p_lru_first;
+    glyph_cache_entry_t *p_lru_last;
+    size_t               i_bytes;
+    size_t               i_max_bytes;   /* 0 if disabled */
+
+    uint64_t             i_hits;
+    uint64_t             i_misses;
+} glyph_cache_t;
+
+static void GlyphCacheClean( glyph_cache_t * );
+
 /*****************************************************************************
  * filter_sys_t: freetype local data
  *****************************************************************************
@@ -307,6 +352,8 @@ struct filter_sys_t
 
     input_attachment_t **pp_font_attachments;
     int                  i_font_attachments;
+
+    glyph_cache_t  glyph_cache;
 };
 
 #define UCHAR uint32_t
@@ -342,6 +389,10 @@ static int Create( vlc_object_t *p_this )
     p_sys->i_font_size = 0;
     p_sys->i_display_height = 0;
 
+    memset( &p_sys->glyph_cache, 0, sizeof(p_sys->glyph_cache) );
+    p_sys->glyph_cache.i_max_bytes = 1024 *
+        __MAX( var_InheritInteger( p_filter, "freetype-cache-size" ), 0 );
+
     var_Create( p_filter, "freetype-rel-fontsize",
                 VLC_VAR_INTEGER | VLC_VAR_DOINHERIT );
 
@@ -486,6 +537,11 @@ static void Destroy( vlc_object_t *p_this )
      * even if no other library functions have been made since FcInit(),
      * so don't call it. */
 
+    if( p_sys->glyph_cache.i_hits || p_sys->glyph_cache.i_misses )
+        msg_Dbg( p_filter, "glyph cache: %"PRIu64" hits, %"PRIu64" misses",
+                 p_sys->glyph_cache.i_hits, p_sys->glyph_cache.i_misses );
+    GlyphCacheClean( &p_sys->glyph_cache );
+
     FT_Done_Face( p_sys->p_face );
     FT_Done_FreeType( p_sys->p_library );
     free( p_sys );
@@ -1010,6 +1066,181 @@ static int RenderYUVA( filter_t *p_filter, subpicture_region_t *p_region,
  * needed glyphs into memory. It is used as pf_add_string callback in
  * the vout method by this module
  */
+/*****************************************************************************
+ * Glyph cache
+ *****************************************************************************/
+static void GlyphCacheUnlink( glyph_cache_t *p_cache, glyph_cache_entry_t *p_entry )
+{
+    if( p_entry->p_lru_prev )
+        p_entry->p_lru_prev->p_lru_next = p_entry->p_lru_next;
+    else
+        p_cache->p_lru_first = p_entry->p_lru_next;
+    if( p_entry->p_lru_next )
+        p_entry->p_lru_next->p_lru_prev = p_entry->p_lru_prev;
+    else
+        p_cache->p_lru_last = p_entry->p_lru_prev;
+}
+
+static void GlyphCachePushFront( glyph_cache_t *p_cache, glyph_cache_entry_t *p_entry )
+{
+    p_entry->p_lru_prev = NULL;
+    p_entry->p_lru_next = p_cache->p_lru_first;
+    if( p_cache->p_lru_first )
+        p_cache->p_lru_first->p_lru_prev = p_entry;
+    else
+        p_cache->p_lru_last = p_entry;
+    p_cache->p_lru_first = p_entry;
+}
+
+static unsigned GlyphCacheHash( FT_UInt i_index, uint32_t i_size, int i_flags )
+{
+    uint32_t h = i_index * 2654435761u ^ i_size * 40503u ^ i_flags;
+    return ( h ^ ( h >> 16 ) ) % GLYPH_CACHE_BUCKETS;
+}
+
+static void GlyphCacheDelete( glyph_cache_t *p_cache, glyph_cache_entry_t *p_entry )
+{
+    glyph_cache_entry_t **pp = &p_cache->pp_bucket[
+        GlyphCacheHash( p_entry->i_index, p_entry->i_size, p_entry->i_flags )];
+    while( *pp != p_entry )
+        pp = &(*pp)->p_hash_next;
+    *pp = p_entry->p_hash_next;
+
+    GlyphCacheUnlink( p_cache, p_entry );
+    p_cache->i_bytes -= p_entry->i_bytes;
+    FT_Done_Glyph( (FT_Glyph)p_entry->p_glyph );
+    free( p_entry );
+}
+
+static void GlyphCacheClean( glyph_cache_t *p_cache )
+{
+    while( p_cache->p_lru_first )
+        GlyphCacheDelete( p_cache, p_cache->p_lru_first );
+}
+
+/**
+ * Loads and rasterizes a glyph, applying the synthetic styles of i_flags.
+ * Glyphs of the default face come from the cache when possible.
+ * On success *pp_glyph is a bitmap glyph owned by the caller.
+ * \return 0 on success, 1 if the glyph cannot be rasterized and should be
+ * skipped, -1 on error
+ */
+static int LoadGlyph( filter_t *p_filter, FT_Face p_face, FT_UInt i_index,
+                      int i_flags, FT_BitmapGlyph *pp_glyph, FT_BBox *p_bbox,
+                      FT_Pos *pi_advance )
+{
+    filter_sys_t *p_sys = p_filter->p_sys;
+    glyph_cache_t *p_cache = &p_sys->glyph_cache;
+    const bool b_cache = p_cache->i_max_bytes > 0 && p_face == p_sys->p_face;
+    const uint32_t i_size = ( p_face->size->metrics.x_ppem << 16 ) |
+                              p_face->size->metrics.y_ppem;
+    const unsigned i_hash = GlyphCacheHash( i_index, i_size, i_flags );
+    FT_Glyph tmp_glyph;
+    int i_error;
+
+    if( b_cache )
+    {
+        glyph_cache_entry_t *p_entry;
+        for( p_entry = p_cache->pp_bucket[i_hash]; p_entry;
+             p_entry = p_entry->p_hash_next )
+        {
+            if( p_entry->i_index == i_index && p_entry->i_size == i_size &&
+                p_entry->i_flags == i_flags )
+                break;
+        }
+        if( p_entry && !FT_Glyph_Copy( (FT_Glyph)p_entry->p_glyph, &tmp_glyph ) )
+        {
+            GlyphCacheUnlink( p_cache, p_entry );
+            GlyphCachePushFront( p_cache, p_entry );
+            p_cache->i_hits++;
+
+            *pp_glyph = (FT_BitmapGlyph)tmp_glyph;
+            *p_bbox = p_entry->bbox;
+            *pi_advance = p_entry->i_advance;
+            return 0;
+        }
+        p_cache->i_misses++;
+    }
+
+    i_error = FT_Load_Glyph( p_face, i_index, FT_LOAD_NO_BITMAP | FT_LOAD_DEFAULT );
+    if( i_error )
+    {
+        i_error = FT_Load_Glyph( p_face, i_index, FT_LOAD_DEFAULT );
+        if( i_error )
+        {
+            msg_Err( p_filter, "unable to render text FT_Load_Glyph returned"
+                               " %d", i_error );
+            return -1;
+        }
+    }
+
+    /* Do synthetic styling now that Freetype supports it */
+    if( i_flags & GLYPH_BOLD )
+        FT_GlyphSlot_Embolden( p_face->glyph );
+    if( i_flags & GLYPH_ITALIC )
+        FT_GlyphSlot_Oblique( p_face->glyph );
+
+    i_error = FT_Get_Glyph( p_face->glyph, &tmp_glyph );
+    if( i_error )
+    {
+        msg_Err( p_filter, "unable to render text FT_Get_Glyph returned "
+                           "%d", i_error );
+        return -1;
+    }
+    if( ( i_flags & GLYPH_HALFWIDTH ) &&
+        tmp_glyph->format == FT_GLYPH_FORMAT_OUTLINE )
+    {
+        FT_Matrix scale = { 1<<15, 0, 0,
+                            1<<16 };
+        FT_Outline *outl = &((FT_OutlineGlyph) tmp_glyph)->outline;
+        FT_Outline_Transform(outl, &scale);
+        FT_Outline_Translate(outl, 0, 0);
+        p_face->glyph->advance.x *= 0.5;
+    }
+    FT_Glyph_Get_CBox( tmp_glyph, ft_glyph_bbox_pixels, p_bbox );
+    i_error = FT_Glyph_To_Bitmap( &tmp_glyph, FT_RENDER_MODE_NORMAL, 0, 1);
+    if( i_error )
+    {
+        FT_Done_Glyph( tmp_glyph );
+        return 1;
+    }
+    *pp_glyph = (FT_BitmapGlyph)tmp_glyph;
+    *pi_advance = p_face->glyph->advance.x;
+
+    if( !b_cache )
+        return 0;
+
+    /* Keep a copy of the bitmap for the next times */
+    glyph_cache_entry_t *p_entry = malloc( sizeof(*p_entry) );
+    if( !p_entry )
+        return 0;
+    if( FT_Glyph_Copy( tmp_glyph, &tmp_glyph ) )
+    {
+        free( p_entry );
+        return 0;
+    }
+    p_entry->i_index = i_index;
+    p_entry->i_size = i_size;
+    p_entry->i_flags = i_flags;
+    p_entry->p_glyph = (FT_BitmapGlyph)tmp_glyph;
+    p_entry->bbox = *p_bbox;
+    p_entry->i_advance = *pi_advance;
+    p_entry->i_bytes = sizeof(*p_entry) + sizeof(FT_BitmapGlyphRec) +
+        (size_t)abs( p_entry->p_glyph->bitmap.pitch ) *
+                     p_entry->p_glyph->bitmap.rows;
+
+    p_entry->p_hash_next = p_cache->pp_bucket[i_hash];
+    p_cache->pp_bucket[i_hash] = p_entry;
+    GlyphCachePushFront( p_cache, p_entry );
+    p_cache->i_bytes += p_entry->i_bytes;
+
+    while( p_cache->i_bytes > p_cache->i_max_bytes &&
+           p_cache->p_lru_last != p_entry )
+        GlyphCacheDelete( p_cache, p_cache->p_lru_last );
+
+    return 0;
+}
+
 static int RenderText( filter_t *p_filter, subpicture_region_t *p_region_out,
                        subpicture_region_t *p_region_in )
 {
@@ -1028,7 +1259,8 @@ static int RenderText( filter_t *p_filter, subpicture_region_t *p_region_out,
     FT_BBox line;
     FT_BBox glyph_size;
     FT_Vector result;
-    FT_Glyph tmp_glyph;
+    FT_BitmapGlyph p_glyph;
+    FT_Pos i_advance;
 
     /* Sanity check */
     if( !p_region_in || !p_region_out ) return VLC_EGENERIC;
@@ -1213,44 +1445,18 @@ static int RenderText( filter_t *p_filter, subpicture_region_t *p_region_out,
 
         p_line->p_glyph_pos[ i ].x = i_pen_x;
         p_line->p_glyph_pos[ i ].y = i_pen_y;
-        i_error = FT_Load_Glyph( face, i_glyph_index, FT_LOAD_NO_BITMAP | FT_LOAD_DEFAULT );
-        if( i_error )
-        {
-            i_error = FT_Load_Glyph( face, i_glyph_index, FT_LOAD_DEFAULT );
-            if( i_error )
-            {
-                msg_Err( p_filter, "unable to render text FT_Load_Glyph returned"
-                                   " %d", i_error );
-                goto error;
-            }
-        }
-        i_error = FT_Get_Glyph( glyph, &tmp_glyph );
-        if( i_error )
-        {
-            msg_Err( p_filter, "unable to render text FT_Get_Glyph returned "
-                               "%d", i_error );
+        i_error = LoadGlyph( p_filter, face, i_glyph_index,
+                             b_halfsize ? GLYPH_HALFWIDTH : 0,
+                             &p_glyph, &glyph_size, &i_advance );
+        if( i_error < 0 )
             goto error;
-        }
-	if (b_halfsize) {
-    FT_Matrix scale = { 1<<15, 0, 0,
-                        1<<16 };
-    FT_Outline *outl = &((FT_OutlineGlyph) tmp_glyph)->outline;
-    FT_Outline_Transform(outl, &scale);
-    FT_Outline_Translate(outl, 0, 0);
-    glyph->advance.x *= 0.5;
-	} 
-        FT_Glyph_Get_CBox( tmp_glyph, ft_glyph_bbox_pixels, &glyph_size );
-        i_error = FT_Glyph_To_Bitmap( &tmp_glyph, ft_render_mode_normal, 0, 1);
-        if( i_error )
-        {
-            FT_Done_Glyph( tmp_glyph );
+        if( i_error > 0 )
             continue;
-        }
-        p_line->pp_glyphs[ i ] = (FT_BitmapGlyph)tmp_glyph;
+        p_line->pp_glyphs[ i ] = p_glyph;
 
         /* Do rest */
         line.xMax = p_line->p_glyph_pos[i].x + glyph_size.xMax -
-            glyph_size.xMin + ((FT_BitmapGlyph)tmp_glyph)->left;
+            glyph_size.xMin + p_glyph->left;
         if( line.xMax > (int)p_filter->fmt_out.video.i_visible_width - 20 )
         {
             FT_Done_Glyph( (FT_Glyph)p_line->pp_glyphs[ i ] );
@@ -1295,7 +1501,7 @@ static int RenderText( filter_t *p_filter, subpicture_region_t *p_region_out,
         line.yMin = __MIN( line.yMin, glyph_size.yMin );
 
         i_previous = i_glyph_index;
-        i_pen_x += glyph->advance.x >> 6;
+        i_pen_x += i_advance >> 6;
         i++;
     }
 
@@ -1508,7 +1714,8 @@ static int RenderTag( filter_t *p_filter, FT_Face p_face, int i_font_color,
     while( *psz_unicode && ( *psz_unicode != '\n' ) )
     {
         FT_BBox glyph_size;
-        FT_Glyph tmp_glyph;
+        FT_BitmapGlyph p_glyph;
+        FT_Pos i_advance;
         int i_error;
 
         int i_glyph_index = FT_Get_Char_Index( p_face, *psz_unicode++ );
@@ -1523,43 +1730,25 @@ static int RenderTag( filter_t *p_filter, FT_Face p_face, int i_font_color,
         p_line->p_glyph_pos[ i ].x = *pi_pen_x;
         p_line->p_glyph_pos[ i ].y = i_pen_y;
 
-        i_error = FT_Load_Glyph( p_face, i_glyph_index, FT_LOAD_NO_BITMAP | FT_LOAD_DEFAULT );
-        if( i_error )
-        {
-            i_error = FT_Load_Glyph( p_face, i_glyph_index, FT_LOAD_DEFAULT );
-            if( i_error )
-            {
-                msg_Err( p_filter,
-                       "unable to render text FT_Load_Glyph returned %d", i_error );
-                p_line->pp_glyphs[ i ] = NULL;
-                return VLC_EGENERIC;
-            }
-        }
-
         /* Do synthetic styling now that Freetype supports it;
          * ie. if the font we have loaded is NOT already in the
          * style that the tags want, then switch it on; if they
          * are then don't. */
+        int i_flags = 0;
         if (b_bold && !( p_face->style_flags & FT_STYLE_FLAG_BOLD ))
-            FT_GlyphSlot_Embolden( p_face->glyph );
+            i_flags |= GLYPH_BOLD;
         if (b_italic && !( p_face->style_flags & FT_STYLE_FLAG_ITALIC ))
-            FT_GlyphSlot_Oblique( p_face->glyph );
+            i_flags |= GLYPH_ITALIC;
 
-        i_error = FT_Get_Glyph( p_face->glyph, &tmp_glyph );
-        if( i_error )
+        i_error = LoadGlyph( p_filter, p_face, i_glyph_index, i_flags,
+                             &p_glyph, &glyph_size, &i_advance );
+        if( i_error < 0 )
         {
-            msg_Err( p_filter,
-                    "unable to render text FT_Get_Glyph returned %d", i_error );
             p_line->pp_glyphs[ i ] = NULL;
             return VLC_EGENERIC;
         }
-        FT_Glyph_Get_CBox( tmp_glyph, ft_glyph_bbox_pixels, &glyph_size );
-        i_error = FT_Glyph_To_Bitmap( &tmp_glyph, FT_RENDER_MODE_NORMAL, 0, 1);
-        if( i_error )
-        {
-            FT_Done_Glyph( tmp_glyph );
+        if( i_error > 0 )
             continue;
-        }
         if( b_uline || b_through )
         {
             float aOffset = FT_FLOOR(FT_MulFix(p_face->underline_position,
@@ -1584,13 +1773,13 @@ static int RenderTag( filter_t *p_filter, FT_Face p_face, int i_font_color,
             }
         }
 
-        p_line->pp_glyphs[ i ] = (FT_BitmapGlyph)tmp_glyph;
+        p_line->pp_glyphs[ i ] = p_glyph;
         p_line->p_fg_rgb[ i ] = i_font_color & 0x00ffffff;
         p_line->p_bg_rgb[ i ] = i_karaoke_bgcolor & 0x00ffffff;
         p_line->p_fg_bg_ratio[ i ] = 0x00;
 
         line.xMax = p_line->p_glyph_pos[i].x + glyph_size.xMax -
-                    glyph_size.xMin + ((FT_BitmapGlyph)tmp_glyph)->left;
+                    glyph_size.xMin + p_glyph->left;
         if( line.xMax > (int)p_filter->fmt_out.video.i_visible_width - 20 )
         {
             for( ; i >= *pi_start; i-- )
@@ -1638,7 +1827,7 @@ static int RenderTag( filter_t *p_filter, FT_Face p_face, int i_font_color,
         line.yMin = __MIN( line.yMin, glyph_size.yMin );
 
         i_previous = i_glyph_index;
-        *pi_pen_x += p_face->glyph->advance.x >> 6;
+        *pi_pen_x += i_advance >> 6;
         i++;
     }
     p_line->i_width = line.xMax;
@@ -30,6 +30,8 @@
 
 #include "csa.h"
 
+typedef struct csa_batch_t csa_batch_t;
+
 struct csa_t
 {
     /* odd and even keys */
@@ -47,6 +49,9 @@ struct csa_t
     int     p, q, r;
 
     bool    use_odd;
+
+    /* batch processing buffers, allocated on first use */
+    csa_batch_t *batch;
 };
 
 static void csa_ComputeKey( uint8_t kk[57], uint8_t ck[8] );
@@ -69,6 +74,7 @@ csa_t *csa_New( void )
  *****************************************************************************/
 void csa_Delete( csa_t *c )
 {
+    free( c->batch );
     free( c );
 }
 
@@ -610,3 +616,875 @@ static void csa_BlockCypher( uint8_t kk[57], uint8_t bd[8], uint8_t ib[8] )
     }
 }
 
+/*****************************************************************************
+ * Batch processing
+ *****************************************************************************
+ * The stream cypher is bit-sliced: bit b of each register of up to
+ * CSA_BATCH packets is stored in one machine word, so that one boolean
+ * operation steps the cypher of all the packets at once.
+ * The block cypher of independent blocks is byte-sliced: the rounds of all
+ * the blocks are interleaved, which hides the latency of the table lookups.
+ *****************************************************************************/
+#if defined(__SSE2__)
+# include <emmintrin.h>
+
+typedef __m128i csa_bs_t;
+# define BS_ZERO        _mm_setzero_si128()
+# define BS_ONES        _mm_set1_epi32( -1 )
+# define BS_AND( a, b ) _mm_and_si128( a, b )
+# define BS_OR( a, b )  _mm_or_si128( a, b )
+# define BS_XOR( a, b ) _mm_xor_si128( a, b )
+# define BS_ANDN( a, b ) _mm_andnot_si128( a, b )
+# define BS_NOT( a )    _mm_xor_si128( a, BS_ONES )
+#else
+typedef uint64_t csa_bs_t;
+# define BS_ZERO        UINT64_C(0)
+# define BS_ONES        UINT64_C(0xffffffffffffffff)
+# define BS_AND( a, b ) ((a) & (b))
+# define BS_OR( a, b )  ((a) | (b))
+# define BS_XOR( a, b ) ((a) ^ (b))
+# define BS_ANDN( a, b ) (~(a) & (b))
+# define BS_NOT( a )    (~(a))
+#endif
+/* (a ? y : x) for each bit */
+#define BS_MUX( a, x, y ) BS_XOR( x, BS_AND( BS_XOR( x, y ), a ) )
+
+/* Packets (de)scrambled per pass; lane l is the bit l%8 of the byte l/8 of
+ * a slice in memory */
+#define CSA_BATCH       (8 * sizeof(csa_bs_t))
+/* Below that many packets, the scalar code is faster */
+#define CSA_BATCH_MIN   8
+
+#define CSA_BLOCKS      (184 / 8)
+/* A and B registers, kept in a window that is only moved every 32 steps */
+#define CSA_BS_SHIFT    32
+
+typedef struct
+{
+    csa_bs_t    A[10 + CSA_BS_SHIFT][4];
+    csa_bs_t    B[10 + CSA_BS_SHIFT][4];
+    int         i_shift;    /* index of A[1] and B[1] */
+
+    csa_bs_t    X[4], Y[4], Z[4];
+    csa_bs_t    D[4], E[4], F[4];
+    csa_bs_t    p, q, r;
+} csa_bs_state_t;
+
+struct csa_batch_t
+{
+    uint8_t     *pkt[CSA_BATCH];
+    int         i_hdr[CSA_BATCH];
+    int         i_blocks[CSA_BATCH];
+    int         i_residue[CSA_BATCH];
+
+    /* stream cypher input (first block) and output */
+    uint8_t     sb[CSA_BATCH][8];
+    uint8_t     stream[CSA_BATCH][CSA_BLOCKS * 8];
+    /* intermediate blocks */
+    uint8_t     ib[CSA_BATCH][CSA_BLOCKS + 1][8];
+};
+
+/* Transposes the 8x8 bit matrix stored with one row per byte */
+static inline uint64_t csa_Transpose8( uint64_t x )
+{
+    uint64_t t;
+
+    t = ( x ^ ( x >> 7 ) ) & UINT64_C(0x00AA00AA00AA00AA);
+    x ^= t ^ ( t << 7 );
+    t = ( x ^ ( x >> 14 ) ) & UINT64_C(0x0000CCCC0000CCCC);
+    x ^= t ^ ( t << 14 );
+    t = ( x ^ ( x >> 28 ) ) & UINT64_C(0x00000000F0F0F0F0);
+    x ^= t ^ ( t << 28 );
+    return x;
+}
+
+/* Loads the i-th byte of each lane into 8 slices */
+static void csa_bs_Load( csa_bs_t slice[8], uint8_t (*src)[8], int i, int i_lanes )
+{
+    uint8_t bits[8][sizeof(csa_bs_t)];
+    int g, l, b;
+
+    memset( bits, 0, sizeof(bits) );
+    for( g = 0; 8 * g < i_lanes; g++ )
+    {
+        uint64_t x = 0;
+        for( l = 0; l < 8 && 8 * g + l < i_lanes; l++ )
+            x |= (uint64_t)src[8*g+l][i] << (8 * l);
+        x = csa_Transpose8( x );
+        for( b = 0; b < 8; b++ )
+            bits[b][g] = x >> (8 * b);
+    }
+    for( b = 0; b < 8; b++ )
+        memcpy( &slice[b], bits[b], sizeof(csa_bs_t) );
+}
+
+/* Stores 8 slices as the i-th byte of each lane */
+static void csa_bs_Store( uint8_t (*dst)[CSA_BLOCKS * 8], int i,
+                          const csa_bs_t slice[8], int i_lanes )
+{
+    uint8_t bits[8][sizeof(csa_bs_t)];
+    int g, l, b;
+
+    for( b = 0; b < 8; b++ )
+        memcpy( bits[b], &slice[b], sizeof(csa_bs_t) );
+    for( g = 0; 8 * g < i_lanes; g++ )
+    {
+        uint64_t x = 0;
+        for( b = 0; b < 8; b++ )
+            x |= (uint64_t)bits[b][g] << (8 * b);
+        x = csa_Transpose8( x );
+        for( l = 0; l < 8 && 8 * g + l < i_lanes; l++ )
+            dst[8*g+l][i] = x >> (8 * l);
+    }
+}
+
+/* Boolean forms of the s-boxes of the stream cypher, xN being the bit N of
+ * the s-box input and oN the bit N of the output */
+static inline void csa_bs_sbox1( csa_bs_t x4, csa_bs_t x3, csa_bs_t x2,
+                                 csa_bs_t x1, csa_bs_t x0,
+                                 csa_bs_t *o1, csa_bs_t *o0 )
+{
+    const csa_bs_t t0 = BS_NOT( x4 );
+    const csa_bs_t t1 = BS_OR( t0, x2 );
+    const csa_bs_t t2 = BS_NOT( x2 );
+    const csa_bs_t t3 = BS_XOR( x2, x4 );
+    const csa_bs_t t4 = BS_XOR( t1, t3 );
+    const csa_bs_t t5 = BS_AND( t4, x1 );
+    const csa_bs_t t6 = BS_XOR( t1, t5 );
+    const csa_bs_t t7 = BS_OR( x2, x4 );
+    const csa_bs_t t8 = BS_ANDN( x1, t7 );
+    const csa_bs_t t9 = BS_XOR( t6, t8 );
+    const csa_bs_t t10 = BS_AND( t9, x0 );
+    const csa_bs_t t11 = BS_XOR( t6, t10 );
+    const csa_bs_t t12 = BS_AND( x4, x1 );
+    const csa_bs_t t13 = BS_XOR( t2, t12 );
+    const csa_bs_t t14 = BS_AND( x1, x0 );
+    const csa_bs_t t15 = BS_XOR( t13, t14 );
+    const csa_bs_t t16 = BS_XOR( t11, t15 );
+    const csa_bs_t t17 = BS_AND( t16, x3 );
+    const csa_bs_t t18 = BS_XOR( t11, t17 );
+    const csa_bs_t t19 = BS_AND( t3, x0 );
+    const csa_bs_t t20 = BS_XOR( x1, t19 );
+    const csa_bs_t t21 = BS_AND( t0, x1 );
+    const csa_bs_t t22 = BS_XOR( t1, t21 );
+    const csa_bs_t t23 = BS_XOR( x2, t12 );
+    const csa_bs_t t24 = BS_XOR( t22, t23 );
+    const csa_bs_t t25 = BS_AND( t24, x0 );
+    const csa_bs_t t26 = BS_XOR( t22, t25 );
+    const csa_bs_t t27 = BS_XOR( t20, t26 );
+    const csa_bs_t t28 = BS_AND( t27, x3 );
+    const csa_bs_t t29 = BS_XOR( t20, t28 );
+    *o1 = t18;
+    *o0 = t29;
+}
+
+static inline void csa_bs_sbox2( csa_bs_t x4, csa_bs_t x3, csa_bs_t x2,
+                                 csa_bs_t x1, csa_bs_t x0,
+                                 csa_bs_t *o1, csa_bs_t *o0 )
+{
+    const csa_bs_t t0 = BS_NOT( x1 );
+    const csa_bs_t t1 = BS_OR( t0, x2 );
+    const csa_bs_t t2 = BS_XOR( x1, x2 );
+    const csa_bs_t t3 = BS_XOR( t1, t2 );
+    const csa_bs_t t4 = BS_AND( t3, x0 );
+    const csa_bs_t t5 = BS_XOR( t1, t4 );
+    const csa_bs_t t6 = BS_XOR( t0, x2 );
+    const csa_bs_t t7 = BS_XOR( t5, x3 );
+    const csa_bs_t t8 = BS_OR( x1, x2 );
+    const csa_bs_t t9 = BS_XOR( t0, t4 );
+    const csa_bs_t t10 = BS_AND( t8, x0 );
+    const csa_bs_t t11 = BS_XOR( x2, t10 );
+    const csa_bs_t t12 = BS_XOR( t9, t11 );
+    const csa_bs_t t13 = BS_AND( t12, x3 );
+    const csa_bs_t t14 = BS_XOR( t9, t13 );
+    const csa_bs_t t15 = BS_XOR( t7, t14 );
+    const csa_bs_t t16 = BS_AND( t15, x4 );
+    const csa_bs_t t17 = BS_XOR( t7, t16 );
+    const csa_bs_t t18 = BS_AND( x2, x0 );
+    const csa_bs_t t19 = BS_XOR( t6, t18 );
+    const csa_bs_t t20 = BS_AND( x1, x0 );
+    const csa_bs_t t21 = BS_XOR( t6, t20 );
+    const csa_bs_t t22 = BS_XOR( t19, t21 );
+    const csa_bs_t t23 = BS_AND( t22, x3 );
+    const csa_bs_t t24 = BS_XOR( t19, t23 );
+    const csa_bs_t t25 = BS_XOR( t0, t22 );
+    const csa_bs_t t26 = BS_XOR( t25, x3 );
+    const csa_bs_t t27 = BS_XOR( t24, t26 );
+    const csa_bs_t t28 = BS_AND( t27, x4 );
+    const csa_bs_t t29 = BS_XOR( t24, t28 );
+    *o1 = t17;
+    *o0 = t29;
+}
+
+static inline void csa_bs_sbox3( csa_bs_t x4, csa_bs_t x3, csa_bs_t x2,
+                                 csa_bs_t x1, csa_bs_t x0,
+                                 csa_bs_t *o1, csa_bs_t *o0 )
+{
+    const csa_bs_t t0 = BS_NOT( x3 );
+    const csa_bs_t t1 = BS_ANDN( x1, t0 );
+    const csa_bs_t t2 = BS_OR( t1, x2 );
+    const csa_bs_t t3 = BS_XOR( x1, t1 );
+    const csa_bs_t t4 = BS_AND( t3, x2 );
+    const csa_bs_t t5 = BS_XOR( x1, t4 );
+    const csa_bs_t t6 = BS_XOR( t2, t5 );
+    const csa_bs_t t7 = BS_AND( t6, x0 );
+    const csa_bs_t t8 = BS_XOR( t2, t7 );
+    const csa_bs_t t9 = BS_ANDN( x1, x3 );
+    const csa_bs_t t10 = BS_XOR( t9, x2 );
+    const csa_bs_t t11 = BS_XOR( t0, x1 );
+    const csa_bs_t t12 = BS_XOR( x3, x1 );
+    const csa_bs_t t13 = BS_XOR( t11, x2 );
+    const csa_bs_t t14 = BS_XOR( t10, t13 );
+    const csa_bs_t t15 = BS_AND( t14, x0 );
+    const csa_bs_t t16 = BS_XOR( t10, t15 );
+    const csa_bs_t t17 = BS_XOR( t8, t16 );
+    const csa_bs_t t18 = BS_AND( t17, x4 );
+    const csa_bs_t t19 = BS_XOR( t8, t18 );
+    const csa_bs_t t20 = BS_XOR( x3, x2 );
+    const csa_bs_t t21 = BS_XOR( t12, t20 );
+    const csa_bs_t t22 = BS_AND( t21, x0 );
+    const csa_bs_t t23 = BS_XOR( t12, t22 );
+    const csa_bs_t t24 = BS_XOR( t23, x4 );
+    *o1 = t19;
+    *o0 = t24;
+}
+
+static inline void csa_bs_sbox4( csa_bs_t x4, csa_bs_t x3, csa_bs_t x2,
+                                 csa_bs_t x1, csa_bs_t x0,
+                                 csa_bs_t *o1, csa_bs_t *o0 )
+{
+    const csa_bs_t t0 = BS_NOT( x0 );
+    const csa_bs_t t1 = BS_OR( t0, x1 );
+    const csa_bs_t t2 = BS_XOR( t1, x0 );
+    const csa_bs_t t3 = BS_AND( t2, x2 );
+    const csa_bs_t t4 = BS_XOR( t1, t3 );
+    const csa_bs_t t5 = BS_ANDN( x1, x0 );
+    const csa_bs_t t6 = BS_XOR( t0, x1 );
+    const csa_bs_t t7 = BS_XOR( t5, t6 );
+    const csa_bs_t t8 = BS_AND( t7, x2 );
+    const csa_bs_t t9 = BS_XOR( t5, t8 );
+    const csa_bs_t t10 = BS_XOR( t4, t9 );
+    const csa_bs_t t11 = BS_AND( t10, x3 );
+    const csa_bs_t t12 = BS_XOR( t4, t11 );
+    const csa_bs_t t13 = BS_AND( x1, t0 );
+    const csa_bs_t t14 = BS_XOR( t13, x2 );
+    const csa_bs_t t15 = BS_XOR( x0, x1 );
+    const csa_bs_t t16 = BS_XOR( t14, t15 );
+    const csa_bs_t t17 = BS_AND( t16, x3 );
+    const csa_bs_t t18 = BS_XOR( t14, t17 );
+    const csa_bs_t t19 = BS_XOR( t12, t18 );
+    const csa_bs_t t20 = BS_AND( t19, x4 );
+    const csa_bs_t t21 = BS_XOR( t12, t20 );
+    const csa_bs_t t22 = BS_XOR( t7, x2 );
+    const csa_bs_t t23 = BS_XOR( t22, t17 );
+    const csa_bs_t t24 = BS_XOR( t23, t12 );
+    const csa_bs_t t25 = BS_AND( t24, x4 );
+    const csa_bs_t t26 = BS_XOR( t23, t25 );
+    *o1 = t21;
+    *o0 = t26;
+}
+
+static inline void csa_bs_sbox5( csa_bs_t x4, csa_bs_t x3, csa_bs_t x2,
+                                 csa_bs_t x1, csa_bs_t x0,
+                                 csa_bs_t *o1, csa_bs_t *o0 )
+{
+    const csa_bs_t t0 = BS_NOT( x0 );
+    const csa_bs_t t1 = BS_OR( t0, x4 );
+    const csa_bs_t t2 = BS_AND( x4, t0 );
+    const csa_bs_t t3 = BS_XOR( t1, t2 );
+    const csa_bs_t t4 = BS_AND( t3, x1 );
+    const csa_bs_t t5 = BS_XOR( t1, t4 );
+    const csa_bs_t t6 = BS_NOT( x4 );
+    const csa_bs_t t7 = BS_OR( t6, x0 );
+    const csa_bs_t t8 = BS_XOR( t7, t6 );
+    const csa_bs_t t9 = BS_AND( t8, x1 );
+    const csa_bs_t t10 = BS_XOR( t7, t9 );
+    const csa_bs_t t11 = BS_XOR( t5, t10 );
+    const csa_bs_t t12 = BS_AND( t11, x2 );
+    const csa_bs_t t13 = BS_XOR( t5, t12 );
+    const csa_bs_t t14 = BS_AND( t1, x1 );
+    const csa_bs_t t15 = BS_XOR( t2, t14 );
+    const csa_bs_t t16 = BS_XOR( x1, t15 );
+    const csa_bs_t t17 = BS_AND( t16, x2 );
+    const csa_bs_t t18 = BS_XOR( x1, t17 );
+    const csa_bs_t t19 = BS_XOR( t13, t18 );
+    const csa_bs_t t20 = BS_AND( t19, x3 );
+    const csa_bs_t t21 = BS_XOR( t13, t20 );
+    const csa_bs_t t22 = BS_AND( x0, x1 );
+    const csa_bs_t t23 = BS_XOR( t8, t22 );
+    const csa_bs_t t24 = BS_AND( t2, x1 );
+    const csa_bs_t t25 = BS_XOR( t3, t24 );
+    const csa_bs_t t26 = BS_XOR( t23, t25 );
+    const csa_bs_t t27 = BS_AND( t26, x2 );
+    const csa_bs_t t28 = BS_XOR( t23, t27 );
+    const csa_bs_t t29 = BS_XOR( t1, x1 );
+    const csa_bs_t t30 = BS_XOR( t11, t29 );
+    const csa_bs_t t31 = BS_AND( t30, x2 );
+    const csa_bs_t t32 = BS_XOR( t11, t31 );
+    const csa_bs_t t33 = BS_XOR( t28, t32 );
+    const csa_bs_t t34 = BS_AND( t33, x3 );
+    const csa_bs_t t35 = BS_XOR( t28, t34 );
+    *o1 = t21;
+    *o0 = t35;
+}
+
+static inline void csa_bs_sbox6( csa_bs_t x4, csa_bs_t x3, csa_bs_t x2,
+                                 csa_bs_t x1, csa_bs_t x0,
+                                 csa_bs_t *o1, csa_bs_t *o0 )
+{
+    const csa_bs_t t0 = BS_OR( x0, x3 );
+    const csa_bs_t t1 = BS_AND( x2, t0 );
+    const csa_bs_t t2 = BS_NOT( x0 );
+    const csa_bs_t t3 = BS_NOT( x3 );
+    const csa_bs_t t4 = BS_OR( t3, t2 );
+    const csa_bs_t t5 = BS_XOR( t4, t1 );
+    const csa_bs_t t6 = BS_AND( t4, x4 );
+    const csa_bs_t t7 = BS_XOR( t1, t6 );
+    const csa_bs_t t8 = BS_AND( x3, t2 );
+    const csa_bs_t t9 = BS_XOR( x0, t1 );
+    const csa_bs_t t10 = BS_XOR( t5, t9 );
+    const csa_bs_t t11 = BS_AND( t10, x4 );
+    const csa_bs_t t12 = BS_XOR( t5, t11 );
+    const csa_bs_t t13 = BS_XOR( t7, t12 );
+    const csa_bs_t t14 = BS_AND( t13, x1 );
+    const csa_bs_t t15 = BS_XOR( t7, t14 );
+    const csa_bs_t t16 = BS_AND( t3, x2 );
+    const csa_bs_t t17 = BS_XOR( x0, t16 );
+    const csa_bs_t t18 = BS_XOR( x0, x3 );
+    const csa_bs_t t19 = BS_AND( x0, x2 );
+    const csa_bs_t t20 = BS_XOR( t18, t19 );
+    const csa_bs_t t21 = BS_XOR( t8, t16 );
+    const csa_bs_t t22 = BS_XOR( t20, t21 );
+    const csa_bs_t t23 = BS_AND( t22, x4 );
+    const csa_bs_t t24 = BS_XOR( t20, t23 );
+    const csa_bs_t t25 = BS_XOR( t17, t24 );
+    const csa_bs_t t26 = BS_AND( t25, x1 );
+    const csa_bs_t t27 = BS_XOR( t17, t26 );
+    *o1 = t15;
+    *o0 = t27;
+}
+
+static inline void csa_bs_sbox7( csa_bs_t x4, csa_bs_t x3, csa_bs_t x2,
+                                 csa_bs_t x1, csa_bs_t x0,
+                                 csa_bs_t *o1, csa_bs_t *o0 )
+{
+    const csa_bs_t t0 = BS_NOT( x0 );
+    const csa_bs_t t1 = BS_XOR( x0, x2 );
+    const csa_bs_t t2 = BS_XOR( t1, x3 );
+    const csa_bs_t t3 = BS_AND( t1, x4 );
+    const csa_bs_t t4 = BS_XOR( t2, t3 );
+    const csa_bs_t t5 = BS_NOT( x2 );
+    const csa_bs_t t6 = BS_AND( t0, x3 );
+    const csa_bs_t t7 = BS_XOR( t5, t6 );
+    const csa_bs_t t8 = BS_OR( t5, x0 );
+    const csa_bs_t t9 = BS_AND( x2, x0 );
+    const csa_bs_t t10 = BS_AND( t5, x3 );
+    const csa_bs_t t11 = BS_XOR( t8, t10 );
+    const csa_bs_t t12 = BS_XOR( t7, t11 );
+    const csa_bs_t t13 = BS_AND( t12, x4 );
+    const csa_bs_t t14 = BS_XOR( t7, t13 );
+    const csa_bs_t t15 = BS_XOR( t4, t14 );
+    const csa_bs_t t16 = BS_AND( t15, x1 );
+    const csa_bs_t t17 = BS_XOR( t4, t16 );
+    const csa_bs_t t18 = BS_XOR( t1, t10 );
+    const csa_bs_t t19 = BS_XOR( t18, x4 );
+    const csa_bs_t t20 = BS_XOR( t9, t10 );
+    const csa_bs_t t21 = BS_OR( t5, t0 );
+    const csa_bs_t t22 = BS_AND( t1, x3 );
+    const csa_bs_t t23 = BS_XOR( t21, t22 );
+    const csa_bs_t t24 = BS_XOR( t20, t23 );
+    const csa_bs_t t25 = BS_AND( t24, x4 );
+    const csa_bs_t t26 = BS_XOR( t20, t25 );
+    const csa_bs_t t27 = BS_XOR( t19, t26 );
+    const csa_bs_t t28 = BS_AND( t27, x1 );
+    const csa_bs_t t29 = BS_XOR( t19, t28 );
+    *o1 = t17;
+    *o0 = t29;
+}
+
+
+/* Loads the nibbles of the common key into the state */
+static void csa_bs_Init( csa_bs_state_t *s, const uint8_t ck[8] )
+{
+    int i, b;
+
+    memset( s, 0, sizeof(*s) );
+    s->i_shift = CSA_BS_SHIFT;
+    for( i = 0; i < 8; i++ )
+    {
+        for( b = 0; b < 4; b++ )
+        {
+            s->A[CSA_BS_SHIFT+i][b] = (ck[i/2] >> ((i&1) ? b : 4 + b))&1 ?
+                                      BS_ONES : BS_ZERO;
+            s->B[CSA_BS_SHIFT+i][b] = (ck[4+i/2] >> ((i&1) ? b : 4 + b))&1 ?
+                                      BS_ONES : BS_ZERO;
+        }
+    }
+}
+
+/* Runs a step of the stream cypher (2 output bits), see csa_StreamCypher.
+ * in_a and in_b are the input nibbles during the initialisation, NULL
+ * otherwise. */
+static inline void csa_bs_Step( csa_bs_state_t *s,
+                                const csa_bs_t *in_a, const csa_bs_t *in_b,
+                                csa_bs_t *o1, csa_bs_t *o0 )
+{
+    /* A(k) is the nibble A[k] */
+#define A( k ) s->A[s->i_shift + (k) - 1]
+#define B( k ) s->B[s->i_shift + (k) - 1]
+    csa_bs_t s1[2], s2[2], s3[2], s4[2], s5[2], s6[2], s7[2];
+    csa_bs_t extra_B[4], next_A1[4], next_B1[4], next_E;
+    csa_bs_t c;
+    int b;
+
+    csa_bs_sbox1( A(4)[0], A(1)[2], A(6)[1], A(7)[3], A(9)[0], &s1[1], &s1[0] );
+    csa_bs_sbox2( A(2)[1], A(3)[2], A(6)[3], A(7)[0], A(9)[1], &s2[1], &s2[0] );
+    csa_bs_sbox3( A(1)[3], A(2)[0], A(5)[1], A(5)[3], A(6)[2], &s3[1], &s3[0] );
+    csa_bs_sbox4( A(3)[3], A(1)[1], A(2)[3], A(4)[2], A(8)[0], &s4[1], &s4[0] );
+    csa_bs_sbox5( A(5)[2], A(4)[3], A(6)[0], A(8)[1], A(9)[2], &s5[1], &s5[0] );
+    csa_bs_sbox6( A(3)[1], A(4)[1], A(5)[0], A(7)[2], A(9)[3], &s6[1], &s6[0] );
+    csa_bs_sbox7( A(2)[2], A(3)[0], A(7)[1], A(8)[2], A(8)[3], &s7[1], &s7[0] );
+
+    extra_B[3] = BS_XOR( BS_XOR( B(3)[0], B(6)[1] ), BS_XOR( B(7)[2], B(9)[3] ) );
+    extra_B[2] = BS_XOR( BS_XOR( B(6)[0], B(8)[1] ), BS_XOR( B(3)[3], B(4)[2] ) );
+    extra_B[1] = BS_XOR( BS_XOR( B(5)[3], B(8)[2] ), BS_XOR( B(4)[0], B(5)[1] ) );
+    extra_B[0] = BS_XOR( BS_XOR( B(9)[2], B(6)[3] ), BS_XOR( B(3)[1], B(8)[0] ) );
+
+    for( b = 0; b < 4; b++ )
+    {
+        next_A1[b] = BS_XOR( A(10)[b], s->X[b] );
+        next_B1[b] = BS_XOR( BS_XOR( B(7)[b], B(10)[b] ), s->Y[b] );
+        if( in_a )
+        {
+            next_A1[b] = BS_XOR( next_A1[b], BS_XOR( s->D[b], in_a[b] ) );
+            next_B1[b] = BS_XOR( next_B1[b], in_b[b] );
+        }
+    }
+
+    /* T3 and T4 (Z + E + r, only if q=1) */
+    c = s->r;
+    for( b = 0; b < 4; b++ )
+    {
+        const csa_bs_t t = BS_XOR( s->Z[b], s->E[b] );
+        const csa_bs_t sum = BS_XOR( t, c );
+
+        c = BS_OR( BS_AND( s->Z[b], s->E[b] ), BS_AND( c, t ) );
+        s->D[b] = BS_XOR( t, extra_B[b] );
+        next_E = s->F[b];
+        s->F[b] = BS_MUX( s->q, s->E[b], sum );
+        s->E[b] = next_E;
+    }
+    s->r = BS_MUX( s->q, s->r, c );
+
+    /* shift the registers, if p=1 next_B1 is rotated left */
+    for( b = 0; b < 4; b++ )
+    {
+        A(0)[b] = next_A1[b];
+        B(0)[b] = BS_MUX( s->p, next_B1[b], next_B1[(b+3)&3] );
+    }
+    if( --s->i_shift == 0 )
+    {
+        memmove( s->A[CSA_BS_SHIFT], s->A[0], sizeof(s->A[0]) * 10 );
+        memmove( s->B[CSA_BS_SHIFT], s->B[0], sizeof(s->B[0]) * 10 );
+        s->i_shift = CSA_BS_SHIFT;
+    }
+#undef A
+#undef B
+
+    s->X[3] = s4[0]; s->X[2] = s3[0]; s->X[1] = s2[1]; s->X[0] = s1[1];
+    s->Y[3] = s6[0]; s->Y[2] = s5[0]; s->Y[1] = s4[1]; s->Y[0] = s3[1];
+    s->Z[3] = s2[0]; s->Z[2] = s1[0]; s->Z[1] = s6[1]; s->Z[0] = s5[1];
+    s->p = s7[1];
+    s->q = s7[0];
+
+    /* 2 output bits from the 4 bits of D */
+    *o1 = BS_XOR( s->D[2], s->D[3] );
+    *o0 = BS_XOR( s->D[0], s->D[1] );
+}
+
+/* Initialises the stream cypher of each lane with its first block sb and
+ * generates i_bytes of stream */
+static void csa_bs_StreamCypher( csa_bs_state_t *s, const uint8_t ck[8],
+                                 csa_batch_t *b, int i_lanes, int i_bytes )
+{
+    csa_bs_t in[8], out[8];
+    int i, j;
+
+    csa_bs_Init( s, ck );
+    for( i = 0; i < 8; i++ )
+    {
+        /* in1 (high nibble) goes to A on even steps, in2 on odd ones */
+        csa_bs_Load( in, b->sb, i, i_lanes );
+        for( j = 0; j < 4; j++ )
+            csa_bs_Step( s, &in[(j&1) ? 0 : 4], &in[(j&1) ? 4 : 0],
+                         &out[7-2*j], &out[6-2*j] );
+    }
+    for( i = 0; i < i_bytes; i++ )
+    {
+        for( j = 0; j < 4; j++ )
+            csa_bs_Step( s, NULL, NULL, &out[7-2*j], &out[6-2*j] );
+        csa_bs_Store( b->stream, i, out, i_lanes );
+    }
+}
+
+/* Bytes of lane l to l + sizeof(csa_bs_t) - 1 of a byte-sliced register */
+#define BS_LOAD( w, r ) memcpy( &(w), &(r)[l], sizeof(csa_bs_t) )
+#define BS_STORE( r, w ) memcpy( &(r)[l], &(w), sizeof(csa_bs_t) )
+
+/* csa_BlockDecypher of n independent blocks */
+static void csa_BlockDecypherN( const uint8_t kk[57], uint8_t (*ib)[8],
+                                uint8_t (*bd)[8], int n )
+{
+    uint8_t R[8][CSA_BATCH];
+    uint8_t sbox_out[CSA_BATCH], perm_out[CSA_BATCH];
+    uint8_t *r[8]; /* r[k] is R[k+1] of csa_BlockDecypher */
+    /* the lanes are processed by words, the extra ones are left unused */
+    const int i_lanes = (n + sizeof(csa_bs_t) - 1) & ~(sizeof(csa_bs_t) - 1);
+    int i, k, l;
+
+    memset( R, 0, sizeof(R) );
+    for( k = 0; k < 8; k++ )
+    {
+        r[k] = R[k];
+        for( l = 0; l < n; l++ )
+            r[k][l] = ib[l][k];
+    }
+
+    for( i = 56; i > 0; i-- )
+    {
+        uint8_t *r8;
+
+        for( l = 0; l < i_lanes; l++ )
+        {
+            sbox_out[l] = block_sbox[ kk[i]^r[6][l] ];
+            perm_out[l] = block_perm[ sbox_out[l] ];
+        }
+        for( l = 0; l < i_lanes; l += sizeof(csa_bs_t) )
+        {
+            csa_bs_t s, p, t, x;
+
+            BS_LOAD( s, sbox_out );
+            BS_LOAD( p, perm_out );
+            BS_LOAD( t, r[7] );
+            t = BS_XOR( t, s );
+            BS_STORE( r[7], t );
+            BS_LOAD( x, r[5] ); x = BS_XOR( x, p ); BS_STORE( r[5], x );
+            BS_LOAD( x, r[3] ); x = BS_XOR( x, t ); BS_STORE( r[3], x );
+            BS_LOAD( x, r[2] ); x = BS_XOR( x, t ); BS_STORE( r[2], x );
+            BS_LOAD( x, r[1] ); x = BS_XOR( x, t ); BS_STORE( r[1], x );
+        }
+        /* R[1..8] = R[8], R[1..7] */
+        r8 = r[7];
+        memmove( &r[1], &r[0], 7 * sizeof(*r) );
+        r[0] = r8;
+    }
+
+    for( k = 0; k < 8; k++ )
+        for( l = 0; l < n; l++ )
+            bd[l][k] = r[k][l];
+}
+
+/* csa_BlockCypher of n independent blocks */
+static void csa_BlockCypherN( const uint8_t kk[57], uint8_t (*bd)[8],
+                              uint8_t (*ib)[8], int n )
+{
+    uint8_t R[8][CSA_BATCH];
+    uint8_t sbox_out[CSA_BATCH], perm_out[CSA_BATCH];
+    uint8_t *r[8]; /* r[k] is R[k+1] of csa_BlockCypher */
+    /* the lanes are processed by words, the extra ones are left unused */
+    const int i_lanes = (n + sizeof(csa_bs_t) - 1) & ~(sizeof(csa_bs_t) - 1);
+    int i, k, l;
+
+    memset( R, 0, sizeof(R) );
+    for( k = 0; k < 8; k++ )
+    {
+        r[k] = R[k];
+        for( l = 0; l < n; l++ )
+            r[k][l] = bd[l][k];
+    }
+
+    for( i = 1; i <= 56; i++ )
+    {
+        uint8_t *r1;
+
+        for( l = 0; l < i_lanes; l++ )
+        {
+            sbox_out[l] = block_sbox[ kk[i]^r[7][l] ];
+            perm_out[l] = block_perm[ sbox_out[l] ];
+        }
+        for( l = 0; l < i_lanes; l += sizeof(csa_bs_t) )
+        {
+            csa_bs_t s, p, t, x;
+
+            BS_LOAD( t, r[0] );
+            BS_LOAD( x, r[2] ); x = BS_XOR( x, t ); BS_STORE( r[2], x );
+            BS_LOAD( x, r[3] ); x = BS_XOR( x, t ); BS_STORE( r[3], x );
+            BS_LOAD( x, r[4] ); x = BS_XOR( x, t ); BS_STORE( r[4], x );
+            BS_LOAD( p, perm_out );
+            BS_LOAD( x, r[6] ); x = BS_XOR( x, p ); BS_STORE( r[6], x );
+            BS_LOAD( s, sbox_out );
+            t = BS_XOR( t, s );
+            BS_STORE( r[0], t );
+        }
+        /* R[1..8] = R[2..8], R[1] */
+        r1 = r[0];
+        memmove( &r[0], &r[1], 7 * sizeof(*r) );
+        r[7] = r1;
+    }
+
+    for( k = 0; k < 8; k++ )
+        for( l = 0; l < n; l++ )
+            ib[l][k] = r[k][l];
+}
+#undef BS_LOAD
+#undef BS_STORE
+
+/* Length of the stream needed by a packet after the initialisation */
+static inline int csa_StreamSize( int i_blocks, int i_residue )
+{
+    return 8 * ( i_blocks - 1 + ( i_residue > 0 ) );
+}
+
+static void csa_bs_Decrypt( csa_t *c, int i_lanes, int i_pkt_size, bool odd )
+{
+    csa_batch_t *b = c->batch;
+    const uint8_t *kk = odd ? c->o_kk : c->e_kk;
+    csa_bs_state_t s;
+    uint8_t ib[CSA_BATCH][8], bd[CSA_BATCH][8];
+    uint8_t *p_bd[CSA_BATCH];
+    int i_bytes = 0;
+    int i, j, l, m;
+
+    for( l = 0; l < i_lanes; l++ )
+    {
+        /* clear transport scrambling control */
+        b->pkt[l][3] &= 0x3f;
+        memcpy( b->sb[l], &b->pkt[l][b->i_hdr[l]], 8 );
+        i_bytes = __MAX( i_bytes,
+                         csa_StreamSize( b->i_blocks[l], b->i_residue[l] ) );
+    }
+
+    csa_bs_StreamCypher( &s, odd ? c->o_ck : c->e_ck, b, i_lanes, i_bytes );
+
+    /* all the blocks to decypher are known from the stream */
+    for( l = 0; l < i_lanes; l++ )
+    {
+        const uint8_t *p = &b->pkt[l][b->i_hdr[l]];
+        const uint8_t *stream = b->stream[l];
+        const int n = b->i_blocks[l];
+
+        memcpy( b->ib[l][0], p, 8 );
+        for( i = 1; i < n; i++ )
+            for( j = 0; j < 8; j++ )
+                b->ib[l][i][j] = p[8*i+j] ^ stream[8*(i-1)+j];
+        memset( b->ib[l][n], 0, 8 );
+    }
+
+    /* decypher them CSA_BATCH at a time, whatever their packet, and xor the
+     * result with the next block */
+    for( l = 0, i = 0, m = 0; l < i_lanes; )
+    {
+        memcpy( ib[m], b->ib[l][i], 8 );
+        p_bd[m++] = &b->pkt[l][b->i_hdr[l] + 8*i];
+        if( ++i == b->i_blocks[l] )
+        {
+            i = 0;
+            l++;
+        }
+        if( m == CSA_BATCH || l == i_lanes )
+        {
+            csa_BlockDecypherN( kk, ib, bd, m );
+            for( m--; m >= 0; m-- )
+                memcpy( p_bd[m], bd[m], 8 );
+            m = 0;
+        }
+    }
+
+    for( l = 0; l < i_lanes; l++ )
+    {
+        uint8_t *p = &b->pkt[l][b->i_hdr[l]];
+        const uint8_t *stream = b->stream[l];
+        const int n = b->i_blocks[l];
+
+        for( i = 0; i < n; i++ )
+            for( j = 0; j < 8; j++ )
+                p[8*i+j] ^= b->ib[l][i+1][j];
+        for( j = 0; j < b->i_residue[l]; j++ )
+            b->pkt[l][i_pkt_size - b->i_residue[l] + j] ^= stream[8*(n-1)+j];
+    }
+}
+
+static void csa_bs_Encrypt( csa_t *c, int i_lanes, int i_pkt_size )
+{
+    csa_batch_t *b = c->batch;
+    const uint8_t *kk = c->use_odd ? c->o_kk : c->e_kk;
+    csa_bs_state_t s;
+    uint8_t bd[CSA_BATCH][8], ib[CSA_BATCH][8];
+    int i_lane[CSA_BATCH];
+    int i_blocks = 0, i_bytes = 0;
+    int i, j, l, m;
+
+    for( l = 0; l < i_lanes; l++ )
+    {
+        memset( b->ib[l][b->i_blocks[l]], 0, 8 );
+        i_blocks = __MAX( i_blocks, b->i_blocks[l] );
+        i_bytes = __MAX( i_bytes,
+                         csa_StreamSize( b->i_blocks[l], b->i_residue[l] ) );
+    }
+
+    /* the blocks of a packet are chained from the last one, but the packets
+     * are independent */
+    for( i = 0; i < i_blocks; i++ )
+    {
+        for( l = 0, m = 0; l < i_lanes; l++ )
+        {
+            const int k = b->i_blocks[l] - 1 - i;
+            if( k < 0 )
+                continue;
+            for( j = 0; j < 8; j++ )
+                bd[m][j] = b->pkt[l][b->i_hdr[l]+8*k+j] ^ b->ib[l][k+1][j];
+            i_lane[m++] = l;
+        }
+        csa_BlockCypherN( kk, bd, ib, m );
+        for( m--; m >= 0; m-- )
+            memcpy( b->ib[i_lane[m]][b->i_blocks[i_lane[m]] - 1 - i], ib[m], 8 );
+    }
+
+    for( l = 0; l < i_lanes; l++ )
+        memcpy( b->sb[l], b->ib[l][0], 8 );
+
+    csa_bs_StreamCypher( &s, c->use_odd ? c->o_ck : c->e_ck, b,
+                         i_lanes, i_bytes );
+
+    for( l = 0; l < i_lanes; l++ )
+    {
+        uint8_t *p = &b->pkt[l][b->i_hdr[l]];
+        const uint8_t *stream = b->stream[l];
+        const int n = b->i_blocks[l];
+
+        memcpy( p, b->ib[l][0], 8 );
+        for( i = 1; i < n; i++ )
+            for( j = 0; j < 8; j++ )
+                p[8*i+j] = b->ib[l][i][j] ^ stream[8*(i-1)+j];
+        for( j = 0; j < b->i_residue[l]; j++ )
+            b->pkt[l][i_pkt_size - b->i_residue[l] + j] ^= stream[8*(n-1)+j];
+    }
+}
+
+/* Fills the layout of the lane l, returns false if the packet has to take
+ * the scalar path */
+static bool csa_BatchAdd( csa_batch_t *b, int l, uint8_t *pkt, int i_pkt_size )
+{
+    int i_hdr = 4;
+
+    if( pkt[3]&0x20 )
+    {
+        /* skip adaption field */
+        i_hdr += pkt[4] + 1;
+    }
+    if( i_pkt_size > 188 || i_pkt_size - i_hdr < 8 )
+        return false;
+
+    b->pkt[l] = pkt;
+    b->i_hdr[l] = i_hdr;
+    b->i_blocks[l] = (i_pkt_size - i_hdr) / 8;
+    b->i_residue[l] = (i_pkt_size - i_hdr) % 8;
+    return true;
+}
+
+static csa_batch_t *csa_BatchGet( csa_t *c )
+{
+    if( !c->batch )
+        c->batch = malloc( sizeof( *c->batch ) );
+    return c->batch;
+}
+
+/*****************************************************************************
+ * csa_DecryptBatch: csa_Decrypt of i_pkts packets
+ *****************************************************************************/
+void csa_DecryptBatch( csa_t *c, uint8_t **pp_pkts, int i_pkts,
+                       int i_pkt_size )
+{
+    csa_batch_t *b = i_pkts >= CSA_BATCH_MIN ? csa_BatchGet( c ) : NULL;
+    int i, i_key;
+
+    if( !b )
+    {
+        for( i = 0; i < i_pkts; i++ )
+            csa_Decrypt( c, pp_pkts[i], i_pkt_size );
+        return;
+    }
+
+    /* even key, then odd key */
+    for( i_key = 0; i_key < 2; i_key++ )
+    {
+        const uint8_t i_tsc = i_key ? 0xc0 : 0x80;
+
+        for( i = 0; i < i_pkts; )
+        {
+            int i_lanes = 0;
+            int l;
+
+            for( ; i < i_pkts && i_lanes < (int)CSA_BATCH; i++ )
+            {
+                uint8_t *pkt = pp_pkts[i];
+
+                if( (pkt[3]&0xc0) != i_tsc )
+                    continue;
+                if( csa_BatchAdd( b, i_lanes, pkt, i_pkt_size ) )
+                    i_lanes++;
+                else
+                    csa_Decrypt( c, pkt, i_pkt_size );
+            }
+
+            if( i_lanes >= CSA_BATCH_MIN )
+                csa_bs_Decrypt( c, i_lanes, i_pkt_size, i_key );
+            else
+                for( l = 0; l < i_lanes; l++ )
+                    csa_Decrypt( c, b->pkt[l], i_pkt_size );
+        }
+    }
+}
+
+/*****************************************************************************
+ * csa_EncryptBatch: csa_Encrypt of i_pkts packets
+ *****************************************************************************/
+void csa_EncryptBatch( csa_t *c, uint8_t **pp_pkts, int i_pkts,
+                       int i_pkt_size )
+{
+    csa_batch_t *b = i_pkts >= CSA_BATCH_MIN ? csa_BatchGet( c ) : NULL;
+    int i;
+
+    if( !b )
+    {
+        for( i = 0; i < i_pkts; i++ )
+            csa_Encrypt( c, pp_pkts[i], i_pkt_size );
+        return;
+    }
+
+    for( i = 0; i < i_pkts; )
+    {
+        int i_lanes = 0;
+        int l;
+
+        for( ; i < i_pkts && i_lanes < (int)CSA_BATCH; i++ )
+        {
+            if( csa_BatchAdd( b, i_lanes, pp_pkts[i], i_pkt_size ) )
+                i_lanes++;
+            else
+                csa_Encrypt( c, pp_pkts[i], i_pkt_size );
+        }
+
+        for( l = 0; l < i_lanes; l++ )
+        {
+            /* set transport scrambling control */
+            b->pkt[l][3] |= c->use_odd ? 0xc0 : 0x80;
+        }
+
+        if( i_lanes >= CSA_BATCH_MIN )
+            csa_bs_Encrypt( c, i_lanes, i_pkt_size );
+        else
+            for( l = 0; l < i_lanes; l++ )
+                csa_Encrypt( c, b->pkt[l], i_pkt_size );
+    }
+}
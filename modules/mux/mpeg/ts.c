@@ -155,6 +155,11 @@ static void    Close  ( vlc_object_t * );
 #define BMAX_TEXT N_( "Maximum B (deprecated)")
 #define BMAX_LONGTEXT N_( "This setting is deprecated and not used anymore")
 
+#define MUXRATE_TEXT N_("Constant mux rate (bits/s)")
+#define MUXRATE_LONGTEXT N_("Output a constant bitrate stream at the given " \
+  "rate, filled with null packets. The PCRs are stamped with the time of " \
+  "their packet in the output. 0 keeps a variable bitrate.")
+
 #define DTS_TEXT N_("DTS delay (ms)")
 #define DTS_LONGTEXT N_("Delay the DTS (decoding time " \
   "stamps) and PTS (presentation timestamps) of the data in the " \
@@ -231,6 +236,8 @@ vlc_module_begin ()
                  true )
     add_integer( SOUT_CFG_PREFIX "bmax", 0, NULL, BMAX_TEXT, BMAX_LONGTEXT,
                  true )
+    add_integer( SOUT_CFG_PREFIX "muxrate", 0, NULL, MUXRATE_TEXT,
+                 MUXRATE_LONGTEXT, true )
     add_integer( SOUT_CFG_PREFIX "dts-delay", 400, NULL, DTS_TEXT,
                  DTS_LONGTEXT, true )
 
@@ -258,7 +265,7 @@ static const char *const ppsz_sout_options[] = {
 #ifdef HAVE_DVBPSI_SDT
     "netid", "sdtdesc",
 #endif
-    "es-id-pid", "shaping", "pcr", "bmin", "bmax", "use-key-frames",
+    "es-id-pid", "shaping", "pcr", "bmin", "bmax", "muxrate", "use-key-frames",
     "dts-delay", "csa-ck", "csa2-ck", "csa-use", "csa-pkt", "crypt-audio", "crypt-video",
     "muxpmt", "program-pmt", "alignment",
     NULL
@@ -370,8 +377,32 @@ typedef struct ts_stream_t
     int                 i_pes_used;
     bool                b_key_frame;
 
+    /* PSI tables only: TS packets of the current version */
+    block_t             *p_psi;
+
 } ts_stream_t;
 
+/* PCR timing statistics, checked against ETSI TR 101 290 */
+#define PCR_INTERVAL_MAX    (40 * 27000)    /* 40 ms at 27 MHz */
+#define PCR_ACCURACY_MAX    500             /* ns */
+#define PCR_REPORT_PERIOD   (INT64_C(10000000))
+
+typedef struct
+{
+    int64_t     i_pcrs;
+    int64_t     i_last_pcr;     /* 27 MHz, -1 before the first PCR */
+    int64_t     i_last_packet;  /* position of the last PCR */
+    int64_t     i_interval_max; /* 27 MHz */
+    int64_t     i_interval_errors;
+    int64_t     i_accuracy_max; /* ns, constant bitrate only */
+    int64_t     i_accuracy_errors;
+
+    int64_t     i_packets;
+    int64_t     i_nulls;
+    int64_t     i_overflows;    /* windows exceeding the mux rate */
+    mtime_t     i_next_report;
+} ts_pcr_stats_t;
+
 struct sout_mux_sys_t
 {
     int             i_pcr_pid;
@@ -394,9 +425,11 @@ struct sout_mux_sys_t
     int             i_num_pmt;
     int             i_pmtslots;
     int             i_pat_version_number;
+    int             i_pat_cache_version;    /* -1 if not generated yet */
     ts_stream_t     pat;
 
     int             i_pmt_version_number;
+    bool            b_pmt_dirty;    /* PMT and SDT must be generated again */
     ts_stream_t     pmt[MAX_PMT];
     pmt_map_t       pmtmap[MAX_PMT_PID];
     int             i_pmt_program_number[MAX_PMT];
@@ -422,6 +455,15 @@ struct sout_mux_sys_t
 
     mtime_t         i_pcr;  /* last PCR emited */
 
+    /* Constant bitrate output clock, i_muxrate is 0 for a variable bitrate */
+    int64_t         i_muxrate;
+    int64_t         i_cbr_clock;    /* 27 MHz time of the next packet slot */
+    int64_t         i_cbr_frac;     /* fraction of tick, in 1/i_muxrate */
+    int64_t         i_cbr_step;     /* duration of a packet slot */
+    int64_t         i_cbr_step_frac;
+
+    ts_pcr_stats_t  pcr_stats;
+
     csa_t           *csa;
     int             i_csa_pkt_size;
     bool            b_crypt_audio;
@@ -488,11 +530,18 @@ static void TSSchedule  ( sout_mux_t *p_mux, sout_buffer_chain_t *p_chain_ts,
                           mtime_t i_pcr_length, mtime_t i_pcr_dts );
 static void TSDate      ( sout_mux_t *p_mux, sout_buffer_chain_t *p_chain_ts,
                           mtime_t i_pcr_length, mtime_t i_pcr_dts );
+static void TSEncrypt   ( sout_mux_t *p_mux, sout_buffer_chain_t *p_chain_ts );
 static void GetPAT( sout_mux_t *p_mux, sout_buffer_chain_t *c );
 static void GetPMT( sout_mux_t *p_mux, sout_buffer_chain_t *c );
+static int  UpdatePMT( sout_mux_t *p_mux );
 
 static block_t *TSNew( sout_mux_t *p_mux, ts_stream_t *p_stream, bool b_pcr );
 static void TSSetPCR( block_t *p_ts, mtime_t i_dts );
+static void TSSetPCR27( block_t *p_ts, int64_t i_pcr );
+static void TSDateCBR( sout_mux_t *p_mux, sout_buffer_chain_t *p_chain_ts,
+                       mtime_t i_pcr_length, mtime_t i_pcr_dts );
+static void PCRStats( sout_mux_t *p_mux, int64_t i_pcr );
+static void PCRReport( sout_mux_t *p_mux );
 
 static void PEStoTS  ( sout_instance_t *, sout_buffer_chain_t *, block_t *, ts_stream_t * );
 
@@ -588,9 +637,11 @@ static int Open( vlc_object_t *p_this )
     unsigned short subi[3];
     vlc_rand_bytes(subi, sizeof(subi));
     p_sys->i_pat_version_number = nrand48(subi) & 0x1f;
+    p_sys->i_pat_cache_version = -1;
     p_sys->pat.i_pid = 0;
     p_sys->pat.i_continuity_counter = 0;
     p_sys->pat.b_discontinuity = false;
+    p_sys->pat.p_psi = NULL;
 
     var_Get( p_mux, SOUT_CFG_PREFIX "tsid", &val );
     if ( val.i_int )
@@ -606,15 +657,18 @@ static int Open( vlc_object_t *p_this )
 #endif
 
     p_sys->i_pmt_version_number = nrand48(subi) & 0x1f;
-    for( i = 0; i < p_sys->i_num_pmt; i++ )
+    p_sys->b_pmt_dirty = true;
+    for( i = 0; i < MAX_PMT; i++ )
     {
         p_sys->pmt[i].i_continuity_counter = 0;
         p_sys->pmt[i].b_discontinuity = false;
+        p_sys->pmt[i].p_psi = NULL;
     }
 
     p_sys->sdt.i_pid = 0x11;
     p_sys->sdt.i_continuity_counter = 0;
     p_sys->sdt.b_discontinuity = false;
+    p_sys->sdt.p_psi = NULL;
 
 #ifdef HAVE_DVBPSI_SDT
     var_Get( p_mux, SOUT_CFG_PREFIX "sdtdesc", &val );
@@ -780,6 +834,25 @@ static int Open( vlc_object_t *p_this )
     msg_Dbg( p_mux, "shaping=%"PRId64" pcr=%"PRId64" dts_delay=%"PRId64,
              p_sys->i_shaping_delay, p_sys->i_pcr_delay, p_sys->i_dts_delay );
 
+    p_sys->i_muxrate = var_GetInteger( p_mux, SOUT_CFG_PREFIX "muxrate" );
+    if( p_sys->i_muxrate < 0 )
+        p_sys->i_muxrate = 0;
+    if( p_sys->i_muxrate > 0 )
+    {
+        const int64_t i_slot = INT64_C(188) * 8 * 27000000;
+
+        p_sys->i_cbr_clock = -1;
+        p_sys->i_cbr_frac = 0;
+        p_sys->i_cbr_step = i_slot / p_sys->i_muxrate;
+        p_sys->i_cbr_step_frac = i_slot % p_sys->i_muxrate;
+        msg_Dbg( p_mux, "constant mux rate %"PRId64" bits/s",
+                 p_sys->i_muxrate );
+        if( p_sys->i_pcr_delay * 27 > PCR_INTERVAL_MAX )
+            msg_Warn( p_mux, "PCR interval above 40 ms" );
+    }
+    memset( &p_sys->pcr_stats, 0, sizeof(p_sys->pcr_stats) );
+    p_sys->pcr_stats.i_last_pcr = -1;
+
     p_sys->b_use_key_frames = var_GetBool( p_mux, SOUT_CFG_PREFIX "use-key-frames" );
 
     /* for TS generation */
@@ -875,6 +948,14 @@ static void Close( vlc_object_t * p_this )
         free( p_sys->sdt_descriptors[i].psz_provider );
     }
 
+    if( p_sys->pcr_stats.i_pcrs > 0 )
+        PCRReport( p_mux );
+
+    block_ChainRelease( p_sys->pat.p_psi );
+    for( i = 0; i < MAX_PMT; i++ )
+        block_ChainRelease( p_sys->pmt[i].p_psi );
+    block_ChainRelease( p_sys->sdt.p_psi );
+
     vlc_mutex_destroy( &p_sys->csa_lock );
     free( p_sys->dvbpmt );
     free( p_sys );
@@ -1256,6 +1337,7 @@ static int AddStream( sout_mux_t *p_mux, sout_input_t *p_input )
 
     /* We only change PMT version (PAT isn't changed) */
     p_sys->i_pmt_version_number = ( p_sys->i_pmt_version_number + 1 )%32;
+    p_sys->b_pmt_dirty = true;
 
     /* Update pcr_pid */
     if( p_input->p_fmt->i_cat != SPU_ES &&
@@ -1370,6 +1452,7 @@ static int DelStream( sout_mux_t *p_mux, sout_input_t *p_input )
 
     /* We only change PMT version (PAT isn't changed) */
     p_sys->i_pmt_version_number++; p_sys->i_pmt_version_number %= 32;
+    p_sys->b_pmt_dirty = true;
 
     return VLC_SUCCESS;
 }
@@ -1968,6 +2051,15 @@ static void TSDate( sout_mux_t *p_mux, sout_buffer_chain_t *p_chain_ts,
         i_pcr_length = i_packet_count;
     }
 
+    if( p_sys->csa )
+        TSEncrypt( p_mux, p_chain_ts );
+
+    if( p_sys->i_muxrate > 0 )
+    {
+        TSDateCBR( p_mux, p_chain_ts, i_pcr_length, i_pcr_dts );
+        return;
+    }
+
     /* msg_Dbg( p_mux, "real pck=%d", i_packet_count ); */
     for( i = 0; i < i_packet_count; i++ )
     {
@@ -1981,13 +2073,9 @@ static void TSDate( sout_mux_t *p_mux, sout_buffer_chain_t *p_chain_ts,
         {
             /* msg_Dbg( p_mux, "pcr=%lld ms", p_ts->i_dts / 1000 ); */
             TSSetPCR( p_ts, p_ts->i_dts - p_sys->i_dts_delay );
+            PCRStats( p_mux, ( p_ts->i_dts - p_sys->i_dts_delay ) * 27 );
         }
-        if( p_ts->i_flags & BLOCK_FLAG_SCRAMBLED )
-        {
-            vlc_mutex_lock( &p_sys->csa_lock );
-            csa_Encrypt( p_sys->csa, p_ts->p_buffer, p_sys->i_csa_pkt_size );
-            vlc_mutex_unlock( &p_sys->csa_lock );
-        }
+        p_sys->pcr_stats.i_packets++;
 
         /* latency */
         p_ts->i_dts += p_sys->i_shaping_delay * 3 / 2;
@@ -1996,6 +2084,205 @@ static void TSDate( sout_mux_t *p_mux, sout_buffer_chain_t *p_chain_ts,
     }
 }
 
+static block_t *TSNull( sout_mux_t *p_mux )
+{
+    sout_mux_sys_t *p_sys = p_mux->p_sys;
+    block_t *p_ts = block_New( p_mux, 188 );
+
+    if( !p_ts )
+        return NULL;
+
+    p_ts->p_buffer[0] = 0x47;
+    p_ts->p_buffer[1] = 0x1f;
+    p_ts->p_buffer[2] = 0xff;
+    p_ts->p_buffer[3] = 0x10 | p_sys->i_null_continuity_counter;
+    p_sys->i_null_continuity_counter = (p_sys->i_null_continuity_counter+1)%16;
+    memset( &p_ts->p_buffer[4], 0xff, 184 );
+
+    return p_ts;
+}
+
+/* Sends the packets at the constant mux rate, one per slot of the output
+ * clock. The packets are spread over the slots up to the end of the window,
+ * the free slots get null packets, and each PCR is the time of its slot. */
+static void TSDateCBR( sout_mux_t *p_mux, sout_buffer_chain_t *p_chain_ts,
+                       mtime_t i_pcr_length, mtime_t i_pcr_dts )
+{
+    sout_mux_sys_t  *p_sys = p_mux->p_sys;
+    const int64_t   i_packet_count = p_chain_ts->i_depth;
+    const int64_t   i_start = i_pcr_dts * 27;
+    const int64_t   i_end = ( i_pcr_dts + i_pcr_length ) * 27;
+    const int64_t   i_slot = INT64_C(188) * 8 * 27000000;
+    int64_t         i_slots = 0;
+    int64_t         i_sent = 0;
+
+    /* Start the clock with the stream, and again after a gap in it */
+    if( p_sys->i_cbr_clock < i_start - p_sys->i_shaping_delay * 27 )
+    {
+        if( p_sys->i_cbr_clock >= 0 )
+            msg_Warn( p_mux, "restarting the output clock" );
+        p_sys->i_cbr_clock = i_start;
+        p_sys->i_cbr_frac = 0;
+    }
+
+    if( p_sys->i_cbr_clock < i_end )
+        i_slots = ( ( i_end - p_sys->i_cbr_clock ) * p_sys->i_muxrate +
+                    i_slot - 1 ) / i_slot;
+    if( i_slots < i_packet_count )
+    {
+        /* The clock gets late, the decoders will eat their buffers */
+        msg_Warn( p_mux, "mux rate exceeded (%"PRId64" packets for %"PRId64
+                  " slots)", i_packet_count, i_slots );
+        p_sys->pcr_stats.i_overflows++;
+        i_slots = i_packet_count;
+    }
+
+    for( int64_t i = 0; i < i_slots; i++ )
+    {
+        block_t *p_ts;
+
+        if( ( i + 1 ) * i_packet_count / i_slots > i_sent )
+        {
+            p_ts = BufferChainGet( p_chain_ts );
+            i_sent++;
+        }
+        else
+        {
+            p_ts = TSNull( p_mux );
+            p_sys->pcr_stats.i_nulls++;
+        }
+
+        if( p_ts )
+        {
+            p_ts->i_dts    = p_sys->i_cbr_clock / 27;
+            p_ts->i_length = p_sys->i_cbr_step / 27;
+
+            if( p_ts->i_flags & BLOCK_FLAG_CLOCK )
+            {
+                TSSetPCR27( p_ts,
+                            p_sys->i_cbr_clock - p_sys->i_dts_delay * 27 );
+                PCRStats( p_mux, p_sys->i_cbr_clock - p_sys->i_dts_delay * 27 );
+            }
+
+            /* latency */
+            p_ts->i_dts += p_sys->i_shaping_delay * 3 / 2;
+
+            sout_AccessOutWrite( p_mux->p_access, p_ts );
+        }
+        p_sys->pcr_stats.i_packets++;
+
+        /* Next slot */
+        p_sys->i_cbr_clock += p_sys->i_cbr_step;
+        p_sys->i_cbr_frac += p_sys->i_cbr_step_frac;
+        if( p_sys->i_cbr_frac >= p_sys->i_muxrate )
+        {
+            p_sys->i_cbr_clock++;
+            p_sys->i_cbr_frac -= p_sys->i_muxrate;
+        }
+    }
+}
+
+/* Measures the interval between the PCRs and, at a constant bitrate, their
+ * accuracy: the difference with the value expected from the number of
+ * packets sent since the previous PCR. */
+static void PCRStats( sout_mux_t *p_mux, int64_t i_pcr )
+{
+    sout_mux_sys_t *p_sys = p_mux->p_sys;
+    ts_pcr_stats_t *p_stats = &p_sys->pcr_stats;
+
+    if( p_stats->i_last_pcr >= 0 )
+    {
+        const int64_t i_interval = i_pcr - p_stats->i_last_pcr;
+
+        if( i_interval > p_stats->i_interval_max )
+            p_stats->i_interval_max = i_interval;
+        if( i_interval > PCR_INTERVAL_MAX )
+            p_stats->i_interval_errors++;
+
+        if( p_sys->i_muxrate > 0 )
+        {
+            const int64_t i_packets = p_stats->i_packets -
+                                      p_stats->i_last_packet;
+            /* in ticks * i_muxrate */
+            const int64_t i_error = i_interval * p_sys->i_muxrate -
+                                    i_packets * 188 * 8 * 27000000;
+            const int64_t i_error_ns = llabs( i_error ) * 1000 /
+                                       ( 27 * p_sys->i_muxrate );
+
+            if( i_error_ns > p_stats->i_accuracy_max )
+                p_stats->i_accuracy_max = i_error_ns;
+            if( i_error_ns > PCR_ACCURACY_MAX )
+                p_stats->i_accuracy_errors++;
+        }
+    }
+    p_stats->i_last_pcr = i_pcr;
+    p_stats->i_last_packet = p_stats->i_packets;
+    p_stats->i_pcrs++;
+
+    const mtime_t i_now = mdate();
+    if( p_stats->i_next_report == 0 )
+        p_stats->i_next_report = i_now + PCR_REPORT_PERIOD;
+    else if( i_now >= p_stats->i_next_report )
+    {
+        PCRReport( p_mux );
+        p_stats->i_next_report = i_now + PCR_REPORT_PERIOD;
+    }
+}
+
+/* Reports the statistics since the previous report */
+static void PCRReport( sout_mux_t *p_mux )
+{
+    sout_mux_sys_t *p_sys = p_mux->p_sys;
+    ts_pcr_stats_t *p_stats = &p_sys->pcr_stats;
+
+    msg_Dbg( p_mux, "%"PRId64" PCR, interval max %"PRId64" us "
+             "(%"PRId64" over 40 ms)", p_stats->i_pcrs,
+             p_stats->i_interval_max / 27, p_stats->i_interval_errors );
+    if( p_sys->i_muxrate > 0 )
+        msg_Dbg( p_mux, "PCR accuracy max %"PRId64" ns (%"PRId64" over "
+                 "500 ns), %"PRId64"/%"PRId64" null packets, %"PRId64
+                 " overflows", p_stats->i_accuracy_max,
+                 p_stats->i_accuracy_errors, p_stats->i_nulls,
+                 p_stats->i_packets, p_stats->i_overflows );
+
+    p_stats->i_pcrs = 0;
+    p_stats->i_interval_max = 0;
+    p_stats->i_interval_errors = 0;
+    p_stats->i_accuracy_max = 0;
+    p_stats->i_accuracy_errors = 0;
+    p_stats->i_nulls = 0;
+    p_stats->i_overflows = 0;
+    p_stats->i_packets -= p_stats->i_last_packet;
+    p_stats->i_last_packet = 0;
+}
+
+/* Scrambles the packets of the chain that are flagged for it, by batches.
+ * The adaptation field, where TSDate sets the PCR, is left in clear. */
+static void TSEncrypt( sout_mux_t *p_mux, sout_buffer_chain_t *p_chain_ts )
+{
+    sout_mux_sys_t *p_sys = p_mux->p_sys;
+    uint8_t *pp_pkts[CSA_BATCH_SIZE];
+    int i_pkts = 0;
+
+    vlc_mutex_lock( &p_sys->csa_lock );
+    for( block_t *p_ts = p_chain_ts->p_first; p_ts; p_ts = p_ts->p_next )
+    {
+        if( !( p_ts->i_flags & BLOCK_FLAG_SCRAMBLED ) )
+            continue;
+
+        pp_pkts[i_pkts++] = p_ts->p_buffer;
+        if( i_pkts == CSA_BATCH_SIZE )
+        {
+            csa_EncryptBatch( p_sys->csa, pp_pkts, i_pkts,
+                              p_sys->i_csa_pkt_size );
+            i_pkts = 0;
+        }
+    }
+    if( i_pkts > 0 )
+        csa_EncryptBatch( p_sys->csa, pp_pkts, i_pkts, p_sys->i_csa_pkt_size );
+    vlc_mutex_unlock( &p_sys->csa_lock );
+}
+
 static block_t *TSNew( sout_mux_t *p_mux, ts_stream_t *p_stream,
                        bool b_pcr )
 {
@@ -2127,6 +2414,20 @@ static void TSSetPCR( block_t *p_ts, mtime_t i_dts )
     p_ts->p_buffer[10]|= ( i_pcr << 7  )&0x80;
 }
 
+/* Sets the PCR with its extension from a 27 MHz clock */
+static void TSSetPCR27( block_t *p_ts, int64_t i_pcr )
+{
+    const int64_t i_base = i_pcr / 300;
+    const int     i_ext  = i_pcr % 300;
+
+    p_ts->p_buffer[6]  = ( i_base >> 25 )&0xff;
+    p_ts->p_buffer[7]  = ( i_base >> 17 )&0xff;
+    p_ts->p_buffer[8]  = ( i_base >> 9  )&0xff;
+    p_ts->p_buffer[9]  = ( i_base >> 1  )&0xff;
+    p_ts->p_buffer[10] = ( ( i_base << 7 )&0x80 ) | 0x7e | ( i_ext >> 8 );
+    p_ts->p_buffer[11] = i_ext & 0xff;
+}
+
 #if 0
 static void TSSetConstraints( sout_mux_t *p_mux, sout_buffer_chain_t *c,
                               mtime_t i_length, int i_bitrate_min,
@@ -2340,15 +2641,54 @@ static block_t *WritePSISection( sout_instance_t *p_sout,
     return( p_first );
 }
 
+/* Packetizes the sections of a PSI table once. Until the next version, its
+ * TS packets are only copied with the continuity counter updated. */
+static void PSICache( sout_mux_t *p_mux, ts_stream_t *p_stream,
+                      dvbpsi_psi_section_t *p_section )
+{
+    sout_buffer_chain_t chain;
+    const int i_continuity_counter = p_stream->i_continuity_counter;
+
+    BufferChainInit( &chain );
+    PEStoTS( p_mux->p_sout, &chain,
+             WritePSISection( p_mux->p_sout, p_section ), p_stream );
+    p_stream->i_continuity_counter = i_continuity_counter;
+
+    block_ChainRelease( p_stream->p_psi );
+    p_stream->p_psi = chain.p_first;
+}
+
+static void PSIToTS( sout_buffer_chain_t *c, ts_stream_t *p_stream )
+{
+    for( block_t *p_psi = p_stream->p_psi; p_psi != NULL;
+         p_psi = p_psi->p_next )
+    {
+        block_t *p_ts = block_Duplicate( p_psi );
+        if( !p_ts )
+            break;
+
+        p_ts->p_buffer[3] = ( p_ts->p_buffer[3]&0xf0 )|
+                            p_stream->i_continuity_counter;
+        p_stream->i_continuity_counter = (p_stream->i_continuity_counter+1)%16;
+
+        BufferChainAppend( c, p_ts );
+    }
+}
+
 static void GetPAT( sout_mux_t *p_mux,
                     sout_buffer_chain_t *c )
 {
     sout_mux_sys_t       *p_sys = p_mux->p_sys;
-    block_t              *p_pat;
     dvbpsi_pat_t         pat;
     dvbpsi_psi_section_t *p_section;
     int i;
 
+    if( p_sys->i_pat_cache_version == p_sys->i_pat_version_number )
+    {
+        PSIToTS( c, &p_sys->pat );
+        return;
+    }
+
     dvbpsi_InitPAT( &pat, p_sys->i_tsid, p_sys->i_pat_version_number,
                     1 );      /* b_current_next */
     /* add all programs */
@@ -2360,12 +2700,13 @@ static void GetPAT( sout_mux_t *p_mux,
     p_section = dvbpsi_GenPATSections( &pat,
                                        0 );     /* max program per section */
 
-    p_pat = WritePSISection( p_mux->p_sout, p_section );
-
-    PEStoTS( p_mux->p_sout, c, p_pat, &p_sys->pat );
+    PSICache( p_mux, &p_sys->pat, p_section );
 
     dvbpsi_DeletePSISections( p_section );
     dvbpsi_EmptyPAT( &pat );
+
+    p_sys->i_pat_cache_version = p_sys->i_pat_version_number;
+    PSIToTS( c, &p_sys->pat );
 }
 
 static uint32_t GetDescriptorLength24b( int i_length )
@@ -2382,7 +2723,26 @@ static uint32_t GetDescriptorLength24b( int i_length )
 static void GetPMT( sout_mux_t *p_mux, sout_buffer_chain_t *c )
 {
     sout_mux_sys_t  *p_sys = p_mux->p_sys;
-    block_t   *p_pmt[MAX_PMT];
+
+    /* The PMT (and SDT) only change with the set of streams */
+    if( p_sys->b_pmt_dirty )
+    {
+        if( UpdatePMT( p_mux ) != VLC_SUCCESS )
+            return;
+        p_sys->b_pmt_dirty = false;
+    }
+
+    for( int i = 0; i < p_sys->i_num_pmt; i++ )
+        PSIToTS( c, &p_sys->pmt[i] );
+#ifdef HAVE_DVBPSI_SDT
+    if( p_sys->b_sdt )
+        PSIToTS( c, &p_sys->sdt );
+#endif
+}
+
+static int UpdatePMT( sout_mux_t *p_mux )
+{
+    sout_mux_sys_t  *p_sys = p_mux->p_sys;
 
     dvbpsi_pmt_es_t     *p_es;
     dvbpsi_psi_section_t *p_section[MAX_PMT];
@@ -2393,7 +2753,6 @@ static void GetPMT( sout_mux_t *p_mux, sout_buffer_chain_t *c )
     int             *p_usepid = NULL;
 
 #ifdef HAVE_DVBPSI_SDT
-    block_t         *p_sdt;
     dvbpsi_sdt_t    sdt;
 
     dvbpsi_psi_section_t* p_section2;
@@ -2407,7 +2766,7 @@ static void GetPMT( sout_mux_t *p_mux, sout_buffer_chain_t *c )
         p_sys->dvbpmt = malloc( p_sys->i_num_pmt * sizeof(dvbpsi_pmt_t) );
         if( !p_sys->dvbpmt )
         {
-            return;
+            return VLC_ENOMEM;
         }
     }
 #ifdef HAVE_DVBPSI_SDT
@@ -2763,8 +3122,7 @@ static void GetPMT( sout_mux_t *p_mux, sout_buffer_chain_t *c )
     for( i = 0; i < p_sys->i_num_pmt; i++ )
     {
         p_section[i] = dvbpsi_GenPMTSections( &p_sys->dvbpmt[i] );
-        p_pmt[i] = WritePSISection( p_mux->p_sout, p_section[i] );
-        PEStoTS( p_mux->p_sout, c, p_pmt[i], &p_sys->pmt[i] );
+        PSICache( p_mux, &p_sys->pmt[i], p_section[i] );
         dvbpsi_DeletePSISections( p_section[i] );
         dvbpsi_EmptyPMT( &p_sys->dvbpmt[i] );
     }
@@ -2773,10 +3131,11 @@ static void GetPMT( sout_mux_t *p_mux, sout_buffer_chain_t *c )
     if( p_sys->b_sdt )
     {
         p_section2 = dvbpsi_GenSDTSections( &sdt );
-        p_sdt = WritePSISection( p_mux->p_sout, p_section2 );
-        PEStoTS( p_mux->p_sout, c, p_sdt, &p_sys->sdt );
+        PSICache( p_mux, &p_sys->sdt, p_section2 );
         dvbpsi_DeletePSISections( p_section2 );
         dvbpsi_EmptySDT( &sdt );
     }
 #endif
+
+    return VLC_SUCCESS;
 }
@@ -79,6 +79,12 @@
 #define VFILTER_LONGTEXT N_( \
     "Video filters will be applied to the video streams (after overlays " \
     "are applied). You can enter a colon-separated list of filters." )
+#define RUNG_TEXT N_("Encoding ladder rung")
+#define RUNG_LONGTEXT N_( \
+    "Additional video output sharing the decoder and the filters, given " \
+    "as {width=...,height=...,vb=...,vcodec=...,venc=...,dst=...}. Only " \
+    "dst is required, the other values default to the ones of the main " \
+    "output. This option can be repeated." )
 
 #define AENC_TEXT N_("Audio encoder")
 #define AENC_LONGTEXT N_( \
@@ -125,7 +131,18 @@
 
 #define THREADS_TEXT N_("Number of threads")
 #define THREADS_LONGTEXT N_( \
-    "Number of threads used for the transcoding." )
+    "Number of threads used for the transcoding. When it is not 0, the " \
+    "video encoder runs in its own thread." )
+#define FILTER_THREADS_TEXT N_("Number of video filtering threads")
+#define FILTER_THREADS_LONGTEXT N_( \
+    "When it is not 0, deinterlacing, scaling, overlays and the video " \
+    "filters run in their own thread, between decoding and encoding. " \
+    "With more threads, the pictures are deinterlaced and scaled in " \
+    "parallel, in turn, and kept in order." )
+#define PICTURE_QUEUE_TEXT N_("Video pipeline queue size")
+#define PICTURE_QUEUE_LONGTEXT N_( \
+    "Number of pictures waiting for the video filtering and encoding " \
+    "threads. A stage waits when the queue of the next one is full." )
 #define HP_TEXT N_("High priority")
 #define HP_LONGTEXT N_( \
     "Runs the optional encoder thread at the OUTPUT priority instead of " \
@@ -188,6 +205,8 @@ vlc_module_begin ()
     add_module_list( SOUT_CFG_PREFIX "vfilter", "video filter2",
                      NULL, NULL,
                      VFILTER_TEXT, VFILTER_LONGTEXT, false )
+    add_string( SOUT_CFG_PREFIX "rung", NULL, NULL, RUNG_TEXT,
+                RUNG_LONGTEXT, true )
 
     set_section( N_("Audio"), NULL )
     add_module( SOUT_CFG_PREFIX "aenc", "encoder", NULL, NULL, AENC_TEXT,
@@ -226,6 +245,10 @@ vlc_module_begin ()
     set_section( N_("Miscellaneous"), NULL )
     add_integer( SOUT_CFG_PREFIX "threads", 0, NULL, THREADS_TEXT,
                  THREADS_LONGTEXT, true )
+    add_integer_with_range( SOUT_CFG_PREFIX "filter-threads", 0, 0, 16, NULL,
+                 FILTER_THREADS_TEXT, FILTER_THREADS_LONGTEXT, true )
+    add_integer_with_range( SOUT_CFG_PREFIX "picture-queue", 8, 1, 64, NULL,
+                 PICTURE_QUEUE_TEXT, PICTURE_QUEUE_LONGTEXT, true )
     add_bool( SOUT_CFG_PREFIX "high-priority", false, NULL, HP_TEXT, HP_LONGTEXT,
               true )
 
@@ -237,7 +260,7 @@ static const char *const ppsz_sout_options[] = {
     "deinterlace-module", "threads", "hurry-up", "aenc", "acodec", "ab", "alang",
     "afilter", "samplerate", "channels", "senc", "scodec", "soverlay",
     "sfilter", "osd", "audio-sync", "high-priority", "maxwidth", "maxheight",
-    NULL
+    "filter-threads", "picture-queue", "rung", NULL
 };
 
 /*****************************************************************************
@@ -247,6 +270,9 @@ static sout_stream_id_t *Add ( sout_stream_t *, es_format_t * );
 static int               Del ( sout_stream_t *, sout_stream_id_t * );
 static int               Send( sout_stream_t *, sout_stream_id_t *, block_t* );
 
+static transcode_rung_t *RungCreate( sout_stream_t *, const char * );
+static void              RungDelete( transcode_rung_t * );
+
 /*****************************************************************************
  * Open:
  *****************************************************************************/
@@ -385,6 +411,18 @@ static int Open( vlc_object_t *p_this )
         p_sys->psz_vf2 = NULL;
     }
 
+    /* Encoding ladder, the rung option can be repeated */
+    TAB_INIT( p_sys->i_rungs, p_sys->pp_rungs );
+    for( config_chain_t *p_cfg = p_stream->p_cfg; p_cfg; p_cfg = p_cfg->p_next )
+    {
+        if( strcmp( p_cfg->psz_name, "rung" ) || !p_cfg->psz_value )
+            continue;
+
+        transcode_rung_t *p_rung = RungCreate( p_stream, p_cfg->psz_value );
+        if( p_rung )
+            TAB_APPEND( p_sys->i_rungs, p_sys->pp_rungs, p_rung );
+    }
+
     var_Get( p_stream, SOUT_CFG_PREFIX "deinterlace", &val );
     p_sys->b_deinterlace = val.b_bool;
 
@@ -403,6 +441,10 @@ static int Open( vlc_object_t *p_this )
 
     var_Get( p_stream, SOUT_CFG_PREFIX "threads", &val );
     p_sys->i_threads = val.i_int;
+    var_Get( p_stream, SOUT_CFG_PREFIX "filter-threads", &val );
+    p_sys->i_filter_threads = val.i_int;
+    var_Get( p_stream, SOUT_CFG_PREFIX "picture-queue", &val );
+    p_sys->i_picture_queue = val.i_int;
     var_Get( p_stream, SOUT_CFG_PREFIX "high-priority", &val );
     p_sys->b_high_priority = val.b_bool;
 
@@ -522,6 +564,10 @@ static void Close( vlc_object_t * p_this )
 
     free( p_sys->psz_vf2 );
 
+    for( int i = 0; i < p_sys->i_rungs; i++ )
+        RungDelete( p_sys->pp_rungs[i] );
+    TAB_CLEAN( p_sys->i_rungs, p_sys->pp_rungs );
+
     config_ChainDestroy( p_sys->p_video_cfg );
     free( p_sys->psz_venc );
 
@@ -539,6 +585,98 @@ static void Close( vlc_object_t * p_this )
     vlc_object_release( p_sys );
 }
 
+/*****************************************************************************
+ * Encoding ladder rungs:
+ *****************************************************************************/
+static transcode_rung_t *RungCreate( sout_stream_t *p_stream,
+                                     const char *psz_profile )
+{
+    transcode_rung_t *p_rung;
+    config_chain_t *p_cfg, *p_list;
+    char *psz_chain, *psz_name, *psz_dst = NULL;
+
+    /* rung{...} keeps the brackets, rung={...} does not */
+    if( *psz_profile == '{' )
+        psz_chain = strdup( psz_profile );
+    else if( asprintf( &psz_chain, "{%s}", psz_profile ) == -1 )
+        psz_chain = NULL;
+    if( !psz_chain )
+        return NULL;
+    free( config_ChainCreate( &psz_name, &p_list, psz_chain ) );
+    free( psz_name );
+    free( psz_chain );
+
+    p_rung = calloc( 1, sizeof( *p_rung ) );
+    if( !p_rung )
+    {
+        config_ChainDestroy( p_list );
+        return NULL;
+    }
+
+    for( p_cfg = p_list; p_cfg != NULL; p_cfg = p_cfg->p_next )
+    {
+        const char *psz_value = p_cfg->psz_value ? p_cfg->psz_value : "";
+
+        if( !strcmp( p_cfg->psz_name, "width" ) )
+            p_rung->i_width = atoi( psz_value );
+        else if( !strcmp( p_cfg->psz_name, "height" ) )
+            p_rung->i_height = atoi( psz_value );
+        else if( !strcmp( p_cfg->psz_name, "vb" ) )
+        {
+            p_rung->i_vbitrate = atoi( psz_value );
+            if( p_rung->i_vbitrate < 16000 ) p_rung->i_vbitrate *= 1000;
+        }
+        else if( !strcmp( p_cfg->psz_name, "vcodec" ) && *psz_value )
+        {
+            char fcc[4] = "    ";
+            memcpy( fcc, psz_value, __MIN( strlen( psz_value ), 4 ) );
+            p_rung->i_vcodec = VLC_FOURCC( fcc[0], fcc[1], fcc[2], fcc[3] );
+        }
+        else if( !strcmp( p_cfg->psz_name, "venc" ) && *psz_value &&
+                 !p_rung->psz_venc )
+        {
+            free( config_ChainCreate( &p_rung->psz_venc,
+                                      &p_rung->p_video_cfg, psz_value ) );
+        }
+        else if( !strcmp( p_cfg->psz_name, "dst" ) && *psz_value &&
+                 !psz_dst )
+            psz_dst = strdup( psz_value );
+        else
+            msg_Err( p_stream, " * ignore unknown rung option `%s'",
+                     p_cfg->psz_name );
+    }
+    config_ChainDestroy( p_list );
+
+    if( !psz_dst )
+    {
+        msg_Err( p_stream, "no destination given for the rung `%s'",
+                 psz_profile );
+        RungDelete( p_rung );
+        return NULL;
+    }
+
+    msg_Dbg( p_stream, " * adding rung `%s'", psz_dst );
+    p_rung->p_out = sout_StreamChainNew( p_stream->p_sout, psz_dst,
+                                         NULL, NULL );
+    free( psz_dst );
+    if( !p_rung->p_out )
+    {
+        msg_Err( p_stream, "cannot create the chain of the rung" );
+        RungDelete( p_rung );
+        return NULL;
+    }
+    return p_rung;
+}
+
+static void RungDelete( transcode_rung_t *p_rung )
+{
+    if( p_rung->p_out )
+        sout_StreamChainDelete( p_rung->p_out, NULL );
+    config_ChainDestroy( p_rung->p_video_cfg );
+    free( p_rung->psz_venc );
+    free( p_rung );
+}
+
 static sout_stream_id_t *Add( sout_stream_t *p_stream, es_format_t *p_fmt )
 {
     sout_stream_sys_t *p_sys = p_stream->p_sys;
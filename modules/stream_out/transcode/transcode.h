@@ -10,23 +10,26 @@
 #include <vlc_codec.h>
 
 
-#define PICTURE_RING_SIZE 64
 #define SUBPICTURE_RING_SIZE 20
 
 #define MASTER_SYNC_MAX_DRIFT 100000
 
+/* Additional output of the video encoding ladder */
+typedef struct
+{
+    unsigned int    i_width;    /* 0 to keep the aspect ratio */
+    unsigned int    i_height;
+    int             i_vbitrate; /* 0 for the one of the main output */
+    vlc_fourcc_t    i_vcodec;
+    char            *psz_venc;
+    config_chain_t  *p_video_cfg;
+    sout_stream_t   *p_out;     /* destination chain */
+} transcode_rung_t;
+
 struct sout_stream_sys_t
 {
     VLC_COMMON_MEMBERS
 
-    sout_stream_id_t *id_video;
-    block_t         *p_buffers;
-    vlc_mutex_t     lock_out;
-    vlc_cond_t      cond;
-    picture_t *     pp_pics[PICTURE_RING_SIZE];
-    int             i_first_pic, i_last_pic;
-    bool            b_error;
-
     /* Audio */
     vlc_fourcc_t    i_acodec;   /* codec audio (0 if not transcode) */
     char            *psz_aenc;
@@ -51,11 +54,17 @@ struct sout_stream_sys_t
     char            *psz_deinterlace;
     config_chain_t  *p_deinterlace_cfg;
     int             i_threads;
+    int             i_filter_threads;
+    int             i_picture_queue;
     bool            b_high_priority;
     bool            b_hurry_up;
 
     char            *psz_vf2;
 
+    /* Encoding ladder */
+    int              i_rungs;
+    transcode_rung_t **pp_rungs;
+
     /* SPU */
     vlc_fourcc_t    i_scodec;   /* codec spu (0 if not transcode) */
     char            *psz_senc;
@@ -74,6 +83,26 @@ struct sout_stream_sys_t
     mtime_t         i_master_drift;
 };
 
+/* Bounded picture queue between two stages of the video pipeline */
+typedef struct transcode_queue_t transcode_queue_t;
+typedef struct transcode_lane_t transcode_lane_t;
+typedef struct transcode_encoder_t transcode_encoder_t;
+
+/* Statistics of a stage of the video pipeline */
+typedef struct
+{
+    unsigned        i_pictures;
+    mtime_t         i_time;     /* total processing time */
+    mtime_t         i_time_max;
+} transcode_stage_t;
+
+enum
+{
+    TRANSCODE_STAGE_DECODE,
+    TRANSCODE_STAGE_FILTER,
+    TRANSCODE_STAGE_COUNT
+};
+
 struct sout_stream_id_t
 {
     bool            b_transcode;
@@ -94,6 +123,23 @@ struct sout_stream_id_t
 
     /* Sync */
     date_t          interpolated_pts;
+
+    /* Video pipeline: decode -> filter queue or lanes -> filter thread ->
+     * encode queues -> encoder threads. The queues are NULL when the
+     * next stage runs in the thread of the previous one. The first encoder
+     * is the one of the main output, the next ones the ladder rungs. */
+    sout_stream_t       *p_stream;
+    transcode_queue_t   *p_filter_queue;
+    transcode_lane_t    *p_lanes;
+    int                 i_lanes;
+    int                 i_lane;     /* next lane to give a picture to */
+    transcode_encoder_t *p_encoders;
+    int                 i_encoders;
+    vlc_thread_t        filter_thread;
+    vlc_mutex_t         lock_out;   /* protects the encoded blocks and the
+                                     * statistics */
+    transcode_stage_t   stages[TRANSCODE_STAGE_COUNT];
+    mtime_t             i_next_report;
 };
 
 /* OSD */
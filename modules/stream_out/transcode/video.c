@@ -36,6 +36,9 @@
 #define ENC_FRAMERATE (25 * 1000 + .5)
 #define ENC_FRAMERATE_BASE 1000
 
+/* Period of the video pipeline statistics in the debug messages */
+#define PIPELINE_REPORT_PERIOD (INT64_C(5000000))
+
 struct decoder_owner_sys_t
 {
     sout_stream_sys_t *p_sys;
@@ -78,23 +81,7 @@ static void video_unlink_picture_decoder( decoder_t *p_dec, picture_t *p_pic )
 
 static picture_t *video_new_buffer_decoder( decoder_t *p_dec )
 {
-    sout_stream_sys_t *p_ssys = p_dec->p_owner->p_sys;
-    if( p_ssys->i_threads >= 1 )
-    {
-        int i_first_pic = p_ssys->i_first_pic;
-
-        if( p_ssys->i_first_pic != p_ssys->i_last_pic )
-        {
-            /* Encoder still has stuff to encode, wait to clear-up the list */
-            while( p_ssys->i_first_pic == i_first_pic )
-            {
-#warning THERE IS DEFINITELY A BUG! LOCKING IS INSUFFICIENT!
-                msleep( 10000 );
-                barrier ();
-            }
-        }
-    }
-
+    /* The bounded queues of the pipeline throttle the decoder */
     p_dec->fmt_out.video.i_chroma = p_dec->fmt_out.i_codec;
     return picture_NewFromFormat( &p_dec->fmt_out.video );
 }
@@ -124,56 +111,713 @@ static void transcode_video_filter_allocation_clear( filter_t *p_filter )
     VLC_UNUSED(p_filter);
 }
 
-static void* EncoderThread( vlc_object_t* p_this )
+/*****************************************************************************
+ * Bounded picture queues
+ *****************************************************************************
+ * The pictures left when a queue is killed are still given to the next
+ * stage, so that nothing is lost when the stream is closed.
+ *****************************************************************************/
+struct transcode_queue_t
 {
-    sout_stream_sys_t *p_sys = (sout_stream_sys_t*)p_this;
-    sout_stream_id_t *id = p_sys->id_video;
-    picture_t *p_pic;
-    int canc = vlc_savecancel ();
+    vlc_mutex_t lock;
+    vlc_cond_t  wait_pic;   /* a picture was pushed, or the queue killed */
+    vlc_cond_t  wait_room;  /* a picture was popped, or the queue killed */
+    bool        b_dead;
+
+    int         i_size;
+    int         i_first;
+    int         i_count;
+    int         i_count_max;
+    struct
+    {
+        picture_t *p_pic;       /* NULL if a filter dropped the picture */
+        mtime_t   i_dup_date;   /* date of a duplicate to encode, or 0 */
+    } *p_entries;
+};
+
+static transcode_queue_t *transcode_queue_New( int i_size )
+{
+    transcode_queue_t *p_queue = malloc( sizeof( *p_queue ) );
+    if( !p_queue )
+        return NULL;
 
-    while( vlc_object_alive (p_sys) && !p_sys->b_error )
+    p_queue->p_entries = calloc( i_size, sizeof( *p_queue->p_entries ) );
+    if( !p_queue->p_entries )
     {
-        block_t *p_block;
+        free( p_queue );
+        return NULL;
+    }
+    vlc_mutex_init( &p_queue->lock );
+    vlc_cond_init( &p_queue->wait_pic );
+    vlc_cond_init( &p_queue->wait_room );
+    p_queue->b_dead = false;
+    p_queue->i_size = i_size;
+    p_queue->i_first = 0;
+    p_queue->i_count = 0;
+    p_queue->i_count_max = 0;
+    return p_queue;
+}
 
-        vlc_mutex_lock( &p_sys->lock_out );
-        while( p_sys->i_last_pic == p_sys->i_first_pic )
+static void transcode_queue_Delete( transcode_queue_t *p_queue )
+{
+    for( int i = 0; i < p_queue->i_count; i++ )
+    {
+        picture_t *p_pic = p_queue->p_entries[(p_queue->i_first + i) %
+                                              p_queue->i_size].p_pic;
+        if( p_pic )
+            picture_Release( p_pic );
+    }
+    vlc_cond_destroy( &p_queue->wait_room );
+    vlc_cond_destroy( &p_queue->wait_pic );
+    vlc_mutex_destroy( &p_queue->lock );
+    free( p_queue->p_entries );
+    free( p_queue );
+}
+
+static void transcode_queue_Kill( transcode_queue_t *p_queue )
+{
+    vlc_mutex_lock( &p_queue->lock );
+    p_queue->b_dead = true;
+    vlc_cond_broadcast( &p_queue->wait_pic );
+    vlc_cond_broadcast( &p_queue->wait_room );
+    vlc_mutex_unlock( &p_queue->lock );
+}
+
+/* Waits until there is room in the queue. The picture is released if the
+ * queue is dead. */
+static void transcode_queue_Push( transcode_queue_t *p_queue, picture_t *p_pic,
+                                  mtime_t i_dup_date )
+{
+    vlc_mutex_lock( &p_queue->lock );
+    while( p_queue->i_count >= p_queue->i_size && !p_queue->b_dead )
+        vlc_cond_wait( &p_queue->wait_room, &p_queue->lock );
+
+    if( p_queue->b_dead )
+    {
+        vlc_mutex_unlock( &p_queue->lock );
+        if( p_pic )
+            picture_Release( p_pic );
+        return;
+    }
+
+    const int i_last = (p_queue->i_first + p_queue->i_count) % p_queue->i_size;
+    p_queue->p_entries[i_last].p_pic = p_pic;
+    p_queue->p_entries[i_last].i_dup_date = i_dup_date;
+    p_queue->i_count++;
+    p_queue->i_count_max = __MAX( p_queue->i_count_max, p_queue->i_count );
+    vlc_cond_signal( &p_queue->wait_pic );
+    vlc_mutex_unlock( &p_queue->lock );
+}
+
+/* Waits for an entry. Returns VLC_EGENERIC when the queue is dead and
+ * empty. */
+static int transcode_queue_Pop( transcode_queue_t *p_queue,
+                                picture_t **pp_pic, mtime_t *pi_dup_date )
+{
+    vlc_mutex_lock( &p_queue->lock );
+    while( p_queue->i_count == 0 && !p_queue->b_dead )
+        vlc_cond_wait( &p_queue->wait_pic, &p_queue->lock );
+
+    if( p_queue->i_count == 0 )
+    {
+        vlc_mutex_unlock( &p_queue->lock );
+        return VLC_EGENERIC;
+    }
+
+    *pp_pic = p_queue->p_entries[p_queue->i_first].p_pic;
+    *pi_dup_date = p_queue->p_entries[p_queue->i_first].i_dup_date;
+    p_queue->i_first = (p_queue->i_first + 1) % p_queue->i_size;
+    p_queue->i_count--;
+    vlc_cond_signal( &p_queue->wait_room );
+    vlc_mutex_unlock( &p_queue->lock );
+    return VLC_SUCCESS;
+}
+
+/* Returns the current number of pictures, and the highest one so far */
+static int transcode_queue_GetDepth( transcode_queue_t *p_queue,
+                                     int *pi_max )
+{
+    vlc_mutex_lock( &p_queue->lock );
+    const int i_count = p_queue->i_count;
+    *pi_max = p_queue->i_count_max;
+    vlc_mutex_unlock( &p_queue->lock );
+    return i_count;
+}
+
+/*****************************************************************************
+ * Video pipeline
+ *****************************************************************************
+ * The decoder runs in the thread sending the blocks. With filter-threads,
+ * the filters run in a filter thread; with more than one filter thread,
+ * the deinterlace and conversion chain runs in lanes that are given the
+ * pictures in turn, each with its own copy of the chain, and the filter
+ * thread reads them back in the same order before the overlays and the
+ * user filters. With threads, each encoder runs in its own thread.
+ *
+ * The first encoder is the one of the main output, the next ones are the
+ * rungs of the encoding ladder. They are given the pictures of the main
+ * output, converted once for each size and shared by reference.
+ *****************************************************************************/
+struct transcode_lane_t
+{
+    sout_stream_id_t  *id;
+    filter_chain_t    *p_chain;
+    transcode_queue_t *p_in;
+    transcode_queue_t *p_out;
+    vlc_thread_t      thread;
+};
+
+struct transcode_encoder_t
+{
+    sout_stream_id_t  *id;
+    encoder_t         *p_encoder;
+    transcode_queue_t *p_queue;     /* NULL without encoder thread */
+    vlc_thread_t      thread;
+    block_t           *p_buffers;   /* protected by id->lock_out */
+    transcode_stage_t stage;        /* protected by id->lock_out */
+
+    /* Rungs of the ladder */
+    transcode_rung_t  *p_rung;
+    sout_stream_id_t  *p_out_id;
+    filter_chain_t    *p_chain;     /* converts the main output pictures */
+    int               i_source;     /* encoder with the same pictures */
+};
+
+static void transcode_video_stage_add( sout_stream_id_t *id,
+                                       transcode_stage_t *p_stage,
+                                       mtime_t i_start, unsigned i_pictures )
+{
+    const mtime_t i_time = mdate() - i_start;
+
+    vlc_mutex_lock( &id->lock_out );
+    p_stage->i_pictures += i_pictures;
+    p_stage->i_time += i_time;
+    p_stage->i_time_max = __MAX( p_stage->i_time_max, i_time );
+    vlc_mutex_unlock( &id->lock_out );
+}
+
+static void transcode_video_report_stage( sout_stream_t *p_stream,
+                                          sout_stream_id_t *id,
+                                          const transcode_stage_t *p_stage,
+                                          const char *psz_name, int i_index )
+{
+    transcode_stage_t stage;
+
+    vlc_mutex_lock( &id->lock_out );
+    stage = *p_stage;
+    vlc_mutex_unlock( &id->lock_out );
+
+    if( stage.i_pictures == 0 )
+        return;
+    msg_Dbg( p_stream, "video %s %d: %u pictures, %"PRId64" us average, "
+             "%"PRId64" us max", psz_name, i_index, stage.i_pictures,
+             stage.i_time / stage.i_pictures, stage.i_time_max );
+}
+
+static void transcode_video_report_queue( sout_stream_t *p_stream,
+                                          transcode_queue_t *p_queue,
+                                          const char *psz_name, int i_index )
+{
+    int i_max;
+    int i_depth = transcode_queue_GetDepth( p_queue, &i_max );
+
+    msg_Dbg( p_stream, "video %s queue %d: %d/%d pictures (max %d)",
+             psz_name, i_index, i_depth, p_queue->i_size, i_max );
+}
+
+static void transcode_video_report( sout_stream_t *p_stream,
+                                    sout_stream_id_t *id )
+{
+    transcode_video_report_stage( p_stream, id,
+                                  &id->stages[TRANSCODE_STAGE_DECODE],
+                                  "decode", 0 );
+    transcode_video_report_stage( p_stream, id,
+                                  &id->stages[TRANSCODE_STAGE_FILTER],
+                                  "filter", 0 );
+    for( int i = 0; i < id->i_encoders; i++ )
+        transcode_video_report_stage( p_stream, id,
+                                      &id->p_encoders[i].stage, "encode", i );
+}
+
+static void transcode_video_report_queues( sout_stream_t *p_stream,
+                                           sout_stream_id_t *id )
+{
+    if( id->p_filter_queue )
+        transcode_video_report_queue( p_stream, id->p_filter_queue,
+                                      "filter", 0 );
+    for( int i = 0; i < id->i_lanes; i++ )
+        transcode_video_report_queue( p_stream, id->p_lanes[i].p_in,
+                                      "filter", i );
+    for( int i = 0; i < id->i_encoders; i++ )
+        if( id->p_encoders[i].p_queue )
+            transcode_video_report_queue( p_stream, id->p_encoders[i].p_queue,
+                                          "encode", i );
+}
+
+/* Overlays the subpictures and runs the user filters */
+static picture_t *transcode_video_filter_final( sout_stream_t *p_stream,
+                                                sout_stream_id_t *id,
+                                                picture_t *p_pic )
+{
+    sout_stream_sys_t *p_sys = p_stream->p_sys;
+    subpicture_t *p_subpic = NULL;
+
+    /* Check if we have a subpicture to overlay */
+    if( p_sys->p_spu )
+    {
+        p_subpic = spu_SortSubpictures( p_sys->p_spu, p_pic->date, false );
+        /* TODO: get another pic */
+    }
+
+    /* Overlay subpicture */
+    if( p_subpic )
+    {
+        video_format_t fmt;
+
+        if( picture_IsReferenced( p_pic ) && !filter_chain_GetLength( id->p_f_chain ) )
         {
-            vlc_cond_wait( &p_sys->cond, &p_sys->lock_out );
-            if( !vlc_object_alive (p_sys) || p_sys->b_error ) break;
+            /* We can't modify the picture, we need to duplicate it */
+            picture_t *p_tmp = picture_NewFromFormat( &p_pic->format );
+            if( p_tmp )
+            {
+                picture_Copy( p_tmp, p_pic );
+                picture_Release( p_pic );
+                p_pic = p_tmp;
+            }
         }
-        if( !vlc_object_alive (p_sys) || p_sys->b_error )
+
+        if( filter_chain_GetLength( id->p_f_chain ) > 0 )
+            fmt = filter_chain_GetFmtOut( id->p_f_chain )->video;
+        else
+            fmt = id->p_decoder->fmt_out.video;
+
+        spu_RenderSubpictures( p_sys->p_spu, p_pic, &fmt,
+                               p_subpic, &id->p_decoder->fmt_out.video, p_pic->date );
+    }
+
+    /* Run user specified filter chain */
+    if( id->p_uf_chain )
+        p_pic = filter_chain_VideoFilter( id->p_uf_chain, p_pic );
+
+    return p_pic;
+}
+
+static picture_t *transcode_video_filter( sout_stream_t *p_stream,
+                                          sout_stream_id_t *id,
+                                          picture_t *p_pic )
+{
+    mtime_t i_start = mdate();
+
+    /* Run filter chain */
+    if( id->p_f_chain )
+        p_pic = filter_chain_VideoFilter( id->p_f_chain, p_pic );
+    if( p_pic )
+        p_pic = transcode_video_filter_final( p_stream, id, p_pic );
+
+    if( p_pic )
+        transcode_video_stage_add( id, &id->stages[TRANSCODE_STAGE_FILTER],
+                                   i_start, 1 );
+    return p_pic;
+}
+
+/* The reference count of the pictures is not atomic: a picture given to
+ * another thread must not be held by anything else, such as the reference
+ * frames linked by the decoder, or the pictures of the other encoders.
+ * Returns such a picture (or NULL), and releases the given one. */
+static picture_t *transcode_video_picture_own( picture_t *p_pic )
+{
+    picture_t *p_own;
+
+    if( !picture_IsReferenced( p_pic ) )
+        return p_pic;
+
+    p_own = picture_NewFromFormat( &p_pic->format );
+    if( p_own )
+        picture_Copy( p_own, p_pic );
+    picture_Release( p_pic );
+    return p_own;
+}
+
+static void transcode_encoder_encode_picture( transcode_encoder_t *p_enc,
+                                              picture_t *p_pic )
+{
+    sout_stream_id_t *id = p_enc->id;
+    mtime_t i_start = mdate();
+    block_t *p_block;
+
+    video_timer_start( p_enc->p_encoder );
+    p_block = p_enc->p_encoder->pf_encode_video( p_enc->p_encoder, p_pic );
+    video_timer_stop( p_enc->p_encoder );
+
+    vlc_mutex_lock( &id->lock_out );
+    block_ChainAppend( &p_enc->p_buffers, p_block );
+    vlc_mutex_unlock( &id->lock_out );
+    transcode_video_stage_add( id, &p_enc->stage, i_start, 1 );
+}
+
+/* Encodes the picture, and a duplicate of it at i_dup_date if it is not 0,
+ * either now or in the encoder thread */
+static void transcode_encoder_encode( transcode_encoder_t *p_enc,
+                                      picture_t *p_pic, mtime_t i_dup_date )
+{
+    if( p_enc->p_queue )
+    {
+        picture_t *p_pic2 = NULL;
+
+        p_pic = transcode_video_picture_own( p_pic );
+        if( !p_pic )
+            return;
+        if( i_dup_date )
         {
-            vlc_mutex_unlock( &p_sys->lock_out );
-            break;
+            /* We can't modify the picture, we need to duplicate it */
+            p_pic2 = picture_NewFromFormat( &p_pic->format );
+            if( p_pic2 != NULL )
+            {
+                picture_Copy( p_pic2, p_pic );
+                p_pic2->date = i_dup_date;
+            }
         }
+        transcode_queue_Push( p_enc->p_queue, p_pic, 0 );
+        if( p_pic2 != NULL )
+            transcode_queue_Push( p_enc->p_queue, p_pic2, 0 );
+        return;
+    }
+
+    transcode_encoder_encode_picture( p_enc, p_pic );
+    if( i_dup_date )
+    {
+        /* The other encoders may use the picture after this one */
+        const mtime_t i_date = p_pic->date;
 
-        p_pic = p_sys->pp_pics[p_sys->i_first_pic++];
-        p_sys->i_first_pic %= PICTURE_RING_SIZE;
-        vlc_mutex_unlock( &p_sys->lock_out );
+        p_pic->date = i_dup_date;
+        transcode_encoder_encode_picture( p_enc, p_pic );
+        p_pic->date = i_date;
+    }
+    picture_Release( p_pic );
+}
 
-        video_timer_start( id->p_encoder );
-        p_block = id->p_encoder->pf_encode_video( id->p_encoder, p_pic );
-        video_timer_stop( id->p_encoder );
+/* Returns the blocks encoded since the last call */
+static block_t *transcode_encoder_get_blocks( transcode_encoder_t *p_enc )
+{
+    block_t *p_blocks;
 
-        vlc_mutex_lock( &p_sys->lock_out );
-        block_ChainAppend( &p_sys->p_buffers, p_block );
+    vlc_mutex_lock( &p_enc->id->lock_out );
+    p_blocks = p_enc->p_buffers;
+    p_enc->p_buffers = NULL;
+    vlc_mutex_unlock( &p_enc->id->lock_out );
+    return p_blocks;
+}
 
-        vlc_mutex_unlock( &p_sys->lock_out );
-        picture_Release( p_pic );
+/* Gives the picture to all the encoders */
+static void transcode_video_encode( sout_stream_id_t *id, picture_t *p_pic,
+                                    mtime_t i_dup_date )
+{
+    picture_t *pp_pics[id->i_encoders];
+
+    /* Every picture is held or converted before any encoder gets it; the
+     * encoder threads get their own copy of the shared ones */
+    pp_pics[0] = p_pic;
+    for( int i = 1; i < id->i_encoders; i++ )
+    {
+        transcode_encoder_t *p_enc = &id->p_encoders[i];
+
+        if( p_enc->p_chain )
+        {
+            mtime_t i_start = mdate();
+
+            pp_pics[i] = filter_chain_VideoFilter( p_enc->p_chain,
+                                                   picture_Hold( p_pic ) );
+            transcode_video_stage_add( id, &id->stages[TRANSCODE_STAGE_FILTER],
+                                       i_start, 0 );
+        }
+        else if( pp_pics[p_enc->i_source] )
+            pp_pics[i] = picture_Hold( pp_pics[p_enc->i_source] );
+        else
+            pp_pics[i] = NULL;
+    }
+
+    for( int i = 0; i < id->i_encoders; i++ )
+        if( pp_pics[i] )
+            transcode_encoder_encode( &id->p_encoders[i], pp_pics[i],
+                                      i_dup_date );
+}
+
+static void* LaneThread( void *data )
+{
+    transcode_lane_t *p_lane = data;
+    picture_t *p_pic;
+    mtime_t i_dup_date;
+    int canc = vlc_savecancel ();
+
+    while( !transcode_queue_Pop( p_lane->p_in, &p_pic, &i_dup_date ) )
+    {
+        mtime_t i_start = mdate();
+
+        if( p_lane->p_chain )
+            p_pic = filter_chain_VideoFilter( p_lane->p_chain, p_pic );
+        if( p_pic )
+            transcode_video_stage_add( p_lane->id,
+                                &p_lane->id->stages[TRANSCODE_STAGE_FILTER],
+                                i_start, 1 );
+
+        /* Even without a picture: the lanes are read in turn */
+        transcode_queue_Push( p_lane->p_out, p_pic, i_dup_date );
+    }
+    transcode_queue_Kill( p_lane->p_out );
+
+    vlc_restorecancel (canc);
+    return NULL;
+}
+
+static void* FilterThread( void *data )
+{
+    sout_stream_id_t *id = data;
+    sout_stream_t *p_stream = id->p_stream;
+    picture_t *p_pic;
+    mtime_t i_dup_date;
+    int i_lane = 0;
+    int canc = vlc_savecancel ();
+
+    for( ;; )
+    {
+        if( id->i_lanes > 0 )
+        {
+            transcode_lane_t *p_lane = &id->p_lanes[i_lane];
+
+            i_lane = (i_lane + 1) % id->i_lanes;
+            if( transcode_queue_Pop( p_lane->p_out, &p_pic, &i_dup_date ) )
+                break;
+            if( p_pic )
+            {
+                mtime_t i_start = mdate();
+                p_pic = transcode_video_filter_final( p_stream, id, p_pic );
+                transcode_video_stage_add( id,
+                                    &id->stages[TRANSCODE_STAGE_FILTER],
+                                    i_start, 0 );
+            }
+        }
+        else
+        {
+            if( transcode_queue_Pop( id->p_filter_queue, &p_pic, &i_dup_date ) )
+                break;
+            p_pic = transcode_video_filter( p_stream, id, p_pic );
+        }
+        if( p_pic )
+            transcode_video_encode( id, p_pic, i_dup_date );
     }
 
-    while( p_sys->i_last_pic != p_sys->i_first_pic )
+    vlc_restorecancel (canc);
+    return NULL;
+}
+
+static void* EncoderThread( void *data )
+{
+    transcode_encoder_t *p_enc = data;
+    picture_t *p_pic;
+    mtime_t i_dup_date;
+    int canc = vlc_savecancel ();
+
+    while( !transcode_queue_Pop( p_enc->p_queue, &p_pic, &i_dup_date ) )
     {
-        p_pic = p_sys->pp_pics[p_sys->i_first_pic++];
-        p_sys->i_first_pic %= PICTURE_RING_SIZE;
+        transcode_encoder_encode_picture( p_enc, p_pic );
         picture_Release( p_pic );
     }
-    block_ChainRelease( p_sys->p_buffers );
 
     vlc_restorecancel (canc);
     return NULL;
 }
 
+static int transcode_encoder_start( sout_stream_t *p_stream,
+                                    transcode_encoder_t *p_enc )
+{
+    sout_stream_sys_t *p_sys = p_stream->p_sys;
+    int i_priority = p_sys->b_high_priority ? VLC_THREAD_PRIORITY_OUTPUT :
+                       VLC_THREAD_PRIORITY_VIDEO;
+
+    p_enc->p_queue = NULL;
+    if( p_sys->i_threads < 1 )
+        return VLC_SUCCESS;
+
+    p_enc->p_queue = transcode_queue_New( p_sys->i_picture_queue );
+    if( !p_enc->p_queue )
+        return VLC_ENOMEM;
+    if( vlc_clone( &p_enc->thread, EncoderThread, p_enc, i_priority ) )
+    {
+        msg_Err( p_stream, "cannot spawn encoder thread" );
+        transcode_queue_Delete( p_enc->p_queue );
+        p_enc->p_queue = NULL;
+        return VLC_EGENERIC;
+    }
+    return VLC_SUCCESS;
+}
+
+static void transcode_encoder_stop( transcode_encoder_t *p_enc )
+{
+    if( !p_enc->p_queue )
+        return;
+
+    transcode_queue_Kill( p_enc->p_queue );
+    vlc_join( p_enc->thread, NULL );
+    transcode_queue_Delete( p_enc->p_queue );
+    p_enc->p_queue = NULL;
+}
+
+/* Lets the threads finish the pictures already queued, and stops them */
+static void transcode_video_pipeline_stop( sout_stream_id_t *id )
+{
+    for( int i = 0; i < id->i_lanes; i++ )
+        transcode_queue_Kill( id->p_lanes[i].p_in );
+    for( int i = 0; i < id->i_lanes; i++ )
+        vlc_join( id->p_lanes[i].thread, NULL );
+    if( id->p_filter_queue )
+        transcode_queue_Kill( id->p_filter_queue );
+    if( id->p_filter_queue || id->i_lanes > 0 )
+        vlc_join( id->filter_thread, NULL );
+
+    for( int i = 0; i < id->i_lanes; i++ )
+    {
+        transcode_lane_t *p_lane = &id->p_lanes[i];
+
+        /* The chain of the first lane is id->p_f_chain */
+        if( i > 0 && p_lane->p_chain )
+            filter_chain_Delete( p_lane->p_chain );
+        transcode_queue_Delete( p_lane->p_out );
+        transcode_queue_Delete( p_lane->p_in );
+    }
+    free( id->p_lanes );
+    id->p_lanes = NULL;
+    id->i_lanes = 0;
+    if( id->p_filter_queue )
+    {
+        transcode_queue_Delete( id->p_filter_queue );
+        id->p_filter_queue = NULL;
+    }
+
+    for( int i = 0; i < id->i_encoders; i++ )
+        transcode_encoder_stop( &id->p_encoders[i] );
+}
+
+static int transcode_video_lanes_start( sout_stream_t *p_stream,
+                                        sout_stream_id_t *id, int i_lanes )
+{
+    sout_stream_sys_t *p_sys = p_stream->p_sys;
+
+    id->p_lanes = calloc( i_lanes, sizeof( *id->p_lanes ) );
+    if( !id->p_lanes )
+        return VLC_ENOMEM;
+
+    for( ; id->i_lanes < i_lanes; id->i_lanes++ )
+    {
+        transcode_lane_t *p_lane = &id->p_lanes[id->i_lanes];
+
+        p_lane->id = id;
+        p_lane->p_in = transcode_queue_New( p_sys->i_picture_queue );
+        p_lane->p_out = transcode_queue_New( p_sys->i_picture_queue );
+        if( !p_lane->p_in || !p_lane->p_out )
+            goto error;
+        if( vlc_clone( &p_lane->thread, LaneThread, p_lane,
+                       VLC_THREAD_PRIORITY_VIDEO ) )
+        {
+            msg_Err( p_stream, "cannot spawn video filter thread" );
+            goto error;
+        }
+    }
+    return VLC_SUCCESS;
+
+error:
+    {
+        transcode_lane_t *p_lane = &id->p_lanes[id->i_lanes];
+        if( p_lane->p_out )
+            transcode_queue_Delete( p_lane->p_out );
+        if( p_lane->p_in )
+            transcode_queue_Delete( p_lane->p_in );
+    }
+    return VLC_EGENERIC;
+}
+
+static int transcode_video_pipeline_start( sout_stream_t *p_stream,
+                                           sout_stream_id_t *id )
+{
+    sout_stream_sys_t *p_sys = p_stream->p_sys;
+
+    id->p_stream = p_stream;
+    id->p_filter_queue = NULL;
+    id->p_lanes = NULL;
+    id->i_lanes = 0;
+    id->i_lane = 0;
+    memset( id->stages, 0, sizeof( id->stages ) );
+    id->i_next_report = mdate() + PIPELINE_REPORT_PERIOD;
+
+    /* The rungs are added once the format of the main output is known */
+    id->p_encoders = calloc( 1 + p_sys->i_rungs, sizeof( *id->p_encoders ) );
+    if( !id->p_encoders )
+        return VLC_ENOMEM;
+    id->p_encoders[0].id = id;
+    id->p_encoders[0].p_encoder = id->p_encoder;
+    id->p_encoders[0].i_source = -1;
+    id->i_encoders = 1;
+    vlc_mutex_init( &id->lock_out );
+
+    if( transcode_encoder_start( p_stream, &id->p_encoders[0] ) )
+        goto error;
+
+    if( p_sys->i_filter_threads > 1 )
+    {
+        /* Lanes started before a failure must be stopped too */
+        if( transcode_video_lanes_start( p_stream, id,
+                                         p_sys->i_filter_threads ) )
+            goto error_lanes;
+    }
+    else if( p_sys->i_filter_threads == 1 )
+    {
+        id->p_filter_queue = transcode_queue_New( p_sys->i_picture_queue );
+        if( !id->p_filter_queue )
+            goto error;
+    }
+
+    if( p_sys->i_filter_threads >= 1 &&
+        vlc_clone( &id->filter_thread, FilterThread, id,
+                   VLC_THREAD_PRIORITY_VIDEO ) )
+    {
+        msg_Err( p_stream, "cannot spawn video filter thread" );
+        if( id->p_filter_queue )
+        {
+            transcode_queue_Delete( id->p_filter_queue );
+            id->p_filter_queue = NULL;
+        }
+        goto error_lanes;
+    }
+
+    msg_Dbg( p_stream, "video pipeline: %d filter thread(s), encoders in %s "
+             "thread, queues of %d pictures", p_sys->i_filter_threads,
+             id->p_encoders[0].p_queue ? "their own" :
+             p_sys->i_filter_threads >= 1 ? "the filter" : "the decoder",
+             p_sys->i_picture_queue );
+    return VLC_SUCCESS;
+
+error_lanes:
+    /* The filter thread is not running: stop the lanes by hand */
+    for( int i = 0; i < id->i_lanes; i++ )
+        transcode_queue_Kill( id->p_lanes[i].p_in );
+    for( int i = 0; i < id->i_lanes; i++ )
+    {
+        vlc_join( id->p_lanes[i].thread, NULL );
+        transcode_queue_Delete( id->p_lanes[i].p_out );
+        transcode_queue_Delete( id->p_lanes[i].p_in );
+    }
+    id->i_lanes = 0;
+error:
+    free( id->p_lanes );
+    id->p_lanes = NULL;
+    id->i_lanes = 0;
+    transcode_video_pipeline_stop( id );
+    vlc_mutex_destroy( &id->lock_out );
+    free( id->p_encoders );
+    id->p_encoders = NULL;
+    id->i_encoders = 0;
+    return VLC_EGENERIC;
+}
+
 int transcode_video_new( sout_stream_t *p_stream, sout_stream_id_t *id )
 {
     sout_stream_sys_t *p_sys = p_stream->p_sys;
@@ -262,26 +906,12 @@ int transcode_video_new( sout_stream_t *p_stream, sout_stream_id_t *id )
     }
     id->p_encoder->p_module = NULL;
 
-    if( p_sys->i_threads >= 1 )
-    {
-        int i_priority = p_sys->b_high_priority ? VLC_THREAD_PRIORITY_OUTPUT :
-                           VLC_THREAD_PRIORITY_VIDEO;
-        p_sys->id_video = id;
-        vlc_mutex_init( &p_sys->lock_out );
-        vlc_cond_init( &p_sys->cond );
-        memset( p_sys->pp_pics, 0, sizeof(p_sys->pp_pics) );
-        p_sys->i_first_pic = 0;
-        p_sys->i_last_pic = 0;
-        p_sys->p_buffers = NULL;
-        p_sys->b_die = p_sys->b_error = 0;
-        if( vlc_thread_create( p_sys, "encoder", EncoderThread, i_priority ) )
-        {
-            msg_Err( p_stream, "cannot spawn encoder thread" );
-            module_unneed( id->p_decoder, id->p_decoder->p_module );
-            id->p_decoder->p_module = 0;
-            free( id->p_decoder->p_owner );
-            return VLC_EGENERIC;
-        }
+    if( transcode_video_pipeline_start( p_stream, id ) )
+    {
+        module_unneed( id->p_decoder, id->p_decoder->p_module );
+        id->p_decoder->p_module = 0;
+        free( id->p_decoder->p_owner );
+        return VLC_EGENERIC;
     }
     return VLC_SUCCESS;
 }
@@ -462,6 +1092,46 @@ static void transcode_video_encoder_init( sout_stream_t *p_stream,
     id->p_encoder->fmt_in.video.i_chroma = id->p_encoder->fmt_in.i_codec;
 }
 
+/* Creates the deinterlace and conversion filters, which need the formats
+ * of the decoder and of the encoder */
+static filter_chain_t *transcode_video_chain_new( sout_stream_t *p_stream,
+                                                  sout_stream_id_t *id )
+{
+    sout_stream_sys_t *p_sys = p_stream->p_sys;
+    filter_chain_t *p_chain;
+
+    p_chain = filter_chain_New( p_stream, "video filter2", false,
+                                transcode_video_filter_allocation_init,
+                                transcode_video_filter_allocation_clear,
+                                p_sys );
+    if( !p_chain )
+        return NULL;
+
+    /* Deinterlace */
+    if( p_sys->b_deinterlace )
+    {
+        filter_chain_AppendFilter( p_chain,
+                                   p_sys->psz_deinterlace,
+                                   p_sys->p_deinterlace_cfg,
+                                   &id->p_decoder->fmt_out,
+                                   &id->p_decoder->fmt_out );
+    }
+    /* Take care of the scaling and chroma conversions */
+    if( ( id->p_decoder->fmt_out.video.i_chroma !=
+          id->p_encoder->fmt_in.video.i_chroma ) ||
+        ( id->p_decoder->fmt_out.video.i_width !=
+          id->p_encoder->fmt_in.video.i_width ) ||
+        ( id->p_decoder->fmt_out.video.i_height !=
+          id->p_encoder->fmt_in.video.i_height ) )
+    {
+        filter_chain_AppendFilter( p_chain,
+                                   NULL, NULL,
+                                   &id->p_decoder->fmt_out,
+                                   &id->p_encoder->fmt_in );
+    }
+    return p_chain;
+}
+
 static int transcode_video_encoder_open( sout_stream_t *p_stream,
                                          sout_stream_id_t *id )
 {
@@ -498,20 +1168,226 @@ static int transcode_video_encoder_open( sout_stream_t *p_stream,
     return VLC_SUCCESS;
 }
 
+/* Opens the encoder of a rung of the ladder, with the pictures of the main
+ * output converted to its size, or shared with an encoder of the same
+ * size */
+static int transcode_video_rung_open( sout_stream_t *p_stream,
+                                      sout_stream_id_t *id,
+                                      transcode_rung_t *p_rung,
+                                      transcode_encoder_t *p_enc )
+{
+    sout_stream_sys_t *p_sys = p_stream->p_sys;
+    const es_format_t *p_main = &id->p_encoder->fmt_in;
+    const char *psz_venc = p_rung->psz_venc ? p_rung->psz_venc
+                                            : p_sys->psz_venc;
+    unsigned i_width = p_rung->i_width & ~1;
+    unsigned i_height = p_rung->i_height & ~1;
+    encoder_t *p_encoder;
+
+    p_enc->id = id;
+    p_enc->p_rung = p_rung;
+    p_enc->i_source = 0;
+
+    /* Keep the aspect ratio of the main output if only one dimension is
+     * given */
+    if( !i_width && !i_height )
+    {
+        i_width = p_main->video.i_width;
+        i_height = p_main->video.i_height;
+    }
+    else if( !i_height )
+        i_height = 2 * (int)( (double)i_width * p_main->video.i_height /
+                              p_main->video.i_width / 2 + 0.5 );
+    else if( !i_width )
+        i_width = 2 * (int)( (double)i_height * p_main->video.i_width /
+                             p_main->video.i_height / 2 + 0.5 );
+
+    p_encoder = sout_EncoderCreate( p_stream );
+    if( !p_encoder )
+        return VLC_ENOMEM;
+    vlc_object_attach( p_encoder, p_stream );
+    p_encoder->p_module = NULL;
+    p_enc->p_encoder = p_encoder;
+
+    es_format_Init( &p_encoder->fmt_in, VIDEO_ES, p_main->i_codec );
+    p_encoder->fmt_in.video = p_main->video;
+    p_encoder->fmt_in.video.p_palette = NULL;
+    p_encoder->fmt_in.video.i_x_offset = 0;
+    p_encoder->fmt_in.video.i_y_offset = 0;
+    p_encoder->fmt_in.video.i_width =
+    p_encoder->fmt_in.video.i_visible_width = i_width;
+    p_encoder->fmt_in.video.i_height =
+    p_encoder->fmt_in.video.i_visible_height = i_height;
+    /* Same display aspect ratio as the main output */
+    vlc_ureduce( &p_encoder->fmt_in.video.i_sar_num,
+                 &p_encoder->fmt_in.video.i_sar_den,
+                 (uint64_t)p_main->video.i_sar_num * p_main->video.i_width *
+                 i_height,
+                 (uint64_t)p_main->video.i_sar_den * p_main->video.i_height *
+                 i_width, 0 );
+
+    es_format_Init( &p_encoder->fmt_out, VIDEO_ES,
+                    p_rung->i_vcodec ? p_rung->i_vcodec : p_sys->i_vcodec );
+    p_encoder->fmt_out.i_id    = id->p_encoder->fmt_out.i_id;
+    p_encoder->fmt_out.i_group = id->p_encoder->fmt_out.i_group;
+    p_encoder->fmt_out.i_bitrate = p_rung->i_vbitrate ? p_rung->i_vbitrate
+                                                      : p_sys->i_vbitrate;
+    p_encoder->fmt_out.video.i_width =
+    p_encoder->fmt_out.video.i_visible_width = i_width;
+    p_encoder->fmt_out.video.i_height =
+    p_encoder->fmt_out.video.i_visible_height = i_height;
+    p_encoder->fmt_out.video.i_frame_rate =
+        id->p_encoder->fmt_out.video.i_frame_rate;
+    p_encoder->fmt_out.video.i_frame_rate_base =
+        id->p_encoder->fmt_out.video.i_frame_rate_base;
+    p_encoder->fmt_out.video.i_sar_num = p_encoder->fmt_in.video.i_sar_num;
+    p_encoder->fmt_out.video.i_sar_den = p_encoder->fmt_in.video.i_sar_den;
+
+    p_encoder->i_threads = p_sys->i_threads;
+    p_encoder->p_cfg = p_rung->psz_venc ? p_rung->p_video_cfg
+                                        : p_sys->p_video_cfg;
+
+    p_encoder->p_module = module_need( p_encoder, "encoder", psz_venc, true );
+    if( !p_encoder->p_module )
+    {
+        msg_Err( p_stream, "cannot find video encoder (module:%s fourcc:%4.4s)",
+                 psz_venc ? psz_venc : "any",
+                 (char *)&p_encoder->fmt_out.i_codec );
+        return VLC_EGENERIC;
+    }
+    p_encoder->fmt_in.video.i_chroma = p_encoder->fmt_in.i_codec;
+    p_encoder->fmt_out.i_codec =
+        vlc_fourcc_GetCodec( VIDEO_ES, p_encoder->fmt_out.i_codec );
+
+    /* Convert the pictures once for all the encoders of the same format */
+    if( p_encoder->fmt_in.i_codec != p_main->i_codec ||
+        i_width != p_main->video.i_width ||
+        i_height != p_main->video.i_height )
+    {
+        p_enc->i_source = -1;
+        for( int i = 1; i < id->i_encoders; i++ )
+        {
+            const transcode_encoder_t *p_other = &id->p_encoders[i];
+            const es_format_t *p_fmt = &p_other->p_encoder->fmt_in;
+
+            if( p_other->p_chain &&
+                p_fmt->i_codec == p_encoder->fmt_in.i_codec &&
+                p_fmt->video.i_width == i_width &&
+                p_fmt->video.i_height == i_height )
+            {
+                p_enc->i_source = i;
+                break;
+            }
+        }
+    }
+    if( p_enc->i_source < 0 )
+    {
+        p_enc->p_chain = filter_chain_New( p_stream, "video filter2", false,
+                                   transcode_video_filter_allocation_init,
+                                   transcode_video_filter_allocation_clear,
+                                   p_sys );
+        if( !p_enc->p_chain )
+            return VLC_ENOMEM;
+        if( !filter_chain_AppendFilter( p_enc->p_chain, NULL, NULL,
+                                        p_main, &p_encoder->fmt_in ) )
+        {
+            msg_Err( p_stream, "cannot convert the pictures to %ux%u",
+                     i_width, i_height );
+            return VLC_EGENERIC;
+        }
+    }
+
+    p_enc->p_out_id = sout_StreamIdAdd( p_rung->p_out, &p_encoder->fmt_out );
+    if( !p_enc->p_out_id )
+    {
+        msg_Err( p_stream, "cannot add this stream" );
+        return VLC_EGENERIC;
+    }
+
+    if( transcode_encoder_start( p_stream, p_enc ) )
+        return VLC_EGENERIC;
+
+    msg_Dbg( p_stream, "ladder rung %d: %ux%u %4.4s %dkb/s, pictures %s",
+             id->i_encoders, i_width, i_height,
+             (char *)&p_encoder->fmt_out.i_codec,
+             p_encoder->fmt_out.i_bitrate / 1000,
+             p_enc->p_chain ? "converted" : "shared" );
+    return VLC_SUCCESS;
+}
+
+static void transcode_video_rung_close( transcode_encoder_t *p_enc )
+{
+    encoder_t *p_encoder = p_enc->p_encoder;
+
+    if( p_enc->p_out_id )
+        sout_StreamIdDel( p_enc->p_rung->p_out, p_enc->p_out_id );
+    if( p_enc->p_chain )
+        filter_chain_Delete( p_enc->p_chain );
+    if( p_encoder )
+    {
+        if( p_encoder->p_module )
+        {
+            video_timer_close( p_encoder );
+            module_unneed( p_encoder, p_encoder->p_module );
+        }
+        es_format_Clean( &p_encoder->fmt_in );
+        es_format_Clean( &p_encoder->fmt_out );
+        vlc_object_release( p_encoder );
+    }
+}
+
+static void transcode_video_rungs_open( sout_stream_t *p_stream,
+                                        sout_stream_id_t *id )
+{
+    sout_stream_sys_t *p_sys = p_stream->p_sys;
+
+    for( int i = 0; i < p_sys->i_rungs; i++ )
+    {
+        transcode_encoder_t *p_enc = &id->p_encoders[id->i_encoders];
+
+        if( transcode_video_rung_open( p_stream, id, p_sys->pp_rungs[i],
+                                       p_enc ) )
+        {
+            msg_Err( p_stream, "cannot open ladder rung %d", i + 1 );
+            transcode_video_rung_close( p_enc );
+            memset( p_enc, 0, sizeof( *p_enc ) );
+            continue;
+        }
+        id->i_encoders++;
+    }
+}
+
 void transcode_video_close( sout_stream_t *p_stream,
                                    sout_stream_id_t *id )
 {
-    if( p_stream->p_sys->i_threads >= 1 )
+    transcode_video_report_queues( p_stream, id );
+    transcode_video_pipeline_stop( id );
+
+    /* Send what the threads encoded after the last picture was sent */
+    for( int i = 0; i < id->i_encoders; i++ )
     {
-        vlc_mutex_lock( &p_stream->p_sys->lock_out );
-        vlc_object_kill( p_stream->p_sys );
-        vlc_cond_signal( &p_stream->p_sys->cond );
-        vlc_mutex_unlock( &p_stream->p_sys->lock_out );
-        vlc_thread_join( p_stream->p_sys );
-        vlc_mutex_destroy( &p_stream->p_sys->lock_out );
-        vlc_cond_destroy( &p_stream->p_sys->cond );
+        transcode_encoder_t *p_enc = &id->p_encoders[i];
+        block_t *p_blocks = transcode_encoder_get_blocks( p_enc );
+
+        if( !p_blocks )
+            continue;
+        if( i == 0 && id->id )
+            sout_StreamIdSend( p_stream->p_next, id->id, p_blocks );
+        else if( i > 0 )
+            sout_StreamIdSend( p_enc->p_rung->p_out, p_enc->p_out_id,
+                               p_blocks );
+        else
+            block_ChainRelease( p_blocks );
     }
 
+    transcode_video_report( p_stream, id );
+    for( int i = 1; i < id->i_encoders; i++ )
+        transcode_video_rung_close( &id->p_encoders[i] );
+    free( id->p_encoders );
+    id->p_encoders = NULL;
+    id->i_encoders = 0;
+    vlc_mutex_destroy( &id->lock_out );
+
     video_timer_close( id->p_encoder );
 
     /* Close decoder */
@@ -538,12 +1414,19 @@ int transcode_video_process( sout_stream_t *p_stream, sout_stream_id_t *id,
 {
     sout_stream_sys_t *p_sys = p_stream->p_sys;
     int i_duplicate = 1;
-    picture_t *p_pic, *p_pic2 = NULL;
+    picture_t *p_pic;
     *out = NULL;
 
-    while( (p_pic = id->p_decoder->pf_decode_video( id->p_decoder, &in )) )
+    for( ;; )
     {
-        subpicture_t *p_subpic = NULL;
+        mtime_t i_start = mdate();
+        mtime_t i_dup_date = 0;
+
+        p_pic = id->p_decoder->pf_decode_video( id->p_decoder, &in );
+        if( !p_pic )
+            break;
+        transcode_video_stage_add( id, &id->stages[TRANSCODE_STAGE_DECODE],
+                                   i_start, 1 );
 
         sout_UpdateStatistic( p_stream->p_sout, SOUT_STATISTIC_DECODED_VIDEO, 1 );
 
@@ -602,34 +1485,10 @@ int transcode_video_process( sout_stream_t *p_stream, sout_stream_id_t *id,
         {
             transcode_video_encoder_init( p_stream, id );
 
-            id->p_f_chain = filter_chain_New( p_stream, "video filter2",
-                                              false,
-                               transcode_video_filter_allocation_init,
-                               transcode_video_filter_allocation_clear,
-                               p_stream->p_sys );
-
-            /* Deinterlace */
-            if( p_stream->p_sys->b_deinterlace )
-            {
-                filter_chain_AppendFilter( id->p_f_chain,
-                                           p_sys->psz_deinterlace,
-                                           p_sys->p_deinterlace_cfg,
-                                           &id->p_decoder->fmt_out,
-                                           &id->p_decoder->fmt_out );
-            }
-            /* Take care of the scaling and chroma conversions */
-            if( ( id->p_decoder->fmt_out.video.i_chroma !=
-                  id->p_encoder->fmt_in.video.i_chroma ) ||
-                ( id->p_decoder->fmt_out.video.i_width !=
-                  id->p_encoder->fmt_in.video.i_width ) ||
-                ( id->p_decoder->fmt_out.video.i_height !=
-                  id->p_encoder->fmt_in.video.i_height ) )
-            {
-                filter_chain_AppendFilter( id->p_f_chain,
-                                           NULL, NULL,
-                                           &id->p_decoder->fmt_out,
-                                           &id->p_encoder->fmt_in );
-            }
+            id->p_f_chain = transcode_video_chain_new( p_stream, id );
+            for( int i = 0; i < id->i_lanes; i++ )
+                id->p_lanes[i].p_chain = i == 0 ? id->p_f_chain :
+                    transcode_video_chain_new( p_stream, id );
 
             if( p_sys->psz_vf2 )
             {
@@ -661,64 +1520,11 @@ int transcode_video_process( sout_stream_t *p_stream, sout_stream_id_t *id,
                 id->b_transcode = false;
                 return VLC_EGENERIC;
             }
+            transcode_video_rungs_open( p_stream, id );
         }
 
-        /* Run filter chain */
-        if( id->p_f_chain )
-            p_pic = filter_chain_VideoFilter( id->p_f_chain, p_pic );
-
-        /*
-         * Encoding
-         */
-
-        /* Check if we have a subpicture to overlay */
-        if( p_sys->p_spu )
-        {
-            p_subpic = spu_SortSubpictures( p_sys->p_spu, p_pic->date, false );
-            /* TODO: get another pic */
-        }
-
-        /* Overlay subpicture */
-        if( p_subpic )
-        {
-            video_format_t fmt;
-
-            if( picture_IsReferenced( p_pic ) && !filter_chain_GetLength( id->p_f_chain ) )
-            {
-                /* We can't modify the picture, we need to duplicate it */
-                picture_t *p_tmp = video_new_buffer_decoder( id->p_decoder );
-                if( p_tmp )
-                {
-                    picture_Copy( p_tmp, p_pic );
-                    picture_Release( p_pic );
-                    p_pic = p_tmp;
-                }
-            }
-
-            if( filter_chain_GetLength( id->p_f_chain ) > 0 )
-                fmt = filter_chain_GetFmtOut( id->p_f_chain )->video;
-            else
-                fmt = id->p_decoder->fmt_out.video;
-
-            spu_RenderSubpictures( p_sys->p_spu, p_pic, &fmt,
-                                   p_subpic, &id->p_decoder->fmt_out.video, p_pic->date );
-        }
-
-        /* Run user specified filter chain */
-        if( id->p_uf_chain )
-            p_pic = filter_chain_VideoFilter( id->p_uf_chain, p_pic );
-
-        if( p_sys->i_threads == 0 )
-        {
-            block_t *p_block;
-
-            video_timer_start( id->p_encoder );
-            p_block = id->p_encoder->pf_encode_video( id->p_encoder, p_pic );
-            video_timer_stop( id->p_encoder );
-
-            block_ChainAppend( out, p_block );
-        }
-
+        /* The dates of the encoded pictures are computed before filtering,
+         * as the filters may run in another thread. They keep the dates. */
         if( p_sys->b_master_sync )
         {
             mtime_t i_pts = date_Get( &id->interpolated_pts ) + 1;
@@ -743,47 +1549,53 @@ int transcode_video_process( sout_stream_t *p_stream, sout_stream_id_t *id,
                 i_pts = p_pic->date + 1;
             }
             date_Increment( &id->interpolated_pts, 1 );
+            i_dup_date = i_pts;
+        }
 
-            if( p_sys->i_threads >= 1 )
-            {
-                /* We can't modify the picture, we need to duplicate it */
-                p_pic2 = video_new_buffer_decoder( id->p_decoder );
-                if( p_pic2 != NULL )
-                {
-                    picture_Copy( p_pic2, p_pic );
-                    p_pic2->date = i_pts;
-                }
-            }
-            else
-            {
-                block_t *p_block;
-                p_pic->date = i_pts;
-                video_timer_start( id->p_encoder );
-                p_block = id->p_encoder->pf_encode_video(id->p_encoder, p_pic);
-                video_timer_stop( id->p_encoder );
-                block_ChainAppend( out, p_block );
-            }
+        /* The decoder may keep the picture as a reference frame */
+        if( id->i_lanes > 0 || id->p_filter_queue )
+        {
+            p_pic = transcode_video_picture_own( p_pic );
+            if( !p_pic )
+                continue;
         }
 
-        if( p_sys->i_threads == 0 )
+        if( id->i_lanes > 0 )
         {
-            picture_Release( p_pic );
+            transcode_queue_Push( id->p_lanes[id->i_lane].p_in, p_pic,
+                                  i_dup_date );
+            id->i_lane = (id->i_lane + 1) % id->i_lanes;
+            continue;
         }
-        else
+        if( id->p_filter_queue )
         {
-            vlc_mutex_lock( &p_sys->lock_out );
-            p_sys->pp_pics[p_sys->i_last_pic++] = p_pic;
-            p_sys->i_last_pic %= PICTURE_RING_SIZE;
-            *out = p_sys->p_buffers;
-            p_sys->p_buffers = NULL;
-            if( p_pic2 != NULL )
-            {
-                p_sys->pp_pics[p_sys->i_last_pic++] = p_pic2;
-                p_sys->i_last_pic %= PICTURE_RING_SIZE;
-            }
-            vlc_cond_signal( &p_sys->cond );
-            vlc_mutex_unlock( &p_sys->lock_out );
+            transcode_queue_Push( id->p_filter_queue, p_pic, i_dup_date );
+            continue;
         }
+
+        p_pic = transcode_video_filter( p_stream, id, p_pic );
+        if( p_pic )
+            transcode_video_encode( id, p_pic, i_dup_date );
+    }
+
+    /* Collect what the encoders output, the rungs are sent here as the
+     * streams are not used by the pipeline threads */
+    *out = transcode_encoder_get_blocks( &id->p_encoders[0] );
+    for( int i = 1; i < id->i_encoders; i++ )
+    {
+        transcode_encoder_t *p_enc = &id->p_encoders[i];
+        block_t *p_blocks = transcode_encoder_get_blocks( p_enc );
+
+        if( p_blocks )
+            sout_StreamIdSend( p_enc->p_rung->p_out, p_enc->p_out_id,
+                               p_blocks );
+    }
+
+    if( mdate() >= id->i_next_report )
+    {
+        transcode_video_report( p_stream, id );
+        transcode_video_report_queues( p_stream, id );
+        id->i_next_report = mdate() + PIPELINE_REPORT_PERIOD;
     }
 
     return VLC_SUCCESS;
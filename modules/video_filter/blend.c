@@ -33,6 +33,16 @@
 #include <vlc_common.h>
 #include <vlc_plugin.h>
 #include <vlc_filter.h>
+#include <vlc_cpu.h>
+
+#if defined(CAN_COMPILE_SSE2) && defined(HAVE_SSE2_INTRINSICS)
+/* Only the SSE2 functions are built for SSE2, they are selected at run time */
+#   include <emmintrin.h>
+#   define BLEND_SSE2 __attribute__ ((__target__ ("sse2")))
+#endif
+#if defined(__ARM_NEON__)
+#   include <arm_neon.h>
+#endif
 
 /*****************************************************************************
  * Module descriptor
@@ -52,6 +62,31 @@ vlc_module_end ()
 static void Blend( filter_t *, picture_t *, const picture_t *,
                    int, int, int );
 
+/* Row primitives */
+static void AlphaRow( uint8_t *, const uint8_t *, int, int );
+static void BlendRow( uint8_t *, const uint8_t *, const uint8_t *, int );
+static void BlendRowSub( uint8_t *, const uint8_t *, const uint8_t *, int );
+static void RGBAToYUVARow( uint8_t *, uint8_t *, uint8_t *, uint8_t *,
+                           const uint8_t *, int );
+#if defined(BLEND_SSE2)
+BLEND_SSE2
+static void AlphaRowSSE2( uint8_t *, const uint8_t *, int, int );
+BLEND_SSE2
+static void BlendRowSSE2( uint8_t *, const uint8_t *, const uint8_t *, int );
+BLEND_SSE2
+static void BlendRowSubSSE2( uint8_t *, const uint8_t *, const uint8_t *, int );
+BLEND_SSE2
+static void RGBAToYUVARowSSE2( uint8_t *, uint8_t *, uint8_t *, uint8_t *,
+                               const uint8_t *, int );
+#endif
+#if defined(__ARM_NEON__)
+static void AlphaRowNEON( uint8_t *, const uint8_t *, int, int );
+static void BlendRowNEON( uint8_t *, const uint8_t *, const uint8_t *, int );
+static void BlendRowSubNEON( uint8_t *, const uint8_t *, const uint8_t *, int );
+static void RGBAToYUVARowNEON( uint8_t *, uint8_t *, uint8_t *, uint8_t *,
+                               const uint8_t *, int );
+#endif
+
 /* YUVA */
 static void BlendYUVAI420( filter_t *, picture_t *, const picture_t *,
                            int, int, int, int, int );
@@ -93,12 +128,25 @@ static void BlendRGBAR16( filter_t *, picture_t *, const picture_t *,
 static void BlendRGBAR24( filter_t *, picture_t *, const picture_t *,
                           int, int, int, int, int );
 
+/*****************************************************************************
+ * filter_sys_t: row primitives for the current CPU
+ *****************************************************************************/
+struct filter_sys_t
+{
+    void (*pf_alpha_row)( uint8_t *, const uint8_t *, int, int );
+    void (*pf_blend_row)( uint8_t *, const uint8_t *, const uint8_t *, int );
+    void (*pf_blend_row_sub)( uint8_t *, const uint8_t *, const uint8_t *, int );
+    void (*pf_rgba_row)( uint8_t *, uint8_t *, uint8_t *, uint8_t *,
+                         const uint8_t *, int );
+};
+
 /*****************************************************************************
  * OpenFilter: probe the filter and return score
  *****************************************************************************/
 static int OpenFilter( vlc_object_t *p_this )
 {
     filter_t *p_filter = (filter_t*)p_this;
+    filter_sys_t *p_sys;
 
     /* Check if we can handle that format.
      * We could try to use a chroma filter if we can't. */
@@ -120,6 +168,35 @@ static int OpenFilter( vlc_object_t *p_this )
     }
 
     /* Misc init */
+    p_filter->p_sys = p_sys = malloc( sizeof( *p_sys ) );
+    if( !p_sys )
+        return VLC_ENOMEM;
+#if defined(BLEND_SSE2)
+    if( vlc_CPU() & CPU_CAPABILITY_SSE2 )
+    {
+        p_sys->pf_alpha_row = AlphaRowSSE2;
+        p_sys->pf_blend_row = BlendRowSSE2;
+        p_sys->pf_blend_row_sub = BlendRowSubSSE2;
+        p_sys->pf_rgba_row = RGBAToYUVARowSSE2;
+    }
+    else
+#endif
+#if defined(__ARM_NEON__)
+    if( vlc_CPU() & CPU_CAPABILITY_NEON )
+    {
+        p_sys->pf_alpha_row = AlphaRowNEON;
+        p_sys->pf_blend_row = BlendRowNEON;
+        p_sys->pf_blend_row_sub = BlendRowSubNEON;
+        p_sys->pf_rgba_row = RGBAToYUVARowNEON;
+    }
+    else
+#endif
+    {
+        p_sys->pf_alpha_row = AlphaRow;
+        p_sys->pf_blend_row = BlendRow;
+        p_sys->pf_blend_row_sub = BlendRowSub;
+        p_sys->pf_rgba_row = RGBAToYUVARow;
+    }
     p_filter->pf_video_blend = Blend;
 
     msg_Dbg( p_filter, "chroma: %4.4s -> %4.4s",
@@ -134,7 +211,8 @@ static int OpenFilter( vlc_object_t *p_this )
  *****************************************************************************/
 static void CloseFilter( vlc_object_t *p_this )
 {
-    (void)p_this;
+    filter_t *p_filter = (filter_t*)p_this;
+    free( p_filter->p_sys );
 }
 
 /****************************************************************************
@@ -379,6 +457,349 @@ static void vlc_rgb_index( int *pi_rindex, int *pi_gindex, int *pi_bindex,
 #endif
 }
 
+/***********************************************************************
+ * Row primitives
+ ***********************************************************************
+ * The YUVA, RGBA and YUVP to I420 routines work on chunks of rows with
+ * these, so that the per pixel arithmetic can be vectorised. All the
+ * versions give exactly the results of vlc_alpha() and vlc_blend().
+ ***********************************************************************/
+#define BLEND_CHUNK 256 /* pixels, must be even */
+
+/* p_trans[i] = vlc_alpha( p_a[i], i_alpha ) */
+static void AlphaRow( uint8_t *p_trans, const uint8_t *p_a,
+                      int i_alpha, int i_count )
+{
+    for( int i = 0; i < i_count; i++ )
+        p_trans[i] = vlc_alpha( p_a[i], i_alpha );
+}
+
+/* p_dst[i] = vlc_blend( p_src[i], p_dst[i], p_trans[i] ) */
+static void BlendRow( uint8_t *p_dst, const uint8_t *p_src,
+                      const uint8_t *p_trans, int i_count )
+{
+    for( int i = 0; i < i_count; i++ )
+        p_dst[i] = vlc_blend( p_src[i], p_dst[i], p_trans[i] );
+}
+
+/* Chroma of the 4:2:0 destination from the even pixels of the source:
+ * p_dst[i] = vlc_blend( p_src[2*i], p_dst[i], p_trans[2*i] ) */
+static void BlendRowSub( uint8_t *p_dst, const uint8_t *p_src,
+                         const uint8_t *p_trans, int i_count )
+{
+    for( int i = 0; i < i_count; i++ )
+        p_dst[i] = vlc_blend( p_src[2*i], p_dst[i], p_trans[2*i] );
+}
+
+static void RGBAToYUVARow( uint8_t *p_y, uint8_t *p_u, uint8_t *p_v,
+                           uint8_t *p_a, const uint8_t *p_rgba, int i_count )
+{
+    for( int i = 0; i < i_count; i++ )
+    {
+        rgb_to_yuv( &p_y[i], &p_u[i], &p_v[i],
+                    p_rgba[4*i+0], p_rgba[4*i+1], p_rgba[4*i+2] );
+        p_a[i] = p_rgba[4*i+3];
+    }
+}
+
+#if defined(BLEND_SSE2)
+/* vlc_blend() on 16 pixels */
+BLEND_SSE2
+static inline __m128i BlendSSE2( __m128i v1, __m128i v2, __m128i a )
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i max = _mm_set1_epi16( MAX_TRANS );
+    const __m128i a_lo = _mm_unpacklo_epi8( a, zero );
+    const __m128i a_hi = _mm_unpackhi_epi8( a, zero );
+
+    /* The sums fit in 16 bits (at most 255 * 255) */
+    __m128i lo = _mm_add_epi16(
+        _mm_mullo_epi16( _mm_unpacklo_epi8( v1, zero ), a_lo ),
+        _mm_mullo_epi16( _mm_unpacklo_epi8( v2, zero ),
+                         _mm_sub_epi16( max, a_lo ) ) );
+    __m128i hi = _mm_add_epi16(
+        _mm_mullo_epi16( _mm_unpackhi_epi8( v1, zero ), a_hi ),
+        _mm_mullo_epi16( _mm_unpackhi_epi8( v2, zero ),
+                         _mm_sub_epi16( max, a_hi ) ) );
+    __m128i r = _mm_packus_epi16( _mm_srli_epi16( lo, TRANS_BITS ),
+                                  _mm_srli_epi16( hi, TRANS_BITS ) );
+
+    const __m128i opaque = _mm_cmpeq_epi8( a, _mm_set1_epi8( -1 ) );
+    const __m128i transparent = _mm_cmpeq_epi8( a, zero );
+    r = _mm_or_si128( _mm_and_si128( opaque, v1 ),
+                      _mm_andnot_si128( opaque, r ) );
+    r = _mm_or_si128( _mm_and_si128( transparent, v2 ),
+                      _mm_andnot_si128( transparent, r ) );
+    return r;
+}
+
+/* vlc_alpha() on 8 words: t * a / 255 as (n + 1 + (n >> 8)) >> 8, which
+ * is exact for n <= 255 * 255 */
+BLEND_SSE2
+static inline __m128i AlphaSSE2( __m128i t, __m128i a )
+{
+    const __m128i n = _mm_mullo_epi16( t, a );
+    return _mm_srli_epi16( _mm_add_epi16( _mm_add_epi16( n, _mm_set1_epi16( 1 ) ),
+                                          _mm_srli_epi16( n, 8 ) ), 8 );
+}
+
+BLEND_SSE2
+static void AlphaRowSSE2( uint8_t *p_trans, const uint8_t *p_a,
+                          int i_alpha, int i_count )
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i a = _mm_set1_epi16( i_alpha );
+    int i = 0;
+
+    for( ; i + 16 <= i_count; i += 16 )
+    {
+        const __m128i t = _mm_loadu_si128( (const __m128i *)&p_a[i] );
+        _mm_storeu_si128( (__m128i *)&p_trans[i],
+            _mm_packus_epi16( AlphaSSE2( _mm_unpacklo_epi8( t, zero ), a ),
+                              AlphaSSE2( _mm_unpackhi_epi8( t, zero ), a ) ) );
+    }
+    AlphaRow( &p_trans[i], &p_a[i], i_alpha, i_count - i );
+}
+
+BLEND_SSE2
+static void BlendRowSSE2( uint8_t *p_dst, const uint8_t *p_src,
+                          const uint8_t *p_trans, int i_count )
+{
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0;
+
+    for( ; i + 16 <= i_count; i += 16 )
+    {
+        const __m128i a = _mm_loadu_si128( (const __m128i *)&p_trans[i] );
+
+        /* Fully transparent spans are common (subtitles, logos) */
+        if( _mm_movemask_epi8( _mm_cmpeq_epi8( a, zero ) ) == 0xffff )
+            continue;
+
+        const __m128i s = _mm_loadu_si128( (const __m128i *)&p_src[i] );
+        const __m128i d = _mm_loadu_si128( (const __m128i *)&p_dst[i] );
+        _mm_storeu_si128( (__m128i *)&p_dst[i], BlendSSE2( s, d, a ) );
+    }
+    BlendRow( &p_dst[i], &p_src[i], &p_trans[i], i_count - i );
+}
+
+BLEND_SSE2
+static void BlendRowSubSSE2( uint8_t *p_dst, const uint8_t *p_src,
+                             const uint8_t *p_trans, int i_count )
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i even = _mm_set1_epi16( 0xff );
+    int i = 0;
+
+    /* Keep the last pixel for the C version, so that the 32 bytes loaded
+     * never go past the last even source pixel */
+    for( ; i + 16 < i_count; i += 16 )
+    {
+        const __m128i a = _mm_packus_epi16(
+            _mm_and_si128( _mm_loadu_si128( (const __m128i *)&p_trans[2*i] ), even ),
+            _mm_and_si128( _mm_loadu_si128( (const __m128i *)&p_trans[2*i+16] ), even ) );
+
+        if( _mm_movemask_epi8( _mm_cmpeq_epi8( a, zero ) ) == 0xffff )
+            continue;
+
+        const __m128i s = _mm_packus_epi16(
+            _mm_and_si128( _mm_loadu_si128( (const __m128i *)&p_src[2*i] ), even ),
+            _mm_and_si128( _mm_loadu_si128( (const __m128i *)&p_src[2*i+16] ), even ) );
+        const __m128i d = _mm_loadu_si128( (const __m128i *)&p_dst[i] );
+        _mm_storeu_si128( (__m128i *)&p_dst[i], BlendSSE2( s, d, a ) );
+    }
+    BlendRowSub( &p_dst[i], &p_src[2*i], &p_trans[2*i], i_count - i );
+}
+
+/* rgb_to_yuv() on 8 pixels. The products are computed modulo 2^16, but
+ * the final sums fit in 16 bits: [0, 56228] for Y and
+ * [-28432, 28688] for U and V. */
+BLEND_SSE2
+static inline void RGBToYUVSSE2( __m128i *y, __m128i *u, __m128i *v,
+                                 __m128i r, __m128i g, __m128i b )
+{
+    const __m128i round = _mm_set1_epi16( 128 );
+
+    *y = _mm_add_epi16( _mm_mullo_epi16( r, _mm_set1_epi16( 66 ) ),
+                        _mm_mullo_epi16( g, _mm_set1_epi16( 129 ) ) );
+    *y = _mm_add_epi16( *y, _mm_mullo_epi16( b, _mm_set1_epi16( 25 ) ) );
+    *y = _mm_add_epi16( _mm_srli_epi16( _mm_add_epi16( *y, round ), 8 ),
+                        _mm_set1_epi16( 16 ) );
+
+    *u = _mm_sub_epi16( _mm_mullo_epi16( b, _mm_set1_epi16( 112 ) ),
+                        _mm_mullo_epi16( r, _mm_set1_epi16( 38 ) ) );
+    *u = _mm_sub_epi16( *u, _mm_mullo_epi16( g, _mm_set1_epi16( 74 ) ) );
+    *u = _mm_add_epi16( _mm_srai_epi16( _mm_add_epi16( *u, round ), 8 ), round );
+
+    *v = _mm_sub_epi16( _mm_mullo_epi16( r, _mm_set1_epi16( 112 ) ),
+                        _mm_mullo_epi16( g, _mm_set1_epi16( 94 ) ) );
+    *v = _mm_sub_epi16( *v, _mm_mullo_epi16( b, _mm_set1_epi16( 18 ) ) );
+    *v = _mm_add_epi16( _mm_srai_epi16( _mm_add_epi16( *v, round ), 8 ), round );
+}
+
+/* Splits 8 RGBA pixels into words */
+BLEND_SSE2
+static inline void RGBAUnpackSSE2( const uint8_t *p_rgba, __m128i *r,
+                                   __m128i *g, __m128i *b, __m128i *a )
+{
+    const __m128i mask = _mm_set1_epi32( 0xff );
+    const __m128i p0 = _mm_loadu_si128( (const __m128i *)&p_rgba[0] );
+    const __m128i p1 = _mm_loadu_si128( (const __m128i *)&p_rgba[16] );
+
+    *r = _mm_packs_epi32( _mm_and_si128( p0, mask ), _mm_and_si128( p1, mask ) );
+    *g = _mm_packs_epi32( _mm_and_si128( _mm_srli_epi32( p0, 8 ), mask ),
+                          _mm_and_si128( _mm_srli_epi32( p1, 8 ), mask ) );
+    *b = _mm_packs_epi32( _mm_and_si128( _mm_srli_epi32( p0, 16 ), mask ),
+                          _mm_and_si128( _mm_srli_epi32( p1, 16 ), mask ) );
+    *a = _mm_packs_epi32( _mm_srli_epi32( p0, 24 ), _mm_srli_epi32( p1, 24 ) );
+}
+
+BLEND_SSE2
+static void RGBAToYUVARowSSE2( uint8_t *p_y, uint8_t *p_u, uint8_t *p_v,
+                               uint8_t *p_a, const uint8_t *p_rgba, int i_count )
+{
+    int i = 0;
+
+    for( ; i + 16 <= i_count; i += 16 )
+    {
+        __m128i r, g, b, a[2], y[2], u[2], v[2];
+
+        for( int k = 0; k < 2; k++ )
+        {
+            RGBAUnpackSSE2( &p_rgba[4*(i + 8*k)], &r, &g, &b, &a[k] );
+            RGBToYUVSSE2( &y[k], &u[k], &v[k], r, g, b );
+        }
+        _mm_storeu_si128( (__m128i *)&p_y[i], _mm_packus_epi16( y[0], y[1] ) );
+        _mm_storeu_si128( (__m128i *)&p_u[i], _mm_packus_epi16( u[0], u[1] ) );
+        _mm_storeu_si128( (__m128i *)&p_v[i], _mm_packus_epi16( v[0], v[1] ) );
+        _mm_storeu_si128( (__m128i *)&p_a[i], _mm_packus_epi16( a[0], a[1] ) );
+    }
+    RGBAToYUVARow( &p_y[i], &p_u[i], &p_v[i], &p_a[i], &p_rgba[4*i], i_count - i );
+}
+#endif
+
+#if defined(__ARM_NEON__)
+/* vlc_blend() on 16 pixels */
+static inline uint8x16_t BlendNEON( uint8x16_t v1, uint8x16_t v2, uint8x16_t a )
+{
+    const uint8x16_t ia = vmvnq_u8( a ); /* MAX_TRANS - a */
+    const uint16x8_t lo = vmlal_u8( vmull_u8( vget_low_u8( v1 ), vget_low_u8( a ) ),
+                                    vget_low_u8( v2 ), vget_low_u8( ia ) );
+    const uint16x8_t hi = vmlal_u8( vmull_u8( vget_high_u8( v1 ), vget_high_u8( a ) ),
+                                    vget_high_u8( v2 ), vget_high_u8( ia ) );
+    uint8x16_t r = vcombine_u8( vshrn_n_u16( lo, TRANS_BITS ),
+                                vshrn_n_u16( hi, TRANS_BITS ) );
+
+    r = vbslq_u8( vceqq_u8( a, vdupq_n_u8( MAX_TRANS ) ), v1, r );
+    r = vbslq_u8( vceqq_u8( a, vdupq_n_u8( 0 ) ), v2, r );
+    return r;
+}
+
+static inline bool IsTransparentNEON( uint8x16_t a )
+{
+    const uint64x2_t a64 = vreinterpretq_u64_u8( a );
+    return ( vgetq_lane_u64( a64, 0 ) | vgetq_lane_u64( a64, 1 ) ) == 0;
+}
+
+/* vlc_alpha() on 8 pixels, see AlphaSSE2() */
+static inline uint8x8_t AlphaNEON( uint8x8_t t, uint8x8_t a )
+{
+    const uint16x8_t n = vmull_u8( t, a );
+    return vshrn_n_u16( vsraq_n_u16( vaddq_u16( n, vdupq_n_u16( 1 ) ), n, 8 ), 8 );
+}
+
+static void AlphaRowNEON( uint8_t *p_trans, const uint8_t *p_a,
+                          int i_alpha, int i_count )
+{
+    const uint8x8_t a = vdup_n_u8( i_alpha );
+    int i = 0;
+
+    for( ; i + 16 <= i_count; i += 16 )
+    {
+        const uint8x16_t t = vld1q_u8( &p_a[i] );
+        vst1q_u8( &p_trans[i], vcombine_u8( AlphaNEON( vget_low_u8( t ), a ),
+                                            AlphaNEON( vget_high_u8( t ), a ) ) );
+    }
+    AlphaRow( &p_trans[i], &p_a[i], i_alpha, i_count - i );
+}
+
+static void BlendRowNEON( uint8_t *p_dst, const uint8_t *p_src,
+                          const uint8_t *p_trans, int i_count )
+{
+    int i = 0;
+
+    for( ; i + 16 <= i_count; i += 16 )
+    {
+        const uint8x16_t a = vld1q_u8( &p_trans[i] );
+        if( IsTransparentNEON( a ) )
+            continue;
+        vst1q_u8( &p_dst[i], BlendNEON( vld1q_u8( &p_src[i] ),
+                                        vld1q_u8( &p_dst[i] ), a ) );
+    }
+    BlendRow( &p_dst[i], &p_src[i], &p_trans[i], i_count - i );
+}
+
+static void BlendRowSubNEON( uint8_t *p_dst, const uint8_t *p_src,
+                             const uint8_t *p_trans, int i_count )
+{
+    int i = 0;
+
+    for( ; i + 16 < i_count; i += 16 ) /* see BlendRowSubSSE2() */
+    {
+        /* val[0] holds the even pixels */
+        const uint8x16_t a = vld2q_u8( &p_trans[2*i] ).val[0];
+        if( IsTransparentNEON( a ) )
+            continue;
+        vst1q_u8( &p_dst[i], BlendNEON( vld2q_u8( &p_src[2*i] ).val[0],
+                                        vld1q_u8( &p_dst[i] ), a ) );
+    }
+    BlendRowSub( &p_dst[i], &p_src[2*i], &p_trans[2*i], i_count - i );
+}
+
+/* rgb_to_yuv() on 8 pixels, see RGBToYUVSSE2() */
+static inline void RGBToYUVNEON( uint8x8_t *y, uint8x8_t *u, uint8x8_t *v,
+                                 uint8x8_t r, uint8x8_t g, uint8x8_t b )
+{
+    const uint16x8_t round = vdupq_n_u16( 128 );
+    uint16x8_t t;
+
+    t = vmlal_u8( vmull_u8( r, vdup_n_u8( 66 ) ), g, vdup_n_u8( 129 ) );
+    t = vmlal_u8( t, b, vdup_n_u8( 25 ) );
+    *y = vadd_u8( vshrn_n_u16( vaddq_u16( t, round ), 8 ), vdup_n_u8( 16 ) );
+
+    t = vmlsl_u8( vmull_u8( b, vdup_n_u8( 112 ) ), r, vdup_n_u8( 38 ) );
+    t = vmlsl_u8( t, g, vdup_n_u8( 74 ) );
+    *u = vmovn_u16( vreinterpretq_u16_s16( vaddq_s16(
+            vshrq_n_s16( vreinterpretq_s16_u16( vaddq_u16( t, round ) ), 8 ),
+            vdupq_n_s16( 128 ) ) ) );
+
+    t = vmlsl_u8( vmull_u8( r, vdup_n_u8( 112 ) ), g, vdup_n_u8( 94 ) );
+    t = vmlsl_u8( t, b, vdup_n_u8( 18 ) );
+    *v = vmovn_u16( vreinterpretq_u16_s16( vaddq_s16(
+            vshrq_n_s16( vreinterpretq_s16_u16( vaddq_u16( t, round ) ), 8 ),
+            vdupq_n_s16( 128 ) ) ) );
+}
+
+static void RGBAToYUVARowNEON( uint8_t *p_y, uint8_t *p_u, uint8_t *p_v,
+                               uint8_t *p_a, const uint8_t *p_rgba, int i_count )
+{
+    int i = 0;
+
+    for( ; i + 8 <= i_count; i += 8 )
+    {
+        const uint8x8x4_t px = vld4_u8( &p_rgba[4*i] );
+        uint8x8_t y, u, v;
+
+        RGBToYUVNEON( &y, &u, &v, px.val[0], px.val[1], px.val[2] );
+        vst1_u8( &p_y[i], y );
+        vst1_u8( &p_u[i], u );
+        vst1_u8( &p_v[i], v );
+        vst1_u8( &p_a[i], px.val[3] );
+    }
+    RGBAToYUVARow( &p_y[i], &p_u[i], &p_v[i], &p_a[i], &p_rgba[4*i], i_count - i );
+}
+#endif
+
 /***********************************************************************
  * YUVA
  ***********************************************************************/
@@ -392,8 +813,10 @@ static void BlendYUVAI420( filter_t *p_filter,
     uint8_t *p_src_u, *p_dst_u;
     uint8_t *p_src_v, *p_dst_v;
     uint8_t *p_trans;
-    int i_x, i_y, i_trans = 0;
+    uint8_t p_trans_row[BLEND_CHUNK];
+    int i_x, i_y;
     bool b_even_scanline = i_y_offset % 2;
+    filter_sys_t *p_sys = p_filter->p_sys;
 
     bool b_swap_up = vlc_fourcc_AreUVPlanesSwapped( p_filter->fmt_out.video.i_chroma,
                                                     VLC_CODEC_I420 );
@@ -424,20 +847,20 @@ static void BlendYUVAI420( filter_t *p_filter,
         b_even_scanline = !b_even_scanline;
 
         /* Draw until we reach the end of the line */
-        for( i_x = 0; i_x < i_width; i_x++ )
+        for( i_x = 0; i_x < i_width; i_x += BLEND_CHUNK )
         {
-            if( p_trans )
-                i_trans = vlc_alpha( p_trans[i_x], i_alpha );
+            const int i_count = __MIN( i_width - i_x, BLEND_CHUNK );
 
-            if( !i_trans )
-                continue;
+            p_sys->pf_alpha_row( p_trans_row, &p_trans[i_x], i_alpha, i_count );
 
             /* Blending */
-            p_dst_y[i_x] = vlc_blend( p_src_y[i_x], p_dst_y[i_x], i_trans );
-            if( b_even_scanline && i_x % 2 == 0 )
+            p_sys->pf_blend_row( &p_dst_y[i_x], &p_src_y[i_x], p_trans_row, i_count );
+            if( b_even_scanline )
             {
-                p_dst_u[i_x/2] = vlc_blend( p_src_u[i_x], p_dst_u[i_x/2], i_trans );
-                p_dst_v[i_x/2] = vlc_blend( p_src_v[i_x], p_dst_v[i_x/2], i_trans );
+                p_sys->pf_blend_row_sub( &p_dst_u[i_x/2], &p_src_u[i_x],
+                                         p_trans_row, (i_count + 1) / 2 );
+                p_sys->pf_blend_row_sub( &p_dst_v[i_x/2], &p_src_v[i_x],
+                                         p_trans_row, (i_count + 1) / 2 );
             }
         }
     }
@@ -1010,8 +1433,12 @@ static void BlendPalI420( filter_t *p_filter,
     uint8_t *p_src, *p_dst_y;
     uint8_t *p_dst_u;
     uint8_t *p_dst_v;
-    int i_x, i_y, i_trans;
+    int i_x, i_y;
     bool b_even_scanline = i_y_offset % 2;
+    filter_sys_t *p_sys = p_filter->p_sys;
+    uint8_t p_y_row[BLEND_CHUNK], p_u_row[BLEND_CHUNK], p_v_row[BLEND_CHUNK];
+    uint8_t p_trans_row[BLEND_CHUNK];
+    uint8_t p_pal_alpha[256], p_pal_trans[256];
 
     bool b_swap_up = vlc_fourcc_AreUVPlanesSwapped( p_filter->fmt_out.video.i_chroma,
                                                     VLC_CODEC_I420 );
@@ -1037,6 +1464,11 @@ static void BlendPalI420( filter_t *p_filter,
 
 #define p_pal p_filter->fmt_in.video.p_palette->palette
 
+    /* The transparency only depends on the palette entry */
+    for( int i = 0; i < 256; i++ )
+        p_pal_alpha[i] = p_pal[i][3];
+    p_sys->pf_alpha_row( p_pal_trans, p_pal_alpha, i_alpha, 256 );
+
     /* Draw until we reach the bottom of the subtitle */
     for( i_y = 0; i_y < i_height; i_y++,
          p_dst_y += i_dst_pitch,
@@ -1044,22 +1476,35 @@ static void BlendPalI420( filter_t *p_filter,
          p_dst_u += b_even_scanline ? i_dst_pitch/2 : 0,
          p_dst_v += b_even_scanline ? i_dst_pitch/2 : 0 )
     {
-        const uint8_t *p_trans = p_src;
         b_even_scanline = !b_even_scanline;
 
         /* Draw until we reach the end of the line */
-        for( i_x = 0; i_x < i_width; i_x++ )
+        for( i_x = 0; i_x < i_width; i_x += BLEND_CHUNK )
         {
-            i_trans = vlc_alpha( p_pal[p_trans[i_x]][3], i_alpha );
-            if( !i_trans )
+            const int i_count = __MIN( i_width - i_x, BLEND_CHUNK );
+            bool b_visible = false;
+
+            for( int i = 0; i < i_count; i++ )
+            {
+                const uint8_t i_index = p_src[i_x + i];
+
+                p_trans_row[i] = p_pal_trans[i_index];
+                p_y_row[i] = p_pal[i_index][0];
+                p_u_row[i] = p_pal[i_index][1];
+                p_v_row[i] = p_pal[i_index][2];
+                b_visible |= p_trans_row[i] != 0;
+            }
+            if( !b_visible )
                 continue;
 
             /* Blending */
-            p_dst_y[i_x] = vlc_blend( p_pal[p_src[i_x]][0], p_dst_y[i_x], i_trans );
-            if( b_even_scanline && ((i_x % 2) == 0) )
+            p_sys->pf_blend_row( &p_dst_y[i_x], p_y_row, p_trans_row, i_count );
+            if( b_even_scanline )
             {
-                p_dst_u[i_x/2] = vlc_blend( p_pal[p_src[i_x]][1], p_dst_u[i_x/2], i_trans );
-                p_dst_v[i_x/2] = vlc_blend( p_pal[p_src[i_x]][2], p_dst_v[i_x/2], i_trans );
+                p_sys->pf_blend_row_sub( &p_dst_u[i_x/2], p_u_row,
+                                         p_trans_row, (i_count + 1) / 2 );
+                p_sys->pf_blend_row_sub( &p_dst_v[i_x/2], p_v_row,
+                                         p_trans_row, (i_count + 1) / 2 );
             }
         }
     }
@@ -1216,8 +1661,10 @@ static void BlendRGBAI420( filter_t *p_filter,
     uint8_t *p_dst_u;
     uint8_t *p_dst_v;
     uint8_t *p_src;
-    int i_x, i_y, i_trans;
-    uint8_t y, u, v;
+    int i_x, i_y;
+    filter_sys_t *p_sys = p_filter->p_sys;
+    uint8_t p_y_row[BLEND_CHUNK], p_u_row[BLEND_CHUNK], p_v_row[BLEND_CHUNK];
+    uint8_t p_a_row[BLEND_CHUNK], p_trans_row[BLEND_CHUNK];
 
     bool b_even_scanline = i_y_offset % 2;
     bool b_swap_up = vlc_fourcc_AreUVPlanesSwapped( p_filter->fmt_out.video.i_chroma,
@@ -1243,7 +1690,7 @@ static void BlendRGBAI420( filter_t *p_filter,
     p_src = p_src_pic->p->p_pixels +
             p_filter->fmt_in.video.i_x_offset * i_src_pix_pitch +
             p_src_pic->p->i_pitch * p_filter->fmt_in.video.i_y_offset;
-
+    assert( i_src_pix_pitch == 4 );
 
     /* Draw until we reach the bottom of the subtitle */
     for( i_y = 0; i_y < i_height; i_y++,
@@ -1255,24 +1702,22 @@ static void BlendRGBAI420( filter_t *p_filter,
         b_even_scanline = !b_even_scanline;
 
         /* Draw until we reach the end of the line */
-        for( i_x = 0; i_x < i_width; i_x++ )
+        for( i_x = 0; i_x < i_width; i_x += BLEND_CHUNK )
         {
-            const int R = p_src[i_x * i_src_pix_pitch + 0];
-            const int G = p_src[i_x * i_src_pix_pitch + 1];
-            const int B = p_src[i_x * i_src_pix_pitch + 2];
+            const int i_count = __MIN( i_width - i_x, BLEND_CHUNK );
 
-            i_trans = vlc_alpha( p_src[i_x * i_src_pix_pitch + 3], i_alpha );
-            if( !i_trans )
-                continue;
+            p_sys->pf_rgba_row( p_y_row, p_u_row, p_v_row, p_a_row,
+                                &p_src[i_x * i_src_pix_pitch], i_count );
+            p_sys->pf_alpha_row( p_trans_row, p_a_row, i_alpha, i_count );
 
             /* Blending */
-            rgb_to_yuv( &y, &u, &v, R, G, B );
-
-            p_dst_y[i_x] = vlc_blend( y, p_dst_y[i_x], i_trans );
-            if( b_even_scanline && i_x % 2 == 0 )
+            p_sys->pf_blend_row( &p_dst_y[i_x], p_y_row, p_trans_row, i_count );
+            if( b_even_scanline )
             {
-                p_dst_u[i_x/2] = vlc_blend( u, p_dst_u[i_x/2], i_trans );
-                p_dst_v[i_x/2] = vlc_blend( v, p_dst_v[i_x/2], i_trans );
+                p_sys->pf_blend_row_sub( &p_dst_u[i_x/2], p_u_row,
+                                         p_trans_row, (i_count + 1) / 2 );
+                p_sys->pf_blend_row_sub( &p_dst_v[i_x/2], p_v_row,
+                                         p_trans_row, (i_count + 1) / 2 );
             }
         }
     }
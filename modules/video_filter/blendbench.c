@@ -36,6 +36,8 @@
 #include <vlc_filter.h>
 #include <vlc_image.h>
 
+#include <assert.h>
+
 /*****************************************************************************
  * Local prototypes
  *****************************************************************************/
@@ -67,6 +69,16 @@ static picture_t *Filter( filter_t *, picture_t * );
 #define BLEND_CHROMA_LONGTEXT N_("Chroma which the blend image will be loaded" \
                                  "in")
 
+#define SIZES_TEXT N_("Synthetic image sizes")
+#define SIZES_LONGTEXT N_("Comma separated list of WIDTHxHEIGHT sizes of " \
+    "the generated images. They are used unless both a base image and a " \
+    "blend image are given.")
+
+#define PATTERNS_TEXT N_("Synthetic alpha patterns")
+#define PATTERNS_LONGTEXT N_("Comma separated list of the alpha patterns of " \
+    "the generated blend images: opaque, transparent, random, gradient " \
+    "or subtitle.")
+
 #define CFG_PREFIX "blendbench-"
 
 vlc_module_begin ()
@@ -94,12 +106,32 @@ vlc_module_begin ()
     add_string( CFG_PREFIX "blend-chroma", "YUVA", NULL, BLEND_CHROMA_TEXT,
               BLEND_CHROMA_LONGTEXT, false )
 
+    set_section( N_("Synthetic images"), NULL )
+    add_string( CFG_PREFIX "sizes", "320x240,720x576,1920x1080", NULL,
+                SIZES_TEXT, SIZES_LONGTEXT, false )
+    add_string( CFG_PREFIX "patterns",
+                "opaque,transparent,random,gradient,subtitle", NULL,
+                PATTERNS_TEXT, PATTERNS_LONGTEXT, false )
+
     set_callbacks( Create, Destroy )
 vlc_module_end ()
 
 static const char *const ppsz_filter_options[] = {
     "loops", "alpha", "base-image", "base-chroma", "blend-image",
-    "blend-chroma", NULL
+    "blend-chroma", "sizes", "patterns", NULL
+};
+
+enum
+{
+    PATTERN_OPAQUE,
+    PATTERN_TRANSPARENT,
+    PATTERN_RANDOM,
+    PATTERN_GRADIENT,
+    PATTERN_SUBTITLE,
+};
+
+static const char *const ppsz_patterns[] = {
+    "opaque", "transparent", "random", "gradient", "subtitle", NULL
 };
 
 /*****************************************************************************
@@ -115,6 +147,9 @@ struct filter_sys_t
 
     vlc_fourcc_t i_base_chroma;
     vlc_fourcc_t i_blend_chroma;
+
+    char *psz_sizes;
+    char *psz_patterns;
 };
 
 static int blendbench_LoadImage( vlc_object_t *p_this, picture_t **pp_pic,
@@ -176,19 +211,42 @@ static int Create( vlc_object_t *p_this )
     psz_temp = var_CreateGetStringCommand( p_filter, CFG_PREFIX "base-chroma" );
     p_sys->i_base_chroma = VLC_FOURCC( psz_temp[0], psz_temp[1],
                                        psz_temp[2], psz_temp[3] );
-    psz_cmd = var_CreateGetStringCommand( p_filter, CFG_PREFIX "base-image" );
-    blendbench_LoadImage( p_this, &p_sys->p_base_image, p_sys->i_base_chroma,
-                          psz_cmd, "Base" );
     free( psz_temp );
-    free( psz_cmd );
 
     psz_temp = var_CreateGetStringCommand( p_filter,
                                            CFG_PREFIX "blend-chroma" );
     p_sys->i_blend_chroma = VLC_FOURCC( psz_temp[0], psz_temp[1],
                                         psz_temp[2], psz_temp[3] );
-    psz_cmd = var_CreateGetStringCommand( p_filter, CFG_PREFIX "blend-image" );
-    blendbench_LoadImage( p_this, &p_sys->p_blend_image, p_sys->i_blend_chroma,
-                          psz_cmd, "Blend" );
+    free( psz_temp );
+
+    p_sys->psz_sizes = var_CreateGetStringCommand( p_filter,
+                                                   CFG_PREFIX "sizes" );
+    p_sys->psz_patterns = var_CreateGetStringCommand( p_filter,
+                                                      CFG_PREFIX "patterns" );
+    p_sys->p_base_image = NULL;
+    p_sys->p_blend_image = NULL;
+
+    /* Real images are only used when both are given, synthetic images
+     * otherwise */
+    psz_cmd = var_CreateGetStringCommand( p_filter, CFG_PREFIX "base-image" );
+    psz_temp = var_CreateGetStringCommand( p_filter, CFG_PREFIX "blend-image" );
+    if( psz_cmd && *psz_cmd && psz_temp && *psz_temp )
+    {
+        if( blendbench_LoadImage( p_this, &p_sys->p_base_image,
+                                  p_sys->i_base_chroma, psz_cmd, "Base" ) ||
+            blendbench_LoadImage( p_this, &p_sys->p_blend_image,
+                                  p_sys->i_blend_chroma, psz_temp, "Blend" ) )
+        {
+            if( p_sys->p_base_image )
+                picture_Release( p_sys->p_base_image );
+            free( psz_temp );
+            free( psz_cmd );
+            free( p_sys->psz_patterns );
+            free( p_sys->psz_sizes );
+            free( p_sys );
+            return VLC_EGENERIC;
+        }
+    }
     free( psz_temp );
     free( psz_cmd );
 
@@ -203,58 +261,302 @@ static void Destroy( vlc_object_t *p_this )
     filter_t *p_filter = (filter_t *)p_this;
     filter_sys_t *p_sys = p_filter->p_sys;
 
-    picture_Release( p_sys->p_base_image );
-    picture_Release( p_sys->p_blend_image );
+    if( p_sys->p_base_image )
+        picture_Release( p_sys->p_base_image );
+    if( p_sys->p_blend_image )
+        picture_Release( p_sys->p_blend_image );
+    free( p_sys->psz_patterns );
+    free( p_sys->psz_sizes );
+    free( p_sys );
 }
 
 /*****************************************************************************
- * Render: displays previously rendered output
+ * Synthetic images
+ *****************************************************************************
+ * The images only depend on their size, chroma and alpha pattern, so that
+ * the checksums of two runs (on different CPUs, or with --no-sse2) can be
+ * compared to check that the results are the same.
  *****************************************************************************/
-static picture_t *Filter( filter_t *p_filter, picture_t *p_pic )
+static uint8_t blendbench_Random( uint32_t *pi_seed )
+{
+    *pi_seed = *pi_seed * 1103515245 + 12345;
+    return *pi_seed >> 16;
+}
+
+static uint8_t blendbench_Alpha( int i_pattern, int x, int y, int i_width,
+                                 int i_height, uint32_t *pi_seed )
+{
+    switch( i_pattern )
+    {
+        case PATTERN_OPAQUE:
+            return 255;
+        case PATTERN_TRANSPARENT:
+            return 0;
+        case PATTERN_RANDOM:
+            return blendbench_Random( pi_seed );
+        case PATTERN_GRADIENT:
+            return i_width > 1 ? x * 255 / (i_width - 1) : 255;
+        case PATTERN_SUBTITLE:
+        {
+            /* Two lines of 12x24 "glyphs" near the bottom, with
+             * anti-aliased borders, and nothing elsewhere */
+            const int i_top = i_height * 3 / 4;
+            if( y < i_top || y >= i_top + 48 || x < i_width / 8 ||
+                x >= i_width * 7 / 8 )
+                return 0;
+            const int i_cell = x / 12 + 97 * ((y - i_top) / 24);
+            if( (i_cell * 2654435761u) >> 30 == 0 ) /* spaces */
+                return 0;
+            if( x % 12 < 2 || y % 24 < 2 )
+                return 0;
+            if( x % 12 == 2 || x % 12 == 10 || y % 24 == 2 || y % 24 == 22 )
+                return 128;
+            return x % 12 == 11 || y % 24 == 23 ? 0 : 255;
+        }
+        default:
+            assert( 0 );
+            return 0;
+    }
+}
+
+static picture_t *blendbench_NewBase( vlc_fourcc_t i_chroma,
+                                      int i_width, int i_height )
+{
+    picture_t *p_pic = picture_New( i_chroma, i_width, i_height, 1, 1 );
+    uint32_t i_seed = 1;
+
+    if( !p_pic )
+        return NULL;
+    for( int i_plane = 0; i_plane < p_pic->i_planes; i_plane++ )
+    {
+        plane_t *p = &p_pic->p[i_plane];
+        for( int i = 0; i < p->i_pitch * p->i_lines; i++ )
+            p->p_pixels[i] = blendbench_Random( &i_seed );
+    }
+    return p_pic;
+}
+
+static picture_t *blendbench_NewBlend( vlc_fourcc_t i_chroma,
+                                       int i_width, int i_height,
+                                       int i_pattern,
+                                       video_palette_t *p_palette )
+{
+    picture_t *p_pic = picture_New( i_chroma, i_width, i_height, 1, 1 );
+    uint32_t i_seed = 2;
+
+    if( !p_pic )
+        return NULL;
+
+    switch( i_chroma )
+    {
+        case VLC_CODEC_YUVA:
+            for( int i_plane = 0; i_plane < A_PLANE; i_plane++ )
+            {
+                plane_t *p = &p_pic->p[i_plane];
+                for( int i = 0; i < p->i_pitch * p->i_lines; i++ )
+                    p->p_pixels[i] = blendbench_Random( &i_seed );
+            }
+            for( int y = 0; y < i_height; y++ )
+                for( int x = 0; x < i_width; x++ )
+                    p_pic->p[A_PLANE].p_pixels[y * p_pic->p[A_PLANE].i_pitch + x] =
+                        blendbench_Alpha( i_pattern, x, y, i_width, i_height,
+                                          &i_seed );
+            break;
+
+        case VLC_CODEC_RGBA:
+            for( int y = 0; y < i_height; y++ )
+            {
+                uint8_t *p_line = &p_pic->p->p_pixels[y * p_pic->p->i_pitch];
+                for( int x = 0; x < i_width; x++ )
+                {
+                    p_line[4*x+0] = blendbench_Random( &i_seed );
+                    p_line[4*x+1] = blendbench_Random( &i_seed );
+                    p_line[4*x+2] = blendbench_Random( &i_seed );
+                    p_line[4*x+3] = blendbench_Alpha( i_pattern, x, y, i_width,
+                                                      i_height, &i_seed );
+                }
+            }
+            break;
+
+        case VLC_CODEC_YUVP:
+            /* The index of each entry is its alpha, so that the pattern
+             * gives the indexes directly */
+            p_palette->i_entries = 256;
+            for( int i = 0; i < 256; i++ )
+            {
+                p_palette->palette[i][0] = 16 + blendbench_Random( &i_seed ) % 220;
+                p_palette->palette[i][1] = 16 + blendbench_Random( &i_seed ) % 225;
+                p_palette->palette[i][2] = 16 + blendbench_Random( &i_seed ) % 225;
+                p_palette->palette[i][3] = i;
+            }
+            for( int y = 0; y < i_height; y++ )
+                for( int x = 0; x < i_width; x++ )
+                    p_pic->p->p_pixels[y * p_pic->p->i_pitch + x] =
+                        blendbench_Alpha( i_pattern, x, y, i_width, i_height,
+                                          &i_seed );
+            break;
+
+        default:
+            picture_Release( p_pic );
+            return NULL;
+    }
+    return p_pic;
+}
+
+/* FNV-1a of the visible pixels */
+static uint32_t blendbench_Checksum( const picture_t *p_pic )
+{
+    uint32_t i_sum = 2166136261u;
+
+    for( int i_plane = 0; i_plane < p_pic->i_planes; i_plane++ )
+    {
+        const plane_t *p = &p_pic->p[i_plane];
+        for( int y = 0; y < p->i_visible_lines; y++ )
+            for( int x = 0; x < p->i_visible_pitch; x++ )
+                i_sum = (i_sum ^ p->p_pixels[y * p->i_pitch + x]) * 16777619u;
+    }
+    return i_sum;
+}
+
+/*****************************************************************************
+ * blendbench_Run: times the blending of p_blend_image onto p_base_image
+ *****************************************************************************/
+static int blendbench_Run( filter_t *p_filter, picture_t *p_base_image,
+                           picture_t *p_blend_image,
+                           video_palette_t *p_palette, const char *psz_name )
 {
     filter_sys_t *p_sys = p_filter->p_sys;
     filter_t *p_blend;
+    picture_t *p_orig;
 
-    if( p_sys->b_done )
-        return p_pic;
+    p_orig = picture_NewFromFormat( &p_base_image->format );
+    if( !p_orig )
+        return VLC_ENOMEM;
+    picture_Copy( p_orig, p_base_image );
 
     p_blend = vlc_object_create( p_filter, sizeof(filter_t) );
     if( !p_blend )
     {
-        picture_Release( p_pic );
-        return NULL;
+        picture_Release( p_orig );
+        return VLC_ENOMEM;
     }
     vlc_object_attach( p_blend, p_filter );
-    p_blend->fmt_out.video = p_sys->p_base_image->format;
-    p_blend->fmt_in.video = p_sys->p_blend_image->format;
+    p_blend->fmt_out.video = p_base_image->format;
+    p_blend->fmt_in.video = p_blend_image->format;
+    p_blend->fmt_in.video.p_palette = p_palette;
     p_blend->p_module = module_need( p_blend, "video blending", NULL, false );
     if( !p_blend->p_module )
     {
-        picture_Release( p_pic );
+        msg_Err( p_filter, "no blending module for %4.4s on %4.4s",
+                 (const char *)&p_blend_image->format.i_chroma,
+                 (const char *)&p_base_image->format.i_chroma );
         vlc_object_release( p_blend );
-        return NULL;
+        picture_Release( p_orig );
+        return VLC_EGENERIC;
     }
 
     mtime_t time = mdate();
     for( int i_iter = 0; i_iter < p_sys->i_loops; ++i_iter )
     {
         p_blend->pf_video_blend( p_blend,
-                                 p_sys->p_base_image, p_sys->p_blend_image,
+                                 p_base_image, p_blend_image,
                                  0, 0, p_sys->i_alpha );
     }
     time = mdate() - time;
 
-    msg_Info( p_filter, "Blended %d images in %f sec", p_sys->i_loops,
-              time / 1000000.0f );
-    msg_Info( p_filter, "Speed is: %f images/second, %f pixels/second",
-              (float) p_sys->i_loops / time * 1000000,
-              (float) p_sys->i_loops / time * 1000000 *
-                  p_sys->p_blend_image->p[Y_PLANE].i_visible_pitch *
-                  p_sys->p_blend_image->p[Y_PLANE].i_visible_lines );
+    /* The checksum is the one of a single blend onto the original image */
+    picture_Copy( p_base_image, p_orig );
+    p_blend->pf_video_blend( p_blend, p_base_image, p_blend_image,
+                             0, 0, p_sys->i_alpha );
+
+    const int i_width = p_blend_image->format.i_visible_width;
+    const int i_height = p_blend_image->format.i_visible_height;
+    msg_Info( p_filter, "%s: %dx%d %4.4s on %4.4s, alpha %d: "
+              "%d loops in %f sec, %.1f Mpixel/s, checksum %08"PRIx32,
+              psz_name, i_width, i_height,
+              (const char *)&p_blend_image->format.i_chroma,
+              (const char *)&p_base_image->format.i_chroma, p_sys->i_alpha,
+              p_sys->i_loops, time / 1000000.0f,
+              time > 0 ? (double)p_sys->i_loops * i_width * i_height / time
+                       : 0.,
+              blendbench_Checksum( p_base_image ) );
 
     module_unneed( p_blend, p_blend->p_module );
-
     vlc_object_release( p_blend );
+    picture_Release( p_orig );
+    return VLC_SUCCESS;
+}
+
+/*****************************************************************************
+ * blendbench_RunSynthetic: benchmarks all the requested sizes and patterns
+ *****************************************************************************/
+static void blendbench_RunSynthetic( filter_t *p_filter )
+{
+    filter_sys_t *p_sys = p_filter->p_sys;
+    const char *psz_size = p_sys->psz_sizes;
+
+    while( psz_size && *psz_size )
+    {
+        int i_width, i_height;
+
+        if( sscanf( psz_size, "%dx%d", &i_width, &i_height ) != 2 ||
+            i_width <= 0 || i_height <= 0 )
+        {
+            msg_Err( p_filter, "invalid size: %s", psz_size );
+            return;
+        }
+
+        for( int i_pattern = 0; ppsz_patterns[i_pattern]; i_pattern++ )
+        {
+            const char *psz = strstr( p_sys->psz_patterns,
+                                      ppsz_patterns[i_pattern] );
+            const size_t i_len = strlen( ppsz_patterns[i_pattern] );
+
+            if( !psz || (psz[i_len] != '\0' && psz[i_len] != ',') )
+                continue;
+
+            video_palette_t palette;
+            picture_t *p_base = blendbench_NewBase( p_sys->i_base_chroma,
+                                                    i_width, i_height );
+            picture_t *p_pic = blendbench_NewBlend( p_sys->i_blend_chroma,
+                                                    i_width, i_height,
+                                                    i_pattern, &palette );
+            if( p_base && p_pic )
+                blendbench_Run( p_filter, p_base, p_pic,
+                                p_sys->i_blend_chroma == VLC_CODEC_YUVP ?
+                                    &palette : NULL,
+                                ppsz_patterns[i_pattern] );
+            else
+                msg_Err( p_filter, "cannot create %4.4s on %4.4s images",
+                         (const char *)&p_sys->i_blend_chroma,
+                         (const char *)&p_sys->i_base_chroma );
+            if( p_pic )
+                picture_Release( p_pic );
+            if( p_base )
+                picture_Release( p_base );
+        }
+
+        psz_size = strchr( psz_size, ',' );
+        if( psz_size )
+            psz_size++;
+    }
+}
+
+/*****************************************************************************
+ * Render: displays previously rendered output
+ *****************************************************************************/
+static picture_t *Filter( filter_t *p_filter, picture_t *p_pic )
+{
+    filter_sys_t *p_sys = p_filter->p_sys;
+
+    if( p_sys->b_done )
+        return p_pic;
+
+    if( p_sys->p_base_image && p_sys->p_blend_image )
+        blendbench_Run( p_filter, p_sys->p_base_image, p_sys->p_blend_image,
+                        p_sys->p_blend_image->format.p_palette, "image" );
+    else
+        blendbench_RunSynthetic( p_filter );
 
     p_sys->b_done = true;
     return p_pic;
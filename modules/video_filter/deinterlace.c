@@ -56,6 +56,8 @@
 #define DEINTERLACE_YADIF   7
 #define DEINTERLACE_YADIF2X 8
 
+typedef struct yadif_pool_t yadif_pool_t;
+
 /*****************************************************************************
  * Local protypes
  *****************************************************************************/
@@ -76,6 +78,7 @@ static void RenderBlend  ( vout_thread_t *, picture_t *, picture_t * );
 static void RenderLinear ( vout_thread_t *, picture_t *, picture_t *, int );
 static void RenderX      ( picture_t *, picture_t * );
 static void RenderYadif  ( vout_thread_t *, picture_t *, picture_t *, int, int );
+static void YadifPoolDelete( yadif_pool_t * );
 
 static void MergeGeneric ( void *, const void *, const void *, size_t );
 #if defined(CAN_COMPILE_C_ALTIVEC)
@@ -118,6 +121,10 @@ static int FilterCallback( vlc_object_t *, char const *,
 #define MODE_TEXT N_("Deinterlace mode")
 #define MODE_LONGTEXT N_("Deinterlace method to use for local playback.")
 
+#define THREADS_TEXT N_("Yadif threads")
+#define THREADS_LONGTEXT N_("Number of threads filtering each picture " \
+    "in the Yadif modes. Each thread filters a slice of the picture.")
+
 #define SOUT_MODE_TEXT N_("Streaming deinterlace mode")
 #define SOUT_MODE_LONGTEXT N_("Deinterlace method to use for streaming.")
 
@@ -140,6 +147,9 @@ vlc_module_begin ()
                 MODE_LONGTEXT, false )
         change_string_list( mode_list, mode_list_text, 0 )
         change_safe ()
+    add_integer( "filter-deinterlace-threads", 1, NULL, THREADS_TEXT,
+                 THREADS_LONGTEXT, true )
+        change_integer_range( 1, 16 )
 
     add_shortcut( "deinterlace" )
     set_callbacks( Create, Destroy )
@@ -183,6 +193,8 @@ struct vout_sys_t
 
     /* Yadif */
     picture_t *pp_history[HISTORY_SIZE];
+    int i_yadif_threads;
+    yadif_pool_t *p_yadif_pool;
 };
 
 /*****************************************************************************
@@ -221,6 +233,8 @@ static int Create( vlc_object_t *p_this )
     p_sys->b_half_height = true;
     p_sys->last_date = 0;
     p_sys->p_vout = 0;
+    p_sys->i_yadif_threads = var_CreateGetInteger( p_vout, "filter-deinterlace-threads" );
+    p_sys->p_yadif_pool = NULL;
     vlc_mutex_init( &p_sys->filter_lock );
 
 #if defined(CAN_COMPILE_C_ALTIVEC)
@@ -464,6 +478,12 @@ static void End( vout_thread_t *p_vout )
             picture_Release( p_sys->pp_history[i] );
     }
 
+    if( p_sys->p_yadif_pool )
+    {
+        YadifPoolDelete( p_sys->p_yadif_pool );
+        p_sys->p_yadif_pool = NULL;
+    }
+
     if( p_sys->p_vout )
     {
         vout_filter_DelChild( p_vout, p_sys->p_vout, MouseEvent );
@@ -1799,30 +1819,221 @@ static void RenderX( picture_t *p_outpic, picture_t *p_pic )
 /*****************************************************************************
  * Yadif (Yet Another DeInterlacing Filter).
  *****************************************************************************/
-/* */
-struct vf_priv_s {
-    /*
-     * 0: Output 1 frame for each frame.
-     * 1: Output 1 frame for each field.
-     * 2: Like 0 but skips spatial interlacing check.
-     * 3: Like 1 but skips spatial interlacing check.
-     *
-     * In vlc, only & 0x02 has meaning, as we do the & 0x01 ourself.
-     */
-    int mode;
+/* yadif.h comes from vf_yadif.c of mplayer project */
+#include "yadif.h"
+
+typedef struct
+{
+    yadif_filter_line_t pf_filter;
+    picture_t *p_dst;
+    picture_t *p_prev;
+    picture_t *p_cur;
+    picture_t *p_next;
+    int i_order;
+    int i_field;
+} yadif_job_t;
+
+typedef struct
+{
+    yadif_pool_t *p_pool;
+    int          i_slice;
+    vlc_thread_t thread;
+} yadif_worker_t;
+
+/* The vout thread filters the first slice of each picture, the workers
+ * the others */
+struct yadif_pool_t
+{
+    vlc_mutex_t lock;
+    vlc_cond_t  wait;      /* signaled when a job is posted */
+    vlc_cond_t  done;      /* signaled when the last slice is finished */
+    yadif_job_t job;
+    unsigned    i_job;     /* sequence number of the current job */
+    int         i_pending; /* worker slices not finished yet */
+    bool        b_exit;
+
+    int            i_slices;
+    yadif_worker_t p_workers[];
 };
 
-/* I am unsure it is the right one */
-typedef intptr_t x86_reg;
+static yadif_filter_line_t YadifGetFilter( void )
+{
+#if defined(HAVE_YADIF_SSSE3)
+    if( vlc_CPU() & CPU_CAPABILITY_SSSE3 )
+        return yadif_filter_line_ssse3;
+#endif
+#if defined(HAVE_YADIF_SSE2)
+    if( vlc_CPU() & CPU_CAPABILITY_SSE2 )
+        return yadif_filter_line_sse2;
+#endif
+#if defined(HAVE_YADIF_MMX2)
+    if( vlc_CPU() & CPU_CAPABILITY_MMXEXT )
+        return yadif_filter_line_mmx2;
+#endif
+#if defined(HAVE_YADIF_NEON)
+    if( vlc_CPU() & CPU_CAPABILITY_NEON )
+        return yadif_filter_line_neon;
+#endif
+    return yadif_filter_line_c;
+}
+
+/* Filters the lines of the i_slice-th of i_slices horizontal bands of each
+ * plane. The output lines only depend on the input pictures, so the slices
+ * can be filtered concurrently. */
+static void YadifSlice( const yadif_job_t *p_job, int i_slice, int i_slices )
+{
+    picture_t *p_dst = p_job->p_dst;
+    const int i_order = p_job->i_order;
+    const int i_field = p_job->i_field;
+
+    for( int n = 0; n < p_dst->i_planes; n++ )
+    {
+        const plane_t *prevp = &p_job->p_prev->p[n];
+        const plane_t *curp  = &p_job->p_cur->p[n];
+        const plane_t *nextp = &p_job->p_next->p[n];
+        plane_t *dstp        = &p_dst->p[n];
 
-#define FFABS(a) ((a) >= 0 ? (a) : (-(a)))
-#define FFMAX(a,b)      __MAX(a,b)
-#define FFMAX3(a,b,c)   FFMAX(FFMAX(a,b),c)
-#define FFMIN(a,b)      __MIN(a,b)
-#define FFMIN3(a,b,c)   FFMIN(FFMIN(a,b),c)
+        /* Lines 1 to i_visible_lines - 2 are split evenly */
+        const int i_lines = dstp->i_visible_lines - 2;
+        const int y_start = 1 + i_lines * i_slice / i_slices;
+        const int y_end   = 1 + i_lines * (i_slice + 1) / i_slices;
 
-/* yadif.h comes from vf_yadif.c of mplayer project */
-#include "yadif.h"
+        for( int y = y_start; y < y_end; y++ )
+        {
+            if( (y % 2) == i_field )
+            {
+                vlc_memcpy( &dstp->p_pixels[y * dstp->i_pitch],
+                            &curp->p_pixels[y * curp->i_pitch], dstp->i_visible_pitch );
+            }
+            else
+            {
+                struct vf_priv_s cfg;
+                /* Spatial checks only when enough data */
+                cfg.mode = (y >= 2 && y < dstp->i_visible_lines - 2) ? 0 : 2;
+
+                assert( prevp->i_pitch == curp->i_pitch && curp->i_pitch == nextp->i_pitch );
+                p_job->pf_filter( &cfg,
+                        &dstp->p_pixels[y * dstp->i_pitch],
+                        &prevp->p_pixels[y * prevp->i_pitch],
+                        &curp->p_pixels[y * curp->i_pitch],
+                        &nextp->p_pixels[y * nextp->i_pitch],
+                        dstp->i_visible_pitch,
+                        curp->i_pitch,
+                        (i_field ^ (i_order == i_field)) & 1 );
+            }
+
+            /* We duplicate the first and last lines */
+            if( y == 1 )
+                vlc_memcpy(&dstp->p_pixels[(y-1) * dstp->i_pitch], &dstp->p_pixels[y * dstp->i_pitch], dstp->i_pitch);
+            else if( y == dstp->i_visible_lines - 2 )
+                vlc_memcpy(&dstp->p_pixels[(y+1) * dstp->i_pitch], &dstp->p_pixels[y * dstp->i_pitch], dstp->i_pitch);
+        }
+    }
+
+#if defined(HAVE_YADIF_MMX2)
+    if( p_job->pf_filter == yadif_filter_line_mmx2 )
+        emms();
+#endif
+}
+
+static void *YadifWorker( void *p_data )
+{
+    yadif_worker_t *p_worker = p_data;
+    yadif_pool_t *p_pool = p_worker->p_pool;
+    unsigned i_job = 0;
+    int canc = vlc_savecancel();
+
+    vlc_mutex_lock( &p_pool->lock );
+    for( ;; )
+    {
+        while( !p_pool->b_exit && p_pool->i_job == i_job )
+            vlc_cond_wait( &p_pool->wait, &p_pool->lock );
+        if( p_pool->b_exit )
+            break;
+
+        const yadif_job_t job = p_pool->job;
+        i_job = p_pool->i_job;
+        vlc_mutex_unlock( &p_pool->lock );
+
+        YadifSlice( &job, p_worker->i_slice, p_pool->i_slices );
+
+        vlc_mutex_lock( &p_pool->lock );
+        if( --p_pool->i_pending == 0 )
+            vlc_cond_signal( &p_pool->done );
+    }
+    vlc_mutex_unlock( &p_pool->lock );
+
+    vlc_restorecancel( canc );
+    return NULL;
+}
+
+static void YadifPoolDelete( yadif_pool_t *p_pool )
+{
+    vlc_mutex_lock( &p_pool->lock );
+    p_pool->b_exit = true;
+    vlc_cond_broadcast( &p_pool->wait );
+    vlc_mutex_unlock( &p_pool->lock );
+
+    for( int i = 1; i < p_pool->i_slices; i++ )
+        vlc_join( p_pool->p_workers[i].thread, NULL );
+
+    vlc_cond_destroy( &p_pool->done );
+    vlc_cond_destroy( &p_pool->wait );
+    vlc_mutex_destroy( &p_pool->lock );
+    free( p_pool );
+}
+
+static yadif_pool_t *YadifPoolNew( vout_thread_t *p_vout, int i_slices )
+{
+    yadif_pool_t *p_pool = malloc( sizeof(*p_pool) +
+                                   i_slices * sizeof(*p_pool->p_workers) );
+    if( !p_pool )
+        return NULL;
+
+    vlc_mutex_init( &p_pool->lock );
+    vlc_cond_init( &p_pool->wait );
+    vlc_cond_init( &p_pool->done );
+    p_pool->i_job = 0;
+    p_pool->i_pending = 0;
+    p_pool->b_exit = false;
+
+    /* Slice 0 has no worker, the vout thread filters it */
+    for( p_pool->i_slices = 1; p_pool->i_slices < i_slices; p_pool->i_slices++ )
+    {
+        yadif_worker_t *p_worker = &p_pool->p_workers[p_pool->i_slices];
+
+        p_worker->p_pool = p_pool;
+        p_worker->i_slice = p_pool->i_slices;
+        if( vlc_clone( &p_worker->thread, YadifWorker, p_worker,
+                       VLC_THREAD_PRIORITY_OUTPUT ) )
+        {
+            msg_Err( p_vout, "cannot spawn yadif thread" );
+            YadifPoolDelete( p_pool );
+            return NULL;
+        }
+    }
+    msg_Dbg( p_vout, "filtering yadif slices with %d threads", i_slices );
+    return p_pool;
+}
+
+/* Filters a picture with the workers, the calling thread filtering its
+ * share. Returns when all slices are done. */
+static void YadifPoolRun( yadif_pool_t *p_pool, const yadif_job_t *p_job )
+{
+    vlc_mutex_lock( &p_pool->lock );
+    p_pool->job = *p_job;
+    p_pool->i_job++;
+    p_pool->i_pending = p_pool->i_slices - 1;
+    vlc_cond_broadcast( &p_pool->wait );
+    vlc_mutex_unlock( &p_pool->lock );
+
+    YadifSlice( p_job, 0, p_pool->i_slices );
+
+    vlc_mutex_lock( &p_pool->lock );
+    while( p_pool->i_pending > 0 )
+        vlc_cond_wait( &p_pool->done, &p_pool->lock );
+    vlc_mutex_unlock( &p_pool->lock );
+}
 
 static void RenderYadif( vout_thread_t *p_vout, picture_t *p_dst, picture_t *p_src, int i_order, int i_field )
 {
@@ -1858,53 +2069,28 @@ static void RenderYadif( vout_thread_t *p_vout, picture_t *p_dst, picture_t *p_s
     if( p_prev && p_cur && p_next )
     {
         /* */
-        void (*filter)(struct vf_priv_s *p, uint8_t *dst, uint8_t *prev, uint8_t *cur, uint8_t *next, int w, int refs, int parity);
-#if defined(HAVE_YADIF_SSE2)
-        if( vlc_CPU() & CPU_CAPABILITY_SSE2 )
-            filter = yadif_filter_line_mmx2;
-        else
-#endif
-            filter = yadif_filter_line_c;
-
-        for( int n = 0; n < p_dst->i_planes; n++ )
+        const yadif_job_t job = {
+            .pf_filter = YadifGetFilter(),
+            .p_dst  = p_dst,
+            .p_prev = p_prev,
+            .p_cur  = p_cur,
+            .p_next = p_next,
+            .i_order = i_order,
+            .i_field = i_field,
+        };
+
+        if( p_sys->i_yadif_threads > 1 && !p_sys->p_yadif_pool )
         {
-            const plane_t *prevp = &p_prev->p[n];
-            const plane_t *curp  = &p_cur->p[n];
-            const plane_t *nextp = &p_next->p[n];
-            plane_t *dstp        = &p_dst->p[n];
-
-            for( int y = 1; y < dstp->i_visible_lines - 1; y++ )
-            {
-                if( (y % 2) == i_field )
-                {
-                    vlc_memcpy( &dstp->p_pixels[y * dstp->i_pitch],
-                                &curp->p_pixels[y * curp->i_pitch], dstp->i_visible_pitch );
-                }
-                else
-                {
-                    struct vf_priv_s cfg;
-                    /* Spatial checks only when enough data */
-                    cfg.mode = (y >= 2 && y < dstp->i_visible_lines - 2) ? 0 : 2;
-
-                    assert( prevp->i_pitch == curp->i_pitch && curp->i_pitch == nextp->i_pitch );
-                    filter( &cfg,
-                            &dstp->p_pixels[y * dstp->i_pitch],
-                            &prevp->p_pixels[y * prevp->i_pitch],
-                            &curp->p_pixels[y * curp->i_pitch],
-                            &nextp->p_pixels[y * nextp->i_pitch],
-                            dstp->i_visible_pitch,
-                            curp->i_pitch,
-                            (i_field ^ (i_order == i_field)) & 1 );
-                }
-
-                /* We duplicate the first and last lines */
-                if( y == 1 )
-                    vlc_memcpy(&dstp->p_pixels[(y-1) * dstp->i_pitch], &dstp->p_pixels[y * dstp->i_pitch], dstp->i_pitch);
-                else if( y == dstp->i_visible_lines - 2 )
-                    vlc_memcpy(&dstp->p_pixels[(y+1) * dstp->i_pitch], &dstp->p_pixels[y * dstp->i_pitch], dstp->i_pitch);
-            }
+            p_sys->p_yadif_pool = YadifPoolNew( p_vout, p_sys->i_yadif_threads );
+            if( !p_sys->p_yadif_pool )
+                p_sys->i_yadif_threads = 1;
         }
 
+        if( p_sys->p_yadif_pool )
+            YadifPoolRun( p_sys->p_yadif_pool, &job );
+        else
+            YadifSlice( &job, 0, 1 );
+
         /* */
         p_dst->date = (p_next->date - p_cur->date) * i_order / 2 + p_cur->date;
     }
@@ -19,221 +19,150 @@
  */
 
 /* */
-#if defined(CAN_COMPILE_SSE2) && ((__GNUC__ > 3) || (__GNUC__ == 3 && __GNUC_MINOR__ > 0))
+struct vf_priv_s {
+    /*
+     * 0: Output 1 frame for each frame.
+     * 1: Output 1 frame for each field.
+     * 2: Like 0 but skips spatial interlacing check.
+     * 3: Like 1 but skips spatial interlacing check.
+     *
+     * In vlc, only & 0x02 has meaning, as we do the & 0x01 ourself.
+     */
+    int mode;
+};
+
+/* Filters w pixels of one line. The SIMD versions process 4 or 8 pixels per
+ * step and may write up to 7 bytes past w: callers must leave that much room
+ * (pitches are multiples of 16). */
+typedef void (*yadif_filter_line_t)(struct vf_priv_s *p, uint8_t *dst, uint8_t *prev, uint8_t *cur, uint8_t *next, int w, int refs, int parity);
+
+/* I am unsure it is the right one */
+typedef intptr_t x86_reg;
+
+#define FFABS(a) ((a) >= 0 ? (a) : (-(a)))
+#define FFMAX(a,b)      __MAX(a,b)
+#define FFMAX3(a,b,c)   FFMAX(FFMAX(a,b),c)
+#define FFMIN(a,b)      __MIN(a,b)
+#define FFMIN3(a,b,c)   FFMIN(FFMIN(a,b),c)
+
+#if (defined(CAN_COMPILE_MMXEXT) || defined(CAN_COMPILE_SSE2)) && ((__GNUC__ > 3) || (__GNUC__ == 3 && __GNUC_MINOR__ > 0))
+static const uint64_t __attribute__((aligned(16))) yadif_pw_1[2] =
+    { 0x0001000100010001ULL, 0x0001000100010001ULL };
+static const uint64_t __attribute__((aligned(16))) yadif_pb_1[2] =
+    { 0x0101010101010101ULL, 0x0101010101010101ULL };
+
+typedef struct { uint64_t q[2]; } __attribute__((aligned(16))) yadif_xmm_t;
+#endif
 
+#if defined(CAN_COMPILE_MMXEXT) && ((__GNUC__ > 3) || (__GNUC__ == 3 && __GNUC_MINOR__ > 0))
+#define HAVE_YADIF_MMX2
+#define RENAME(a) a ## _mmx2
+#include "yadif_template.h"
+#undef RENAME
+#endif
+
+#if defined(CAN_COMPILE_SSE2) && ((__GNUC__ > 3) || (__GNUC__ == 3 && __GNUC_MINOR__ > 0))
 #define HAVE_YADIF_SSE2
+#define COMPILE_TEMPLATE_SSE
+#define RENAME(a) a ## _sse2
+#include "yadif_template.h"
+#undef RENAME
+#undef COMPILE_TEMPLATE_SSE
+#endif
 
-#define LOAD4(mem,dst) \
-            "movd      "mem", "#dst" \n\t"\
-            "punpcklbw %%mm7, "#dst" \n\t"
+#if defined(CAN_COMPILE_SSSE3) && ((__GNUC__ > 3) || (__GNUC__ == 3 && __GNUC_MINOR__ > 0))
+#define HAVE_YADIF_SSSE3
+#define COMPILE_TEMPLATE_SSE
+#define COMPILE_TEMPLATE_SSSE3
+#define RENAME(a) a ## _ssse3
+#include "yadif_template.h"
+#undef RENAME
+#undef COMPILE_TEMPLATE_SSSE3
+#undef COMPILE_TEMPLATE_SSE
+#endif
 
-#define PABS(tmp,dst) \
-            "pxor     "#tmp", "#tmp" \n\t"\
-            "psubw    "#dst", "#tmp" \n\t"\
-            "pmaxsw   "#tmp", "#dst" \n\t"
+#ifdef __ARM_NEON__
+#include <arm_neon.h>
 
-#define CHECK(pj,mj) \
-            "movq "#pj"(%[cur],%[mrefs]), %%mm2 \n\t" /* cur[x-refs-1+j] */\
-            "movq "#mj"(%[cur],%[prefs]), %%mm3 \n\t" /* cur[x+refs-1-j] */\
-            "movq      %%mm2, %%mm4 \n\t"\
-            "movq      %%mm2, %%mm5 \n\t"\
-            "pxor      %%mm3, %%mm4 \n\t"\
-            "pavgb     %%mm3, %%mm5 \n\t"\
-            "pand     %[pb1], %%mm4 \n\t"\
-            "psubusb   %%mm4, %%mm5 \n\t"\
-            "psrlq     $8,    %%mm5 \n\t"\
-            "punpcklbw %%mm7, %%mm5 \n\t" /* (cur[x-refs+j] + cur[x+refs-j])>>1 */\
-            "movq      %%mm2, %%mm4 \n\t"\
-            "psubusb   %%mm3, %%mm2 \n\t"\
-            "psubusb   %%mm4, %%mm3 \n\t"\
-            "pmaxub    %%mm3, %%mm2 \n\t"\
-            "movq      %%mm2, %%mm3 \n\t"\
-            "movq      %%mm2, %%mm4 \n\t" /* ABS(cur[x-refs-1+j] - cur[x+refs-1-j]) */\
-            "psrlq      $8,   %%mm3 \n\t" /* ABS(cur[x-refs  +j] - cur[x+refs  -j]) */\
-            "psrlq     $16,   %%mm4 \n\t" /* ABS(cur[x-refs+1+j] - cur[x+refs+1-j]) */\
-            "punpcklbw %%mm7, %%mm2 \n\t"\
-            "punpcklbw %%mm7, %%mm3 \n\t"\
-            "punpcklbw %%mm7, %%mm4 \n\t"\
-            "paddw     %%mm3, %%mm2 \n\t"\
-            "paddw     %%mm4, %%mm2 \n\t" /* score */
+#define HAVE_YADIF_NEON
 
-#define CHECK1 \
-            "movq      %%mm0, %%mm3 \n\t"\
-            "pcmpgtw   %%mm2, %%mm3 \n\t" /* if(score < spatial_score) */\
-            "pminsw    %%mm2, %%mm0 \n\t" /* spatial_score= score; */\
-            "movq      %%mm3, %%mm6 \n\t"\
-            "pand      %%mm3, %%mm5 \n\t"\
-            "pandn     %%mm1, %%mm3 \n\t"\
-            "por       %%mm5, %%mm3 \n\t"\
-            "movq      %%mm3, %%mm1 \n\t" /* spatial_pred= (cur[x-refs+j] + cur[x+refs-j])>>1; */
+/* ABS(a[i] - b[i]) for 8 pixels, widened */
+static inline int16x8_t yadif_absdiff_neon(const uint8_t *a, const uint8_t *b){
+    return vreinterpretq_s16_u16(vabdl_u8(vld1_u8(a), vld1_u8(b)));
+}
 
-#define CHECK2 /* pretend not to have checked dir=2 if dir=1 was bad.\
-                  hurts both quality and speed, but matches the C version. */\
-            "paddw    %[pw1], %%mm6 \n\t"\
-            "psllw     $14,   %%mm6 \n\t"\
-            "paddsw    %%mm6, %%mm2 \n\t"\
-            "movq      %%mm0, %%mm3 \n\t"\
-            "pcmpgtw   %%mm2, %%mm3 \n\t"\
-            "pminsw    %%mm2, %%mm0 \n\t"\
-            "pand      %%mm3, %%mm5 \n\t"\
-            "pandn     %%mm1, %%mm3 \n\t"\
-            "por       %%mm5, %%mm3 \n\t"\
-            "movq      %%mm3, %%mm1 \n\t"
+/* (a[i] + b[i])>>1 for 8 pixels, widened */
+static inline int16x8_t yadif_avg_neon(const uint8_t *a, const uint8_t *b){
+    return vreinterpretq_s16_u16(vmovl_u8(vhadd_u8(vld1_u8(a), vld1_u8(b))));
+}
 
-static void yadif_filter_line_mmx2(struct vf_priv_s *p, uint8_t *dst, uint8_t *prev, uint8_t *cur, uint8_t *next, int w, int refs, int parity){
-    static const uint64_t pw_1 = 0x0001000100010001ULL;
-    static const uint64_t pb_1 = 0x0101010101010101ULL;
-    const int mode = p->mode;
-    uint64_t tmp0, tmp1, tmp2, tmp3;
+/* CHECK(j) of the C version, restricted to the lanes set in mask.
+ * Returns the lanes where the score improved. */
+static inline uint16x8_t yadif_check_neon(const uint8_t *cur, int refs, int j,
+                                          int16x8_t *spatial_score, int16x8_t *spatial_pred,
+                                          uint16x8_t mask){
+    const int16x8_t score = vaddq_s16(vaddq_s16(yadif_absdiff_neon(&cur[-refs-1+j], &cur[+refs-1-j]),
+                                                yadif_absdiff_neon(&cur[-refs  +j], &cur[+refs  -j])),
+                                      yadif_absdiff_neon(&cur[-refs+1+j], &cur[+refs+1-j]));
+    const uint16x8_t better = vandq_u16(vcltq_s16(score, *spatial_score), mask);
+
+    *spatial_score = vbslq_s16(better, score, *spatial_score);
+    *spatial_pred  = vbslq_s16(better, yadif_avg_neon(&cur[-refs+j], &cur[+refs-j]), *spatial_pred);
+    return better;
+}
+
+static void yadif_filter_line_neon(struct vf_priv_s *p, uint8_t *dst, uint8_t *prev, uint8_t *cur, uint8_t *next, int w, int refs, int parity){
+    uint8_t *prev2= parity ? prev : cur ;
+    uint8_t *next2= parity ? cur  : next;
+    const int16x8_t one = vdupq_n_s16(1);
     int x;
 
-#define FILTER\
-    for(x=0; x<w; x+=4){\
-        __asm__ volatile(\
-            "pxor      %%mm7, %%mm7 \n\t"\
-            LOAD4("(%[cur],%[mrefs])", %%mm0) /* c = cur[x-refs] */\
-            LOAD4("(%[cur],%[prefs])", %%mm1) /* e = cur[x+refs] */\
-            LOAD4("(%["prev2"])", %%mm2) /* prev2[x] */\
-            LOAD4("(%["next2"])", %%mm3) /* next2[x] */\
-            "movq      %%mm3, %%mm4 \n\t"\
-            "paddw     %%mm2, %%mm3 \n\t"\
-            "psraw     $1,    %%mm3 \n\t" /* d = (prev2[x] + next2[x])>>1 */\
-            "movq      %%mm0, %[tmp0] \n\t" /* c */\
-            "movq      %%mm3, %[tmp1] \n\t" /* d */\
-            "movq      %%mm1, %[tmp2] \n\t" /* e */\
-            "psubw     %%mm4, %%mm2 \n\t"\
-            PABS(      %%mm4, %%mm2) /* temporal_diff0 */\
-            LOAD4("(%[prev],%[mrefs])", %%mm3) /* prev[x-refs] */\
-            LOAD4("(%[prev],%[prefs])", %%mm4) /* prev[x+refs] */\
-            "psubw     %%mm0, %%mm3 \n\t"\
-            "psubw     %%mm1, %%mm4 \n\t"\
-            PABS(      %%mm5, %%mm3)\
-            PABS(      %%mm5, %%mm4)\
-            "paddw     %%mm4, %%mm3 \n\t" /* temporal_diff1 */\
-            "psrlw     $1,    %%mm2 \n\t"\
-            "psrlw     $1,    %%mm3 \n\t"\
-            "pmaxsw    %%mm3, %%mm2 \n\t"\
-            LOAD4("(%[next],%[mrefs])", %%mm3) /* next[x-refs] */\
-            LOAD4("(%[next],%[prefs])", %%mm4) /* next[x+refs] */\
-            "psubw     %%mm0, %%mm3 \n\t"\
-            "psubw     %%mm1, %%mm4 \n\t"\
-            PABS(      %%mm5, %%mm3)\
-            PABS(      %%mm5, %%mm4)\
-            "paddw     %%mm4, %%mm3 \n\t" /* temporal_diff2 */\
-            "psrlw     $1,    %%mm3 \n\t"\
-            "pmaxsw    %%mm3, %%mm2 \n\t"\
-            "movq      %%mm2, %[tmp3] \n\t" /* diff */\
-\
-            "paddw     %%mm0, %%mm1 \n\t"\
-            "paddw     %%mm0, %%mm0 \n\t"\
-            "psubw     %%mm1, %%mm0 \n\t"\
-            "psrlw     $1,    %%mm1 \n\t" /* spatial_pred */\
-            PABS(      %%mm2, %%mm0)      /* ABS(c-e) */\
-\
-            "movq -1(%[cur],%[mrefs]), %%mm2 \n\t" /* cur[x-refs-1] */\
-            "movq -1(%[cur],%[prefs]), %%mm3 \n\t" /* cur[x+refs-1] */\
-            "movq      %%mm2, %%mm4 \n\t"\
-            "psubusb   %%mm3, %%mm2 \n\t"\
-            "psubusb   %%mm4, %%mm3 \n\t"\
-            "pmaxub    %%mm3, %%mm2 \n\t"\
-            "pshufw $9,%%mm2, %%mm3 \n\t"\
-            "punpcklbw %%mm7, %%mm2 \n\t" /* ABS(cur[x-refs-1] - cur[x+refs-1]) */\
-            "punpcklbw %%mm7, %%mm3 \n\t" /* ABS(cur[x-refs+1] - cur[x+refs+1]) */\
-            "paddw     %%mm2, %%mm0 \n\t"\
-            "paddw     %%mm3, %%mm0 \n\t"\
-            "psubw    %[pw1], %%mm0 \n\t" /* spatial_score */\
-\
-            CHECK(-2,0)\
-            CHECK1\
-            CHECK(-3,1)\
-            CHECK2\
-            CHECK(0,-2)\
-            CHECK1\
-            CHECK(1,-3)\
-            CHECK2\
-\
-            /* if(p->mode<2) ... */\
-            "movq    %[tmp3], %%mm6 \n\t" /* diff */\
-            "cmpl       $2, %[mode] \n\t"\
-            "jge       1f \n\t"\
-            LOAD4("(%["prev2"],%[mrefs],2)", %%mm2) /* prev2[x-2*refs] */\
-            LOAD4("(%["next2"],%[mrefs],2)", %%mm4) /* next2[x-2*refs] */\
-            LOAD4("(%["prev2"],%[prefs],2)", %%mm3) /* prev2[x+2*refs] */\
-            LOAD4("(%["next2"],%[prefs],2)", %%mm5) /* next2[x+2*refs] */\
-            "paddw     %%mm4, %%mm2 \n\t"\
-            "paddw     %%mm5, %%mm3 \n\t"\
-            "psrlw     $1,    %%mm2 \n\t" /* b */\
-            "psrlw     $1,    %%mm3 \n\t" /* f */\
-            "movq    %[tmp0], %%mm4 \n\t" /* c */\
-            "movq    %[tmp1], %%mm5 \n\t" /* d */\
-            "movq    %[tmp2], %%mm7 \n\t" /* e */\
-            "psubw     %%mm4, %%mm2 \n\t" /* b-c */\
-            "psubw     %%mm7, %%mm3 \n\t" /* f-e */\
-            "movq      %%mm5, %%mm0 \n\t"\
-            "psubw     %%mm4, %%mm5 \n\t" /* d-c */\
-            "psubw     %%mm7, %%mm0 \n\t" /* d-e */\
-            "movq      %%mm2, %%mm4 \n\t"\
-            "pminsw    %%mm3, %%mm2 \n\t"\
-            "pmaxsw    %%mm4, %%mm3 \n\t"\
-            "pmaxsw    %%mm5, %%mm2 \n\t"\
-            "pminsw    %%mm5, %%mm3 \n\t"\
-            "pmaxsw    %%mm0, %%mm2 \n\t" /* max */\
-            "pminsw    %%mm0, %%mm3 \n\t" /* min */\
-            "pxor      %%mm4, %%mm4 \n\t"\
-            "pmaxsw    %%mm3, %%mm6 \n\t"\
-            "psubw     %%mm2, %%mm4 \n\t" /* -max */\
-            "pmaxsw    %%mm4, %%mm6 \n\t" /* diff= MAX3(diff, min, -max); */\
-            "1: \n\t"\
-\
-            "movq    %[tmp1], %%mm2 \n\t" /* d */\
-            "movq      %%mm2, %%mm3 \n\t"\
-            "psubw     %%mm6, %%mm2 \n\t" /* d-diff */\
-            "paddw     %%mm6, %%mm3 \n\t" /* d+diff */\
-            "pmaxsw    %%mm2, %%mm1 \n\t"\
-            "pminsw    %%mm3, %%mm1 \n\t" /* d = clip(spatial_pred, d-diff, d+diff); */\
-            "packuswb  %%mm1, %%mm1 \n\t"\
-\
-            :[tmp0]"=m"(tmp0),\
-             [tmp1]"=m"(tmp1),\
-             [tmp2]"=m"(tmp2),\
-             [tmp3]"=m"(tmp3)\
-            :[prev] "r"(prev),\
-             [cur]  "r"(cur),\
-             [next] "r"(next),\
-             [prefs]"r"((x86_reg)refs),\
-             [mrefs]"r"((x86_reg)-refs),\
-             [pw1]  "m"(pw_1),\
-             [pb1]  "m"(pb_1),\
-             [mode] "g"(mode)\
-        );\
-        __asm__ volatile("movd %%mm1, %0" :"=m"(*dst));\
-        dst += 4;\
-        prev+= 4;\
-        cur += 4;\
-        next+= 4;\
-    }
+    for(x=0; x<w; x+=8){
+        const int16x8_t c = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(&cur[-refs])));
+        const int16x8_t e = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(&cur[+refs])));
+        const int16x8_t d = yadif_avg_neon(prev2, next2);
+        const int16x8_t temporal_diff0 = yadif_absdiff_neon(prev2, next2);
+        const int16x8_t temporal_diff1 = vshrq_n_s16(vaddq_s16(yadif_absdiff_neon(&prev[-refs], &cur[-refs]),
+                                                               yadif_absdiff_neon(&prev[+refs], &cur[+refs])), 1);
+        const int16x8_t temporal_diff2 = vshrq_n_s16(vaddq_s16(yadif_absdiff_neon(&next[-refs], &cur[-refs]),
+                                                               yadif_absdiff_neon(&next[+refs], &cur[+refs])), 1);
+        int16x8_t diff = vmaxq_s16(vmaxq_s16(vshrq_n_s16(temporal_diff0, 1), temporal_diff1), temporal_diff2);
+        int16x8_t spatial_pred = yadif_avg_neon(&cur[-refs], &cur[+refs]);
+        int16x8_t spatial_score = vsubq_s16(vaddq_s16(vaddq_s16(yadif_absdiff_neon(&cur[-refs-1], &cur[+refs-1]),
+                                                                yadif_absdiff_neon(&cur[-refs], &cur[+refs])),
+                                                      yadif_absdiff_neon(&cur[-refs+1], &cur[+refs+1])), one);
+        uint16x8_t better;
+
+        /* dir=2 is only checked by the lanes where dir=1 was better */
+        better = yadif_check_neon(cur, refs, -1, &spatial_score, &spatial_pred, vdupq_n_u16(0xffff));
+        yadif_check_neon(cur, refs, -2, &spatial_score, &spatial_pred, better);
+        better = yadif_check_neon(cur, refs,  1, &spatial_score, &spatial_pred, vdupq_n_u16(0xffff));
+        yadif_check_neon(cur, refs,  2, &spatial_score, &spatial_pred, better);
 
-    if(parity){
-#define prev2 "prev"
-#define next2 "cur"
-        FILTER
-#undef prev2
-#undef next2
-    }else{
-#define prev2 "cur"
-#define next2 "next"
-        FILTER
-#undef prev2
-#undef next2
+        if(p->mode<2){
+            const int16x8_t b = yadif_avg_neon(&prev2[-2*refs], &next2[-2*refs]);
+            const int16x8_t f = yadif_avg_neon(&prev2[+2*refs], &next2[+2*refs]);
+            const int16x8_t dc = vsubq_s16(d, c);
+            const int16x8_t de = vsubq_s16(d, e);
+            const int16x8_t bc = vsubq_s16(b, c);
+            const int16x8_t fe = vsubq_s16(f, e);
+            const int16x8_t max = vmaxq_s16(vmaxq_s16(de, dc), vminq_s16(bc, fe));
+            const int16x8_t min = vminq_s16(vminq_s16(de, dc), vmaxq_s16(bc, fe));
+
+            diff = vmaxq_s16(vmaxq_s16(diff, min), vnegq_s16(max));
+        }
+
+        spatial_pred = vminq_s16(vmaxq_s16(spatial_pred, vsubq_s16(d, diff)), vaddq_s16(d, diff));
+        vst1_u8(dst, vqmovun_s16(spatial_pred));
+
+        dst  += 8;
+        cur  += 8;
+        prev += 8;
+        next += 8;
+        prev2+= 8;
+        next2+= 8;
     }
 }
-#undef LOAD4
-#undef PABS
-#undef CHECK
-#undef CHECK1
-#undef CHECK2
-#undef FILTER
-
 #endif
 
 static void yadif_filter_line_c(struct vf_priv_s *p, uint8_t *dst, uint8_t *prev, uint8_t *cur, uint8_t *next, int w, int refs, int parity){
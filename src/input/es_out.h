@@ -70,7 +70,7 @@ enum es_out_query_private_e
     ES_OUT_SET_RATE,                                /* arg1=int i_source_rate arg2=int i_rate                  res=can fail */
 
     /* Set a new time */
-    ES_OUT_SET_TIME,                                /* arg1=mtime_t             res=can fail */
+    ES_OUT_SET_TIME,                                /* arg1=mtime_t (-1 to reset, or a time within the timeshift buffer) res=can fail */
 
     /* Set next frame */
     ES_OUT_SET_FRAME_NEXT,                          /*                          res=can fail */
@@ -37,6 +37,13 @@
 #ifdef HAVE_SYS_STAT_H
 #   include <sys/stat.h>
 #endif
+#ifdef HAVE_UNISTD_H
+#   include <unistd.h>
+#endif
+#ifdef HAVE_MMAP
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#endif
 
 #include <vlc_common.h>
 #include <vlc_fs.h>
@@ -67,6 +74,7 @@ enum
     C_SEND,
     C_DEL,
     C_CONTROL,
+    C_NONE,     /* Already executed, nothing to replay */
 };
 
 typedef struct attribute_packed
@@ -151,23 +159,62 @@ typedef struct attribute_packed
     } u;
 } ts_cmd_t;
 
+/* Block metadata, followed by the block data in the storage file */
+typedef struct
+{
+    size_t   i_buffer;
+    uint32_t i_flags;
+    unsigned i_nb_samples;
+    int      i_rate;
+    mtime_t  i_pts;
+    mtime_t  i_dts;
+    mtime_t  i_length;
+} ts_block_header_t;
+
+#define TS_BLOCK_HEADER ((sizeof(ts_block_header_t) + 15) & ~15)
+#define TS_BLOCK_SIZE(i_buffer) (TS_BLOCK_HEADER + (((i_buffer) + 15) & ~15))
+
+/* Position where playback can resume after a seek */
+typedef struct
+{
+    int     i_cmd;      /* Command index in the storage */
+    mtime_t i_time;     /* Last input time reported before it */
+    bool    b_key;      /* Video key frame */
+} ts_index_t;
+
+/* Commands per storage */
+#define TS_STORAGE_CMD_MAX 30000
+/* Storage file growth step */
+#define TS_STORAGE_GROW (1024*1024)
+/* Exhausted storages kept for reuse */
+#define TS_STORAGE_FREE_MAX 2
+
 typedef struct ts_storage_t ts_storage_t;
 struct ts_storage_t
 {
     ts_storage_t *p_next;
 
     /* */
+#ifdef HAVE_MMAP
+    int     fd;         /* Unlinked file descriptor */
+    uint8_t *p_map;     /* Mapping of i_file_max bytes (or NULL) */
+    int64_t i_file_alloc;/* Allocated size in bytes */
+#else
     char    *psz_file;  /* Filename */
-    size_t  i_file_max; /* Max size in bytes */
-    int64_t i_file_size;/* Current size in bytes */
     FILE    *p_filew;   /* FILE handle for data writing */
     FILE    *p_filer;   /* FILE handle for data reading */
+#endif
+    size_t  i_file_max; /* Max size in bytes */
+    int64_t i_file_size;/* Current size in bytes */
 
     /* */
     int      i_cmd_r;
     int      i_cmd_w;
     int      i_cmd_max;
     ts_cmd_t *p_cmd;
+
+    /* */
+    DECL_ARRAY(ts_index_t) index;
 };
 
 typedef struct
@@ -179,6 +226,7 @@ typedef struct
     es_out_t       *p_out;
     int64_t        i_tmp_size_max;
     const char     *psz_tmp_path;
+    mtime_t        i_history;
 
     /* Lock for all following fields */
     vlc_mutex_t    lock;
@@ -197,17 +245,30 @@ typedef struct
     /* */
     mtime_t        i_buffering_delay;
 
-    /* */
+    /* Storages from the oldest one kept for seeking back (p_storage_h) to
+     * the one being written, through the one being read */
+    ts_storage_t   *p_storage_h;
     ts_storage_t   *p_storage_r;
     ts_storage_t   *p_storage_w;
 
+    /* exhausted storages ready for reuse */
+    ts_storage_t   *p_storage_free;
+    int            i_storage_free;
+
     mtime_t        i_cmd_delay;
 
+    /* */
+    mtime_t        i_index_time;    /* Last input time pushed */
+    bool           b_index_keyed;   /* Key frame indexed since then */
+    bool           b_index_key;     /* The stream flags its key frames */
+    mtime_t        i_seek_time;     /* Pending seek (or -1) */
+
 } ts_thread_t;
 
 struct es_out_id_t
 {
     es_out_id_t *p_es;
+    int         i_cat;
 };
 
 struct es_out_sys_t
@@ -218,6 +279,7 @@ struct es_out_sys_t
     /* Configuration */
     int64_t        i_tmp_size_max;    /* Maximal temporary file size in byte */
     char           *psz_tmp_path;     /* Path for temporary files */
+    mtime_t        i_history;         /* Played content kept for seeking */
 
     /* Lock for all following fields */
     vlc_mutex_t    lock;
@@ -253,18 +315,37 @@ static bool         TsHasCmd( ts_thread_t * );
 static bool         TsIsUnused( ts_thread_t * );
 static int          TsChangePause( ts_thread_t *, bool b_source_paused, bool b_paused, mtime_t i_date );
 static int          TsChangeRate( ts_thread_t *, int i_src_rate, int i_rate );
+static int          TsChangeTime( ts_thread_t *, mtime_t i_time );
+static int          TsSeekLocked( ts_thread_t *, mtime_t i_time, ts_cmd_t **, int * );
+static void         TsRestartLocked( ts_thread_t * );
+static void         TsHistoryTrim( ts_thread_t *, mtime_t i_date );
+static void         TsHistoryCut( ts_thread_t * );
+
+static void         TsIndexUpdate( ts_thread_t *, const ts_cmd_t * );
+static int          TsIndexFind( ts_thread_t *, mtime_t i_time, ts_storage_t **, int *pi_cmd );
 
 static void         *TsRun( vlc_object_t * );
 
 static ts_storage_t *TsStorageNew( const char *psz_path, int64_t i_tmp_size_max );
 static void         TsStorageDelete( ts_storage_t * );
+static ts_storage_t *TsStorageGet( ts_thread_t * );
+static void         TsStorageRecycle( ts_thread_t *, ts_storage_t * );
+static void         TsStorageClean( ts_storage_t * );
 static void         TsStoragePack( ts_storage_t *p_storage );
 static bool         TsStorageIsFull( ts_storage_t *, const ts_cmd_t *p_cmd );
 static bool         TsStorageIsEmpty( ts_storage_t * );
 static void         TsStoragePushCmd( ts_storage_t *, const ts_cmd_t *p_cmd, bool b_flush );
 static void         TsStoragePopCmd( ts_storage_t *p_storage, ts_cmd_t *p_cmd, bool b_flush );
 
+static int          TsStorageOpen( ts_storage_t *, const char *psz_tmp_path );
+static void         TsStorageClose( ts_storage_t * );
+static void         TsStorageSeal( ts_storage_t *, bool b_read );
+static void         TsStorageReset( ts_storage_t * );
+static int          TsStorageWrite( ts_storage_t *, const block_t *, bool b_flush );
+static block_t      *TsStorageRead( ts_storage_t *, int i_offset );
+
 static void CmdClean( ts_cmd_t * );
+static void CmdExecute( es_out_t *, ts_cmd_t * );
 static void cmd_cleanup_routine( void *p ) { CmdClean( p ); }
 
 static int  CmdInitAdd    ( ts_cmd_t *, es_out_id_t *, const es_format_t *, bool b_copy );
@@ -285,7 +366,10 @@ static int  CmdExecuteControl( es_out_t *, ts_cmd_t * );
 
 /* File helpers */
 static char *GetTmpPath( char *psz_path );
+static int GetTmpFd( char **ppsz_file, const char *psz_path );
+#ifndef HAVE_MMAP
 static FILE *GetTmpFile( char **ppsz_file, const char *psz_path );
+#endif
 
 /*****************************************************************************
  * input_EsOutTimeshiftNew:
@@ -339,6 +423,9 @@ es_out_t *input_EsOutTimeshiftNew( input_thread_t *p_input, es_out_t *p_next_out
     p_sys->psz_tmp_path = GetTmpPath( psz_tmp_path );
     msg_Dbg( p_input, "using timeshift path '%s'", p_sys->psz_tmp_path );
 
+    p_sys->i_history = __MAX( var_CreateGetInteger( p_input, "input-timeshift-history" ), 0 )
+                           * INT64_C(1000000);
+
 #if 0
 #define S(t) msg_Err( p_input, "SIZEOF("#t")=%d", sizeof(t) )
     S(ts_cmd_t);
@@ -388,6 +475,7 @@ static es_out_id_t *Add( es_out_t *p_out, const es_format_t *p_fmt )
 
     TsAutoStop( p_out );
 
+    p_es->i_cat = p_fmt->i_cat;
     if( CmdInitAdd( &cmd, p_es, p_fmt, p_sys->b_delayed ) )
     {
         vlc_mutex_unlock( &p_sys->lock );
@@ -560,7 +648,15 @@ static int ControlLockedSetTime( es_out_t *p_out, mtime_t i_date )
     es_out_sys_t *p_sys = p_out->p_sys;
 
     if( !p_sys->b_delayed )
+    {
+        /* Nothing buffered to seek into */
+        if( i_date >= 0 )
+            return VLC_EGENERIC;
         return es_out_SetTime( p_sys->p_out, i_date );
+    }
+
+    if( i_date >= 0 )
+        return TsChangeTime( p_sys->p_thread, i_date );
 
     /* TODO */
     msg_Err( p_sys->p_input, "EsOutTimeshift does not yet support time change" );
@@ -746,6 +842,7 @@ static int TsStart( es_out_t *p_out )
 
     p_ts->i_tmp_size_max = p_sys->i_tmp_size_max;
     p_ts->psz_tmp_path = p_sys->psz_tmp_path;
+    p_ts->i_history = p_sys->i_history;
     p_ts->p_input = p_sys->p_input;
     p_ts->p_out = p_sys->p_out;
     vlc_mutex_init( &p_ts->lock );
@@ -758,8 +855,15 @@ static int TsStart( es_out_t *p_out )
     p_ts->i_rate_delay = 0;
     p_ts->i_buffering_delay = 0;
     p_ts->i_cmd_delay = 0;
+    p_ts->p_storage_h = NULL;
     p_ts->p_storage_r = NULL;
     p_ts->p_storage_w = NULL;
+    p_ts->p_storage_free = NULL;
+    p_ts->i_storage_free = 0;
+    p_ts->i_index_time = -1;
+    p_ts->b_index_keyed = false;
+    p_ts->b_index_key = false;
+    p_ts->i_seek_time = -1;
 
     vlc_object_set_destructor( p_ts, TsDestructor );
 
@@ -795,18 +899,15 @@ static void TsStop( ts_thread_t *p_ts )
     vlc_thread_join( p_ts );
 
     vlc_mutex_lock( &p_ts->lock );
-    for( ;; )
+    while( p_ts->p_storage_h )
     {
-        ts_cmd_t cmd;
-
-        if( TsPopCmdLocked( p_ts, &cmd, true ) )
-            break;
+        ts_storage_t *p_next = p_ts->p_storage_h->p_next;
 
-        CmdClean( &cmd );
+        TsStorageDelete( p_ts->p_storage_h );
+        p_ts->p_storage_h = p_next;
     }
-    assert( !p_ts->p_storage_r || !p_ts->p_storage_r->p_next );
-    if( p_ts->p_storage_r )
-        TsStorageDelete( p_ts->p_storage_r );
+    while( p_ts->p_storage_free )
+        TsStorageDelete( TsStorageGet( p_ts ) );
     vlc_mutex_unlock( &p_ts->lock );
 
     vlc_object_release( p_ts );
@@ -817,7 +918,7 @@ static void TsPushCmd( ts_thread_t *p_ts, ts_cmd_t *p_cmd )
 
     if( !p_ts->p_storage_w || TsStorageIsFull( p_ts->p_storage_w, p_cmd ) )
     {
-        ts_storage_t *p_storage = TsStorageNew( p_ts->psz_tmp_path, p_ts->i_tmp_size_max );
+        ts_storage_t *p_storage = TsStorageGet( p_ts );
 
         if( !p_storage )
         {
@@ -829,16 +930,20 @@ static void TsPushCmd( ts_thread_t *p_ts, ts_cmd_t *p_cmd )
 
         if( !p_ts->p_storage_w )
         {
-            p_ts->p_storage_r = p_ts->p_storage_w = p_storage;
+            p_ts->p_storage_h = p_ts->p_storage_r = p_ts->p_storage_w = p_storage;
         }
         else
         {
             TsStoragePack( p_ts->p_storage_w );
+            TsStorageSeal( p_ts->p_storage_w,
+                           p_ts->p_storage_w == p_ts->p_storage_r );
             p_ts->p_storage_w->p_next = p_storage;
             p_ts->p_storage_w = p_storage;
         }
     }
 
+    TsIndexUpdate( p_ts, p_cmd );
+
     /* TODO return error and warn the user (but only once) */
     TsStoragePushCmd( p_ts->p_storage_w, p_cmd, p_ts->p_storage_r == p_ts->p_storage_w );
 
@@ -861,10 +966,17 @@ static int TsPopCmdLocked( ts_thread_t *p_ts, ts_cmd_t *p_cmd, bool b_flush )
         if( !p_next )
             break;
 
-        TsStorageDelete( p_ts->p_storage_r );
+        /* Keep it as history */
+        TsStorageSeal( p_ts->p_storage_r, false );
         p_ts->p_storage_r = p_next;
     }
 
+    /* Commands before an ES deletion cannot be replayed */
+    if( p_cmd->i_type == C_DEL )
+        TsHistoryCut( p_ts );
+    else
+        TsHistoryTrim( p_ts, p_cmd->i_date );
+
     return VLC_SUCCESS;
 }
 static bool TsHasCmd( ts_thread_t *p_ts )
@@ -939,6 +1051,216 @@ static int TsChangeRate( ts_thread_t *p_ts, int i_src_rate, int i_rate )
     return i_ret;
 }
 
+static int TsChangeTime( ts_thread_t *p_ts, mtime_t i_time )
+{
+    ts_storage_t *p_storage;
+    int i_cmd;
+    int i_ret;
+
+    vlc_mutex_lock( &p_ts->lock );
+
+    /* The seek itself is done by the timeshift thread, between two commands */
+    i_ret = TsIndexFind( p_ts, i_time, &p_storage, &i_cmd );
+    if( !i_ret )
+    {
+        p_ts->i_seek_time = i_time;
+        vlc_cond_signal( &p_ts->wait );
+    }
+    vlc_mutex_unlock( &p_ts->lock );
+
+    return i_ret;
+}
+/* Moves the read position to i_time. The commands skipped when moving
+ * forward are returned in *pp_skip, to be executed without the lock, before
+ * the decoders are reset and TsRestartLocked() is called. */
+static int TsSeekLocked( ts_thread_t *p_ts, mtime_t i_time,
+                         ts_cmd_t **pp_skip, int *pi_skip )
+{
+    ts_storage_t *p_target;
+    int i_target;
+    bool b_backward;
+
+    vlc_assert_locked( &p_ts->lock );
+
+    *pp_skip = NULL;
+    *pi_skip = 0;
+
+    if( TsIndexFind( p_ts, i_time, &p_target, &i_target ) )
+        return VLC_EGENERIC;
+
+    if( p_target == p_ts->p_storage_r )
+    {
+        b_backward = i_target < p_target->i_cmd_r;
+    }
+    else
+    {
+        b_backward = false;
+        for( ts_storage_t *p = p_ts->p_storage_h; p != p_ts->p_storage_r; p = p->p_next )
+        {
+            if( p == p_target )
+                b_backward = true;
+        }
+    }
+
+    if( b_backward )
+    {
+        /* Everything from the target up to the current position is
+         * played again (the commands that cannot be were neutralized) */
+        ts_storage_t *p_old = p_ts->p_storage_r;
+
+        for( ts_storage_t *p = p_target->p_next; p != p_old->p_next; p = p->p_next )
+            p->i_cmd_r = 0;
+        p_target->i_cmd_r = i_target;
+        p_ts->p_storage_r = p_target;
+
+        if( p_old != p_target && p_old != p_ts->p_storage_w )
+            TsStorageSeal( p_old, false );
+    }
+    else
+    {
+        /* Skip the data up to the target, but keep the es_out state */
+        int i_skip_max = 0;
+
+        while( p_ts->p_storage_r != p_target || p_target->i_cmd_r < i_target )
+        {
+            if( *pi_skip >= i_skip_max )
+            {
+                const int i_max = __MAX( 64, 2 * i_skip_max );
+                ts_cmd_t *p_skip = realloc( *pp_skip, i_max * sizeof(*p_skip) );
+                if( !p_skip )
+                    break; /* resume a bit before the target */
+                *pp_skip = p_skip;
+                i_skip_max = i_max;
+            }
+            if( TsPopCmdLocked( p_ts, &(*pp_skip)[*pi_skip], true ) )
+                break;
+            (*pi_skip)++;
+        }
+    }
+    return VLC_SUCCESS;
+}
+/* Restarts the clock from the read position, after a seek */
+static void TsRestartLocked( ts_thread_t *p_ts )
+{
+    vlc_assert_locked( &p_ts->lock );
+
+    const mtime_t i_now = mdate();
+    if( !TsStorageIsEmpty( p_ts->p_storage_r ) )
+        p_ts->i_cmd_delay = i_now - p_ts->p_storage_r->p_cmd[p_ts->p_storage_r->i_cmd_r].i_date;
+    p_ts->i_rate_date = -1;
+    p_ts->i_rate_delay = 0;
+    p_ts->i_buffering_delay = 0;
+    if( p_ts->b_paused )
+        p_ts->i_pause_date = i_now;
+}
+static void TsHistoryTrim( ts_thread_t *p_ts, mtime_t i_date )
+{
+    vlc_assert_locked( &p_ts->lock );
+
+    while( p_ts->p_storage_h != p_ts->p_storage_r )
+    {
+        ts_storage_t *p_storage = p_ts->p_storage_h;
+
+        assert( p_storage->i_cmd_w > 0 );
+        if( p_storage->p_cmd[p_storage->i_cmd_w-1].i_date + p_ts->i_history >= i_date )
+            break;
+
+        p_ts->p_storage_h = p_storage->p_next;
+        p_storage->p_next = NULL;
+        TsStorageRecycle( p_ts, p_storage );
+    }
+}
+static void TsHistoryCut( ts_thread_t *p_ts )
+{
+    ts_storage_t *p_storage = p_ts->p_storage_r;
+
+    vlc_assert_locked( &p_ts->lock );
+
+    TsHistoryTrim( p_ts, INT64_MAX );
+
+    while( p_storage->index.i_size > 0 &&
+           p_storage->index.p_elems[0].i_cmd < p_storage->i_cmd_r )
+        ARRAY_REMOVE( p_storage->index, 0 );
+}
+
+static void TsIndexUpdate( ts_thread_t *p_ts, const ts_cmd_t *p_cmd )
+{
+    ts_storage_t *p_storage = p_ts->p_storage_w;
+    ts_index_t index;
+
+    vlc_assert_locked( &p_ts->lock );
+
+    if( p_cmd->i_type == C_CONTROL &&
+        p_cmd->u.control.i_query == ES_OUT_SET_TIMES )
+    {
+        const mtime_t i_time = p_cmd->u.control.u.times.i_time;
+
+        if( i_time == p_ts->i_index_time )
+            return;
+
+        /* The input has moved on: the position is a seek point */
+        p_ts->i_index_time = i_time;
+        p_ts->b_index_keyed = false;
+        index.b_key = false;
+    }
+    else if( p_cmd->i_type == C_SEND &&
+             p_cmd->u.send.p_es->i_cat == VIDEO_ES &&
+             ( p_cmd->u.send.p_block->i_flags & BLOCK_FLAG_TYPE_I ) )
+    {
+        if( p_ts->i_index_time < 0 || p_ts->b_index_keyed )
+            return;
+
+        /* First key frame since the last time update */
+        p_ts->b_index_keyed = true;
+        p_ts->b_index_key = true;
+        index.b_key = true;
+    }
+    else
+    {
+        return;
+    }
+    index.i_cmd = p_storage->i_cmd_w;
+    index.i_time = p_ts->i_index_time;
+
+    ARRAY_APPEND( p_storage->index, index );
+}
+static int TsIndexFind( ts_thread_t *p_ts, mtime_t i_time,
+                        ts_storage_t **pp_storage, int *pi_cmd )
+{
+    ts_storage_t *p_found = NULL;
+    int i_found = -1;
+
+    vlc_assert_locked( &p_ts->lock );
+
+    /* Look for the last seek point before i_time; when the stream flags
+     * its key frames, only those are used */
+    for( ts_storage_t *p = p_ts->p_storage_h; p != NULL; p = p->p_next )
+    {
+        for( int i = 0; i < p->index.i_size; i++ )
+        {
+            const ts_index_t *p_index = &p->index.p_elems[i];
+
+            if( p_index->i_time > i_time )
+            {
+                if( !p_found )
+                    continue;
+
+                *pp_storage = p_found;
+                *pi_cmd = i_found;
+                return VLC_SUCCESS;
+            }
+            if( p_index->b_key || !p_ts->b_index_key )
+            {
+                p_found = p;
+                i_found = p_index->i_cmd;
+            }
+        }
+    }
+
+    /* i_time is not within the buffered window */
+    return VLC_EGENERIC;
+}
+
 static void *TsRun( vlc_object_t *p_thread )
 {
     ts_thread_t *p_ts = (ts_thread_t*)p_thread;
@@ -957,6 +1279,36 @@ static void *TsRun( vlc_object_t *p_thread )
         for( ;; )
         {
             const int canc = vlc_savecancel();
+            if( p_ts->i_seek_time >= 0 )
+            {
+                const mtime_t i_seek_time = p_ts->i_seek_time;
+                ts_cmd_t *p_skip;
+                int i_skip;
+
+                p_ts->i_seek_time = -1;
+                if( TsSeekLocked( p_ts, i_seek_time, &p_skip, &i_skip ) )
+                {
+                    msg_Warn( p_ts->p_input, "es out timeshift: cannot seek to %"PRId64,
+                              i_seek_time );
+                }
+                else
+                {
+                    /* The es_out is not called with our lock held (the
+                     * cancellation is disabled, the cleanup handler
+                     * cannot run meanwhile) */
+                    vlc_mutex_unlock( &p_ts->lock );
+                    for( int i = 0; i < i_skip; i++ )
+                        CmdExecute( p_ts->p_out, &p_skip[i] );
+                    free( p_skip );
+
+                    /* Reset the decoders, and restart from now on */
+                    es_out_SetTime( p_ts->p_out, -1 );
+                    vlc_mutex_lock( &p_ts->lock );
+
+                    TsRestartLocked( p_ts );
+                    i_buffering_date = -1;
+                }
+            }
             b_buffering = es_out_GetBuffering( p_ts->p_out );
 
             if( ( !p_ts->b_paused || b_buffering ) && !TsPopCmdLocked( p_ts, &cmd, false ) )
@@ -1030,27 +1382,7 @@ static void *TsRun( vlc_object_t *p_thread )
 
         /* Execute the command  */
         const int canc = vlc_savecancel();
-        switch( cmd.i_type )
-        {
-        case C_ADD:
-            CmdExecuteAdd( p_ts->p_out, &cmd );
-            CmdCleanAdd( &cmd );
-            break;
-        case C_SEND:
-            CmdExecuteSend( p_ts->p_out, &cmd );
-            CmdCleanSend( &cmd );
-            break;
-        case C_CONTROL:
-            CmdExecuteControl( p_ts->p_out, &cmd );
-            CmdCleanControl( &cmd );
-            break;
-        case C_DEL:
-            CmdExecuteDel( p_ts->p_out, &cmd );
-            break;
-        default:
-            assert(0);
-            break;
-        }
+        CmdExecute( p_ts->p_out, &cmd );
         vlc_restorecancel( canc );
     }
 
@@ -1068,22 +1400,25 @@ static ts_storage_t *TsStorageNew( const char *psz_tmp_path, int64_t i_tmp_size_
 
     /* */
     p_storage->p_next = NULL;
+#ifdef HAVE_MMAP
+    p_storage->fd = -1;
+    p_storage->p_map = NULL;
+    p_storage->i_file_alloc = 0;
+#endif
 
     /* */
     p_storage->i_file_max = i_tmp_size_max;
     p_storage->i_file_size = 0;
-    p_storage->p_filew = GetTmpFile( &p_storage->psz_file, psz_tmp_path );
-    if( p_storage->psz_file )
-        p_storage->p_filer = vlc_fopen( p_storage->psz_file, "rb" );
 
     /* */
     p_storage->i_cmd_w = 0;
     p_storage->i_cmd_r = 0;
-    p_storage->i_cmd_max = 30000;
+    p_storage->i_cmd_max = TS_STORAGE_CMD_MAX;
     p_storage->p_cmd = malloc( p_storage->i_cmd_max * sizeof(*p_storage->p_cmd) );
+    ARRAY_INIT( p_storage->index );
     //fprintf( stderr, "\nSTORAGE name=%s size=%d KiB\n", p_storage->psz_file, p_storage->i_cmd_max * sizeof(*p_storage->p_cmd) /1024 );
 
-    if( !p_storage->p_cmd || !p_storage->p_filew || !p_storage->p_filer )
+    if( TsStorageOpen( p_storage, psz_tmp_path ) || !p_storage->p_cmd )
     {
         TsStorageDelete( p_storage );
         return NULL;
@@ -1092,28 +1427,64 @@ static ts_storage_t *TsStorageNew( const char *psz_tmp_path, int64_t i_tmp_size_
 }
 static void TsStorageDelete( ts_storage_t *p_storage )
 {
-    while( p_storage->i_cmd_r < p_storage->i_cmd_w )
-    {
-        ts_cmd_t cmd;
+    if( p_storage->p_cmd )
+        TsStorageClean( p_storage );
+    free( p_storage->p_cmd );
+    p_storage->p_cmd = NULL;
+    ARRAY_RESET( p_storage->index );
 
-        TsStoragePopCmd( p_storage, &cmd, true );
+    TsStorageClose( p_storage );
+    free( p_storage );
+}
+static ts_storage_t *TsStorageGet( ts_thread_t *p_ts )
+{
+    ts_storage_t *p_storage = p_ts->p_storage_free;
 
-        CmdClean( &cmd );
-    }
-    free( p_storage->p_cmd );
+    if( !p_storage )
+        return TsStorageNew( p_ts->psz_tmp_path, p_ts->i_tmp_size_max );
 
-    if( p_storage->p_filer )
-        fclose( p_storage->p_filer );
-    if( p_storage->p_filew )
-        fclose( p_storage->p_filew );
+    p_ts->p_storage_free = p_storage->p_next;
+    p_ts->i_storage_free--;
+    p_storage->p_next = NULL;
+    return p_storage;
+}
+static void TsStorageRecycle( ts_thread_t *p_ts, ts_storage_t *p_storage )
+{
+    assert( TsStorageIsEmpty( p_storage ) );
+    assert( !p_storage->p_next );
 
-    if( p_storage->psz_file )
+    /* Reuse the file (and its mapping) */
+    if( p_ts->i_storage_free >= TS_STORAGE_FREE_MAX )
     {
-        vlc_unlink( p_storage->psz_file );
-        free( p_storage->psz_file );
+        TsStorageDelete( p_storage );
+        return;
     }
 
-    free( p_storage );
+    /* Undo TsStoragePack() */
+    if( p_storage->i_cmd_max < TS_STORAGE_CMD_MAX )
+    {
+        ts_cmd_t *p_new = realloc( p_storage->p_cmd, TS_STORAGE_CMD_MAX * sizeof(*p_storage->p_cmd) );
+        if( p_new )
+        {
+            p_storage->p_cmd = p_new;
+            p_storage->i_cmd_max = TS_STORAGE_CMD_MAX;
+        }
+    }
+    TsStorageClean( p_storage );
+    p_storage->i_cmd_r = 0;
+    p_storage->i_cmd_w = 0;
+    p_storage->index.i_size = 0;
+    TsStorageReset( p_storage );
+
+    p_storage->p_next = p_ts->p_storage_free;
+    p_ts->p_storage_free = p_storage;
+    p_ts->i_storage_free++;
+}
+static void TsStorageClean( ts_storage_t *p_storage )
+{
+    /* Played commands are kept (in their replayable form) until then */
+    for( int i = 0; i < p_storage->i_cmd_w; i++ )
+        CmdClean( &p_storage->p_cmd[i] );
 }
 static void TsStoragePack( ts_storage_t *p_storage )
 {
@@ -1131,7 +1502,7 @@ static bool TsStorageIsFull( ts_storage_t *p_storage, const ts_cmd_t *p_cmd )
 {
     if( p_cmd && p_cmd->i_type == C_SEND && p_storage->i_cmd_w > 0 )
     {
-        size_t i_size = sizeof(*p_cmd->u.send.p_block) + p_cmd->u.send.p_block->i_buffer;
+        size_t i_size = TS_BLOCK_SIZE( p_cmd->u.send.p_block->i_buffer );
 
         if( p_storage->i_file_size + i_size >= p_storage->i_file_max )
             return true;
@@ -1152,28 +1523,13 @@ static void TsStoragePushCmd( ts_storage_t *p_storage, const ts_cmd_t *p_cmd, bo
     {
         block_t *p_block = cmd.u.send.p_block;
 
-        cmd.u.send.p_block = NULL;
-        cmd.u.send.i_offset = ftell( p_storage->p_filew );
-
-        if( fwrite( p_block, sizeof(*p_block), 1, p_storage->p_filew ) != 1 )
+        cmd.u.send.i_offset = TsStorageWrite( p_storage, p_block, b_flush );
+        if( cmd.u.send.i_offset >= 0 )
         {
+            cmd.u.send.p_block = NULL;
             block_Release( p_block );
-            return;
-        }
-        p_storage->i_file_size += sizeof(*p_block);
-        if( p_block->i_buffer > 0 )
-        {
-            if( fwrite( p_block->p_buffer, p_block->i_buffer, 1, p_storage->p_filew ) != 1 )
-            {
-                block_Release( p_block );
-                return;
-            }
         }
-        p_storage->i_file_size += p_block->i_buffer;
-        block_Release( p_block );
-
-        if( b_flush )
-            fflush( p_storage->p_filew );
+        /* else the block is kept in memory */
     }
     p_storage->p_cmd[p_storage->i_cmd_w++] = cmd;
 }
@@ -1181,35 +1537,273 @@ static void TsStoragePopCmd( ts_storage_t *p_storage, ts_cmd_t *p_cmd, bool b_fl
 {
     assert( !TsStorageIsEmpty( p_storage ) );
 
-    *p_cmd = p_storage->p_cmd[p_storage->i_cmd_r++];
-    if( p_cmd->i_type == C_SEND )
+    /* The command stays in the storage so that it can be replayed after a
+     * seek back: the caller gets its own copy */
+    ts_cmd_t *p_stored = &p_storage->p_cmd[p_storage->i_cmd_r++];
+
+    *p_cmd = *p_stored;
+    switch( p_stored->i_type )
     {
-        block_t block;
+    case C_SEND:
+    {
+        block_t *p_block = NULL;
 
-        if( !b_flush &&
-            !fseek( p_storage->p_filer, p_cmd->u.send.i_offset, SEEK_SET ) &&
-            fread( &block, sizeof(block), 1, p_storage->p_filer ) == 1 )
+        if( !b_flush )
         {
-            block_t *p_block = block_Alloc( block.i_buffer );
-            if( p_block )
+            if( p_stored->u.send.p_block )
+                p_block = block_Duplicate( p_stored->u.send.p_block );
+            else
+                p_block = TsStorageRead( p_storage, p_stored->u.send.i_offset );
+            if( !p_block )
             {
-                p_block->i_dts      = block.i_dts;
-                p_block->i_pts      = block.i_pts;
-                p_block->i_flags    = block.i_flags;
-                p_block->i_length   = block.i_length;
-                p_block->i_rate     = block.i_rate;
-                p_block->i_nb_samples = block.i_nb_samples;
-                p_block->i_buffer = fread( p_block->p_buffer, 1, block.i_buffer, p_storage->p_filer );
+                //fprintf( stderr, "TsStoragePopCmd: %m\n" );
+                p_block = block_Alloc( 1 );
             }
-            p_cmd->u.send.p_block = p_block;
         }
-        else
+        p_cmd->u.send.p_block = p_block;
+        break;
+    }
+    case C_CONTROL:
+        switch( p_stored->u.control.i_query )
         {
-            //fprintf( stderr, "TsStoragePopCmd: %m\n" );
-            p_cmd->u.send.p_block = block_Alloc( 1 );
+        /* Timing controls are needed to play the content again */
+        case ES_OUT_SET_PCR:
+        case ES_OUT_SET_GROUP_PCR:
+        case ES_OUT_RESET_PCR:
+        case ES_OUT_SET_NEXT_DISPLAY_TIME:
+        case ES_OUT_SET_TIMES:
+        case ES_OUT_SET_JITTER:
+            break;
+        default:
+            p_stored->i_type = C_NONE;
+            break;
         }
+        break;
+    case C_ADD:
+    case C_DEL:
+        /* Only executed once, the ownership goes to the caller */
+        p_stored->i_type = C_NONE;
+        break;
+    }
+}
+
+#ifdef HAVE_MMAP
+static int  TsStorageMap( ts_storage_t * );
+static void TsStorageUnmap( ts_storage_t * );
+static int  TsStorageGrow( ts_storage_t *, int64_t i_size );
+
+/* The data of a storage lives in a memory-mapped and already unlinked
+ * temporary file, which grows as it is written. Blocks are written to and
+ * read from the mapping with a single copy. */
+static int TsStorageOpen( ts_storage_t *p_storage, const char *psz_tmp_path )
+{
+    char *psz_file;
+
+    p_storage->fd = GetTmpFd( &psz_file, psz_tmp_path );
+    if( psz_file )
+    {
+        vlc_unlink( psz_file );
+        free( psz_file );
     }
+    if( p_storage->fd < 0 )
+        return VLC_EGENERIC;
+
+    return TsStorageMap( p_storage );
+}
+static void TsStorageClose( ts_storage_t *p_storage )
+{
+    TsStorageUnmap( p_storage );
+    if( p_storage->fd >= 0 )
+        close( p_storage->fd );
+}
+static int TsStorageMap( ts_storage_t *p_storage )
+{
+    void *p_map;
+
+    if( p_storage->p_map )
+        return VLC_SUCCESS;
+
+    p_map = mmap( NULL, p_storage->i_file_max, PROT_READ|PROT_WRITE,
+                  MAP_SHARED, p_storage->fd, 0 );
+    if( p_map == MAP_FAILED )
+        return VLC_EGENERIC;
+    p_storage->p_map = p_map;
+    return VLC_SUCCESS;
 }
+static void TsStorageUnmap( ts_storage_t *p_storage )
+{
+    if( !p_storage->p_map )
+        return;
+    munmap( p_storage->p_map, p_storage->i_file_max );
+    p_storage->p_map = NULL;
+}
+static int TsStorageGrow( ts_storage_t *p_storage, int64_t i_size )
+{
+    int64_t i_alloc;
+
+    if( i_size <= p_storage->i_file_alloc )
+        return VLC_SUCCESS;
+
+    i_alloc = __MAX( i_size, p_storage->i_file_alloc + TS_STORAGE_GROW );
+    i_alloc = __MIN( i_alloc, (int64_t)p_storage->i_file_max );
+
+    /* The mapping covers i_file_max bytes, but only the allocated part of
+     * the file may be touched. The new part is reserved on the disk:
+     * writing to a sparse mapping of a full file system raises SIGBUS */
+#if defined(_POSIX_ADVISORY_INFO) && (_POSIX_ADVISORY_INFO > 0)
+    if( posix_fallocate( p_storage->fd, p_storage->i_file_alloc,
+                         i_alloc - p_storage->i_file_alloc ) )
+#else
+    if( ftruncate( p_storage->fd, i_alloc ) )
+#endif
+        return VLC_EGENERIC;
+
+    p_storage->i_file_alloc = i_alloc;
+    return VLC_SUCCESS;
+}
+static void TsStorageSeal( ts_storage_t *p_storage, bool b_read )
+{
+    /* Only keep the storages being read and written mapped, so that long
+     * timeshifts fit in the address space */
+    if( !b_read )
+        TsStorageUnmap( p_storage );
+}
+static void TsStorageReset( ts_storage_t *p_storage )
+{
+    p_storage->i_file_size = 0;
+}
+static int TsStorageWrite( ts_storage_t *p_storage, const block_t *p_block, bool b_flush )
+{
+    const int i_offset = p_storage->i_file_size;
+    ts_block_header_t *p_header;
+
+    VLC_UNUSED( b_flush ); /* the mapping is shared with the reader */
+
+    if( i_offset + TS_BLOCK_SIZE( p_block->i_buffer ) > p_storage->i_file_max ||
+        TsStorageGrow( p_storage, i_offset + TS_BLOCK_SIZE( p_block->i_buffer ) ) ||
+        TsStorageMap( p_storage ) )
+        return -1;
+
+    p_header = (ts_block_header_t *)&p_storage->p_map[i_offset];
+    p_header->i_buffer     = p_block->i_buffer;
+    p_header->i_flags      = p_block->i_flags;
+    p_header->i_pts        = p_block->i_pts;
+    p_header->i_dts        = p_block->i_dts;
+    p_header->i_length     = p_block->i_length;
+    p_header->i_nb_samples = p_block->i_nb_samples;
+    p_header->i_rate       = p_block->i_rate;
+    memcpy( &p_storage->p_map[i_offset + TS_BLOCK_HEADER], p_block->p_buffer,
+            p_block->i_buffer );
+
+    p_storage->i_file_size += TS_BLOCK_SIZE( p_block->i_buffer );
+    return i_offset;
+}
+static block_t *TsStorageRead( ts_storage_t *p_storage, int i_offset )
+{
+    const ts_block_header_t *p_header;
+    block_t *p_block;
+
+    if( TsStorageMap( p_storage ) )
+        return NULL;
+
+    /* The data is copied out of the mapping: decoders may modify their
+     * blocks, and read past their end (block_Alloc() pads them) */
+    p_header = (const ts_block_header_t *)&p_storage->p_map[i_offset];
+    p_block = block_Alloc( p_header->i_buffer );
+    if( p_block )
+    {
+        p_block->i_dts      = p_header->i_dts;
+        p_block->i_pts      = p_header->i_pts;
+        p_block->i_flags    = p_header->i_flags;
+        p_block->i_length   = p_header->i_length;
+        p_block->i_rate     = p_header->i_rate;
+        p_block->i_nb_samples = p_header->i_nb_samples;
+        memcpy( p_block->p_buffer, &p_storage->p_map[i_offset + TS_BLOCK_HEADER],
+                p_header->i_buffer );
+    }
+    return p_block;
+}
+#else
+static int TsStorageOpen( ts_storage_t *p_storage, const char *psz_tmp_path )
+{
+    p_storage->p_filew = GetTmpFile( &p_storage->psz_file, psz_tmp_path );
+    if( p_storage->psz_file )
+        p_storage->p_filer = vlc_fopen( p_storage->psz_file, "rb" );
+
+    if( !p_storage->p_filew || !p_storage->p_filer )
+        return VLC_EGENERIC;
+    return VLC_SUCCESS;
+}
+static void TsStorageClose( ts_storage_t *p_storage )
+{
+    if( p_storage->p_filer )
+        fclose( p_storage->p_filer );
+    if( p_storage->p_filew )
+        fclose( p_storage->p_filew );
+
+    if( p_storage->psz_file )
+    {
+        vlc_unlink( p_storage->psz_file );
+        free( p_storage->psz_file );
+    }
+}
+static void TsStorageSeal( ts_storage_t *p_storage, bool b_read )
+{
+    VLC_UNUSED( b_read );
+    fflush( p_storage->p_filew );
+}
+static void TsStorageReset( ts_storage_t *p_storage )
+{
+    p_storage->i_file_size = 0;
+    rewind( p_storage->p_filew );
+}
+static int TsStorageWrite( ts_storage_t *p_storage, const block_t *p_block, bool b_flush )
+{
+    const int i_offset = ftell( p_storage->p_filew );
+    ts_block_header_t header;
+
+    header.i_buffer     = p_block->i_buffer;
+    header.i_flags      = p_block->i_flags;
+    header.i_pts        = p_block->i_pts;
+    header.i_dts        = p_block->i_dts;
+    header.i_length     = p_block->i_length;
+    header.i_nb_samples = p_block->i_nb_samples;
+    header.i_rate       = p_block->i_rate;
+
+    if( fwrite( &header, sizeof(header), 1, p_storage->p_filew ) != 1 )
+        return -1;
+    if( p_block->i_buffer > 0 &&
+        fwrite( p_block->p_buffer, p_block->i_buffer, 1, p_storage->p_filew ) != 1 )
+        return -1;
+    p_storage->i_file_size += TS_BLOCK_SIZE( p_block->i_buffer );
+
+    if( b_flush )
+        fflush( p_storage->p_filew );
+    return i_offset;
+}
+static block_t *TsStorageRead( ts_storage_t *p_storage, int i_offset )
+{
+    ts_block_header_t header;
+    block_t *p_block;
+
+    if( fseek( p_storage->p_filer, i_offset, SEEK_SET ) ||
+        fread( &header, sizeof(header), 1, p_storage->p_filer ) != 1 )
+        return NULL;
+
+    p_block = block_Alloc( header.i_buffer );
+    if( p_block )
+    {
+        p_block->i_dts      = header.i_dts;
+        p_block->i_pts      = header.i_pts;
+        p_block->i_flags    = header.i_flags;
+        p_block->i_length   = header.i_length;
+        p_block->i_rate     = header.i_rate;
+        p_block->i_nb_samples = header.i_nb_samples;
+        p_block->i_buffer = fread( p_block->p_buffer, 1, header.i_buffer, p_storage->p_filer );
+    }
+    return p_block;
+}
+#endif
 
 /*****************************************************************************
  *
@@ -1228,6 +1822,33 @@ static void CmdClean( ts_cmd_t *p_cmd )
         CmdCleanControl( p_cmd );
         break;
     case C_DEL:
+    case C_NONE:
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+static void CmdExecute( es_out_t *p_out, ts_cmd_t *p_cmd )
+{
+    switch( p_cmd->i_type )
+    {
+    case C_ADD:
+        CmdExecuteAdd( p_out, p_cmd );
+        CmdCleanAdd( p_cmd );
+        break;
+    case C_SEND:
+        CmdExecuteSend( p_out, p_cmd );
+        CmdCleanSend( p_cmd );
+        break;
+    case C_CONTROL:
+        CmdExecuteControl( p_out, p_cmd );
+        CmdCleanControl( p_cmd );
+        break;
+    case C_DEL:
+        CmdExecuteDel( p_out, p_cmd );
+        break;
+    case C_NONE:
         break;
     default:
         assert(0);
@@ -1591,21 +2212,27 @@ static char *GetTmpPath( char *psz_path )
     return psz_path;
 }
 
-static FILE *GetTmpFile( char **ppsz_file, const char *psz_path )
+static int GetTmpFd( char **ppsz_file, const char *psz_path )
 {
     char *psz_name;
-    int fd;
-    FILE *f;
 
     /* */
     *ppsz_file = NULL;
     if( asprintf( &psz_name, "%s/vlc-timeshift.XXXXXX", psz_path ) < 0 )
-        return NULL;
+        return -1;
 
     /* */
-    fd = vlc_mkstemp( psz_name );
     *ppsz_file = psz_name;
+    return vlc_mkstemp( psz_name );
+}
+
+#ifndef HAVE_MMAP
+static FILE *GetTmpFile( char **ppsz_file, const char *psz_path )
+{
+    int fd;
+    FILE *f;
 
+    fd = GetTmpFd( ppsz_file, psz_path );
     if( fd < 0 )
         return NULL;
 
@@ -1616,4 +2243,4 @@ static FILE *GetTmpFile( char **ppsz_file, const char *psz_path )
 
     return f;
 }
-
+#endif
@@ -795,8 +795,9 @@ static void MainLoop( input_thread_t *p_input, bool b_interactive )
 
                 /* We will postpone the execution of a seek until we have
                  * finished the ES bufferisation (postpone is limited to
-                 * 125ms) */
-                bool b_buffering = es_out_GetBuffering( p_input->p->p_es_out ) &&
+                 * 125ms). The timeshift always claims to be buffering, so
+                 * look at the decoders themselves. */
+                bool b_buffering = es_out_GetBuffering( p_input->p->p_es_out_display ) &&
                                    !p_input->p->input.b_eof;
                 if( b_buffering )
                 {
@@ -1725,6 +1726,13 @@ static bool Control( input_thread_t *p_input,
             if( i_time < 0 )
                 i_time = 0;
 
+            /* Seek within the timeshift buffer without touching the access */
+            if( !es_out_SetTime( p_input->p->p_es_out, i_time ) )
+            {
+                b_force_update = true;
+                break;
+            }
+
             /* Reset the decoders states and clock sync (before calling the demuxer */
             es_out_SetTime( p_input->p->p_es_out, -1 );
 
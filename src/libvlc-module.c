@@ -797,6 +797,12 @@ static const char *const ppsz_clock_descriptions[] =
     "This is the maximum size in bytes of the temporary files " \
     "that will be used to store the timeshifted streams." )
 
+#define INPUT_TIMESHIFT_HISTORY_TEXT N_("Timeshift history")
+#define INPUT_TIMESHIFT_HISTORY_LONGTEXT N_( \
+    "Duration (in seconds) of already played content kept in the " \
+    "timeshift buffer, so that it is possible to seek back into it. " \
+    "0 disables it." )
+
 // DEPRECATED
 #define SUB_CAT_LONGTEXT N_( \
     "These options allow you to modify the behavior of the subpictures " \
@@ -883,6 +889,12 @@ static const char *const ppsz_clock_descriptions[] =
 #define TIMEOUT_LONGTEXT N_( \
     "Default TCP connection timeout (in milliseconds). " )
 
+#define HTTP_THREADS_TEXT N_("HTTP server threads")
+#define HTTP_THREADS_LONGTEXT N_( \
+    "Number of threads serving the clients of each HTTP server. " \
+    "More threads help with many concurrent connections (only " \
+    "supported on Linux)." )
+
 #define SOCKS_SERVER_TEXT N_("SOCKS server")
 #define SOCKS_SERVER_LONGTEXT N_( \
     "SOCKS proxy server to use. This must be of the form " \
@@ -1883,6 +1895,9 @@ vlc_module_begin ()
         change_short('4')
     add_integer( "ipv4-timeout", 5 * 1000, NULL, TIMEOUT_TEXT,
                  TIMEOUT_LONGTEXT, true )
+    add_integer( "http-threads", 1, NULL, HTTP_THREADS_TEXT,
+                 HTTP_THREADS_LONGTEXT, true )
+        change_integer_range( 1, 64 )
 
     set_section( N_( "Socks proxy") , NULL )
     add_string( "socks", NULL, NULL,
@@ -1942,6 +1957,8 @@ vlc_module_begin ()
                 INPUT_TIMESHIFT_PATH_LONGTEXT, true )
     add_integer( "input-timeshift-granularity", -1, NULL, INPUT_TIMESHIFT_GRANULARITY_TEXT,
                  INPUT_TIMESHIFT_GRANULARITY_LONGTEXT, true )
+    add_integer( "input-timeshift-history", 0, NULL, INPUT_TIMESHIFT_HISTORY_TEXT,
+                 INPUT_TIMESHIFT_HISTORY_LONGTEXT, true )
 
 /* Decoder options */
     add_category_hint( N_("Decoders"), CODEC_CAT_LONGTEXT , true )
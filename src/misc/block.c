@@ -45,6 +45,7 @@ struct block_sys_t
 {
     block_t     self;
     size_t      i_allocated_buffer;
+    unsigned    i_class; /**< pool size class, or BLOCK_POOL_NONE */
     uint8_t     p_allocated_buffer[];
 };
 
@@ -73,9 +74,281 @@ void block_Init( block_t *restrict b, void *buf, size_t size )
 #endif
 }
 
+/**
+ * @section Block pool
+ *
+ * Heap blocks of BLOCK_POOL_MIN to BLOCK_POOL_MAX bytes (allocation included)
+ * are rounded up to a power of two size class and recycled rather than
+ * freed. Smaller blocks stay on malloc(), whose own per-thread cache is
+ * faster for them. Each thread keeps a small free list per class, so that
+ * most allocations do not take any lock. When a thread list overflows
+ * (typically the decoder thread releasing what the input thread allocated),
+ * half of it moves to a global list, where the other threads refill theirs
+ * from. Beyond BLOCK_POOL_GLOBAL bytes, released blocks are freed. The lists
+ * of a thread are freed when it exits, and the global lists when the last
+ * thread using the pool exits.
+ */
+#define BLOCK_POOL_SMALL    2048 /* at most this goes to malloc() */
+#define BLOCK_POOL_MIN      4096
+#define BLOCK_POOL_CLASSES  5 /* 4 kB to 64 kB */
+#define BLOCK_POOL_MAX      (BLOCK_POOL_MIN << (BLOCK_POOL_CLASSES - 1))
+#define BLOCK_POOL_NONE     BLOCK_POOL_CLASSES
+/* Maximum bytes per class and per thread */
+#define BLOCK_POOL_LOCAL    (128 * 1024)
+/* Maximum bytes per thread */
+#define BLOCK_POOL_THREAD   (512 * 1024)
+/* Maximum bytes in the global lists */
+#define BLOCK_POOL_GLOBAL   (4 * 1024 * 1024)
+
+typedef struct block_cache_t block_cache_t;
+
+/** Per-thread free lists */
+struct block_cache_t
+{
+    block_t       *p_list[BLOCK_POOL_CLASSES];
+    unsigned       i_count[BLOCK_POOL_CLASSES];
+    size_t         i_cached;
+    block_cache_t *p_next; /**< in the global registry */
+};
+
+static struct
+{
+    vlc_mutex_t    lock;
+    block_t       *p_list[BLOCK_POOL_CLASSES];
+    unsigned       i_count[BLOCK_POOL_CLASSES];
+    size_t         i_cached;
+    block_cache_t *p_caches;
+    vlc_threadvar_t key;
+    volatile bool  b_key;
+} pool = { .lock = VLC_STATIC_MUTEX, };
+
+static inline size_t BlockClassSize( unsigned i_class )
+{
+    return BLOCK_POOL_MIN << i_class;
+}
+
+static unsigned BlockClass( size_t i_alloc )
+{
+    unsigned i_class = 0;
+
+    if( i_alloc <= BLOCK_POOL_SMALL || i_alloc > BLOCK_POOL_MAX )
+        return BLOCK_POOL_NONE;
+    while( BlockClassSize( i_class ) < i_alloc )
+        i_class++;
+    return i_class;
+}
+
+static inline unsigned BlockLocalMax( unsigned i_class )
+{
+    unsigned i_max = BLOCK_POOL_LOCAL / BlockClassSize( i_class );
+    return (i_max < 4) ? 4 : i_max;
+}
+
+static void BlockListFree( block_t *p_list )
+{
+    while( p_list != NULL )
+    {
+        block_t *p_next = p_list->p_next;
+
+        free( p_list );
+        p_list = p_next;
+    }
+}
+
+/* Must be called with the pool lock held */
+static void BlockPoolPutLocked( block_t *p_list, unsigned i_class,
+                                unsigned i_count )
+{
+    const size_t i_size = BlockClassSize( i_class );
+
+    while( p_list != NULL )
+    {
+        block_t *p_next = p_list->p_next;
+
+        if( pool.i_cached + i_size <= BLOCK_POOL_GLOBAL )
+        {
+            p_list->p_next = pool.p_list[i_class];
+            pool.p_list[i_class] = p_list;
+            pool.i_count[i_class]++;
+            pool.i_cached += i_size;
+        }
+        else
+            free( p_list );
+        p_list = p_next;
+        i_count--;
+    }
+    assert( i_count == 0 );
+}
+
+static void BlockCacheDestroy( void *data )
+{
+    block_cache_t *p_cache = data;
+
+    for( unsigned i = 0; i < BLOCK_POOL_CLASSES; i++ )
+        BlockListFree( p_cache->p_list[i] );
+
+    vlc_mutex_lock( &pool.lock );
+    for( block_cache_t **pp = &pool.p_caches; *pp != NULL; pp = &(*pp)->p_next )
+        if( *pp == p_cache )
+        {
+            *pp = p_cache->p_next;
+            break;
+        }
+    if( pool.p_caches == NULL )
+    {   /* Nobody left to reuse the global lists */
+        for( unsigned i = 0; i < BLOCK_POOL_CLASSES; i++ )
+        {
+            BlockListFree( pool.p_list[i] );
+            pool.p_list[i] = NULL;
+            pool.i_count[i] = 0;
+        }
+        pool.i_cached = 0;
+    }
+    vlc_mutex_unlock( &pool.lock );
+    free( p_cache );
+}
+
+/**
+ * Gets the free lists of the calling thread, creating them if needed.
+ * @return NULL on error (the global lists are used directly then).
+ */
+static block_cache_t *BlockCacheGet( void )
+{
+    block_cache_t *p_cache;
+
+    if( unlikely(!pool.b_key) )
+    {
+        vlc_mutex_lock( &pool.lock );
+        if( !pool.b_key )
+            pool.b_key = !vlc_threadvar_create( &pool.key, BlockCacheDestroy );
+        vlc_mutex_unlock( &pool.lock );
+        if( !pool.b_key )
+            return NULL;
+    }
+    else
+        barrier();
+
+    p_cache = vlc_threadvar_get( pool.key );
+    if( likely(p_cache != NULL) )
+        return p_cache;
+
+    p_cache = calloc( 1, sizeof( *p_cache ) );
+    if( p_cache == NULL )
+        return NULL;
+    if( vlc_threadvar_set( pool.key, p_cache ) )
+    {
+        free( p_cache );
+        return NULL;
+    }
+    vlc_mutex_lock( &pool.lock );
+    p_cache->p_next = pool.p_caches;
+    pool.p_caches = p_cache;
+    vlc_mutex_unlock( &pool.lock );
+    return p_cache;
+}
+
+static block_sys_t *BlockPoolGet( unsigned i_class )
+{
+    block_cache_t *p_cache = BlockCacheGet();
+    const size_t i_size = BlockClassSize( i_class );
+    block_t *p_block;
+
+    if( p_cache != NULL )
+    {
+        if( p_cache->p_list[i_class] == NULL && pool.i_count[i_class] > 0 )
+        {   /* Refill half of the local list from the global one */
+            unsigned i_batch = BlockLocalMax( i_class ) / 2;
+
+            vlc_mutex_lock( &pool.lock );
+            while( i_batch-- > 0 && (p_block = pool.p_list[i_class]) != NULL )
+            {
+                pool.p_list[i_class] = p_block->p_next;
+                pool.i_count[i_class]--;
+                pool.i_cached -= i_size;
+                p_block->p_next = p_cache->p_list[i_class];
+                p_cache->p_list[i_class] = p_block;
+                p_cache->i_count[i_class]++;
+                p_cache->i_cached += i_size;
+            }
+            vlc_mutex_unlock( &pool.lock );
+        }
+
+        p_block = p_cache->p_list[i_class];
+        if( p_block != NULL )
+        {
+            p_cache->p_list[i_class] = p_block->p_next;
+            p_cache->i_count[i_class]--;
+            p_cache->i_cached -= i_size;
+        }
+    }
+    else
+    {
+        vlc_mutex_lock( &pool.lock );
+        p_block = pool.p_list[i_class];
+        if( p_block != NULL )
+        {
+            pool.p_list[i_class] = p_block->p_next;
+            pool.i_count[i_class]--;
+            pool.i_cached -= i_size;
+        }
+        vlc_mutex_unlock( &pool.lock );
+    }
+
+    if( p_block == NULL )
+        return malloc( i_size );
+    return (block_sys_t *)p_block;
+}
+
+static void BlockPoolPut( block_sys_t *p_sys )
+{
+    const unsigned i_class = p_sys->i_class;
+    block_cache_t *p_cache = BlockCacheGet();
+    block_t *p_block = &p_sys->self;
+
+    if( p_cache == NULL )
+    {
+        p_block->p_next = NULL;
+        vlc_mutex_lock( &pool.lock );
+        BlockPoolPutLocked( p_block, i_class, 1 );
+        vlc_mutex_unlock( &pool.lock );
+        return;
+    }
+
+    p_block->p_next = p_cache->p_list[i_class];
+    p_cache->p_list[i_class] = p_block;
+    p_cache->i_count[i_class]++;
+    p_cache->i_cached += BlockClassSize( i_class );
+
+    if( p_cache->i_count[i_class] > BlockLocalMax( i_class )
+     || p_cache->i_cached > BLOCK_POOL_THREAD )
+    {   /* Move half of the local list to the global one */
+        unsigned i_batch = p_cache->i_count[i_class] / 2;
+        if( i_batch == 0 )
+            return;
+
+        block_t *p_list = p_cache->p_list[i_class], **pp = &p_list;
+
+        for( unsigned i = 0; i < i_batch; i++ )
+            pp = &(*pp)->p_next;
+        p_cache->p_list[i_class] = *pp;
+        *pp = NULL;
+        p_cache->i_count[i_class] -= i_batch;
+        p_cache->i_cached -= i_batch * BlockClassSize( i_class );
+
+        vlc_mutex_lock( &pool.lock );
+        BlockPoolPutLocked( p_list, i_class, i_batch );
+        vlc_mutex_unlock( &pool.lock );
+    }
+}
+
 static void BlockRelease( block_t *p_block )
 {
-    free( p_block );
+    block_sys_t *p_sys = (block_sys_t *)p_block;
+
+    if( p_sys->i_class != BLOCK_POOL_NONE )
+        BlockPoolPut( p_sys );
+    else
+        free( p_sys );
 }
 
 static void BlockMetaCopy( block_t *restrict out, const block_t *in )
@@ -98,8 +371,7 @@ static void BlockMetaCopy( block_t *restrict out, const block_t *in )
 
 block_t *block_Alloc( size_t i_size )
 {
-    /* We do only one malloc
-     * TODO: bench if doing 2 malloc but keeping a pool of buffer is better
+    /* We do only one malloc, and recycle small ones (see block pool)
      * 2 * BLOCK_PADDING -> pre + post padding
      */
     block_sys_t *p_sys;
@@ -120,11 +392,22 @@ block_t *block_Alloc( size_t i_size )
     buf = p_sys->p_allocated_buffer + (-sizeof(*p_sys) & (BLOCK_ALIGN - 1));
 
 #else
-    const size_t i_alloc = sizeof(*p_sys) + BLOCK_ALIGN + (2 * BLOCK_PADDING)
-                         + ALIGN(i_size);
-    p_sys = malloc( i_alloc );
+    size_t i_alloc = sizeof(*p_sys) + BLOCK_ALIGN + (2 * BLOCK_PADDING)
+                   + ALIGN(i_size);
+    if( unlikely(i_alloc < i_size) )
+        return NULL;
+
+    const unsigned i_class = BlockClass( i_alloc );
+    if( i_class != BLOCK_POOL_NONE )
+    {
+        i_alloc = BlockClassSize( i_class );
+        p_sys = BlockPoolGet( i_class );
+    }
+    else
+        p_sys = malloc( i_alloc );
     if( p_sys == NULL )
         return NULL;
+    p_sys->i_class = i_class;
 
     buf = (void *)ALIGN((uintptr_t)p_sys->p_allocated_buffer);
 
@@ -464,22 +747,203 @@ block_t *block_File (int fd)
  * @section Thread-safe block queue functions
  */
 
+/* Atomic operations on the queue tail and counters */
+#if defined (__GCC_HAVE_SYNC_COMPARE_AND_SWAP_4) \
+ && ((SIZE_MAX == UINT32_MAX) || defined (__GCC_HAVE_SYNC_COMPARE_AND_SWAP_8))
+# define FIFO_ATOMIC 1
+#endif
+
 /**
  * Internal state for block queues
+ *
+ * Writers never take the lock: a block chain is appended by atomically
+ * swapping the tail pointer then linking the previous tail to it (intrusive
+ * multiple-producers single-consumer queue). The queue always holds at least
+ * one element, hence the stub block. Readers are serialized by the lock, and
+ * are only signaled when one of them actually sleeps.
+ *
+ * Writers account for their blocks before publishing them, so the counters
+ * never go below the linked blocks, whichever writer a reader sees first.
+ * A reader may thus see blocks that are not linked yet (see FifoPopWait).
  */
 struct block_fifo_t
 {
-    vlc_mutex_t         lock;                         /* fifo data lock */
+    vlc_mutex_t         lock;      /**< Serializes readers */
     vlc_cond_t          wait;      /**< Wait for data */
     vlc_cond_t          wait_room; /**< Wait for queue depth to shrink */
 
-    block_t             *p_first;
-    block_t             **pp_last;
-    size_t              i_depth;
-    size_t              i_size;
-    bool          b_force_wake;
+    block_t             *p_first;  /**< Head (readers only) */
+    block_t * volatile  p_last;    /**< Tail (writers only) */
+    block_t             stub;
+
+    volatile size_t     i_depth;
+    volatile size_t     i_size;
+    volatile size_t     i_waiting; /**< Readers sleeping on wait */
+    unsigned            i_pacing;  /**< Threads sleeping on wait_room */
+    bool                b_force_wake;
+#ifndef FIFO_ATOMIC
+    vlc_spinlock_t      atomic;
+#endif
 };
 
+#define FIFO_NEXT(b) (*(block_t * volatile *)&(b)->p_next)
+
+static block_t *FifoSwapLast (block_fifo_t *fifo, block_t *last)
+{
+    block_t *prev;
+#ifdef FIFO_ATOMIC
+    do
+        prev = fifo->p_last;
+    while (!__sync_bool_compare_and_swap (&fifo->p_last, prev, last));
+#else
+    vlc_spin_lock (&fifo->atomic);
+    prev = fifo->p_last;
+    fifo->p_last = last;
+    vlc_spin_unlock (&fifo->atomic);
+#endif
+    return prev;
+}
+
+static size_t FifoAdd (block_fifo_t *fifo, volatile size_t *p, size_t v)
+{
+#ifdef FIFO_ATOMIC
+    (void) fifo;
+    return __sync_add_and_fetch (p, v);
+#else
+    size_t ret;
+
+    vlc_spin_lock (&fifo->atomic);
+    ret = (*p += v);
+    vlc_spin_unlock (&fifo->atomic);
+    return ret;
+#endif
+}
+
+static size_t FifoSub (block_fifo_t *fifo, volatile size_t *p, size_t v)
+{
+#ifdef FIFO_ATOMIC
+    (void) fifo;
+    return __sync_sub_and_fetch (p, v);
+#else
+    size_t ret;
+
+    vlc_spin_lock (&fifo->atomic);
+    ret = (*p -= v);
+    vlc_spin_unlock (&fifo->atomic);
+    return ret;
+#endif
+}
+
+/* Full barrier read */
+#define FifoLoad(fifo, p) FifoAdd (fifo, p, 0)
+
+/**
+ * Appends a chain of blocks (last->p_next must be NULL). Lock-less.
+ */
+static void FifoPush (block_fifo_t *fifo, block_t *first, block_t *last)
+{
+    block_t *prev = FifoSwapLast (fifo, last);
+    /* Readers cannot get past prev until this is stored. */
+    FIFO_NEXT(prev) = first;
+}
+
+/**
+ * Removes the head block, without any accounting.
+ * Must be called with the lock held.
+ * @return the block, or NULL if the queue is empty or a writer is in the
+ * middle of FifoPush().
+ */
+static block_t *FifoPop (block_fifo_t *fifo)
+{
+    block_t *first = fifo->p_first;
+    block_t *next = FIFO_NEXT(first);
+
+    if (first == &fifo->stub)
+    {
+        if (next == NULL)
+            return NULL;
+        fifo->p_first = first = next;
+        next = FIFO_NEXT(first);
+    }
+
+    if (next == NULL)
+    {
+        if (first != fifo->p_last)
+            return NULL; /* being linked */
+
+        /* Re-queue the stub so that first can be removed */
+        fifo->stub.p_next = NULL;
+        FifoPush (fifo, &fifo->stub, &fifo->stub);
+        next = FIFO_NEXT(first);
+        if (next == NULL)
+            return NULL;
+    }
+
+    fifo->p_first = next;
+    first->p_next = NULL;
+    return first;
+}
+
+/**
+ * Waits while a writer has accounted for its blocks but not linked them yet.
+ * Must be called with the lock held. Writers link their blocks in a few
+ * instructions, so this only sleeps if one got preempted right in the middle
+ * of block_FifoPut(); it will signal us once its blocks are linked.
+ */
+#define FifoWaitLink(fifo, cond) \
+    do { \
+        int canc = vlc_savecancel (); \
+        FifoAdd (fifo, &(fifo)->i_waiting, 1); \
+        while (cond) \
+            vlc_cond_wait (&(fifo)->wait, &(fifo)->lock); \
+        FifoSub (fifo, &(fifo)->i_waiting, 1); \
+        vlc_restorecancel (canc); \
+    } while (0)
+
+/**
+ * Removes the head block, knowing that the queue is not empty.
+ * Must be called with the lock held.
+ */
+static block_t *FifoPopWait (block_fifo_t *fifo)
+{
+    block_t *b = FifoPop (fifo);
+
+    if (unlikely(b == NULL))
+        FifoWaitLink (fifo, (b = FifoPop (fifo)) == NULL);
+
+    FifoSub (fifo, &fifo->i_size, b->i_buffer);
+    FifoSub (fifo, &fifo->i_depth, 1);
+    return b;
+}
+
+static void FifoCleanupWait (void *data)
+{
+    block_fifo_t *fifo = data;
+
+    FifoSub (fifo, &fifo->i_waiting, 1);
+    vlc_mutex_unlock (&fifo->lock);
+}
+
+/**
+ * Waits for data. Must be called with the lock held.
+ * This is a cancellation point, the lock is released if cancelled.
+ */
+static void FifoWait (block_fifo_t *fifo, bool wakeable)
+{
+    /* The writer increments i_depth then reads i_waiting; we increment
+     * i_waiting then read i_depth, so either we see the block, or the writer
+     * sees us (and signals after we went to sleep, as it needs the lock). */
+    FifoAdd (fifo, &fifo->i_waiting, 1);
+    vlc_cleanup_push (FifoCleanupWait, fifo);
+    /* Remember vlc_cond_wait() may cause spurious wakeups
+     * (on both Win32 and POSIX) */
+    while (FifoLoad (fifo, &fifo->i_depth) == 0
+        && !(wakeable && fifo->b_force_wake))
+        vlc_cond_wait (&fifo->wait, &fifo->lock);
+    vlc_cleanup_pop ();
+    FifoSub (fifo, &fifo->i_waiting, 1);
+}
+
 block_fifo_t *block_FifoNew( void )
 {
     block_fifo_t *p_fifo = malloc( sizeof( block_fifo_t ) );
@@ -489,10 +953,17 @@ block_fifo_t *block_FifoNew( void )
     vlc_mutex_init( &p_fifo->lock );
     vlc_cond_init( &p_fifo->wait );
     vlc_cond_init( &p_fifo->wait_room );
-    p_fifo->p_first = NULL;
-    p_fifo->pp_last = &p_fifo->p_first;
+    p_fifo->stub.p_next = NULL;
+    p_fifo->stub.i_buffer = 0;
+    p_fifo->p_first = &p_fifo->stub;
+    p_fifo->p_last = &p_fifo->stub;
     p_fifo->i_depth = p_fifo->i_size = 0;
+    p_fifo->i_waiting = 0;
+    p_fifo->i_pacing = 0;
     p_fifo->b_force_wake = false;
+#ifndef FIFO_ATOMIC
+    vlc_spin_init( &p_fifo->atomic );
+#endif
 
     return p_fifo;
 }
@@ -500,35 +971,41 @@ block_fifo_t *block_FifoNew( void )
 void block_FifoRelease( block_fifo_t *p_fifo )
 {
     block_FifoEmpty( p_fifo );
+#ifndef FIFO_ATOMIC
+    vlc_spin_destroy( &p_fifo->atomic );
+#endif
     vlc_cond_destroy( &p_fifo->wait_room );
     vlc_cond_destroy( &p_fifo->wait );
     vlc_mutex_destroy( &p_fifo->lock );
     free( p_fifo );
 }
 
+/**
+ * Releases the blocks queued at the time of the call. Blocks queued
+ * concurrently by other threads may or may not be released.
+ */
 void block_FifoEmpty( block_fifo_t *p_fifo )
 {
-    block_t *block;
+    block_t *block = NULL, **pp_last = &block;
 
     vlc_mutex_lock( &p_fifo->lock );
-    block = p_fifo->p_first;
-    if (block != NULL)
+    for( size_t i = FifoLoad( p_fifo, &p_fifo->i_depth ); i > 0; i-- )
     {
-        p_fifo->i_depth = p_fifo->i_size = 0;
-        p_fifo->p_first = NULL;
-        p_fifo->pp_last = &p_fifo->p_first;
+        *pp_last = FifoPopWait( p_fifo );
+        pp_last = &(*pp_last)->p_next;
     }
     vlc_cond_broadcast( &p_fifo->wait_room );
     vlc_mutex_unlock( &p_fifo->lock );
 
-    while (block != NULL)
-    {
-        block_t *buf;
+    block_ChainRelease( block );
+}
 
-        buf = block->p_next;
-        block_Release (block);
-        block = buf;
-    }
+static void FifoCleanupPace (void *data)
+{
+    block_fifo_t *fifo = data;
+
+    fifo->i_pacing--;
+    vlc_mutex_unlock (&fifo->lock);
 }
 
 /**
@@ -552,18 +1029,22 @@ void block_FifoPace (block_fifo_t *fifo, size_t max_depth, size_t max_size)
 {
     vlc_testcancel ();
 
+    if ((FifoLoad (fifo, &fifo->i_depth) <= max_depth)
+     && (FifoLoad (fifo, &fifo->i_size) <= max_size))
+        return; /* fast path, no need to lock */
+
     vlc_mutex_lock (&fifo->lock);
-    while ((fifo->i_depth > max_depth) || (fifo->i_size > max_size))
-    {
-         mutex_cleanup_push (&fifo->lock);
-         vlc_cond_wait (&fifo->wait_room, &fifo->lock);
-         vlc_cleanup_pop ();
-    }
-    vlc_mutex_unlock (&fifo->lock);
+    fifo->i_pacing++;
+    vlc_cleanup_push (FifoCleanupPace, fifo);
+    while ((FifoLoad (fifo, &fifo->i_depth) > max_depth)
+        || (FifoLoad (fifo, &fifo->i_size) > max_size))
+        vlc_cond_wait (&fifo->wait_room, &fifo->lock);
+    vlc_cleanup_run ();
 }
 
 /**
  * Immediately queue one block at the end of a FIFO.
+ * This function does not lock the FIFO unless a reader is waiting.
  * @param fifo queue
  * @param block head of a block list to queue (may be NULL)
  * @return total number of bytes appended to the queue
@@ -583,14 +1064,21 @@ size_t block_FifoPut( block_fifo_t *p_fifo, block_t *p_block )
             break;
     }
 
-    vlc_mutex_lock (&p_fifo->lock);
-    *p_fifo->pp_last = p_block;
-    p_fifo->pp_last = &p_last->p_next;
-    p_fifo->i_depth += i_depth;
-    p_fifo->i_size += i_size;
-    /* We queued at least one block: wake up one read-waiting thread */
-    vlc_cond_signal( &p_fifo->wait );
-    vlc_mutex_unlock( &p_fifo->lock );
+    /* Account first: a reader must never remove a block that is not
+     * counted yet, or the counters would wrap around. */
+    FifoAdd (p_fifo, &p_fifo->i_size, i_size);
+    FifoAdd (p_fifo, &p_fifo->i_depth, i_depth);
+    FifoPush (p_fifo, p_block, p_last);
+
+    /* We queued at least one block: wake up read-waiting threads. One of
+     * them may be waiting for this very push to complete (see FifoWaitLink),
+     * so signaling just one thread would not do. */
+    if (FifoLoad (p_fifo, &p_fifo->i_waiting) > 0)
+    {
+        vlc_mutex_lock (&p_fifo->lock);
+        vlc_cond_broadcast( &p_fifo->wait );
+        vlc_mutex_unlock (&p_fifo->lock);
+    }
 
     return i_size;
 }
@@ -598,7 +1086,7 @@ size_t block_FifoPut( block_fifo_t *p_fifo, block_t *p_block )
 void block_FifoWake( block_fifo_t *p_fifo )
 {
     vlc_mutex_lock( &p_fifo->lock );
-    if( p_fifo->p_first == NULL )
+    if( FifoLoad( p_fifo, &p_fifo->i_depth ) == 0 )
         p_fifo->b_force_wake = true;
     vlc_cond_broadcast( &p_fifo->wait );
     vlc_mutex_unlock( &p_fifo->lock );
@@ -617,38 +1105,24 @@ block_t *block_FifoGet( block_fifo_t *p_fifo )
     vlc_testcancel( );
 
     vlc_mutex_lock( &p_fifo->lock );
-    mutex_cleanup_push( &p_fifo->lock );
-
-    /* Remember vlc_cond_wait() may cause spurious wakeups
-     * (on both Win32 and POSIX) */
-    while( ( p_fifo->p_first == NULL ) && !p_fifo->b_force_wake )
-        vlc_cond_wait( &p_fifo->wait, &p_fifo->lock );
-
-    vlc_cleanup_pop();
-    b = p_fifo->p_first;
+    if( FifoLoad( p_fifo, &p_fifo->i_depth ) == 0 )
+        FifoWait( p_fifo, true );
 
     p_fifo->b_force_wake = false;
-    if( b == NULL )
+    if( FifoLoad( p_fifo, &p_fifo->i_depth ) == 0 )
     {
         /* Forced wakeup */
         vlc_mutex_unlock( &p_fifo->lock );
         return NULL;
     }
 
-    p_fifo->p_first = b->p_next;
-    p_fifo->i_depth--;
-    p_fifo->i_size -= b->i_buffer;
-
-    if( p_fifo->p_first == NULL )
-    {
-        p_fifo->pp_last = &p_fifo->p_first;
-    }
+    b = FifoPopWait( p_fifo );
 
     /* We don't know how many threads can queue new packets now. */
-    vlc_cond_broadcast( &p_fifo->wait_room );
+    if( p_fifo->i_pacing > 0 )
+        vlc_cond_broadcast( &p_fifo->wait_room );
     vlc_mutex_unlock( &p_fifo->lock );
 
-    b->p_next = NULL;
     return b;
 }
 
@@ -670,24 +1144,27 @@ block_t *block_FifoShow( block_fifo_t *p_fifo )
     vlc_testcancel( );
 
     vlc_mutex_lock( &p_fifo->lock );
-    mutex_cleanup_push( &p_fifo->lock );
-
-    while( p_fifo->p_first == NULL )
-        vlc_cond_wait( &p_fifo->wait, &p_fifo->lock );
+    if( FifoLoad( p_fifo, &p_fifo->i_depth ) == 0 )
+        FifoWait( p_fifo, false );
 
+    /* Skip the stub, if needed, so that the head is a real block */
+    if( p_fifo->p_first == &p_fifo->stub )
+    {
+        if( FIFO_NEXT(&p_fifo->stub) == NULL )
+            FifoWaitLink( p_fifo, FIFO_NEXT(&p_fifo->stub) == NULL );
+        p_fifo->p_first = p_fifo->stub.p_next;
+    }
     b = p_fifo->p_first;
 
-    vlc_cleanup_run ();
+    vlc_mutex_unlock( &p_fifo->lock );
     return b;
 }
 
-/* FIXME: not thread-safe */
 size_t block_FifoSize( const block_fifo_t *p_fifo )
 {
     return p_fifo->i_size;
 }
 
-/* FIXME: not thread-safe */
 size_t block_FifoCount( const block_fifo_t *p_fifo )
 {
     return p_fifo->i_depth;
@@ -58,6 +58,21 @@
 #   include <sys/socket.h>
 #endif
 
+#ifdef __linux__
+# include <sys/epoll.h>
+# define HTTPD_EPOLL 1
+# ifndef EPOLLRDHUP
+#  define EPOLLRDHUP 0x2000
+# endif
+/* Socket events handled per epoll_wait() call */
+# define HTTPD_EPOLL_EVENTS 64
+/* Socket operations for a client before the others get their turn */
+# define HTTPD_RUN_MAX 16
+#endif
+
+/* Maximum number of client threads per host */
+#define HTTPD_WORKER_MAX 64
+
 #if defined( WIN32 )
 /* We need HUGE buffer otherwise TCP throughput is very limited */
 #define HTTPD_CL_BUFSIZE 1000000
@@ -65,7 +80,14 @@
 #define HTTPD_CL_BUFSIZE 10000
 #endif
 
+/* Maximum number of stream buffer segments referenced by a client */
+#define HTTPD_CL_MAXSEG 16
+
+typedef struct httpd_stream_seg_t httpd_stream_seg_t;
+typedef struct httpd_worker_t httpd_worker_t;
+
 static void httpd_ClientClean( httpd_client_t *cl );
+static void httpd_StreamRelease( httpd_client_t *cl );
 
 struct httpd_t
 {
@@ -76,7 +98,25 @@ struct httpd_t
 };
 
 
-/* each host run in his own thread */
+/* the clients of a host are served by one or more threads */
+struct httpd_worker_t
+{
+    httpd_host_t *host;
+    vlc_thread_t  thread;
+    int           epfd; /* -1 for the poll() loop */
+
+    /* clients served by this worker (protected by the host lock) */
+    int            i_client;
+    httpd_client_t **client;
+
+    /* clients to run without waiting for a socket event (worker only) */
+    int            i_run;
+    int            i_run_max;
+    httpd_client_t **run;
+
+    unsigned      i_queue; /* clients run during the last iteration */
+};
+
 struct httpd_host_t
 {
     VLC_COMMON_MEMBERS
@@ -92,9 +132,13 @@ struct httpd_host_t
     int         *fds;
     unsigned     nfd;
 
-    vlc_thread_t thread;
+    unsigned       i_worker;
+    httpd_worker_t *worker;
+    unsigned       i_next_worker;
+
     vlc_mutex_t lock;
     vlc_cond_t  wait;
+    vlc_cond_t  busy;   /* a client has been sent data without the lock */
 
     /* all registered url (becarefull that 2 httpd_url_t could point at the same url)
      * This will slow down the url research but make my live easier
@@ -106,6 +150,14 @@ struct httpd_host_t
     int            i_client;
     httpd_client_t **client;
 
+    /* statistics, published once per second as host variables */
+    uint64_t    i_accepted;
+    unsigned    i_accept_count; /* connections since i_stats_date */
+    unsigned    i_queue_peak;   /* most clients run at once since then */
+    mtime_t     i_stats_date;
+    unsigned    i_active_max;
+    unsigned    i_queue_max;
+
     /* TLS data */
     tls_server_t *p_tls;
 };
@@ -162,6 +214,11 @@ struct httpd_client_t
 
     int     fd;
 
+    httpd_worker_t *worker;
+    int     i_ready;    /* socket events not consumed yet (epoll) */
+    bool    b_busy;     /* being sent data without the host lock */
+    bool    b_queued;   /* in the worker run queue */
+
     int     i_mode;
     int     i_state;
     int     b_read_waiting; /* stop as soon as possible sending */
@@ -178,6 +235,13 @@ struct httpd_client_t
     httpd_message_t query;  /* client -> httpd */
     httpd_message_t answer; /* httpd -> client */
 
+    /* stream body data, sent directly from the stream buffer */
+    httpd_stream_t     *p_stream;
+    httpd_stream_seg_t *pp_seg[HTTPD_CL_MAXSEG];
+    struct iovec        iov[HTTPD_CL_MAXSEG];
+    unsigned            i_seg;  /* referenced segments */
+    unsigned            i_iov;  /* first segment not completely sent */
+
     /* TLS data */
     tls_session_t *p_tls;
 };
@@ -707,6 +771,23 @@ void httpd_RedirectDelete( httpd_redirect_t *rdir )
 /*****************************************************************************
  * High Level Funtions: httpd_stream_t
  *****************************************************************************/
+/* The stream buffer is a list of reference-counted segments: clients send
+ * directly from them, and the last ones are kept alive as long as a client
+ * still references them. Segments are appended to while not full, which is
+ * safe as clients only reference bytes written before. */
+struct httpd_stream_seg_t
+{
+    httpd_stream_seg_t *p_next;
+    int64_t  i_pos;     /* absolute position of p_data[0] */
+    size_t   i_size;    /* bytes written */
+    size_t   i_alloc;
+    unsigned i_refs;    /* protected by the stream lock */
+    uint8_t  p_data[];
+};
+
+/* Minimum allocation of a stream buffer segment */
+#define HTTPD_STREAM_SEG 65536
+
 struct httpd_stream_t
 {
     vlc_mutex_t lock;
@@ -718,13 +799,34 @@ struct httpd_stream_t
     uint8_t *p_header;
     int     i_header;
 
-    /* circular buffer */
-    int         i_buffer_size;      /* buffer size, can't be reallocated smaller */
-    uint8_t     *p_buffer;          /* buffer */
+    /* segmented buffer */
+    int         i_buffer_size;      /* bytes kept for lagging clients */
+    httpd_stream_seg_t *p_first;
+    httpd_stream_seg_t *p_last;
     int64_t     i_buffer_pos;       /* absolute position from begining */
     int64_t     i_buffer_last_pos;  /* a new connection will start with that */
 };
 
+static void httpd_StreamSegRelease( httpd_stream_seg_t *seg )
+{
+    assert( seg->i_refs > 0 );
+    if( --seg->i_refs == 0 )
+        free( seg );
+}
+
+/* Releases the segments referenced by a client */
+static void httpd_StreamRelease( httpd_client_t *cl )
+{
+    if( cl->i_seg == 0 )
+        return;
+
+    vlc_mutex_lock( &cl->p_stream->lock );
+    for( unsigned i = 0; i < cl->i_seg; i++ )
+        httpd_StreamSegRelease( cl->pp_seg[i] );
+    vlc_mutex_unlock( &cl->p_stream->lock );
+    cl->i_seg = cl->i_iov = 0;
+}
+
 static int httpd_StreamCallBack( httpd_callback_sys_t *p_sys,
                                  httpd_client_t *cl, httpd_message_t *answer,
                                  const httpd_message_t *query )
@@ -738,43 +840,42 @@ static int httpd_StreamCallBack( httpd_callback_sys_t *p_sys,
 
     if( answer->i_body_offset > 0 )
     {
-        int64_t i_write;
-        int     i_pos;
-
-#if 0
-        fprintf( stderr, "httpd_StreamCallBack i_body_offset=%lld\n",
-                 answer->i_body_offset );
-#endif
+        httpd_stream_seg_t *seg;
+        int64_t i_offset;
+        int64_t i_write = 0;
 
+        assert( cl->i_seg == 0 );
+        vlc_mutex_lock( &stream->lock );
         if( answer->i_body_offset >= stream->i_buffer_pos )
         {
-            /* fprintf( stderr, "httpd_StreamCallBack: no data\n" ); */
+            vlc_mutex_unlock( &stream->lock );
             return VLC_EGENERIC;    /* wait, no data available */
         }
-        if( answer->i_body_offset + stream->i_buffer_size <
-            stream->i_buffer_pos )
+        if( answer->i_body_offset < stream->p_first->i_pos )
         {
             /* this client isn't fast enough */
-#if 0
-            fprintf( stderr, "fixing i_body_offset (old=%lld new=%lld)\n",
-                     answer->i_body_offset, stream->i_buffer_last_pos );
-#endif
             answer->i_body_offset = stream->i_buffer_last_pos;
         }
 
-        i_pos   = answer->i_body_offset % stream->i_buffer_size;
-        i_write = stream->i_buffer_pos - answer->i_body_offset;
-        if( i_write > HTTPD_CL_BUFSIZE )
-        {
-            i_write = HTTPD_CL_BUFSIZE;
-        }
-        else if( i_write <= 0 )
+        /* Reference the segments from the client position */
+        i_offset = answer->i_body_offset;
+        for( seg = stream->p_first;
+             seg->i_pos + (int64_t)seg->i_size <= i_offset; seg = seg->p_next )
+            assert( seg->p_next != NULL );
+
+        for( ; seg != NULL && cl->i_seg < HTTPD_CL_MAXSEG; seg = seg->p_next )
         {
-            return VLC_EGENERIC;    /* wait, no data available */
+            size_t i_skip = i_offset + i_write - seg->i_pos;
+
+            seg->i_refs++;
+            cl->pp_seg[cl->i_seg] = seg;
+            cl->iov[cl->i_seg].iov_base = seg->p_data + i_skip;
+            cl->iov[cl->i_seg].iov_len = seg->i_size - i_skip;
+            i_write += seg->i_size - i_skip;
+            cl->i_seg++;
         }
-
-        /* Don't go past the end of the circular buffer */
-        i_write = __MIN( i_write, stream->i_buffer_size - i_pos );
+        cl->p_stream = stream;
+        vlc_mutex_unlock( &stream->lock );
 
         /* using HTTPD_MSG_ANSWER -> data available */
         answer->i_proto  = HTTPD_PROTO_HTTP;
@@ -782,8 +883,7 @@ static int httpd_StreamCallBack( httpd_callback_sys_t *p_sys,
         answer->i_type   = HTTPD_MSG_ANSWER;
 
         answer->i_body = i_write;
-        answer->p_body = xmalloc( i_write );
-        memcpy( answer->p_body, &stream->p_buffer[i_pos], i_write );
+        answer->p_body = NULL;
 
         answer->i_body_offset += i_write;
 
@@ -880,11 +980,16 @@ httpd_stream_t *httpd_StreamNew( httpd_host_t *host,
     stream->i_header = 0;
     stream->p_header = NULL;
     stream->i_buffer_size = 5000000;    /* 5 Mo per stream */
-    stream->p_buffer = xmalloc( stream->i_buffer_size );
     /* We set to 1 to make life simpler
      * (this way i_body_offset can never be 0) */
     stream->i_buffer_pos = 1;
     stream->i_buffer_last_pos = 1;
+    /* Empty initial segment, so that the list is never empty */
+    stream->p_first = stream->p_last = xmalloc( sizeof( httpd_stream_seg_t ) );
+    stream->p_first->p_next = NULL;
+    stream->p_first->i_pos = 1;
+    stream->p_first->i_size = stream->p_first->i_alloc = 0;
+    stream->p_first->i_refs = 1;
 
     httpd_UrlCatch( stream->url, HTTPD_MSG_HEAD, httpd_StreamCallBack,
                     (httpd_callback_sys_t*)stream );
@@ -915,8 +1020,7 @@ int httpd_StreamHeader( httpd_stream_t *stream, uint8_t *p_data, int i_data )
 
 int httpd_StreamSend( httpd_stream_t *stream, uint8_t *p_data, int i_data )
 {
-    int i_count;
-    int i_pos;
+    httpd_stream_seg_t *seg;
 
     if( i_data < 0 || p_data == NULL )
     {
@@ -927,24 +1031,36 @@ int httpd_StreamSend( httpd_stream_t *stream, uint8_t *p_data, int i_data )
     /* save this pointer (to be used by new connection) */
     stream->i_buffer_last_pos = stream->i_buffer_pos;
 
-    i_pos = stream->i_buffer_pos % stream->i_buffer_size;
-    i_count = i_data;
-    while( i_count > 0)
+    /* Fill the last segment, then add one */
+    seg = stream->p_last;
+    if( seg->i_alloc - seg->i_size < (size_t)i_data )
     {
-        int i_copy;
-
-        i_copy = __MIN( i_count, stream->i_buffer_size - i_pos );
+        size_t i_alloc = __MAX( (size_t)i_data, HTTPD_STREAM_SEG );
+
+        seg = xmalloc( sizeof( *seg ) + i_alloc );
+        seg->p_next = NULL;
+        seg->i_pos = stream->i_buffer_pos;
+        seg->i_size = 0;
+        seg->i_alloc = i_alloc;
+        seg->i_refs = 1;
+        stream->p_last->p_next = seg;
+        stream->p_last = seg;
+    }
+    memcpy( seg->p_data + seg->i_size, p_data, i_data );
+    seg->i_size += i_data;
+    stream->i_buffer_pos += i_data;
 
-        /* Ok, we can't go past the end of our buffer */
-        memcpy( &stream->p_buffer[i_pos], p_data, i_copy );
+    /* Forget the oldest segments; lagging clients may still use them */
+    while( stream->p_first != stream->p_last
+        && stream->i_buffer_pos - stream->p_first->p_next->i_pos
+               >= stream->i_buffer_size )
+    {
+        httpd_stream_seg_t *old = stream->p_first;
 
-        i_pos = ( i_pos + i_copy ) % stream->i_buffer_size;
-        i_count -= i_copy;
-        p_data  += i_copy;
+        stream->p_first = old->p_next;
+        httpd_StreamSegRelease( old );
     }
 
-    stream->i_buffer_pos += i_data;
-
     vlc_mutex_unlock( &stream->lock );
     return VLC_SUCCESS;
 }
@@ -955,7 +1071,13 @@ void httpd_StreamDelete( httpd_stream_t *stream )
     vlc_mutex_destroy( &stream->lock );
     free( stream->psz_mime );
     free( stream->p_header );
-    free( stream->p_buffer );
+    while( stream->p_first != NULL )
+    {
+        httpd_stream_seg_t *seg = stream->p_first;
+
+        stream->p_first = seg->p_next;
+        httpd_StreamSegRelease( seg );
+    }
     free( stream );
 }
 
@@ -963,6 +1085,25 @@ void httpd_StreamDelete( httpd_stream_t *stream )
  * Low level
  *****************************************************************************/
 static void* httpd_HostThread( void * );
+#ifdef HTTPD_EPOLL
+static void* httpd_HostWorker( void * );
+static int httpd_HostEpoll( httpd_host_t *, int );
+#endif
+static void httpd_HostDelClient( httpd_host_t *, httpd_client_t * );
+
+static void httpd_HostWorkersClean( httpd_host_t *host )
+{
+    for( unsigned i = 0; i < host->i_worker; i++ )
+    {
+        httpd_worker_t *w = &host->worker[i];
+
+        if( w->epfd != -1 )
+            close( w->epfd );
+        free( w->client );
+        free( w->run );
+    }
+    free( host->worker );
+}
 
 /* create a new host */
 httpd_host_t *httpd_HostNew( vlc_object_t *p_this, const char *psz_host,
@@ -1079,6 +1220,7 @@ httpd_host_t *httpd_TLSHostNew( vlc_object_t *p_this, const char *psz_hostname,
     host->httpd = httpd;
     vlc_mutex_init( &host->lock );
     vlc_cond_init( &host->wait );
+    vlc_cond_init( &host->busy );
     host->i_ref = 1;
 
     vlc_object_attach( host, p_this );
@@ -1091,7 +1233,8 @@ httpd_host_t *httpd_TLSHostNew( vlc_object_t *p_this, const char *psz_hostname,
     }
     for (host->nfd = 0; host->fds[host->nfd] != -1; host->nfd++);
 
-    if( vlc_object_waitpipe( VLC_OBJECT( host ) ) == -1 )
+    int evfd = vlc_object_waitpipe( VLC_OBJECT( host ) );
+    if( evfd == -1 )
     {
         msg_Err( host, "signaling pipe error: %m" );
         goto error;
@@ -1107,13 +1250,54 @@ httpd_host_t *httpd_TLSHostNew( vlc_object_t *p_this, const char *psz_hostname,
 
     host->p_tls = p_tls;
 
-    /* create the thread */
-    if( vlc_clone( &host->thread, httpd_HostThread, host,
-                   VLC_THREAD_PRIORITY_LOW ) )
-    {
-        msg_Err( p_this, "cannot spawn http host thread" );
+    host->i_accepted = 0;
+    host->i_accept_count = host->i_queue_peak = 0;
+    host->i_stats_date = mdate();
+    host->i_active_max = host->i_queue_max = 0;
+    var_Create( host, "http-accepted", VLC_VAR_INTEGER );
+    var_Create( host, "http-accept-rate", VLC_VAR_INTEGER );
+    var_Create( host, "http-active", VLC_VAR_INTEGER );
+    var_Create( host, "http-queue", VLC_VAR_INTEGER );
+
+    /* create the client threads */
+    host->i_worker = 1;
+#ifdef HTTPD_EPOLL
+    i = var_InheritInteger( p_this, "http-threads" );
+    host->i_worker = __MAX( __MIN( i, HTTPD_WORKER_MAX ), 1 );
+#endif
+    host->i_next_worker = 0;
+    host->worker = calloc( host->i_worker, sizeof( *host->worker ) );
+    if( host->worker == NULL )
         goto error;
+    for( unsigned j = 0; j < host->i_worker; j++ )
+    {
+        host->worker[j].host = host;
+        host->worker[j].epfd = -1;
+    }
+#ifdef HTTPD_EPOLL
+    if( httpd_HostEpoll( host, evfd ) )
+        host->i_worker = 1; /* fallback to poll() */
+#endif
+
+    for( unsigned j = 0; j < host->i_worker; j++ )
+    {
+        httpd_worker_t *w = &host->worker[j];
+
+        if( vlc_clone( &w->thread,
+#ifdef HTTPD_EPOLL
+                       (w->epfd != -1) ? httpd_HostWorker :
+#endif
+                       httpd_HostThread, w, VLC_THREAD_PRIORITY_LOW ) )
+        {
+            msg_Err( p_this, "cannot spawn http host thread" );
+            vlc_object_kill( host );
+            while( j > 0 )
+                vlc_join( host->worker[--j].thread, NULL );
+            goto error;
+        }
     }
+    msg_Dbg( host, "serving clients with %u thread(s) (%s)", host->i_worker,
+             host->worker[0].epfd != -1 ? "epoll" : "poll" );
 
     /* now add it to httpd */
     TAB_APPEND( httpd->i_host, httpd->host, host );
@@ -1132,7 +1316,10 @@ error:
 
     if( host != NULL )
     {
+        if( host->worker != NULL )
+            httpd_HostWorkersClean( host );
         net_ListenClose( host->fds );
+        vlc_cond_destroy( &host->busy );
         vlc_cond_destroy( &host->wait );
         vlc_mutex_destroy( &host->lock );
         vlc_object_release( host );
@@ -1157,7 +1344,7 @@ void httpd_HostDelete( httpd_host_t *host )
     host->i_ref--;
     if( host->i_ref == 0 )
     {
-        vlc_cond_signal( &host->wait );
+        vlc_cond_broadcast( &host->wait );
         delete = true;
     }
     vlc_mutex_unlock( &host->lock );
@@ -1171,9 +1358,13 @@ void httpd_HostDelete( httpd_host_t *host )
     TAB_REMOVE( httpd->i_host, httpd->host, host );
 
     vlc_object_kill( host );
-    vlc_join( host->thread, NULL );
+    for( unsigned j = 0; j < host->i_worker; j++ )
+        vlc_join( host->worker[j].thread, NULL );
 
     msg_Dbg( host, "HTTP host removed" );
+    msg_Dbg( host, "%"PRIu64" connections accepted, up to %u clients, "
+             "up to %u clients run at once", host->i_accepted,
+             host->i_active_max, host->i_queue_max );
 
     for( i = 0; i < host->i_url; i++ )
     {
@@ -1183,12 +1374,11 @@ void httpd_HostDelete( httpd_host_t *host )
     {
         httpd_client_t *cl = host->client[i];
         msg_Warn( host, "client still connected" );
-        httpd_ClientClean( cl );
-        TAB_REMOVE( host->i_client, host->client, cl );
-        free( cl );
+        httpd_HostDelClient( host, cl );
         i--;
         /* TODO */
     }
+    httpd_HostWorkersClean( host );
 
     if( host->p_tls != NULL)
         tls_ServerDelete( host->p_tls );
@@ -1196,6 +1386,7 @@ void httpd_HostDelete( httpd_host_t *host )
     net_ListenClose( host->fds );
     free( host->psz_hostname );
 
+    vlc_cond_destroy( &host->busy );
     vlc_cond_destroy( &host->wait );
     vlc_mutex_destroy( &host->lock );
     vlc_object_release( host );
@@ -1250,7 +1441,7 @@ static httpd_url_t *httpd_UrlNewPrivate( httpd_host_t *host, const char *psz_url
     }
 
     TAB_APPEND( host->i_url, host->url, url );
-    vlc_cond_signal( &host->wait );
+    vlc_cond_broadcast( &host->wait );
     vlc_mutex_unlock( &host->lock );
 
     return url;
@@ -1305,12 +1496,20 @@ void httpd_UrlDelete( httpd_url_t *url )
 
         if( client->url == url )
         {
+            if( client->b_busy )
+            {
+                /* wait for the worker, then start over */
+                vlc_cond_wait( &host->busy, &host->lock );
+                i = -1;
+                continue;
+            }
+
             /* TODO complete it */
             msg_Warn( host, "force closing connections" );
             httpd_ClientClean( client );
-            TAB_REMOVE( host->i_client, host->client, client );
-            free( client );
-            i--;
+            /* the client thread will destroy it */
+            client->url = NULL;
+            client->i_state = HTTPD_CLIENT_DEAD;
         }
     }
     free( url );
@@ -1406,6 +1605,8 @@ static void httpd_ClientInit( httpd_client_t *cl, mtime_t now )
     cl->p_buffer = xmalloc( cl->i_buffer_size );
     cl->i_mode   = HTTPD_CLIENT_FILE;
     cl->b_read_waiting = false;
+    cl->p_stream = NULL;
+    cl->i_seg = cl->i_iov = 0;
 
     httpd_MsgInit( &cl->query );
     httpd_MsgInit( &cl->answer );
@@ -1435,12 +1636,17 @@ static void httpd_ClientClean( httpd_client_t *cl )
 {
     if( cl->fd >= 0 )
     {
+#ifdef HTTPD_EPOLL
+        if( cl->worker != NULL && cl->worker->epfd != -1 )
+            epoll_ctl( cl->worker->epfd, EPOLL_CTL_DEL, cl->fd, NULL );
+#endif
         if( cl->p_tls != NULL )
             tls_ServerSessionClose( cl->p_tls );
         net_Close( cl->fd );
         cl->fd = -1;
     }
 
+    httpd_StreamRelease( cl );
     httpd_MsgClean( &cl->answer );
     httpd_MsgClean( &cl->query );
 
@@ -1458,6 +1664,10 @@ static httpd_client_t *httpd_ClientNew( int fd, tls_session_t *p_tls, mtime_t no
     cl->fd      = fd;
     cl->url     = NULL;
     cl->p_tls = p_tls;
+    cl->worker  = NULL;
+    cl->i_ready = 0;
+    cl->b_busy  = false;
+    cl->b_queued = false;
 
     httpd_ClientInit( cl, now );
 
@@ -1475,6 +1685,8 @@ ssize_t httpd_NetRecv (httpd_client_t *cl, uint8_t *p, size_t i_len)
         val = p_tls ? tls_Recv (p_tls, p, i_len)
                     : recv (cl->fd, p, i_len, 0);
     while (val == -1 && errno == EINTR);
+    if (val == -1 && errno == EAGAIN)
+        cl->i_ready &= ~POLLIN;
     return val;
 }
 
@@ -1489,9 +1701,70 @@ ssize_t httpd_NetSend (httpd_client_t *cl, const uint8_t *p, size_t i_len)
         val = p_tls ? tls_Send( p_tls, p, i_len )
                     : send (cl->fd, p, i_len, 0);
     while (val == -1 && errno == EINTR);
+    if (val == -1 && errno == EAGAIN)
+        cl->i_ready &= ~POLLOUT;
+    return val;
+}
+
+/* Sends stream segments referenced by the client, with a single system call
+ * if possible */
+static
+ssize_t httpd_NetSendSeg (httpd_client_t *cl)
+{
+    struct iovec *iov = &cl->iov[cl->i_iov];
+    ssize_t val;
+
+#ifndef WIN32
+    if (cl->p_tls == NULL)
+    {
+        struct msghdr hdr = {
+            .msg_iov = iov,
+            .msg_iovlen = cl->i_seg - cl->i_iov,
+        };
+
+        do
+            val = sendmsg (cl->fd, &hdr, 0);
+        while (val == -1 && errno == EINTR);
+        if (val == -1 && errno == EAGAIN)
+            cl->i_ready &= ~POLLOUT;
+    }
+    else
+#endif
+        /* no gather write: one segment at a time */
+        val = httpd_NetSend (cl, iov->iov_base, iov->iov_len);
+
+    /* Skip what has been sent */
+    for (size_t i_done = (val > 0) ? val : 0; i_done > 0;)
+    {
+        iov = &cl->iov[cl->i_iov];
+        if (i_done < iov->iov_len)
+        {
+            iov->iov_base = (uint8_t *)iov->iov_base + i_done;
+            iov->iov_len -= i_done;
+            break;
+        }
+        i_done -= iov->iov_len;
+        cl->i_iov++;
+    }
     return val;
 }
 
+/* Makes the answer body the data to send */
+static void httpd_ClientBodyStart( httpd_client_t *cl )
+{
+    free( cl->p_buffer );
+    if( cl->i_seg > 0 )
+        /* sent from the stream buffer segments (httpd_NetSendSeg) */
+        cl->p_buffer = NULL;
+    else
+        cl->p_buffer = cl->answer.p_body;
+    cl->i_buffer_size = cl->answer.i_body;
+    cl->i_buffer = 0;
+
+    cl->answer.i_body = 0;
+    cl->answer.p_body = NULL;
+}
+
 
 static const struct
 {
@@ -1932,6 +2205,8 @@ static void httpd_ClientRecv( httpd_client_t *cl )
 #endif
 }
 
+static void httpd_ClientSent( httpd_client_t *, int );
+
 static void httpd_ClientSend( httpd_client_t *cl )
 {
     int i;
@@ -1977,14 +2252,24 @@ static void httpd_ClientSend( httpd_client_t *cl )
         fprintf( stderr, "%s",  cl->p_buffer );*/
     }
 
-    i_len = httpd_NetSend( cl, &cl->p_buffer[cl->i_buffer],
-                           cl->i_buffer_size - cl->i_buffer );
+    if( cl->i_seg > 0 )
+        i_len = httpd_NetSendSeg( cl );
+    else
+        i_len = httpd_NetSend( cl, &cl->p_buffer[cl->i_buffer],
+                               cl->i_buffer_size - cl->i_buffer );
+    httpd_ClientSent( cl, i_len );
+}
+
+/* Handles the result of a send operation */
+static void httpd_ClientSent( httpd_client_t *cl, int i_len )
+{
     if( i_len >= 0 )
     {
         cl->i_buffer += i_len;
 
         if( cl->i_buffer >= cl->i_buffer_size )
         {
+            httpd_StreamRelease( cl );
             if( cl->answer.i_body == 0  && cl->answer.i_body_offset > 0 &&
                 !cl->b_read_waiting )
             {
@@ -2002,13 +2287,7 @@ static void httpd_ClientSend( httpd_client_t *cl )
             if( cl->answer.i_body > 0 )
             {
                 /* send the body data */
-                free( cl->p_buffer );
-                cl->p_buffer = cl->answer.p_body;
-                cl->i_buffer_size = cl->answer.i_body;
-                cl->i_buffer = 0;
-
-                cl->answer.i_body = 0;
-                cl->answer.p_body = NULL;
+                httpd_ClientBodyStart( cl );
             }
             else
             {
@@ -2044,8 +2323,13 @@ static void httpd_ClientTlsHsIn( httpd_client_t *cl )
             cl->p_tls = NULL;
             break;
 
+        case 1:
+            cl->i_ready &= ~POLLIN;
+            break;
+
         case 2:
             cl->i_state = HTTPD_CLIENT_TLS_HS_OUT;
+            cl->i_ready &= ~POLLOUT;
     }
 }
 
@@ -2064,410 +2348,570 @@ static void httpd_ClientTlsHsOut( httpd_client_t *cl )
 
         case 1:
             cl->i_state = HTTPD_CLIENT_TLS_HS_IN;
+            cl->i_ready &= ~POLLIN;
+            break;
+
+        case 2:
+            cl->i_ready &= ~POLLOUT;
             break;
     }
 }
 
-static void* httpd_HostThread( void *data )
+/* Handles a client which is not waiting for network I/O */
+static void httpd_ClientProcess( httpd_host_t *host, httpd_client_t *cl )
 {
-    httpd_host_t *host = data;
-    tls_session_t *p_tls = NULL;
-    counter_t *p_total_counter = stats_CounterCreate( host, VLC_VAR_INTEGER, STATS_COUNTER );
-    counter_t *p_active_counter = stats_CounterCreate( host, VLC_VAR_INTEGER, STATS_COUNTER );
-    int evfd = vlc_object_waitpipe( VLC_OBJECT( host ) );
-
-    for( ;; )
+    if( cl->i_state == HTTPD_CLIENT_RECEIVE_DONE )
     {
-        /* prepare a new TLS session */
-        if( ( p_tls == NULL ) && ( host->p_tls != NULL ) )
-            p_tls = tls_ServerSessionPrepare( host->p_tls );
+        httpd_message_t *answer = &cl->answer;
+        httpd_message_t *query  = &cl->query;
+        int i_msg = query->i_type;
 
-        struct pollfd ufd[host->nfd + host->i_client + 1];
-        unsigned nfd;
-        for( nfd = 0; nfd < host->nfd; nfd++ )
+        httpd_MsgInit( answer );
+
+        /* Handle what we received */
+        if( (cl->i_mode != HTTPD_CLIENT_BIDIR) &&
+            (i_msg == HTTPD_MSG_ANSWER || i_msg == HTTPD_MSG_CHANNEL) )
         {
-            ufd[nfd].fd = host->fds[nfd];
-            ufd[nfd].events = POLLIN;
-            ufd[nfd].revents = 0;
+            /* we can only receive request from client when not
+             * in BIDIR mode */
+            cl->url     = NULL;
+            cl->i_state = HTTPD_CLIENT_DEAD;
         }
-
-        /* add all socket that should be read/write and close dead connection */
-        vlc_mutex_lock( &host->lock );
-        while( host->i_url <= 0 && host->i_ref > 0 )
-            vlc_cond_wait( &host->wait, &host->lock );
-
-        mtime_t now = mdate();
-        bool b_low_delay = false;
-
-        for(int i_client = 0; i_client < host->i_client; i_client++ )
+        else if( i_msg == HTTPD_MSG_ANSWER )
         {
-            httpd_client_t *cl = host->client[i_client];
-            if( cl->i_ref < 0 || ( cl->i_ref == 0 &&
-                ( cl->i_state == HTTPD_CLIENT_DEAD ||
-                  ( cl->i_activity_timeout > 0 &&
-                    cl->i_activity_date+cl->i_activity_timeout < now) ) ) )
+            /* We are in BIDIR mode, trigger the callback and then
+             * check for new data */
+            if( cl->url && cl->url->catch[i_msg].cb )
             {
-                httpd_ClientClean( cl );
-                stats_UpdateInteger( host, p_active_counter, -1, NULL );
-                TAB_REMOVE( host->i_client, host->client, cl );
-                free( cl );
-                i_client--;
-                continue;
+                cl->url->catch[i_msg].cb( cl->url->catch[i_msg].p_sys,
+                                          cl, NULL, query );
+            }
+            cl->i_state = HTTPD_CLIENT_WAITING;
+        }
+        else if( i_msg == HTTPD_MSG_CHANNEL )
+        {
+            /* We are in BIDIR mode, trigger the callback and then
+             * check for new data */
+            if( cl->url && cl->url->catch[i_msg].cb )
+            {
+                cl->url->catch[i_msg].cb( cl->url->catch[i_msg].p_sys,
+                                          cl, NULL, query );
             }
+            cl->i_state = HTTPD_CLIENT_WAITING;
+        }
+        else if( i_msg == HTTPD_MSG_OPTIONS )
+        {
 
-            struct pollfd *pufd = ufd + nfd;
-            assert (pufd < ufd + (sizeof (ufd) / sizeof (ufd[0])));
+            answer->i_type   = HTTPD_MSG_ANSWER;
+            answer->i_proto  = query->i_proto;
+            answer->i_status = 200;
+            answer->i_body = 0;
+            answer->p_body = NULL;
 
-            pufd->fd = cl->fd;
-            pufd->events = pufd->revents = 0;
+            httpd_MsgAdd( answer, "Server", "VLC/%s", VERSION );
+            httpd_MsgAdd( answer, "Content-Length", "0" );
 
-            if( ( cl->i_state == HTTPD_CLIENT_RECEIVING )
-                  || ( cl->i_state == HTTPD_CLIENT_TLS_HS_IN ) )
-            {
-                pufd->events = POLLIN;
-            }
-            else if( ( cl->i_state == HTTPD_CLIENT_SENDING )
-                  || ( cl->i_state == HTTPD_CLIENT_TLS_HS_OUT ) )
+            switch( query->i_proto )
             {
-                pufd->events = POLLOUT;
-            }
-            else if( cl->i_state == HTTPD_CLIENT_RECEIVE_DONE )
-            {
-                httpd_message_t *answer = &cl->answer;
-                httpd_message_t *query  = &cl->query;
-                int i_msg = query->i_type;
-
-                httpd_MsgInit( answer );
+                case HTTPD_PROTO_HTTP:
+                    answer->i_version = 1;
+                    httpd_MsgAdd( answer, "Allow",
+                                  "GET,HEAD,POST,OPTIONS" );
+                    break;
 
-                /* Handle what we received */
-                if( (cl->i_mode != HTTPD_CLIENT_BIDIR) &&
-                    (i_msg == HTTPD_MSG_ANSWER || i_msg == HTTPD_MSG_CHANNEL) )
-                {
-                    /* we can only receive request from client when not
-                     * in BIDIR mode */
-                    cl->url     = NULL;
-                    cl->i_state = HTTPD_CLIENT_DEAD;
-                }
-                else if( i_msg == HTTPD_MSG_ANSWER )
-                {
-                    /* We are in BIDIR mode, trigger the callback and then
-                     * check for new data */
-                    if( cl->url && cl->url->catch[i_msg].cb )
-                    {
-                        cl->url->catch[i_msg].cb( cl->url->catch[i_msg].p_sys,
-                                                  cl, NULL, query );
-                    }
-                    cl->i_state = HTTPD_CLIENT_WAITING;
-                }
-                else if( i_msg == HTTPD_MSG_CHANNEL )
+                case HTTPD_PROTO_RTSP:
                 {
-                    /* We are in BIDIR mode, trigger the callback and then
-                     * check for new data */
-                    if( cl->url && cl->url->catch[i_msg].cb )
+                    const char *p;
+                    answer->i_version = 0;
+
+                    p = httpd_MsgGet( query, "Cseq" );
+                    if( p != NULL )
+                        httpd_MsgAdd( answer, "Cseq", "%s", p );
+                    p = httpd_MsgGet( query, "Timestamp" );
+                    if( p != NULL )
+                        httpd_MsgAdd( answer, "Timestamp", "%s", p );
+
+                    p = httpd_MsgGet( query, "Require" );
+                    if( p != NULL )
                     {
-                        cl->url->catch[i_msg].cb( cl->url->catch[i_msg].p_sys,
-                                                  cl, NULL, query );
+                        answer->i_status = 551;
+                        httpd_MsgAdd( query, "Unsupported", "%s", p );
                     }
-                    cl->i_state = HTTPD_CLIENT_WAITING;
+
+                    httpd_MsgAdd( answer, "Public", "DESCRIBE,SETUP,"
+                                  "TEARDOWN,PLAY,PAUSE,GET_PARAMETER" );
+                    break;
                 }
-                else if( i_msg == HTTPD_MSG_OPTIONS )
-                {
+            }
 
-                    answer->i_type   = HTTPD_MSG_ANSWER;
-                    answer->i_proto  = query->i_proto;
-                    answer->i_status = 200;
-                    answer->i_body = 0;
-                    answer->p_body = NULL;
+            cl->i_buffer = -1;  /* Force the creation of the answer in
+                                 * httpd_ClientSend */
+            cl->i_state = HTTPD_CLIENT_SENDING;
+        }
+        else if( i_msg == HTTPD_MSG_NONE )
+        {
+            if( query->i_proto == HTTPD_PROTO_NONE )
+            {
+                cl->url = NULL;
+                cl->i_state = HTTPD_CLIENT_DEAD;
+            }
+            else
+            {
+                char *p;
 
-                    httpd_MsgAdd( answer, "Server", "VLC/%s", VERSION );
-                    httpd_MsgAdd( answer, "Content-Length", "0" );
+                /* unimplemented */
+                answer->i_proto  = query->i_proto ;
+                answer->i_type   = HTTPD_MSG_ANSWER;
+                answer->i_version= 0;
+                answer->i_status = 501;
 
-                    switch( query->i_proto )
-                    {
-                        case HTTPD_PROTO_HTTP:
-                            answer->i_version = 1;
-                            httpd_MsgAdd( answer, "Allow",
-                                          "GET,HEAD,POST,OPTIONS" );
-                            break;
+                answer->i_body = httpd_HtmlError (&p, 501, NULL);
+                answer->p_body = (uint8_t *)p;
+                httpd_MsgAdd( answer, "Content-Length", "%d", answer->i_body );
 
-                        case HTTPD_PROTO_RTSP:
-                        {
-                            const char *p;
-                            answer->i_version = 0;
-
-                            p = httpd_MsgGet( query, "Cseq" );
-                            if( p != NULL )
-                                httpd_MsgAdd( answer, "Cseq", "%s", p );
-                            p = httpd_MsgGet( query, "Timestamp" );
-                            if( p != NULL )
-                                httpd_MsgAdd( answer, "Timestamp", "%s", p );
-
-                            p = httpd_MsgGet( query, "Require" );
-                            if( p != NULL )
-                            {
-                                answer->i_status = 551;
-                                httpd_MsgAdd( query, "Unsupported", "%s", p );
-                            }
+                cl->i_buffer = -1;  /* Force the creation of the answer in httpd_ClientSend */
+                cl->i_state = HTTPD_CLIENT_SENDING;
+            }
+        }
+        else
+        {
+            bool b_auth_failed = false;
+            bool b_hosts_failed = false;
 
-                            httpd_MsgAdd( answer, "Public", "DESCRIBE,SETUP,"
-                                          "TEARDOWN,PLAY,PAUSE,GET_PARAMETER" );
-                            break;
-                        }
-                    }
+            /* Search the url and trigger callbacks */
+            for(int i = 0; i < host->i_url; i++ )
+            {
+                httpd_url_t *url = host->url[i];
 
-                    cl->i_buffer = -1;  /* Force the creation of the answer in
-                                         * httpd_ClientSend */
-                    cl->i_state = HTTPD_CLIENT_SENDING;
-                }
-                else if( i_msg == HTTPD_MSG_NONE )
+                if( !strcmp( url->psz_url, query->psz_url ) )
                 {
-                    if( query->i_proto == HTTPD_PROTO_NONE )
-                    {
-                        cl->url = NULL;
-                        cl->i_state = HTTPD_CLIENT_DEAD;
-                    }
-                    else
+                    if( url->catch[i_msg].cb )
                     {
-                        char *p;
-
-                        /* unimplemented */
-                        answer->i_proto  = query->i_proto ;
-                        answer->i_type   = HTTPD_MSG_ANSWER;
-                        answer->i_version= 0;
-                        answer->i_status = 501;
-
-                        answer->i_body = httpd_HtmlError (&p, 501, NULL);
-                        answer->p_body = (uint8_t *)p;
-                        httpd_MsgAdd( answer, "Content-Length", "%d", answer->i_body );
-
-                        cl->i_buffer = -1;  /* Force the creation of the answer in httpd_ClientSend */
-                        cl->i_state = HTTPD_CLIENT_SENDING;
-                    }
-                }
-                else
-                {
-                    bool b_auth_failed = false;
-                    bool b_hosts_failed = false;
+                        if( answer && ( url->p_acl != NULL ) )
+                        {
+                            char ip[NI_MAXNUMERICHOST];
 
-                    /* Search the url and trigger callbacks */
-                    for(int i = 0; i < host->i_url; i++ )
-                    {
-                        httpd_url_t *url = host->url[i];
+                            if( ( httpd_ClientIP( cl, ip ) == NULL )
+                             || ACL_Check( url->p_acl, ip ) )
+                            {
+                                b_hosts_failed = true;
+                                break;
+                            }
+                        }
 
-                        if( !strcmp( url->psz_url, query->psz_url ) )
+                        if( answer && ( *url->psz_user || *url->psz_password ) )
                         {
-                            if( url->catch[i_msg].cb )
-                            {
-                                if( answer && ( url->p_acl != NULL ) )
-                                {
-                                    char ip[NI_MAXNUMERICHOST];
-
-                                    if( ( httpd_ClientIP( cl, ip ) == NULL )
-                                     || ACL_Check( url->p_acl, ip ) )
-                                    {
-                                        b_hosts_failed = true;
-                                        break;
-                                    }
-                                }
+                            /* create the headers */
+                            const char *b64 = httpd_MsgGet( query, "Authorization" ); /* BASIC id */
+                            char *user = NULL, *pass = NULL;
 
-                                if( answer && ( *url->psz_user || *url->psz_password ) )
-                                {
-                                    /* create the headers */
-                                    const char *b64 = httpd_MsgGet( query, "Authorization" ); /* BASIC id */
-                                    char *user = NULL, *pass = NULL;
-
-                                    if( b64 != NULL
-                                     && !strncasecmp( b64, "BASIC", 5 ) )
-                                    {
-                                        b64 += 5;
-                                        while( *b64 == ' ' )
-                                            b64++;
-
-                                        user = vlc_b64_decode( b64 );
-                                        if (user != NULL)
-                                        {
-                                            pass = strchr (user, ':');
-                                            if (pass != NULL)
-                                                *pass++ = '\0';
-                                        }
-                                    }
-
-                                    if ((user == NULL) || (pass == NULL)
-                                     || strcmp (user, url->psz_user)
-                                     || strcmp (pass, url->psz_password))
-                                    {
-                                        httpd_MsgAdd( answer,
-                                                      "WWW-Authenticate",
-                                                      "Basic realm=\"VLC stream\"" );
-                                        /* We fail for all url */
-                                        b_auth_failed = true;
-                                        free( user );
-                                        break;
-                                    }
-
-                                    free( user );
-                                }
+                            if( b64 != NULL
+                             && !strncasecmp( b64, "BASIC", 5 ) )
+                            {
+                                b64 += 5;
+                                while( *b64 == ' ' )
+                                    b64++;
 
-                                if( !url->catch[i_msg].cb( url->catch[i_msg].p_sys, cl, answer, query ) )
+                                user = vlc_b64_decode( b64 );
+                                if (user != NULL)
                                 {
-                                    if( answer->i_proto == HTTPD_PROTO_NONE )
-                                    {
-                                        /* Raw answer from a CGI */
-                                        cl->i_buffer = cl->i_buffer_size;
-                                    }
-                                    else
-                                        cl->i_buffer = -1;
-
-                                    /* only one url can answer */
-                                    answer = NULL;
-                                    if( cl->url == NULL )
-                                    {
-                                        cl->url = url;
-                                    }
+                                    pass = strchr (user, ':');
+                                    if (pass != NULL)
+                                        *pass++ = '\0';
                                 }
                             }
-                        }
-                    }
-
-                    if( answer )
-                    {
-                        char *p;
 
-                        answer->i_proto  = query->i_proto;
-                        answer->i_type   = HTTPD_MSG_ANSWER;
-                        answer->i_version= 0;
+                            if ((user == NULL) || (pass == NULL)
+                             || strcmp (user, url->psz_user)
+                             || strcmp (pass, url->psz_password))
+                            {
+                                httpd_MsgAdd( answer,
+                                              "WWW-Authenticate",
+                                              "Basic realm=\"VLC stream\"" );
+                                /* We fail for all url */
+                                b_auth_failed = true;
+                                free( user );
+                                break;
+                            }
 
-                        if( b_hosts_failed )
-                        {
-                            answer->i_status = 403;
-                        }
-                        else if( b_auth_failed )
-                        {
-                            answer->i_status = 401;
-                        }
-                        else
-                        {
-                            /* no url registered */
-                            answer->i_status = 404;
+                            free( user );
                         }
 
-                        answer->i_body = httpd_HtmlError (&p,
-                                                          answer->i_status,
-                                                          query->psz_url);
-                        answer->p_body = (uint8_t *)p;
+                        if( !url->catch[i_msg].cb( url->catch[i_msg].p_sys, cl, answer, query ) )
+                        {
+                            if( answer->i_proto == HTTPD_PROTO_NONE )
+                            {
+                                /* Raw answer from a CGI */
+                                cl->i_buffer = cl->i_buffer_size;
+                            }
+                            else
+                                cl->i_buffer = -1;
 
-                        cl->i_buffer = -1;  /* Force the creation of the answer in httpd_ClientSend */
-                        httpd_MsgAdd( answer, "Content-Length", "%d", answer->i_body );
-                        httpd_MsgAdd( answer, "Content-Type", "%s", "text/html" );
+                            /* only one url can answer */
+                            answer = NULL;
+                            if( cl->url == NULL )
+                            {
+                                cl->url = url;
+                            }
+                        }
                     }
-
-                    cl->i_state = HTTPD_CLIENT_SENDING;
                 }
             }
-            else if( cl->i_state == HTTPD_CLIENT_SEND_DONE )
+
+            if( answer )
             {
-                if( cl->i_mode == HTTPD_CLIENT_FILE || cl->answer.i_body_offset == 0 )
-                {
-                    const char *psz_connection = httpd_MsgGet( &cl->answer, "Connection" );
-                    const char *psz_query = httpd_MsgGet( &cl->query, "Connection" );
-                    bool b_connection = false;
-                    bool b_keepalive = false;
-                    bool b_query = false;
-
-                    cl->url = NULL;
-                    if( psz_connection )
-                    {
-                        b_connection = ( strcasecmp( psz_connection, "Close" ) == 0 );
-                        b_keepalive = ( strcasecmp( psz_connection, "Keep-Alive" ) == 0 );
-                    }
+                char *p;
 
-                    if( psz_query )
-                    {
-                        b_query = ( strcasecmp( psz_query, "Close" ) == 0 );
-                    }
+                answer->i_proto  = query->i_proto;
+                answer->i_type   = HTTPD_MSG_ANSWER;
+                answer->i_version= 0;
 
-                    if( ( ( cl->query.i_proto == HTTPD_PROTO_HTTP ) &&
-                          ( ( cl->query.i_version == 0 && b_keepalive ) ||
-                            ( cl->query.i_version == 1 && !b_connection ) ) ) ||
-                        ( ( cl->query.i_proto == HTTPD_PROTO_RTSP ) &&
-                          !b_query && !b_connection ) )
-                    {
-                        httpd_MsgClean( &cl->query );
-                        httpd_MsgInit( &cl->query );
-
-                        cl->i_buffer = 0;
-                        cl->i_buffer_size = 1000;
-                        free( cl->p_buffer );
-                        cl->p_buffer = xmalloc( cl->i_buffer_size );
-                        cl->i_state = HTTPD_CLIENT_RECEIVING;
-                    }
-                    else
-                    {
-                        cl->i_state = HTTPD_CLIENT_DEAD;
-                    }
-                    httpd_MsgClean( &cl->answer );
+                if( b_hosts_failed )
+                {
+                    answer->i_status = 403;
                 }
-                else if( cl->b_read_waiting )
+                else if( b_auth_failed )
                 {
-                    /* we have a message waiting for us to read it */
-                    httpd_MsgClean( &cl->answer );
-                    httpd_MsgClean( &cl->query );
-
-                    cl->i_buffer = 0;
-                    cl->i_buffer_size = 1000;
-                    free( cl->p_buffer );
-                    cl->p_buffer = xmalloc( cl->i_buffer_size );
-                    cl->i_state = HTTPD_CLIENT_RECEIVING;
-                    cl->b_read_waiting = false;
+                    answer->i_status = 401;
                 }
                 else
                 {
-                    int64_t i_offset = cl->answer.i_body_offset;
-                    httpd_MsgClean( &cl->answer );
-
-                    cl->answer.i_body_offset = i_offset;
-                    free( cl->p_buffer );
-                    cl->p_buffer = NULL;
-                    cl->i_buffer = 0;
-                    cl->i_buffer_size = 0;
-
-                    cl->i_state = HTTPD_CLIENT_WAITING;
+                    /* no url registered */
+                    answer->i_status = 404;
                 }
-            }
-            else if( cl->i_state == HTTPD_CLIENT_WAITING )
-            {
-                int64_t i_offset = cl->answer.i_body_offset;
-                int     i_msg = cl->query.i_type;
 
-                httpd_MsgInit( &cl->answer );
-                cl->answer.i_body_offset = i_offset;
+                answer->i_body = httpd_HtmlError (&p,
+                                                  answer->i_status,
+                                                  query->psz_url);
+                answer->p_body = (uint8_t *)p;
 
-                cl->url->catch[i_msg].cb( cl->url->catch[i_msg].p_sys, cl,
-                                          &cl->answer, &cl->query );
-                if( cl->answer.i_type != HTTPD_MSG_NONE )
-                {
-                    /* we have new data, so re-enter send mode */
-                    cl->i_buffer      = 0;
-                    cl->p_buffer      = cl->answer.p_body;
-                    cl->i_buffer_size = cl->answer.i_body;
-                    cl->answer.p_body = NULL;
-                    cl->answer.i_body = 0;
-                    cl->i_state = HTTPD_CLIENT_SENDING;
-                }
+                cl->i_buffer = -1;  /* Force the creation of the answer in httpd_ClientSend */
+                httpd_MsgAdd( answer, "Content-Length", "%d", answer->i_body );
+                httpd_MsgAdd( answer, "Content-Type", "%s", "text/html" );
             }
 
+            cl->i_state = HTTPD_CLIENT_SENDING;
+        }
+    }
+    else if( cl->i_state == HTTPD_CLIENT_SEND_DONE )
+    {
+        if( cl->i_mode == HTTPD_CLIENT_FILE || cl->answer.i_body_offset == 0 )
+        {
+            const char *psz_connection = httpd_MsgGet( &cl->answer, "Connection" );
+            const char *psz_query = httpd_MsgGet( &cl->query, "Connection" );
+            bool b_connection = false;
+            bool b_keepalive = false;
+            bool b_query = false;
+
+            cl->url = NULL;
+            if( psz_connection )
+            {
+                b_connection = ( strcasecmp( psz_connection, "Close" ) == 0 );
+                b_keepalive = ( strcasecmp( psz_connection, "Keep-Alive" ) == 0 );
+            }
+
+            if( psz_query )
+            {
+                b_query = ( strcasecmp( psz_query, "Close" ) == 0 );
+            }
+
+            if( ( ( cl->query.i_proto == HTTPD_PROTO_HTTP ) &&
+                  ( ( cl->query.i_version == 0 && b_keepalive ) ||
+                    ( cl->query.i_version == 1 && !b_connection ) ) ) ||
+                ( ( cl->query.i_proto == HTTPD_PROTO_RTSP ) &&
+                  !b_query && !b_connection ) )
+            {
+                httpd_MsgClean( &cl->query );
+                httpd_MsgInit( &cl->query );
+
+                cl->i_buffer = 0;
+                cl->i_buffer_size = 1000;
+                free( cl->p_buffer );
+                cl->p_buffer = xmalloc( cl->i_buffer_size );
+                cl->i_state = HTTPD_CLIENT_RECEIVING;
+            }
+            else
+            {
+                cl->i_state = HTTPD_CLIENT_DEAD;
+            }
+            httpd_MsgClean( &cl->answer );
+        }
+        else if( cl->b_read_waiting )
+        {
+            /* we have a message waiting for us to read it */
+            httpd_MsgClean( &cl->answer );
+            httpd_MsgClean( &cl->query );
+
+            cl->i_buffer = 0;
+            cl->i_buffer_size = 1000;
+            free( cl->p_buffer );
+            cl->p_buffer = xmalloc( cl->i_buffer_size );
+            cl->i_state = HTTPD_CLIENT_RECEIVING;
+            cl->b_read_waiting = false;
+        }
+        else
+        {
+            int64_t i_offset = cl->answer.i_body_offset;
+            httpd_MsgClean( &cl->answer );
+
+            cl->answer.i_body_offset = i_offset;
+            free( cl->p_buffer );
+            cl->p_buffer = NULL;
+            cl->i_buffer = 0;
+            cl->i_buffer_size = 0;
+
+            cl->i_state = HTTPD_CLIENT_WAITING;
+        }
+    }
+    else if( cl->i_state == HTTPD_CLIENT_WAITING )
+    {
+        int64_t i_offset = cl->answer.i_body_offset;
+        int     i_msg = cl->query.i_type;
+
+        httpd_MsgInit( &cl->answer );
+        cl->answer.i_body_offset = i_offset;
+
+        cl->url->catch[i_msg].cb( cl->url->catch[i_msg].p_sys, cl,
+                                  &cl->answer, &cl->query );
+        if( cl->answer.i_type != HTTPD_MSG_NONE )
+        {
+            /* we have new data, so re-enter send mode */
+            httpd_ClientBodyStart( cl );
+            cl->i_state = HTTPD_CLIENT_SENDING;
+        }
+    }
+}
+
+/* Returns the socket events a client is waiting for */
+static int httpd_ClientEvents( const httpd_client_t *cl )
+{
+    switch( cl->i_state )
+    {
+        case HTTPD_CLIENT_RECEIVING:
+        case HTTPD_CLIENT_TLS_HS_IN:
+            return POLLIN;
+
+        case HTTPD_CLIENT_SENDING:
             /* Special for BIDIR mode we also check reading */
-            if( cl->i_mode == HTTPD_CLIENT_BIDIR &&
-                cl->i_state == HTTPD_CLIENT_SENDING )
+            if( cl->i_mode == HTTPD_CLIENT_BIDIR && !cl->b_read_waiting )
+                return POLLIN | POLLOUT;
+            /* fall through */
+        case HTTPD_CLIENT_TLS_HS_OUT:
+            return POLLOUT;
+    }
+    return 0;
+}
+
+/* Handles the socket events of a client */
+static void httpd_ClientIO( httpd_client_t *cl, int revents )
+{
+    if( cl->i_state == HTTPD_CLIENT_RECEIVING )
+    {
+        if( revents & POLLIN )
+            httpd_ClientRecv( cl );
+    }
+    else if( cl->i_state == HTTPD_CLIENT_SENDING )
+    {
+        if( revents & POLLOUT )
+            httpd_ClientSend( cl );
+    }
+    else if( cl->i_state == HTTPD_CLIENT_TLS_HS_IN )
+    {
+        if( revents & POLLIN )
+            httpd_ClientTlsHsIn( cl );
+    }
+    else if( cl->i_state == HTTPD_CLIENT_TLS_HS_OUT )
+    {
+        if( revents & POLLOUT )
+            httpd_ClientTlsHsOut( cl );
+    }
+
+    if( cl->i_mode == HTTPD_CLIENT_BIDIR &&
+        cl->i_state == HTTPD_CLIENT_SENDING &&
+        (revents & POLLIN) )
+    {
+        cl->b_read_waiting = true;
+    }
+}
+
+static bool httpd_ClientExpired( const httpd_client_t *cl, mtime_t now )
+{
+    return cl->i_ref < 0 || ( cl->i_ref == 0 &&
+           ( cl->i_state == HTTPD_CLIENT_DEAD ||
+             ( cl->i_activity_timeout > 0 &&
+               cl->i_activity_date+cl->i_activity_timeout < now) ) );
+}
+
+/* Publishes the statistics of the last second, host lock held */
+static void httpd_HostStatsTick( httpd_host_t *host, mtime_t now )
+{
+    const mtime_t i_delay = now - host->i_stats_date;
+
+    if( i_delay < CLOCK_FREQ )
+        return;
+
+    var_SetInteger( host, "http-accepted", host->i_accepted );
+    var_SetInteger( host, "http-accept-rate",
+                    host->i_accept_count * CLOCK_FREQ / i_delay );
+    var_SetInteger( host, "http-active", host->i_client );
+    var_SetInteger( host, "http-queue", host->i_queue_peak );
+    host->i_accept_count = host->i_queue_peak = 0;
+    host->i_stats_date = now;
+}
+
+/* Adds a new client to the least recently used worker, host lock held */
+static void httpd_HostAddClient( httpd_host_t *host, httpd_client_t *cl )
+{
+    httpd_worker_t *w = &host->worker[host->i_next_worker];
+
+    host->i_next_worker = (host->i_next_worker + 1) % host->i_worker;
+    cl->worker = w;
+    TAB_APPEND( host->i_client, host->client, cl );
+    TAB_APPEND( w->i_client, w->client, cl );
+
+    host->i_accepted++;
+    host->i_accept_count++;
+    if( (unsigned)host->i_client > host->i_active_max )
+        host->i_active_max = host->i_client;
+
+#ifdef HTTPD_EPOLL
+    if( w->epfd != -1 )
+    {
+        /* Edge-triggered: readiness is tracked in cl->i_ready, and cleared
+         * when a socket operation would block. */
+        struct epoll_event ev = {
+            .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+            .data.ptr = cl,
+        };
+
+        if( epoll_ctl( w->epfd, EPOLL_CTL_ADD, cl->fd, &ev ) )
+        {
+            msg_Err( host, "cannot watch client socket: %m" );
+            cl->i_state = HTTPD_CLIENT_DEAD;
+        }
+    }
+#endif
+}
+
+/* Removes and destroys a client, host lock held */
+static void httpd_HostDelClient( httpd_host_t *host, httpd_client_t *cl )
+{
+    httpd_worker_t *w = cl->worker;
+
+    httpd_ClientClean( cl );
+    TAB_REMOVE( host->i_client, host->client, cl );
+    TAB_REMOVE( w->i_client, w->client, cl );
+    free( cl );
+}
+
+/* Accepts a connection from a listening socket.
+ * Returns VLC_EGENERIC if no connection was pending. */
+static int httpd_HostAccept( httpd_host_t *host, int fd,
+                             tls_session_t **pp_tls, mtime_t now )
+{
+    tls_session_t *p_tls = *pp_tls;
+    httpd_client_t *cl;
+    int i_state = -1;
+
+    fd = vlc_accept (fd, NULL, NULL, true);
+    if (fd == -1)
+        return VLC_EGENERIC;
+    setsockopt (fd, SOL_SOCKET, SO_REUSEADDR,
+                &(int){ 1 }, sizeof(int));
+
+    if( p_tls != NULL )
+    {
+        *pp_tls = NULL;
+        switch( tls_ServerSessionHandshake( p_tls, fd ) )
+        {
+            case -1:
+                msg_Err( host, "Rejecting TLS connection" );
+                net_Close( fd );
+                return VLC_SUCCESS;
+
+            case 1: /* missing input - most likely */
+                i_state = HTTPD_CLIENT_TLS_HS_IN;
+                break;
+
+            case 2: /* missing output */
+                i_state = HTTPD_CLIENT_TLS_HS_OUT;
+                break;
+        }
+    }
+
+    cl = httpd_ClientNew( fd, p_tls, now );
+    if( cl == NULL )
+    {
+        if( p_tls != NULL )
+            tls_ServerSessionClose( p_tls );
+        net_Close( fd );
+        return VLC_SUCCESS;
+    }
+    if( i_state != -1 )
+        cl->i_state = i_state; // override state for TLS
+
+    vlc_mutex_lock( &host->lock );
+    httpd_HostAddClient( host, cl );
+    vlc_mutex_unlock( &host->lock );
+    return VLC_SUCCESS;
+}
+
+/* poll() loop, serving all clients of a host from a single thread */
+static void* httpd_HostThread( void *data )
+{
+    httpd_worker_t *w = data;
+    httpd_host_t *host = w->host;
+    tls_session_t *p_tls = NULL;
+    int evfd = vlc_object_waitpipe( VLC_OBJECT( host ) );
+
+    for( ;; )
+    {
+        /* prepare a new TLS session */
+        if( ( p_tls == NULL ) && ( host->p_tls != NULL ) )
+            p_tls = tls_ServerSessionPrepare( host->p_tls );
+
+        struct pollfd ufd[host->nfd + host->i_client + 1];
+        unsigned nfd;
+        for( nfd = 0; nfd < host->nfd; nfd++ )
+        {
+            ufd[nfd].fd = host->fds[nfd];
+            ufd[nfd].events = POLLIN;
+            ufd[nfd].revents = 0;
+        }
+
+        /* add all socket that should be read/write and close dead connection */
+        vlc_mutex_lock( &host->lock );
+        while( host->i_url <= 0 && host->i_ref > 0 )
+            vlc_cond_wait( &host->wait, &host->lock );
+
+        mtime_t now = mdate();
+        bool b_low_delay = false;
+
+        for(int i_client = 0; i_client < host->i_client; i_client++ )
+        {
+            httpd_client_t *cl = host->client[i_client];
+            if( httpd_ClientExpired( cl, now ) )
             {
-                pufd->events |= POLLIN;
+                httpd_HostDelClient( host, cl );
+                i_client--;
+                continue;
             }
 
+            struct pollfd *pufd = ufd + nfd;
+            assert (pufd < ufd + (sizeof (ufd) / sizeof (ufd[0])));
+
+            httpd_ClientProcess( host, cl );
+
+            pufd->fd = cl->fd;
+            pufd->events = httpd_ClientEvents( cl );
+            pufd->revents = 0;
+
             if (pufd->events != 0)
                 nfd++;
             else
                 b_low_delay = true;
         }
+        httpd_HostStatsTick( host, now );
         vlc_mutex_unlock( &host->lock );
 
         ufd[nfd].fd = evfd;
@@ -2475,8 +2919,9 @@ static void* httpd_HostThread( void *data )
         ufd[nfd].revents = 0;
         nfd++;
 
-        /* we will wait 20ms (not too big) if HTTPD_CLIENT_WAITING */
-        switch( poll( ufd, nfd, b_low_delay ? 20 : -1) )
+        /* we will wait 20ms (not too big) if HTTPD_CLIENT_WAITING,
+         * and wake up every second to publish the statistics */
+        switch( poll( ufd, nfd, b_low_delay ? 20 : 1000 ) )
         {
             case -1:
                 if (errno != EINTR)
@@ -2495,11 +2940,13 @@ static void* httpd_HostThread( void *data )
         /* Handle client sockets */
         vlc_mutex_lock( &host->lock );
         now = mdate();
+        w->i_queue = 0;
         nfd = host->nfd;
         for( int i_client = 0; i_client < host->i_client; i_client++ )
         {
             httpd_client_t *cl = host->client[i_client];
             const struct pollfd *pufd = &ufd[nfd];
+            int revents;
 
             assert( pufd < &ufd[sizeof(ufd) / sizeof(ufd[0])] );
 
@@ -2509,98 +2956,291 @@ static void* httpd_HostThread( void *data )
             if( pufd->revents == 0 )
                 continue; // no event received
 
+            /* errors are reported by the next socket operation */
+            revents = pufd->revents;
+            if( revents & (POLLERR | POLLHUP | POLLNVAL) )
+                revents |= POLLIN | POLLOUT;
+
             cl->i_activity_date = now;
+            w->i_queue++;
+            httpd_ClientIO( cl, revents );
+        }
+        if( w->i_queue > host->i_queue_peak )
+            host->i_queue_peak = w->i_queue;
+        if( w->i_queue > host->i_queue_max )
+            host->i_queue_max = w->i_queue;
+        vlc_mutex_unlock( &host->lock );
 
-            if( cl->i_state == HTTPD_CLIENT_RECEIVING )
-            {
-                httpd_ClientRecv( cl );
-            }
-            else if( cl->i_state == HTTPD_CLIENT_SENDING )
-            {
-                httpd_ClientSend( cl );
-            }
-            else if( cl->i_state == HTTPD_CLIENT_TLS_HS_IN )
-            {
-                httpd_ClientTlsHsIn( cl );
-            }
-            else if( cl->i_state == HTTPD_CLIENT_TLS_HS_OUT )
-            {
-                httpd_ClientTlsHsOut( cl );
-            }
+        /* Handle server sockets (accept new connections) */
+        for( nfd = 0; nfd < host->nfd; nfd++ )
+        {
+            assert (ufd[nfd].fd == host->fds[nfd]);
+
+            if( ufd[nfd].revents == 0 )
+                continue;
+
+            if( (p_tls == NULL) != (host->p_tls == NULL) )
+                break; // cannot accept further without new TLS session
+
+            httpd_HostAccept( host, ufd[nfd].fd, &p_tls, now );
+        }
+    }
+
+    if( p_tls != NULL )
+        tls_ServerSessionClose( p_tls );
+    return NULL;
+}
+
+#ifdef HTTPD_EPOLL
+/* Queues a client to be run without waiting for a socket event */
+static void httpd_WorkerQueue( httpd_worker_t *w, httpd_client_t *cl )
+{
+    if( cl->b_queued )
+        return;
+
+    if( w->i_run >= w->i_run_max )
+    {
+        w->i_run_max = w->i_run_max ? 2 * w->i_run_max : 64;
+        w->run = xrealloc( w->run, w->i_run_max * sizeof( *w->run ) );
+    }
+    w->run[w->i_run++] = cl;
+    cl->b_queued = true;
+}
+
+/* Sends stream data without the host lock, so that the workers do not
+ * serialize on the system calls. httpd_UrlDelete() waits for b_busy. */
+static void httpd_WorkerSendSeg( httpd_host_t *host, httpd_client_t *cl )
+{
+    ssize_t i_len;
+
+    assert( cl->i_buffer >= 0 );
+    cl->b_busy = true;
+    vlc_mutex_unlock( &host->lock );
+
+    i_len = httpd_NetSendSeg( cl );
 
+    vlc_mutex_lock( &host->lock );
+    cl->b_busy = false;
+    vlc_cond_broadcast( &host->busy );
+
+    httpd_ClientSent( cl, i_len );
+}
+
+/* Runs a client until its socket would block */
+static void httpd_WorkerRun( httpd_worker_t *w, httpd_client_t *cl,
+                             mtime_t now )
+{
+    httpd_host_t *host = w->host;
+
+    for( unsigned i = 0; i < HTTPD_RUN_MAX; i++ )
+    {
+        if( httpd_ClientExpired( cl, now ) )
+        {
+            httpd_HostDelClient( host, cl );
+            return;
+        }
+
+        httpd_ClientProcess( host, cl );
+
+        int i_events = httpd_ClientEvents( cl );
+        int revents = i_events & cl->i_ready;
+
+        if( revents == 0 )
+        {
+            if( cl->i_state == HTTPD_CLIENT_DEAD )
+                continue;
+            if( i_events == 0 )
+                /* waiting for more data from the callback */
+                httpd_WorkerQueue( w, cl );
+            return;
+        }
+
+        cl->i_activity_date = now;
+        if( cl->i_state == HTTPD_CLIENT_SENDING && cl->i_seg > 0 &&
+            (revents & POLLOUT) )
+        {
+            httpd_WorkerSendSeg( host, cl );
             if( cl->i_mode == HTTPD_CLIENT_BIDIR &&
                 cl->i_state == HTTPD_CLIENT_SENDING &&
-                (pufd->revents & POLLIN) )
-            {
+                (revents & POLLIN) )
                 cl->b_read_waiting = true;
+        }
+        else
+            httpd_ClientIO( cl, revents );
+    }
+
+    /* do not starve the other clients */
+    httpd_WorkerQueue( w, cl );
+}
+
+/* epoll() loop, serving a share of the clients of a host */
+static void* httpd_HostWorker( void *data )
+{
+    httpd_worker_t *w = data;
+    httpd_host_t *host = w->host;
+    tls_session_t *p_tls = NULL;
+    struct epoll_event ev[HTTPD_EPOLL_EVENTS];
+    mtime_t i_scan_date = mdate();
+
+    for( ;; )
+    {
+        int i_timeout = 1000; /* check for inactive clients every second */
+        bool b_accept = false;
+        bool b_die = false;
+        int n;
+
+        vlc_mutex_lock( &host->lock );
+        while( host->i_url <= 0 && host->i_ref > 0 )
+            vlc_cond_wait( &host->wait, &host->lock );
+
+        /* we will wait 20ms (not too big) if HTTPD_CLIENT_WAITING */
+        for( int i = 0; i < w->i_run; i++ )
+        {
+            if( w->run[i]->i_state != HTTPD_CLIENT_WAITING )
+            {
+                i_timeout = 0;
+                break;
             }
+            i_timeout = 20;
         }
         vlc_mutex_unlock( &host->lock );
 
-        /* Handle server sockets (accept new connections) */
-        for( nfd = 0; nfd < host->nfd; nfd++ )
+        n = epoll_wait( w->epfd, ev, HTTPD_EPOLL_EVENTS, i_timeout );
+        if( n == -1 )
         {
-            httpd_client_t *cl;
-            int i_state = -1;
-            int fd = ufd[nfd].fd;
+            if( errno != EINTR )
+            {
+                /* Kernel on low memory or a bug: pace, but do not delay
+                 * the deletion of the host */
+                msg_Err( host, "polling error: %m" );
+                vlc_mutex_lock( &host->lock );
+                if( host->i_ref > 0 )
+                    vlc_cond_timedwait( &host->wait, &host->lock,
+                                        mdate() + 100000 );
+                b_die = host->i_ref == 0;
+                vlc_mutex_unlock( &host->lock );
+                if( b_die )
+                    break;
+            }
+            continue;
+        }
 
-            assert (fd == host->fds[nfd]);
+        vlc_mutex_lock( &host->lock );
+        mtime_t now = mdate();
 
-            if( ufd[nfd].revents == 0 )
-                continue;
+        for( int i = 0; i < n; i++ )
+        {
+            httpd_client_t *cl = ev[i].data.ptr;
+            uint32_t events = ev[i].events;
 
-            /* */
-            fd = vlc_accept (fd, NULL, NULL, true);
-            if (fd == -1)
-                continue;
-            setsockopt (fd, SOL_SOCKET, SO_REUSEADDR,
-                        &(int){ 1 }, sizeof(int));
+            if( ev[i].data.ptr == NULL )
+                b_die = true; /* object killed */
+            else if( ev[i].data.ptr == host )
+                b_accept = true;
+            else
+            {
+                if( events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR) )
+                    cl->i_ready |= POLLIN;
+                if( events & (EPOLLOUT | EPOLLHUP | EPOLLERR) )
+                    cl->i_ready |= POLLOUT;
+                httpd_WorkerQueue( w, cl );
+            }
+        }
+        if( b_die )
+        {
+            vlc_mutex_unlock( &host->lock );
+            break;
+        }
+
+        /* Run the queued clients. Those queued again go after them. */
+        int i_run = w->i_run;
 
-            if( p_tls != NULL )
+        w->i_queue = i_run;
+        if( w->i_queue > host->i_queue_peak )
+            host->i_queue_peak = w->i_queue;
+        if( w->i_queue > host->i_queue_max )
+            host->i_queue_max = w->i_queue;
+        for( int i = 0; i < i_run; i++ )
+        {
+            httpd_client_t *cl = w->run[i];
+
+            cl->b_queued = false;
+            httpd_WorkerRun( w, cl, now );
+        }
+        w->i_run -= i_run;
+        memmove( w->run, w->run + i_run, w->i_run * sizeof( *w->run ) );
+
+        /* Close dead and inactive connections */
+        if( now - i_scan_date >= CLOCK_FREQ )
+        {
+            i_scan_date = now;
+            for( int i = 0; i < w->i_client; i++ )
             {
-                switch( tls_ServerSessionHandshake( p_tls, fd ) )
+                httpd_client_t *cl = w->client[i];
+
+                if( !cl->b_queued && httpd_ClientExpired( cl, now ) )
                 {
-                    case -1:
-                        msg_Err( host, "Rejecting TLS connection" );
-                        net_Close( fd );
-                        fd = -1;
-                        p_tls = NULL;
-                        break;
-
-                    case 1: /* missing input - most likely */
-                        i_state = HTTPD_CLIENT_TLS_HS_IN;
-                        break;
-
-                    case 2: /* missing output */
-                        i_state = HTTPD_CLIENT_TLS_HS_OUT;
-                        break;
+                    httpd_HostDelClient( host, cl );
+                    i--;
                 }
+            }
+        }
+        httpd_HostStatsTick( host, now );
+        vlc_mutex_unlock( &host->lock );
 
+        /* Handle server sockets (accept new connections) */
+        for( unsigned i = 0; b_accept && i < host->nfd; i++ )
+        {
+            do
+            {
+                /* prepare a new TLS session */
+                if( ( p_tls == NULL ) && ( host->p_tls != NULL ) )
+                    p_tls = tls_ServerSessionPrepare( host->p_tls );
                 if( (p_tls == NULL) != (host->p_tls == NULL) )
-                    break; // wasted TLS session, cannot accept() anymore
+                    break; // cannot accept without TLS session
             }
-
-            stats_UpdateInteger( host, p_total_counter, 1, NULL );
-            stats_UpdateInteger( host, p_active_counter, 1, NULL );
-            cl = httpd_ClientNew( fd, p_tls, now );
-            p_tls = NULL;
-            vlc_mutex_lock( &host->lock );
-            TAB_APPEND( host->i_client, host->client, cl );
-            vlc_mutex_unlock( &host->lock );
-            if( i_state != -1 )
-                cl->i_state = i_state; // override state for TLS
-
-            if (host->p_tls != NULL)
-                break; // cannot accept further without new TLS session
+            while( httpd_HostAccept( host, host->fds[i], &p_tls, now )
+                   == VLC_SUCCESS );
         }
-
     }
 
     if( p_tls != NULL )
         tls_ServerSessionClose( p_tls );
-    if( p_total_counter )
-        stats_CounterClean( p_total_counter );
-    if( p_active_counter )
-        stats_CounterClean( p_active_counter );
     return NULL;
 }
+
+/* Creates the epoll instances of the workers. The first worker also accepts
+ * the new connections. */
+static int httpd_HostEpoll( httpd_host_t *host, int evfd )
+{
+    for( unsigned i = 0; i < host->i_worker; i++ )
+    {
+        httpd_worker_t *w = &host->worker[i];
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+
+        w->epfd = epoll_create1( EPOLL_CLOEXEC );
+        if( w->epfd == -1
+         || epoll_ctl( w->epfd, EPOLL_CTL_ADD, evfd, &ev ) )
+            goto error;
+
+        for( unsigned j = 0; i == 0 && j < host->nfd; j++ )
+        {
+            /* level-triggered: a connection may be left pending */
+            ev.data.ptr = host;
+            if( epoll_ctl( w->epfd, EPOLL_CTL_ADD, host->fds[j], &ev ) )
+                goto error;
+        }
+    }
+    return VLC_SUCCESS;
+
+error:
+    msg_Warn( host, "cannot use epoll: %m" );
+    for( unsigned i = 0; i < host->i_worker; i++ )
+    {
+        if( host->worker[i].epfd != -1 )
+            close( host->worker[i].epfd );
+        host->worker[i].epfd = -1;
+    }
+    return VLC_EGENERIC;
+}
+#endif
@@ -0,0 +1,136 @@
+/*****************************************************************************
+ * block_bench.c: block_Alloc() pool versus plain malloc() benchmark
+ *****************************************************************************
+ * Copyright (C) 2010 the VideoLAN team
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <vlc_common.h>
+#include <vlc_block.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#undef NDEBUG
+#include <assert.h>
+
+#define LOOPS 2000
+#define BATCH 64
+
+static const struct
+{
+    const char *name;
+    size_t size;
+} sizes[] = {
+    { "TS packet",    188 },
+    { "UDP datagram", 1316 },
+    { "audio frame",  4608 },
+    { "PES packet",   32768 },
+};
+
+/* Allocates and releases BATCH buffers at a time, as a demuxer would */
+static mtime_t bench_malloc (size_t size)
+{
+    void *tab[BATCH];
+    mtime_t start = mdate ();
+
+    for (unsigned i = 0; i < LOOPS; i++)
+    {
+        for (unsigned j = 0; j < BATCH; j++)
+        {
+            tab[j] = malloc (size);
+            assert (tab[j] != NULL);
+            *(volatile char *)tab[j] = 0;
+        }
+        for (unsigned j = 0; j < BATCH; j++)
+            free (tab[j]);
+    }
+    return mdate () - start;
+}
+
+static mtime_t bench_block (size_t size)
+{
+    block_t *tab[BATCH];
+    mtime_t start = mdate ();
+
+    for (unsigned i = 0; i < LOOPS; i++)
+    {
+        for (unsigned j = 0; j < BATCH; j++)
+        {
+            tab[j] = block_Alloc (size);
+            assert (tab[j] != NULL);
+            *(volatile uint8_t *)tab[j]->p_buffer = 0;
+        }
+        for (unsigned j = 0; j < BATCH; j++)
+            block_Release (tab[j]);
+    }
+    return mdate () - start;
+}
+
+/* Allocates in one thread and releases in another, as input and decoder
+ * threads do through a FIFO */
+static void *consumer (void *data)
+{
+    block_fifo_t *fifo = data;
+    block_t *block;
+
+    while ((block = block_FifoGet (fifo)) != NULL)
+        block_Release (block);
+    return NULL;
+}
+
+static mtime_t bench_block_fifo (size_t size)
+{
+    block_fifo_t *fifo = block_FifoNew ();
+    vlc_thread_t th;
+    mtime_t start = mdate ();
+
+    assert (fifo != NULL);
+    assert (!vlc_clone (&th, consumer, fifo, VLC_THREAD_PRIORITY_LOW));
+    for (unsigned i = 0; i < LOOPS * BATCH; i++)
+    {
+        block_t *block = block_Alloc (size);
+        assert (block != NULL);
+        block_FifoPace (fifo, BATCH, SIZE_MAX);
+        block_FifoPut (fifo, block);
+    }
+    block_FifoPace (fifo, 0, SIZE_MAX);
+    block_FifoWake (fifo);
+    vlc_join (th, NULL);
+    block_FifoRelease (fifo);
+    return mdate () - start;
+}
+
+static void print (const char *what, mtime_t d)
+{
+    printf ("  %-18s %7.1f ns/block\n", what,
+            d * 1000. / (LOOPS * BATCH));
+}
+
+int main (void)
+{
+    for (unsigned i = 0; i < sizeof (sizes) / sizeof (sizes[0]); i++)
+    {
+        printf ("%s (%zu bytes):\n", sizes[i].name, sizes[i].size);
+        print ("malloc/free", bench_malloc (sizes[i].size));
+        print ("block_Alloc", bench_block (sizes[i].size));
+        print ("block_Alloc + FIFO", bench_block_fifo (sizes[i].size));
+    }
+    return 0;
+}
@@ -84,10 +84,147 @@ static void test_block (void)
     //assert (block == NULL);
 }
 
+#define FIFO_WRITERS 3
+#define FIFO_BLOCKS  20000
+
+static void *fifo_writer (void *data)
+{
+    block_fifo_t *fifo = data;
+
+    for (unsigned i = 0; i < FIFO_BLOCKS; i++)
+    {
+        block_t *block = block_Alloc (sizeof (unsigned));
+        assert (block != NULL);
+        memcpy (block->p_buffer, &i, sizeof (i));
+        block_FifoPace (fifo, 64, SIZE_MAX);
+        block_FifoPut (fifo, block);
+    }
+    return NULL;
+}
+
+static void test_block_fifo (void)
+{
+    block_fifo_t *fifo = block_FifoNew ();
+    vlc_thread_t th[FIFO_WRITERS];
+    unsigned next[FIFO_WRITERS] = { 0 };
+
+    assert (fifo != NULL);
+    assert (block_FifoCount (fifo) == 0);
+
+    /* Wake-up with an empty queue */
+    block_FifoWake (fifo);
+    assert (block_FifoGet (fifo) == NULL);
+
+    for (unsigned i = 0; i < FIFO_WRITERS; i++)
+        assert (!vlc_clone (th + i, fifo_writer, fifo,
+                            VLC_THREAD_PRIORITY_LOW));
+
+    /* Each writer queues in order, so every value read must be the next
+     * expected value of one of the writers. */
+    for (unsigned n = 0; n < FIFO_WRITERS * FIFO_BLOCKS; n++)
+    {
+        block_t *block = (n & 1) ? block_FifoShow (fifo) : NULL;
+        block_t *got = block_FifoGet (fifo);
+        unsigned val, w;
+
+        assert (got != NULL);
+        assert (block == NULL || block == got);
+        assert (got->i_buffer == sizeof (val));
+        memcpy (&val, got->p_buffer, sizeof (val));
+        for (w = 0; w < FIFO_WRITERS; w++)
+            if (next[w] == val)
+                break;
+        assert (w < FIFO_WRITERS);
+        next[w]++;
+        block_Release (got);
+    }
+
+    for (unsigned i = 0; i < FIFO_WRITERS; i++)
+        vlc_join (th[i], NULL);
+    assert (block_FifoCount (fifo) == 0);
+    assert (block_FifoSize (fifo) == 0);
+
+    /* Chains and flushing */
+    block_t *chain = NULL;
+    for (unsigned i = 0; i < 10; i++)
+    {
+        block_t *block = block_Alloc (10);
+        assert (block != NULL);
+        block_ChainAppend (&chain, block);
+    }
+    assert (block_FifoPut (fifo, chain) == 100);
+    assert (block_FifoCount (fifo) == 10);
+    assert (block_FifoSize (fifo) == 100);
+    block_Release (block_FifoGet (fifo));
+    block_FifoEmpty (fifo);
+    assert (block_FifoCount (fifo) == 0);
+    block_FifoRelease (fifo);
+}
+
+/* The size of the queue must never exceed what the writers queued, even
+ * while several of them are linking their blocks. */
+static vlc_mutex_t fifo_lock;
+static size_t fifo_queued;
+
+static void *fifo_size_writer (void *data)
+{
+    block_fifo_t *fifo = data;
+
+    for (unsigned i = 0; i < FIFO_BLOCKS; i++)
+    {
+        block_t *block = block_Alloc (1 + (i % 7) * 100);
+        assert (block != NULL);
+        vlc_mutex_lock (&fifo_lock);
+        fifo_queued += block->i_buffer;
+        vlc_mutex_unlock (&fifo_lock);
+        block_FifoPace (fifo, 64, SIZE_MAX);
+        block_FifoPut (fifo, block);
+    }
+    return NULL;
+}
+
+static void test_block_fifo_size (void)
+{
+    block_fifo_t *fifo = block_FifoNew ();
+    vlc_thread_t th[FIFO_WRITERS];
+    size_t dequeued = 0;
+
+    assert (fifo != NULL);
+    vlc_mutex_init (&fifo_lock);
+    fifo_queued = 0;
+
+    for (unsigned i = 0; i < FIFO_WRITERS; i++)
+        assert (!vlc_clone (th + i, fifo_size_writer, fifo,
+                            VLC_THREAD_PRIORITY_LOW));
+
+    for (unsigned n = 0; n < FIFO_WRITERS * FIFO_BLOCKS; n++)
+    {
+        block_t *got = block_FifoGet (fifo);
+        assert (got != NULL);
+        dequeued += got->i_buffer;
+        block_Release (got);
+
+        /* Read the size first: the writers only ever add to fifo_queued */
+        size_t size = block_FifoSize (fifo);
+        vlc_mutex_lock (&fifo_lock);
+        assert (size <= fifo_queued - dequeued);
+        vlc_mutex_unlock (&fifo_lock);
+    }
+
+    for (unsigned i = 0; i < FIFO_WRITERS; i++)
+        vlc_join (th[i], NULL);
+    assert (block_FifoCount (fifo) == 0);
+    assert (block_FifoSize (fifo) == 0);
+    vlc_mutex_destroy (&fifo_lock);
+    block_FifoRelease (fifo);
+}
+
 int main (void)
 {
     test_block_File ();
     test_block ();
+    test_block_fifo ();
+    test_block_fifo_size ();
     return 0;
 }
 
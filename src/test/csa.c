@@ -0,0 +1,121 @@
+/*****************************************************************************
+ * csa.c: Test the batch CSA (de)scrambler against the packet one
+ *****************************************************************************
+ * Copyright (C) 2010 the VideoLAN team
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#undef NDEBUG
+#include <assert.h>
+
+/* The scrambler is built in the modules, without any message */
+#define MODULE_STRING "test_csa"
+#define TS_NO_CSA_CK_MSG 1
+#include "../../modules/mux/mpeg/csa.c"
+
+#define PACKETS 300
+
+static uint8_t ref[PACKETS][188], pkt[PACKETS][188], clear[PACKETS][188];
+
+/* Random packets, scrambled with either key or not scrambled, with or
+ * without adaptation field */
+static void fill( int i_pkts )
+{
+    int i, j;
+
+    for( i = 0; i < i_pkts; i++ )
+    {
+        for( j = 0; j < 188; j++ )
+            clear[i][j] = rand();
+        clear[i][0] = 0x47;
+        clear[i][3] &= 0x3f;
+        if( clear[i][3] & 0x20 )
+            clear[i][4] = rand() % 200; /* including invalid ones */
+    }
+}
+
+static void test( csa_t *c, int i_pkts, int i_pkt_size )
+{
+    uint8_t *pp_pkts[PACKETS];
+    int i;
+
+    fill( i_pkts );
+
+    /* scrambling */
+    memcpy( ref, clear, sizeof(clear) );
+    memcpy( pkt, clear, sizeof(clear) );
+    for( i = 0; i < i_pkts; i++ )
+    {
+        csa_UseKey( NULL, c, i & 1 );
+        csa_Encrypt( c, ref[i], i_pkt_size );
+    }
+    /* the batch uses a single key: even packets first, then odd ones */
+    for( i = 0; i < i_pkts; i++ )
+        pp_pkts[i] = pkt[i < (i_pkts + 1) / 2 ? 2 * i
+                                              : 2 * (i - (i_pkts + 1) / 2) + 1];
+    csa_UseKey( NULL, c, false );
+    csa_EncryptBatch( c, pp_pkts, (i_pkts + 1) / 2, i_pkt_size );
+    csa_UseKey( NULL, c, true );
+    csa_EncryptBatch( c, &pp_pkts[(i_pkts + 1) / 2], i_pkts / 2, i_pkt_size );
+    assert( !memcmp( ref, pkt, sizeof(ref) ) );
+
+    /* leave some packets in clear */
+    for( i = 0; i < i_pkts; i += 7 )
+    {
+        memcpy( ref[i], clear[i], 188 );
+        memcpy( pkt[i], clear[i], 188 );
+    }
+
+    /* descrambling */
+    for( i = 0; i < i_pkts; i++ )
+    {
+        csa_Decrypt( c, ref[i], i_pkt_size );
+        pp_pkts[i] = pkt[i];
+    }
+    csa_DecryptBatch( c, pp_pkts, i_pkts, i_pkt_size );
+    assert( !memcmp( ref, pkt, sizeof(ref) ) );
+    assert( !memcmp( clear, pkt, sizeof(clear) ) );
+}
+
+int main( void )
+{
+    static const int pi_pkts[] = { 1, 7, 8, 31, 64, 65, 128, 129, 256, 300 };
+    static const int pi_sizes[] = { 188, 184, 100 };
+    csa_t *c = csa_New();
+    unsigned i, j;
+
+    assert( c );
+    assert( !csa_SetCW( NULL, c, (char *)"0x0123456789abcdef", true ) );
+    assert( !csa_SetCW( NULL, c, (char *)"fedcba9876543210", false ) );
+
+    srand( 0 );
+    for( i = 0; i < sizeof(pi_sizes) / sizeof(*pi_sizes); i++ )
+        for( j = 0; j < sizeof(pi_pkts) / sizeof(*pi_pkts); j++ )
+        {
+            printf( "%d packets of %d bytes\n", pi_pkts[j], pi_sizes[i] );
+            test( c, pi_pkts[j], pi_sizes[i] );
+        }
+
+    csa_Delete( c );
+    return 0;
+}
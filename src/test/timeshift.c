@@ -0,0 +1,253 @@
+/*****************************************************************************
+ * timeshift.c: Test the timeshift seek index
+ *****************************************************************************
+ * Copyright (C) 2010 the VideoLAN team
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The storages and the index are used without the timeshift thread */
+#define MODULE_STRING "test_timeshift"
+#include "../input/es_out_timeshift.c"
+
+#undef NDEBUG
+#include <assert.h>
+
+/* Internal to libvlccore, and not reached here */
+#undef vlc_custom_create
+void *vlc_custom_create( vlc_object_t *p_this, size_t i_size, int i_type,
+                         const char *psz_type )
+{
+    (void)p_this; (void)i_size; (void)i_type; (void)psz_type;
+    abort();
+}
+void input_ControlPush( input_thread_t *p_input, int i_type, vlc_value_t *p_val )
+{
+    (void)p_input; (void)i_type; (void)p_val;
+    abort();
+}
+
+#define SECONDS     12
+#define FRAMES      10  /* per second */
+#define GOP         20  /* frames between two key frames */
+#define FRAME_SIZE  4096
+#define FILE_MAX    (64 * 1024)
+
+static es_out_id_t video = { NULL, VIDEO_ES };
+
+static void PushTime( ts_thread_t *p_ts, mtime_t i_date, mtime_t i_time )
+{
+    ts_cmd_t cmd;
+
+    memset( &cmd, 0, sizeof(cmd) );
+    cmd.i_type = C_CONTROL;
+    cmd.i_date = i_date;
+    cmd.u.control.i_query = ES_OUT_SET_TIMES;
+    cmd.u.control.u.times.i_time = i_time;
+    TsPushCmd( p_ts, &cmd );
+}
+
+static void PushFrame( ts_thread_t *p_ts, mtime_t i_date, bool b_key )
+{
+    ts_cmd_t cmd;
+    block_t *p_block = block_Alloc( FRAME_SIZE );
+
+    assert( p_block );
+    memset( p_block->p_buffer, b_key, p_block->i_buffer );
+    p_block->i_flags = b_key ? BLOCK_FLAG_TYPE_I : BLOCK_FLAG_TYPE_P;
+    p_block->i_dts = p_block->i_pts = i_date;
+
+    memset( &cmd, 0, sizeof(cmd) );
+    cmd.i_type = C_SEND;
+    cmd.i_date = i_date;
+    cmd.u.send.p_es = &video;
+    cmd.u.send.p_block = p_block;
+    TsPushCmd( p_ts, &cmd );
+}
+
+/* Returns the input time reported before the read position */
+static mtime_t ReadTime( ts_thread_t *p_ts )
+{
+    ts_storage_t *p_storage = p_ts->p_storage_r;
+    mtime_t i_time = -1;
+
+    for( ts_storage_t *p = p_ts->p_storage_h; p; p = p->p_next )
+    {
+        const int i_end = p == p_storage ? p->i_cmd_r : p->i_cmd_w;
+
+        for( int i = 0; i < i_end; i++ )
+        {
+            const ts_cmd_t *p_cmd = &p->p_cmd[i];
+
+            if( p_cmd->i_type == C_CONTROL &&
+                p_cmd->u.control.i_query == ES_OUT_SET_TIMES )
+                i_time = p_cmd->u.control.u.times.i_time;
+        }
+        if( p == p_storage )
+            break;
+    }
+    return i_time;
+}
+
+static bool ReadKey( ts_thread_t *p_ts )
+{
+    ts_storage_t *p_storage = p_ts->p_storage_r;
+    const ts_cmd_t *p_cmd = &p_storage->p_cmd[p_storage->i_cmd_r];
+    block_t *p_block;
+    bool b_key;
+
+    if( p_cmd->i_type != C_SEND )
+        return false;
+    if( p_cmd->u.send.p_block )
+        p_block = block_Duplicate( p_cmd->u.send.p_block );
+    else
+        p_block = TsStorageRead( p_storage, p_cmd->u.send.i_offset );
+    assert( p_block );
+    b_key = ( p_block->i_flags & BLOCK_FLAG_TYPE_I ) && p_block->p_buffer[0];
+    block_Release( p_block );
+    return b_key;
+}
+
+static void Seek( ts_thread_t *p_ts, mtime_t i_time, bool b_forward )
+{
+    ts_cmd_t *p_skip;
+    int i_skip;
+
+    assert( !TsSeekLocked( p_ts, i_time, &p_skip, &i_skip ) );
+    assert( b_forward ? i_skip > 0 : i_skip == 0 );
+    for( int i = 0; i < i_skip; i++ )
+    {
+        /* Skipped data is not read back */
+        if( p_skip[i].i_type == C_SEND )
+            assert( p_skip[i].u.send.p_block == NULL );
+        CmdClean( &p_skip[i] );
+    }
+    free( p_skip );
+}
+
+static void Check( ts_thread_t *p_ts, mtime_t i_time )
+{
+    /* Resume on the last key frame reported at or before i_time */
+    const mtime_t i_key = i_time / (GOP / FRAMES * CLOCK_FREQ) *
+                          (GOP / FRAMES * CLOCK_FREQ);
+
+    assert( ReadTime( p_ts ) == i_key );
+    assert( ReadKey( p_ts ) );
+}
+
+int main( void )
+{
+    ts_thread_t ts;
+    ts_storage_t *p_storage;
+    int i_cmd;
+    int i_storages = 0;
+
+    memset( &ts, 0, sizeof(ts) );
+    vlc_mutex_init( &ts.lock );
+    vlc_cond_init( &ts.wait );
+    ts.psz_tmp_path = ".";
+    ts.i_tmp_size_max = FILE_MAX;
+    ts.i_history = INT64_C(1) << 40;
+    ts.i_index_time = -1;
+    ts.i_seek_time = -1;
+
+    /* A time update every second, GOP frames between key frames */
+    for( int i = 0; i < SECONDS * FRAMES; i++ )
+    {
+        const mtime_t i_date = i * CLOCK_FREQ / FRAMES;
+
+        if( i % FRAMES == 0 )
+            PushTime( &ts, i_date, i_date );
+        PushFrame( &ts, i_date, i % GOP == 0 );
+    }
+    for( p_storage = ts.p_storage_h; p_storage; p_storage = p_storage->p_next )
+    {
+#ifdef HAVE_MMAP
+        /* The files grow as they are written */
+        assert( p_storage->i_file_alloc >= p_storage->i_file_size );
+        assert( p_storage->i_file_alloc <= FILE_MAX );
+#endif
+        i_storages++;
+    }
+    printf( "%d frames in %d storages\n", SECONDS * FRAMES, i_storages );
+    assert( i_storages > 2 );
+
+    vlc_mutex_lock( &ts.lock );
+
+    /* Only key frames are used once the stream flags them */
+    assert( ts.b_index_key );
+    for( p_storage = ts.p_storage_h; p_storage; p_storage = p_storage->p_next )
+    {
+        for( int i = 0; i < p_storage->index.i_size; i++ )
+        {
+            const ts_index_t *p_index = &p_storage->index.p_elems[i];
+            if( p_index->b_key )
+                assert( p_index->i_time % (GOP / FRAMES * CLOCK_FREQ) == 0 );
+        }
+    }
+
+    /* Outside of the buffered window */
+    assert( TsIndexFind( &ts, -1, &p_storage, &i_cmd ) );
+    assert( TsIndexFind( &ts, SECONDS * CLOCK_FREQ, &p_storage, &i_cmd ) );
+    assert( !TsIndexFind( &ts, 0, &p_storage, &i_cmd ) );
+    assert( p_storage == ts.p_storage_h && i_cmd == 1 );
+
+    /* Forward, across the storages, then back */
+    Seek( &ts, 7 * CLOCK_FREQ + CLOCK_FREQ / 2, true );
+    Check( &ts, 7 * CLOCK_FREQ + CLOCK_FREQ / 2 );
+    assert( ts.p_storage_r != ts.p_storage_h );
+
+    Seek( &ts, 9 * CLOCK_FREQ, true );
+    Check( &ts, 9 * CLOCK_FREQ );
+
+    Seek( &ts, 3 * CLOCK_FREQ, false );
+    Check( &ts, 3 * CLOCK_FREQ );
+
+    /* The data played again is read back from the storage */
+    ts_cmd_t cmd;
+    do
+        assert( !TsPopCmdLocked( &ts, &cmd, false ) );
+    while( cmd.i_type != C_SEND );
+    assert( cmd.u.send.p_block && cmd.u.send.p_block->i_buffer == FRAME_SIZE );
+    assert( cmd.u.send.p_block->p_buffer[0] == 1 );
+    CmdClean( &cmd );
+
+    /* Up to the last seek point */
+    Seek( &ts, (SECONDS - 1) * CLOCK_FREQ - CLOCK_FREQ / 2, true );
+    Check( &ts, (SECONDS - 1) * CLOCK_FREQ - CLOCK_FREQ / 2 );
+
+    while( ts.p_storage_h )
+    {
+        ts_storage_t *p_next = ts.p_storage_h->p_next;
+
+        TsStorageDelete( ts.p_storage_h );
+        ts.p_storage_h = p_next;
+    }
+    while( ts.p_storage_free )
+        TsStorageDelete( TsStorageGet( &ts ) );
+    vlc_mutex_unlock( &ts.lock );
+
+    vlc_cond_destroy( &ts.wait );
+    vlc_mutex_destroy( &ts.lock );
+    return 0;
+}
@@ -0,0 +1,182 @@
+/*****************************************************************************
+ * yadif.c: Test the SIMD Yadif line filters against the C version
+ *****************************************************************************
+ * Copyright (C) 2010 the VideoLAN team
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <vlc_common.h>
+#include <vlc_cpu.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#undef NDEBUG
+#include <assert.h>
+
+#include "../libvlc.h"
+#include "../../modules/video_filter/yadif.h"
+
+/* Lines of each test picture; the filtered line is in the middle, so that
+ * all the lines read by the filters (up to 2 above and below) exist. */
+#define LINES  7
+#define MARGIN 64
+
+static const struct
+{
+    const char *name;
+    yadif_filter_line_t filter;
+    uint32_t cpu;
+} kernels[] = {
+#ifdef HAVE_YADIF_MMX2
+    { "mmx2",  yadif_filter_line_mmx2,  CPU_CAPABILITY_MMXEXT },
+#endif
+#ifdef HAVE_YADIF_SSE2
+    { "sse2",  yadif_filter_line_sse2,  CPU_CAPABILITY_SSE2 },
+#endif
+#ifdef HAVE_YADIF_SSSE3
+    { "ssse3", yadif_filter_line_ssse3, CPU_CAPABILITY_SSSE3 },
+#endif
+#ifdef HAVE_YADIF_NEON
+    { "neon",  yadif_filter_line_neon,  CPU_CAPABILITY_NEON },
+#endif
+};
+
+static unsigned seed = 1;
+
+static uint8_t rnd (void)
+{
+    seed = seed * 1103515245 + 12345;
+    return seed >> 16;
+}
+
+typedef struct
+{
+    uint8_t *base;
+    uint8_t *pixels; /* first pixel of the middle line */
+} buffer_t;
+
+static void buffer_Init (buffer_t *b, int pitch)
+{
+    b->base = malloc (2 * MARGIN + LINES * pitch);
+    assert (b->base != NULL);
+    b->pixels = b->base + MARGIN + (LINES / 2) * pitch;
+}
+
+/* Fills the whole buffer, including what lies outside of the picture:
+ * the filters read a few pixels on each side of the line. */
+static void buffer_Fill (buffer_t *b, int pitch, int pattern)
+{
+    for (int i = 0; i < 2 * MARGIN + LINES * pitch; i++)
+    {
+        switch (pattern)
+        {
+            case 0: /* noise */
+                b->base[i] = rnd ();
+                break;
+            case 1: /* low contrast, many equal scores */
+                b->base[i] = 128 + (rnd () & 3);
+                break;
+            default: /* extreme values */
+                b->base[i] = (rnd () & 1) ? 255 : 0;
+                break;
+        }
+    }
+}
+
+static void test_width (int w)
+{
+    const int pitch = (w + 15) / 16 * 16 + 16;
+    buffer_t prev, cur, next, ref, out;
+
+    buffer_Init (&prev, pitch);
+    buffer_Init (&cur, pitch);
+    buffer_Init (&next, pitch);
+    buffer_Init (&ref, pitch);
+    buffer_Init (&out, pitch);
+
+    for (int pattern = 0; pattern < 3; pattern++)
+    for (int loop = 0; loop < 8; loop++)
+    {
+        buffer_Fill (&prev, pitch, pattern);
+        buffer_Fill (&cur, pitch, pattern);
+        buffer_Fill (&next, pitch, pattern);
+
+        for (int mode = 0; mode <= 2; mode += 2)
+        for (int parity = 0; parity < 2; parity++)
+        {
+            struct vf_priv_s cfg = { .mode = mode };
+
+            yadif_filter_line_c (&cfg, ref.pixels, prev.pixels, cur.pixels,
+                                 next.pixels, w, pitch, parity);
+
+            for (size_t k = 0; k < sizeof (kernels) / sizeof (kernels[0]); k++)
+            {
+                if (!(vlc_CPU () & kernels[k].cpu))
+                    continue;
+
+                memset (out.pixels, 0x55, pitch);
+                kernels[k].filter (&cfg, out.pixels, prev.pixels, cur.pixels,
+                                   next.pixels, w, pitch, parity);
+                if (memcmp (out.pixels, ref.pixels, w))
+                {
+                    for (int x = 0; x < w; x++)
+                        if (out.pixels[x] != ref.pixels[x])
+                        {
+                            fprintf (stderr, "%s: width %d, pattern %d, "
+                                     "mode %d, parity %d: pixel %d is %u "
+                                     "instead of %u\n", kernels[k].name, w,
+                                     pattern, mode, parity, x,
+                                     out.pixels[x], ref.pixels[x]);
+                            break;
+                        }
+                    abort ();
+                }
+            }
+        }
+    }
+#if defined(HAVE_YADIF_MMX2)
+    if (vlc_CPU () & CPU_CAPABILITY_MMXEXT)
+        __asm__ volatile ("emms");
+#endif
+
+    free (out.base);
+    free (ref.base);
+    free (next.base);
+    free (cur.base);
+    free (prev.base);
+}
+
+int main (void)
+{
+    static const int widths[] = {
+        1, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 33, 64, 100, 360, 719, 720,
+    };
+
+    cpu_flags = CPUCapabilities ();
+
+    for (size_t k = 0; k < sizeof (kernels) / sizeof (kernels[0]); k++)
+        printf ("%s: %s\n", kernels[k].name,
+                (vlc_CPU () & kernels[k].cpu) ? "tested" : "not supported");
+
+    for (size_t i = 0; i < sizeof (widths) / sizeof (widths[0]); i++)
+        test_width (widths[i]);
+    return 0;
+}